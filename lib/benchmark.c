@@ -0,0 +1,368 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   benchmark.c makes it possible to measure the frame times of a
+   program in a reproducible way. In benchmark mode:
+
+   - The window is hidden (there is no user to look at it) and buffer
+     swaps are not synchronized with the monitor refresh.
+
+   - Time advances by a fixed amount every frame instead of following
+     the wall clock. glfwGetTime() is set to the benchmark time after
+     each frame, so programs which animate with glfwGetTime() draw the
+     same sequence of frames every run. The "replay" viewmat control
+     mode (see camcontrol-replay.cpp) also follows the benchmark
+     time, so a recorded tracker stream drives the camera exactly the
+     same way every run.
+
+   - After the requested number of frames, a summary of the frame
+     times is printed and the window is closed.
+
+   Benchmark mode is enabled by setting "benchmark.frames" to the
+   number of frames to measure. Other settings:
+
+   - benchmark.timestep: Microseconds that time advances each frame
+     (default: 16667, i.e., 60 frames per second).
+
+   - benchmark.warmup: Number of frames to render before measuring
+     starts (default: 10, minimum: 1).
+
+   - benchmark.finish: If true, glFinish() is called at the end of
+     each frame so that the time includes all of the work done on the
+     GPU (default: 1).
+
+   - benchmark.csv: If set, the time of each measured frame is
+     written to this file. Each line contains the total frame time,
+     the CPU time (from the end of the previous frame until the
+     program asked for the buffers to be swapped), and the time the
+     GPU spent on the frame (from a timer query, -1 if timer queries
+     aren't supported). All times are in microseconds.
+
+   - benchmark.checksum: If true, a checksum of the pixels of each
+     measured frame is added to the CSV file and a checksum of all
+     frames is printed in the summary (default: 0). Reading the
+     pixels isn't included in the frame times. Checksums are only
+     comparable between runs that use the same OpenGL
+     implementation (for example, Mesa's llvmpipe software renderer
+     in headless mode).
+
+   Benchmarks can be run on machines without a display by also
+   setting "window.headless" (see kuhl_ogl_init()).
+
+   bufferswap() calls benchmark_before_swap() before the buffers are
+   swapped and benchmark_frame() after each frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "benchmark.h"
+#include "kuhl-util.h"
+
+static int benchmark_state = 0; /**< 0=uninitialized, 1=enabled, -1=disabled */
+static int benchmark_frames = 0;   /**< Number of frames to measure */
+static int benchmark_warmup = 0;   /**< Number of frames to render before measuring */
+static int benchmark_finish = 1;   /**< Call glFinish() at the end of each frame */
+static long benchmark_timestep = 0; /**< Microseconds per frame */
+static long benchmark_count = 0;   /**< Number of frames rendered so far */
+static long benchmark_prev = -1;   /**< kuhl_microseconds() at end of previous frame */
+static long *benchmark_times = NULL; /**< Time to render each measured frame */
+static long *benchmark_cpu = NULL;   /**< CPU time of each measured frame */
+static long *benchmark_gpu = NULL;   /**< GPU time of each measured frame (-1 if unknown) */
+static unsigned long long *benchmark_checksums = NULL; /**< Pixel checksum of each measured frame (NULL if disabled) */
+static long benchmark_excluded = 0;  /**< Time spent computing the checksum of the current frame */
+
+/** Timer queries are read a few frames after they are issued so that
+ * we don't wait for the GPU. */
+#define BENCHMARK_QUERIES 4
+static GLuint benchmark_queries[BENCHMARK_QUERIES];
+static long benchmark_query_frame[BENCHMARK_QUERIES]; /**< Frame each query measured, -1 if none */
+static int benchmark_query_active = 0;
+
+/** Returns 1 if benchmark mode is enabled, 0 otherwise. */
+int benchmark_enabled(void)
+{
+	if(benchmark_state != 0)
+		return benchmark_state == 1;
+
+	benchmark_state = -1;
+	benchmark_frames = kuhl_config_int("benchmark.frames", 0, 0);
+	if(benchmark_frames <= 0)
+		return 0;
+
+	benchmark_timestep = kuhl_config_int("benchmark.timestep", 16667, 16667);
+	benchmark_warmup = kuhl_config_int("benchmark.warmup", 10, 10);
+	benchmark_finish = kuhl_config_boolean("benchmark.finish", 1, 1);
+	if(benchmark_timestep <= 0)
+	{
+		msg(MSG_WARNING, "benchmark.timestep must be positive; using 16667.");
+		benchmark_timestep = 16667;
+	}
+	/* The first frame can't be measured because there is no previous
+	 * frame to measure from. */
+	if(benchmark_warmup < 1)
+		benchmark_warmup = 1;
+
+	benchmark_times = (long*) malloc(sizeof(long)*(size_t)benchmark_frames);
+	benchmark_cpu = (long*) malloc(sizeof(long)*(size_t)benchmark_frames);
+	benchmark_gpu = (long*) malloc(sizeof(long)*(size_t)benchmark_frames);
+	if(kuhl_config_boolean("benchmark.checksum", 0, 0))
+		benchmark_checksums = (unsigned long long*) malloc(sizeof(unsigned long long)*(size_t)benchmark_frames);
+	if(benchmark_times == NULL || benchmark_cpu == NULL || benchmark_gpu == NULL ||
+	   (benchmark_checksums == NULL && kuhl_config_boolean("benchmark.checksum", 0, 0)))
+	{
+		msg(MSG_FATAL, "Unable to allocate memory for %d frame times.", benchmark_frames);
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i=0; i<benchmark_frames; i++)
+		benchmark_gpu[i] = -1;
+	for(int i=0; i<BENCHMARK_QUERIES; i++)
+		benchmark_query_frame[i] = -1;
+
+	msg(MSG_INFO, "Benchmark mode: %d frames (after %d warmup frames), %.3f ms per frame.",
+	    benchmark_frames, benchmark_warmup, benchmark_timestep/1000.0);
+	benchmark_state = 1;
+	return 1;
+}
+
+/** Returns the current benchmark time in microseconds. The time starts
+    at 0 and advances by benchmark.timestep each frame.
+
+    @return The benchmark time or -1 if benchmark mode is not enabled.
+*/
+long benchmark_time(void)
+{
+	if(!benchmark_enabled())
+		return -1;
+	return benchmark_count * benchmark_timestep;
+}
+
+static int benchmark_compare(const void *a, const void *b)
+{
+	long x = *(const long*) a;
+	long y = *(const long*) b;
+	return (x > y) - (x < y);
+}
+
+/** Returns 1 if GPU timer queries are available. */
+static int benchmark_has_timer_query(void)
+{
+	return GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+}
+
+/** Stores the result of a timer query.
+
+    @param wait If 0, only store the result if it is already
+    available. Otherwise, wait for it.
+*/
+static void benchmark_query_collect(int slot, int wait)
+{
+	if(benchmark_query_frame[slot] < 0)
+		return;
+	if(!wait)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(benchmark_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available)
+			return;
+	}
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(benchmark_queries[slot], GL_QUERY_RESULT, &elapsed);
+	long measured = benchmark_query_frame[slot] - benchmark_warmup;
+	if(measured >= 0 && measured < benchmark_frames)
+		benchmark_gpu[measured] = (long) (elapsed / 1000);
+	benchmark_query_frame[slot] = -1;
+}
+
+/** Starts a timer query for the frame that is about to be drawn. */
+static void benchmark_query_begin(void)
+{
+	if(!benchmark_has_timer_query())
+		return;
+	if(benchmark_queries[0] == 0)
+		glGenQueries(BENCHMARK_QUERIES, benchmark_queries);
+
+	for(int i=0; i<BENCHMARK_QUERIES; i++)
+		benchmark_query_collect(i, 0);
+
+	int slot = (int) (benchmark_count % BENCHMARK_QUERIES);
+	benchmark_query_collect(slot, 1); // still in use from BENCHMARK_QUERIES frames ago
+	benchmark_query_frame[slot] = benchmark_count;
+	glBeginQuery(GL_TIME_ELAPSED, benchmark_queries[slot]);
+	benchmark_query_active = 1;
+}
+
+/** Computes a checksum (64-bit FNV-1a) of the pixels in the current
+ * read framebuffer. */
+static unsigned long long benchmark_checksum(void)
+{
+	int width, height;
+	glfwGetFramebufferSize(kuhl_get_window(), &width, &height);
+
+	static unsigned char *pixels = NULL;
+	static size_t pixelsSize = 0;
+	size_t size = (size_t) width*height*4;
+	if(size > pixelsSize)
+	{
+		free(pixels);
+		pixels = (unsigned char*) kuhl_malloc(size);
+		pixelsSize = size;
+	}
+
+	GLint prevPack, prevAlignment;
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &prevPack);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &prevAlignment);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_PACK_ALIGNMENT, prevAlignment);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, prevPack);
+
+	unsigned long long hash = 14695981039346656037ULL;
+	for(size_t i=0; i<size; i++)
+	{
+		hash ^= pixels[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/** Prints a summary of the measured frame times and writes them to
+ * benchmark.csv if requested. */
+static void benchmark_report(void)
+{
+	int n = benchmark_frames;
+
+	/* Wait for the remaining timer queries. */
+	if(benchmark_has_timer_query())
+	{
+		for(int i=0; i<BENCHMARK_QUERIES; i++)
+			benchmark_query_collect(i, 1);
+	}
+
+	const char *csvFile = kuhl_config_get("benchmark.csv");
+	if(csvFile != NULL)
+	{
+		FILE *f = fopen(csvFile, "w");
+		if(f == NULL)
+			msg(MSG_ERROR, "Unable to write benchmark results to '%s'", csvFile);
+		else
+		{
+			fprintf(f, "frame,usec,cpu_usec,gpu_usec,checksum\n");
+			for(int i=0; i<n; i++)
+			{
+				fprintf(f, "%d,%ld,%ld,%ld,", i, benchmark_times[i], benchmark_cpu[i], benchmark_gpu[i]);
+				if(benchmark_checksums)
+					fprintf(f, "%016llx", benchmark_checksums[i]);
+				fprintf(f, "\n");
+			}
+			fclose(f);
+		}
+	}
+
+	double cpuSum = 0, gpuSum = 0;
+	int gpuCount = 0;
+	unsigned long long checksum = 14695981039346656037ULL;
+	for(int i=0; i<n; i++)
+	{
+		cpuSum += benchmark_cpu[i];
+		if(benchmark_gpu[i] >= 0)
+		{
+			gpuSum += benchmark_gpu[i];
+			gpuCount++;
+		}
+		if(benchmark_checksums)
+			checksum = (checksum ^ benchmark_checksums[i]) * 1099511628211ULL;
+	}
+
+	double sum = 0;
+	for(int i=0; i<n; i++)
+		sum += benchmark_times[i];
+	qsort(benchmark_times, (size_t) n, sizeof(long), benchmark_compare);
+
+	msg(MSG_INFO, "Benchmark: %d frames in %.3f seconds (%.1f fps)", n, sum/1000000.0, n/(sum/1000000.0));
+	msg(MSG_INFO, "Benchmark: frame time ms: min=%.3f avg=%.3f median=%.3f 95%%=%.3f 99%%=%.3f max=%.3f",
+	    benchmark_times[0]/1000.0, sum/n/1000.0,
+	    benchmark_times[n/2]/1000.0,
+	    benchmark_times[(int)(n*.95)]/1000.0,
+	    benchmark_times[(int)(n*.99)]/1000.0,
+	    benchmark_times[n-1]/1000.0);
+	msg(MSG_INFO, "Benchmark: average CPU ms=%.3f GPU ms=%.3f", cpuSum/n/1000.0,
+	    gpuCount > 0 ? gpuSum/gpuCount/1000.0 : -1.0);
+	printf("benchmark: frames=%d avg_ms=%.3f median_ms=%.3f p95_ms=%.3f p99_ms=%.3f max_ms=%.3f cpu_ms=%.3f gpu_ms=%.3f",
+	       n, sum/n/1000.0, benchmark_times[n/2]/1000.0,
+	       benchmark_times[(int)(n*.95)]/1000.0, benchmark_times[(int)(n*.99)]/1000.0,
+	       benchmark_times[n-1]/1000.0, cpuSum/n/1000.0,
+	       gpuCount > 0 ? gpuSum/gpuCount/1000.0 : -1.0);
+	if(benchmark_checksums)
+		printf(" checksum=%016llx", checksum);
+	printf("\n");
+}
+
+/** Called at the end of each frame before the buffers are
+ * swapped. Records the CPU time of the frame, ends the GPU timer
+ * query and computes the checksum of the frame if requested. */
+void benchmark_before_swap(void)
+{
+	if(!benchmark_enabled())
+		return;
+	if(benchmark_count >= benchmark_warmup + benchmark_frames)
+		return;
+
+	long now = kuhl_microseconds();
+	long measured = benchmark_count - benchmark_warmup;
+	if(measured >= 0)
+		benchmark_cpu[measured] = now - benchmark_prev;
+
+	if(benchmark_query_active)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		benchmark_query_active = 0;
+	}
+
+	benchmark_excluded = 0;
+	if(benchmark_checksums && measured >= 0)
+	{
+		benchmark_checksums[measured] = benchmark_checksum();
+		benchmark_excluded = kuhl_microseconds() - now;
+	}
+}
+
+/** Called at the end of each frame (after the buffers are
+ * swapped). Records how long the frame took, advances the benchmark
+ * time, and closes the window when enough frames have been
+ * measured. */
+void benchmark_frame(void)
+{
+	if(!benchmark_enabled())
+		return;
+	if(benchmark_count >= benchmark_warmup + benchmark_frames)
+		return;
+
+	if(benchmark_finish)
+		glFinish();
+	long now = kuhl_microseconds();
+
+	long measured = benchmark_count - benchmark_warmup;
+	if(measured >= 0)
+		benchmark_times[measured] = now - benchmark_prev - benchmark_excluded;
+	benchmark_prev = now;
+	benchmark_count++;
+
+	glfwSetTime(benchmark_time() / 1000000.0);
+
+	if(benchmark_count == benchmark_warmup + benchmark_frames)
+	{
+		benchmark_report();
+		glfwSetWindowShouldClose(kuhl_get_window(), GL_TRUE);
+	}
+	else
+		benchmark_query_begin();
+}
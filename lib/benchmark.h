@@ -0,0 +1,23 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Benchmark mode runs a program for a fixed number of frames with a
+ * fixed timestep and then reports how long the frames took. See
+ * benchmark.c for details.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int  benchmark_enabled(void);
+long benchmark_time(void);
+void benchmark_before_swap(void);
+void benchmark_frame(void);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
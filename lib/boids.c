@@ -0,0 +1,539 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   A flocking simulation based on Craig Reynolds' "boids." Each agent
+   steers toward the center of its neighbors (cohesion), toward the
+   average velocity of its neighbors (alignment), and away from
+   neighbors that are too close (separation). Agents that leave the
+   bounding box are steered back in.
+
+   Checking every pair of agents would take O(n^2) time. Instead,
+   space is divided into a uniform grid of cells that are as large as
+   the neighbor radius, so all of an agent's neighbors are in its own
+   cell or one of the 26 cells around it. The grid is endless: cell
+   coordinates are hashed into a fixed-size table, and agents in
+   different cells which hash to the same table entry are rejected by
+   the distance test.
+
+   Each update first sorts the agents by hash table entry (a counting
+   sort, which takes O(n) time). The positions and velocities are
+   stored as separate arrays of floats (structure of arrays) and are
+   stored in sorted order, so the agents in one cell are next to each
+   other in memory. As a result, the order of the agents changes
+   every update. Then, the agents are divided among a pool of worker
+   threads which compute the new velocities and positions. The
+   workers only read the sorted arrays and each writes a different
+   part of the output arrays, so they don't need any locks.
+
+   boids.c doesn't use OpenGL. To draw the flock, copy the positions
+   and directions into a buffer with boids_instances() and draw a
+   model with kuhl_geometry_draw_instanced() (see samples/flock.c).
+   selftests/bench-boids.c measures how many agents are updated per
+   second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _WIN32
+#include "windows-compat.h" // GetSystemInfo() on windows
+#else
+#include <unistd.h> // sysconf()
+#endif
+#ifndef _MSC_VER
+#include <pthread.h> // windows-compat.h provides pthreads on Visual Studio
+#endif
+
+#include "boids.h"
+#include "vecmat.h" // M_PI
+#include "msg.h"
+
+#define BOIDS_MAX_THREADS 64
+
+/** Positions and velocities of the agents, one array per component. */
+typedef struct {
+	float *px, *py, *pz;
+	float *vx, *vy, *vz;
+} boids_state;
+
+struct boids
+{
+	int count;
+	boids_params params;
+	boids_state cur;     /**< State after the last update */
+	boids_state sorted;  /**< State sorted by cell, read during an update */
+
+	float cellSize;
+	uint32_t tableMask;  /**< Table size - 1 (table size is a power of two) */
+	uint32_t *hash;      /**< Table entry of each agent */
+	uint32_t *cellStart; /**< Sorted agents in entry h are cellStart[h] to cellStart[h+1]-1 */
+	uint32_t *cellFill;
+
+	float dt;            /**< Time step of the update in progress */
+
+	int numThreads;      /**< Including the thread that calls boids_update() */
+	pthread_t threads[BOIDS_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /**< Signaled when an update starts or the workers should quit */
+	pthread_cond_t done; /**< Signaled when a worker finishes its part of an update */
+	/* Protected by lock */
+	unsigned int generation; /**< Incremented when an update starts */
+	int remaining;       /**< Workers that haven't finished the update */
+	int quit;
+};
+
+typedef struct {
+	boids *b;
+	int index;
+} boids_worker;
+
+
+/** Fills in reasonable default parameters for a flock of ducks
+ * (about 1 unit long) which move a few units per second. */
+void boids_params_default(boids_params *params)
+{
+	params->bounds[0] = 50;
+	params->bounds[1] = 15;
+	params->bounds[2] = 50;
+	params->radius = 2.5f;
+	params->separation = 1;
+	params->minSpeed = 2;
+	params->maxSpeed = 6;
+	params->cohesionWeight = .5f;
+	params->alignmentWeight = 1;
+	params->separationWeight = 2;
+	params->boundsWeight = 2;
+	params->maxNeighbors = 32;
+	params->threads = 0;
+}
+
+static void boids_state_alloc(boids_state *s, int count)
+{
+	float **arrays[6] = { &s->px, &s->py, &s->pz, &s->vx, &s->vy, &s->vz };
+	for(int i=0; i<6; i++)
+	{
+		*arrays[i] = (float*) malloc(sizeof(float)*(count > 0 ? count : 1));
+		if(*arrays[i] == NULL)
+		{
+			msg(MSG_FATAL, "Unable to allocate memory for %d agents.", count);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void boids_state_free(boids_state *s)
+{
+	free(s->px); free(s->py); free(s->pz);
+	free(s->vx); free(s->vy); free(s->vz);
+}
+
+/** Returns a random number between 0 and 1 (xorshift64*). */
+static float boids_random(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (float) ((*state * 2685821657736338717ULL) >> 40) / (float) (1 << 24);
+}
+
+/** Returns the hash table entry for a cell. */
+static inline uint32_t boids_hash(const boids *b, int x, int y, int z)
+{
+	uint32_t h = ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u) ^ ((uint32_t) z * 83492791u);
+	return h & b->tableMask;
+}
+
+static inline int boids_cell(const boids *b, float p)
+{
+	return (int) floorf(p / b->cellSize);
+}
+
+/** Updates sorted agents first to last-1, reading from b->sorted and
+ * writing to b->cur. */
+static void boids_update_range(boids *b, int first, int last)
+{
+	const boids_params *prm = &b->params;
+	const boids_state *in = &b->sorted;
+	const boids_state *out = &b->cur;
+	const float radius2 = prm->radius * prm->radius;
+	const float separation2 = prm->separation * prm->separation;
+	const float dt = b->dt;
+
+	for(int i=first; i<last; i++)
+	{
+		const float px = in->px[i], py = in->py[i], pz = in->pz[i];
+		float vx = in->vx[i], vy = in->vy[i], vz = in->vz[i];
+		int cx = boids_cell(b, px), cy = boids_cell(b, py), cz = boids_cell(b, pz);
+
+		float sumP[3] = { 0, 0, 0 };
+		float sumV[3] = { 0, 0, 0 };
+		float sep[3] = { 0, 0, 0 };
+		int neighbors = 0;
+
+		/* Neighboring cells can hash to the same table entry; only
+		 * visit each entry once. */
+		uint32_t visited[27];
+		int numVisited = 0;
+		for(int dz=-1; dz<=1 && neighbors < prm->maxNeighbors; dz++)
+		for(int dy=-1; dy<=1 && neighbors < prm->maxNeighbors; dy++)
+		for(int dx=-1; dx<=1 && neighbors < prm->maxNeighbors; dx++)
+		{
+			uint32_t h = boids_hash(b, cx+dx, cy+dy, cz+dz);
+			int seen = 0;
+			for(int k=0; k<numVisited; k++)
+				if(visited[k] == h)
+					seen = 1;
+			if(seen)
+				continue;
+			visited[numVisited++] = h;
+
+			uint32_t end = b->cellStart[h+1];
+			for(uint32_t j=b->cellStart[h]; j<end; j++)
+			{
+				if(j == (uint32_t) i)
+					continue;
+				float ox = px - in->px[j];
+				float oy = py - in->py[j];
+				float oz = pz - in->pz[j];
+				float d2 = ox*ox + oy*oy + oz*oz;
+				if(d2 >= radius2)
+					continue;
+
+				sumP[0] += in->px[j]; sumP[1] += in->py[j]; sumP[2] += in->pz[j];
+				sumV[0] += in->vx[j]; sumV[1] += in->vy[j]; sumV[2] += in->vz[j];
+				if(d2 < separation2 && d2 > 0)
+				{
+					/* Push harder when agents are closer. */
+					sep[0] += ox / d2; sep[1] += oy / d2; sep[2] += oz / d2;
+				}
+				if(++neighbors >= prm->maxNeighbors)
+					break;
+			}
+		}
+
+		float acc[3] = { 0, 0, 0 };
+		if(neighbors > 0)
+		{
+			float inv = 1.0f / neighbors;
+			acc[0] = prm->cohesionWeight * (sumP[0]*inv - px) + prm->alignmentWeight * (sumV[0]*inv - vx);
+			acc[1] = prm->cohesionWeight * (sumP[1]*inv - py) + prm->alignmentWeight * (sumV[1]*inv - vy);
+			acc[2] = prm->cohesionWeight * (sumP[2]*inv - pz) + prm->alignmentWeight * (sumV[2]*inv - vz);
+			for(int k=0; k<3; k++)
+				acc[k] += prm->separationWeight * sep[k];
+		}
+
+		/* Steer back inside of the bounding box. */
+		const float p[3] = { px, py, pz };
+		for(int k=0; k<3; k++)
+		{
+			if(p[k] > prm->bounds[k])
+				acc[k] -= prm->boundsWeight * (p[k] - prm->bounds[k]);
+			else if(p[k] < -prm->bounds[k])
+				acc[k] += prm->boundsWeight * (-prm->bounds[k] - p[k]);
+		}
+
+		vx += acc[0]*dt;
+		vy += acc[1]*dt;
+		vz += acc[2]*dt;
+		float speed = sqrtf(vx*vx + vy*vy + vz*vz);
+		if(speed > prm->maxSpeed)
+		{
+			float s = prm->maxSpeed / speed;
+			vx *= s; vy *= s; vz *= s;
+		}
+		else if(speed < prm->minSpeed)
+		{
+			if(speed > 0)
+			{
+				float s = prm->minSpeed / speed;
+				vx *= s; vy *= s; vz *= s;
+			}
+			else
+				vx = prm->minSpeed;
+		}
+
+		out->vx[i] = vx;
+		out->vy[i] = vy;
+		out->vz[i] = vz;
+		out->px[i] = px + vx*dt;
+		out->py[i] = py + vy*dt;
+		out->pz[i] = pz + vz*dt;
+	}
+}
+
+/** Updates the part of the flock that belongs to a thread. */
+static void boids_update_part(boids *b, int index)
+{
+	long first = (long) b->count * index / b->numThreads;
+	long last  = (long) b->count * (index+1) / b->numThreads;
+	boids_update_range(b, (int) first, (int) last);
+}
+
+static void* boids_thread(void *arg)
+{
+	boids_worker *w = (boids_worker*) arg;
+	boids *b = w->b;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&b->lock);
+	for(;;)
+	{
+		while(!b->quit && b->generation == generation)
+			pthread_cond_wait(&b->wake, &b->lock);
+		if(b->quit)
+			break;
+		generation = b->generation;
+		pthread_mutex_unlock(&b->lock);
+
+		boids_update_part(b, w->index);
+
+		pthread_mutex_lock(&b->lock);
+		if(--b->remaining == 0)
+			pthread_cond_signal(&b->done);
+	}
+	pthread_mutex_unlock(&b->lock);
+	free(w);
+	return NULL;
+}
+
+/** Creates a flock of agents with random positions within the bounds
+    and random directions.
+
+    @param count The number of agents.
+
+    @param params The parameters of the flock (copied). NULL uses
+    boids_params_default().
+
+    @param seed Flocks made with the same seed start in the same
+    state.
+
+    @return The new flock. Free it with boids_free().
+*/
+boids* boids_new(int count, const boids_params *params, uint64_t seed)
+{
+	boids *b = (boids*) calloc(1, sizeof(boids));
+	if(b == NULL)
+	{
+		msg(MSG_FATAL, "Unable to allocate memory for %d agents.", count);
+		exit(EXIT_FAILURE);
+	}
+	if(count < 0)
+		count = 0;
+	b->count = count;
+	if(params)
+		b->params = *params;
+	else
+		boids_params_default(&b->params);
+	if(b->params.radius <= 0)
+		b->params.radius = 1;
+	if(b->params.maxNeighbors < 1)
+		b->params.maxNeighbors = 1;
+	b->cellSize = b->params.radius;
+
+	boids_state_alloc(&b->cur, count);
+	boids_state_alloc(&b->sorted, count);
+
+	/* Use about two table entries per agent so that few cells share
+	 * an entry. */
+	uint32_t tableSize = 1024;
+	while(tableSize < 2u*(uint32_t)count && tableSize < (1u<<30))
+		tableSize *= 2;
+	b->tableMask = tableSize-1;
+	b->hash = (uint32_t*) malloc(sizeof(uint32_t)*(count > 0 ? count : 1));
+	b->cellStart = (uint32_t*) malloc(sizeof(uint32_t)*(tableSize+1));
+	b->cellFill = (uint32_t*) malloc(sizeof(uint32_t)*tableSize);
+	if(b->hash == NULL || b->cellStart == NULL || b->cellFill == NULL)
+	{
+		msg(MSG_FATAL, "Unable to allocate memory for %d agents.", count);
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t state = seed * 2 + 1; // xorshift state must not be zero
+	const float speed = (b->params.minSpeed + b->params.maxSpeed) / 2;
+	for(int i=0; i<count; i++)
+	{
+		b->cur.px[i] = (boids_random(&state)*2-1) * b->params.bounds[0];
+		b->cur.py[i] = (boids_random(&state)*2-1) * b->params.bounds[1];
+		b->cur.pz[i] = (boids_random(&state)*2-1) * b->params.bounds[2];
+
+		/* Random direction (uniform on a sphere) */
+		float z = boids_random(&state)*2-1;
+		float angle = boids_random(&state) * 2 * (float) M_PI;
+		float r = sqrtf(1-z*z);
+		b->cur.vx[i] = r*cosf(angle) * speed;
+		b->cur.vy[i] = r*sinf(angle) * speed;
+		b->cur.vz[i] = z * speed;
+	}
+
+	/* Start the worker threads. */
+	int threads = b->params.threads;
+	if(threads <= 0)
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		threads = (int) info.dwNumberOfProcessors;
+#else
+		threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	}
+	if(threads < 1)
+		threads = 1;
+	if(threads > BOIDS_MAX_THREADS)
+		threads = BOIDS_MAX_THREADS;
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->wake, NULL);
+	pthread_cond_init(&b->done, NULL);
+	b->numThreads = 1;
+	for(int i=1; i<threads; i++)
+	{
+		boids_worker *w = (boids_worker*) malloc(sizeof(boids_worker));
+		if(w == NULL)
+			break;
+		w->b = b;
+		w->index = i;
+		if(pthread_create(&b->threads[i], NULL, boids_thread, w) != 0)
+		{
+			msg(MSG_WARNING, "Unable to create boids thread; using %d threads.", b->numThreads);
+			free(w);
+			break;
+		}
+		b->numThreads++;
+	}
+	return b;
+}
+
+/** Stops the worker threads and frees a flock. */
+void boids_free(boids *b)
+{
+	if(b == NULL)
+		return;
+	pthread_mutex_lock(&b->lock);
+	b->quit = 1;
+	pthread_cond_broadcast(&b->wake);
+	pthread_mutex_unlock(&b->lock);
+	for(int i=1; i<b->numThreads; i++)
+		pthread_join(b->threads[i], NULL);
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->wake);
+	pthread_cond_destroy(&b->done);
+
+	boids_state_free(&b->cur);
+	boids_state_free(&b->sorted);
+	free(b->hash);
+	free(b->cellStart);
+	free(b->cellFill);
+	free(b);
+}
+
+/** Returns the number of agents in the flock. */
+int boids_count(const boids *b)
+{
+	return b->count;
+}
+
+/** Returns the number of threads that boids_update() uses. */
+int boids_threads(const boids *b)
+{
+	return b->numThreads;
+}
+
+/** Moves the flock forward in time.
+
+    @param b The flock.
+
+    @param dt The amount of time to move forward (in seconds). Large
+    time steps make the flock unstable; call this multiple times with
+    a smaller time step instead.
+*/
+void boids_update(boids *b, float dt)
+{
+	const int n = b->count;
+	const uint32_t tableSize = b->tableMask+1;
+
+	/* Count the agents in each table entry. */
+	memset(b->cellStart, 0, sizeof(uint32_t)*(tableSize+1));
+	for(int i=0; i<n; i++)
+	{
+		uint32_t h = boids_hash(b, boids_cell(b, b->cur.px[i]),
+		                        boids_cell(b, b->cur.py[i]),
+		                        boids_cell(b, b->cur.pz[i]));
+		b->hash[i] = h;
+		b->cellStart[h+1]++;
+	}
+	for(uint32_t h=0; h<tableSize; h++)
+		b->cellStart[h+1] += b->cellStart[h];
+
+	/* Copy the agents into sorted order. */
+	memcpy(b->cellFill, b->cellStart, sizeof(uint32_t)*tableSize);
+	for(int i=0; i<n; i++)
+	{
+		uint32_t j = b->cellFill[b->hash[i]]++;
+		b->sorted.px[j] = b->cur.px[i];
+		b->sorted.py[j] = b->cur.py[i];
+		b->sorted.pz[j] = b->cur.pz[i];
+		b->sorted.vx[j] = b->cur.vx[i];
+		b->sorted.vy[j] = b->cur.vy[i];
+		b->sorted.vz[j] = b->cur.vz[i];
+	}
+
+	/* Compute the new state on all of the threads. */
+	b->dt = dt;
+	if(b->numThreads > 1)
+	{
+		pthread_mutex_lock(&b->lock);
+		b->remaining = b->numThreads-1;
+		b->generation++;
+		pthread_cond_broadcast(&b->wake);
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	boids_update_part(b, 0);
+
+	if(b->numThreads > 1)
+	{
+		pthread_mutex_lock(&b->lock);
+		while(b->remaining > 0)
+			pthread_cond_wait(&b->done, &b->lock);
+		pthread_mutex_unlock(&b->lock);
+	}
+}
+
+/** Copies the state of the flock into arrays which can be used as
+    per-instance data when drawing.
+
+    @param b The flock.
+
+    @param positions boids_count()*3 floats which are filled with the
+    position of each agent. Can be NULL.
+
+    @param directions boids_count()*3 floats which are filled with the
+    normalized direction that each agent is moving. Can be NULL.
+*/
+void boids_instances(const boids *b, float *positions, float *directions)
+{
+	for(int i=0; i<b->count; i++)
+	{
+		if(positions)
+		{
+			positions[i*3+0] = b->cur.px[i];
+			positions[i*3+1] = b->cur.py[i];
+			positions[i*3+2] = b->cur.pz[i];
+		}
+		if(directions)
+		{
+			float vx = b->cur.vx[i], vy = b->cur.vy[i], vz = b->cur.vz[i];
+			float len = sqrtf(vx*vx + vy*vy + vz*vz);
+			if(len > 0)
+				len = 1/len;
+			directions[i*3+0] = vx*len;
+			directions[i*3+1] = vy*len;
+			directions[i*3+2] = vz*len;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * A multithreaded flocking (boids) simulation which uses a spatial
+ * hash to find neighbors. See boids.c for details.
+ */
+
+#pragma once
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Parameters of a flock. Use boids_params_default() to fill in
+ * reasonable values and then change the ones you care about. */
+typedef struct {
+	float bounds[3];        /**< Agents stay within +/- bounds of the origin */
+	float radius;           /**< Agents within this distance are neighbors */
+	float separation;       /**< Agents closer than this push apart */
+	float minSpeed, maxSpeed;
+	float cohesionWeight;   /**< Steer toward the center of the neighbors */
+	float alignmentWeight;  /**< Steer toward the average velocity of the neighbors */
+	float separationWeight; /**< Steer away from nearby neighbors */
+	float boundsWeight;     /**< Steer back inside of the bounds */
+	int maxNeighbors;       /**< Stop looking for neighbors after this many are found */
+	int threads;            /**< Number of threads to update with (0 = one per CPU) */
+} boids_params;
+
+typedef struct boids boids;
+
+void boids_params_default(boids_params *params);
+boids* boids_new(int count, const boids_params *params, uint64_t seed);
+void boids_free(boids *b);
+int boids_count(const boids *b);
+int boids_threads(const boids *b);
+void boids_update(boids *b, float dt);
+void boids_instances(const boids *b, float *positions, float *directions);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
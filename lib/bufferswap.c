@@ -5,12 +5,24 @@
 #endif
 
 #include <stdlib.h>
+#include <math.h> // fabsf()
+#include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "kuhl-util.h"
 #include "dgr.h"
+#include "trace.h"
+#include "benchmark.h"
+#include "gputimer.h"
+#include "capture.h"
 
 static int viewmat_swapinterval = 0;
 
+/* Timing information used by bufferswap_predict_display_time() */
+static int vsyncTime = -1;          /**< microseconds/frame */
+static long lastSwapTime = -1;      /**< Time the previous glfwSwapBuffers() returned */
+static float avgRenderTime = -1;    /**< Average time to render a frame in microseconds */
+static long predictedSwapTime = -1; /**< Swap time predicted for the current frame */
+
 /** Call once per frame to update the 'fps' variable. */
 static float fps = 0;
 static void bufferswap_stats_fps(void)
@@ -111,115 +123,220 @@ int bufferswap_get_refresh_rate(void)
 
 
 
+/** Called after the buffers are swapped to keep track of when frames
+ * are displayed. */
+static void bufferswap_stats_swap(long postswap)
+{
+	if(predictedSwapTime >= 0)
+		trace_counter("swap_prediction_error_usec", (double) (postswap - predictedSwapTime));
+	predictedSwapTime = -1;
+	lastSwapTime = postswap;
+}
+
 static void bufferswap_simple(void)
 {
-	glfwSwapBuffers(kuhl_get_window());
+	trace_begin("glfwSwapBuffers");
+	if(kuhl_headless())
+		glFlush(); // nothing to swap, we are drawing into a framebuffer object
+	else
+		glfwSwapBuffers(kuhl_get_window());
+	trace_end("glfwSwapBuffers");
 	bufferswap_stats_fps();
+
+	/* We don't know how much of the frame time was spent rendering,
+	 * assume all of it was. */
+	long postswap = kuhl_microseconds();
+	if(lastSwapTime >= 0)
+	{
+		float frameTime = (float) (postswap - lastSwapTime);
+		if(avgRenderTime < 0)
+			avgRenderTime = frameTime;
+		avgRenderTime = .95f * avgRenderTime + .05f * frameTime;
+	}
+	bufferswap_stats_swap(postswap);
 	return;
 }
 
 
 
+/* Frame pacing (see bufferswap_latencyreduce()) */
+#define PACE_HIST_BINS 128 /**< Number of bins in each histogram; the last bin holds everything larger */
+static int paceVrr = 0;            /**< 1 if the display has a variable refresh rate */
+static int paceFence = 1;          /**< 1 if we wait on a fence to find out when the GPU finished */
+static float paceMargin = 1500;    /**< Time (usec) we try to have left when rendering finishes */
+static float paceMarginMin = 250;  /**< Smallest margin we will use */
+static float paceTargetMiss = .01f; /**< Fraction of frames we are willing to miss */
+static float paceMissRate = 0;     /**< Recent fraction of missed frames */
+static long paceFrames = 0;        /**< Number of frames paced */
+static long paceMissed = 0;        /**< Number of those frames which were late */
+static int paceHistBin = 250;      /**< Width of each histogram bin in microseconds */
+static long paceHist[4][PACE_HIST_BINS]; /**< Histograms of the frame interval, render, sleep and swap wait times */
+static const char *paceHistNames[4] = { "interval", "render", "sleep", "swapwait" };
+
+/** Adds a time (in microseconds) to one of the frame pacing
+ * histograms. */
+static void bufferswap_pace_hist(int hist, long usec)
+{
+	long bin = usec / paceHistBin;
+	if(bin < 0)
+		bin = 0;
+	if(bin >= PACE_HIST_BINS)
+		bin = PACE_HIST_BINS-1;
+	paceHist[hist][bin]++;
+}
+
+/** Writes the frame pacing histograms to the file named by
+ * "bufferswap.csv" and prints a summary to the log when the program
+ * exits. */
+static void bufferswap_pace_exit(void)
+{
+	if(paceFrames == 0)
+		return;
+	msg(MSG_INFO, "Frame pacing: %ld frames, %ld missed (%.2f%%), final margin %.0f usec",
+	    paceFrames, paceMissed, 100.0*paceMissed/paceFrames, paceMargin);
+
+	const char *csvFile = kuhl_config_get("bufferswap.csv");
+	if(csvFile == NULL)
+		return;
+	FILE *f = fopen(csvFile, "w");
+	if(f == NULL)
+	{
+		msg(MSG_ERROR, "Unable to write frame pacing histogram to '%s'", csvFile);
+		return;
+	}
+	fprintf(f, "usec");
+	for(int h=0; h<4; h++)
+		fprintf(f, ",%s", paceHistNames[h]);
+	fprintf(f, "\n");
+	for(int i=0; i<PACE_HIST_BINS; i++)
+	{
+		fprintf(f, "%d", i*paceHistBin);
+		for(int h=0; h<4; h++)
+			fprintf(f, ",%ld", paceHist[h][i]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+
+/** Reads the frame pacing settings. */
+static void bufferswap_pace_init(void)
+{
+	if(paceVrr)
+	{
+		/* The display refreshes when we swap, so pick the rate we
+		 * want to run at. */
+		int hz = kuhl_config_int("bufferswap.vrr.hz", -1, -1);
+		if(hz > 0)
+			vsyncTime = 1000000 / hz;
+	}
+	paceFence = kuhl_config_boolean("bufferswap.fence", 1, 1) &&
+		(GLEW_ARB_sync || GLEW_VERSION_3_2);
+	paceMargin = (float) kuhl_config_int("bufferswap.margin", 1500, 1500);
+	paceMarginMin = (float) kuhl_config_int("bufferswap.margin.min", 250, 250);
+	if(paceMargin < paceMarginMin)
+		paceMargin = paceMarginMin;
+	paceTargetMiss = kuhl_config_float("bufferswap.missrate", .01f, .01f);
+	paceHistBin = kuhl_config_int("bufferswap.csv.bin", 250, 250);
+	if(paceHistBin < 1)
+		paceHistBin = 1;
+	atexit(bufferswap_pace_exit);
+
+	msg(MSG_INFO, "Latency reduction is turned on; assuming %s %dHz and we have %d microseconds/frame\n",
+	    paceVrr ? "variable refresh rate display running at" : "monitor is",
+	    1000000/vsyncTime, vsyncTime);
+	msg(MSG_INFO, "Set bufferswap.latencyreduce to 0 to disable latency reduction.\n");
+}
+
+/** Swaps buffers and then sleeps so that the next frame finishes
+    rendering shortly before the next vsync, reducing the time
+    between rendering and display.
+
+    The time it takes to render a frame is measured from when we
+    stopped sleeping until the GPU finished (we wait on a fence
+    before swapping; without a fence, we only know when the CPU
+    finished). We sleep for the frame time minus a high estimate of
+    the render time minus a safety margin. The margin adapts: it
+    grows quickly when a frame is late and slowly shrinks while fewer
+    than "bufferswap.missrate" of the frames are late.
+
+    With "bufferswap.vrr", the display refreshes when we swap instead
+    of at a fixed rate. Then we also wait before swapping so that
+    frames are displayed at a steady "bufferswap.vrr.hz".
+ */
 static void bufferswap_latencyreduce()
 {
-	
 	static int count = 0;
 	if(count < 100)
 		count++;
-	static float avgRenderingLastFrame = -1;
-	static float avgRenderingLastFrameDev = 0;
-	static float avgWaitingForVsync = -1;
+	static float avgRender = -1;
+	static float avgRenderDev = 0;
 	static long postswap_prev = -1;
 	static long postsleep_prev = -1;
 
+	static int needsInit = 1;
+	if(needsInit)
+	{
+		needsInit = 0;
+		bufferswap_pace_init();
+	}
 
-	static int vsyncTime = -1; //**< microseconds/frame
-	if(vsyncTime == -1)
+	/* Wait for the GPU to finish the frame so that we know how long
+	 * it really took to render it. Otherwise, the time spent in
+	 * glfwSwapBuffers() would be both the time waiting for vsync and
+	 * the time waiting for the GPU, and our render time estimate
+	 * would only include the CPU. */
+	if(paceFence)
 	{
-		int refreshRate = bufferswap_get_refresh_rate();
-		// 1 / (frames/second) * 1000000 microseconds/second = microseconds/frame
-		vsyncTime = (int) (1.0/refreshRate * 1000000);
-		msg(MSG_INFO, "Latency reduction is turned on; assuming monitor is %dHz and we have %d microseconds/frame\n", refreshRate, vsyncTime);
-		msg(MSG_INFO, "Set bufferswap.latencyreduce to 0 to disable latency reduction.\n", refreshRate, vsyncTime);
+		trace_begin("bufferswap_fence");
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64) vsyncTime * 4000);
+		glDeleteSync(fence);
+		trace_end("bufferswap_fence");
+	}
+	long rendered = kuhl_microseconds();
+
+	/* With a variable refresh rate, the frame is displayed as soon as
+	 * we swap. Don't display it before it is due. */
+	if(paceVrr && postswap_prev >= 0)
+	{
+		long due = postswap_prev + vsyncTime;
+		if(rendered < due)
+			usleep((int) (due - rendered));
 	}
 
-	
-	GLFWwindow *window = kuhl_get_window();
-	/* We can call glFinish() to ensure that all rendering is done so
-	 * that our preswap time has a higher chance of being
-	 * accurate. Otherwise, our the time spent in swapbuffers can be
-	 * both the time waiting for vsync and the time waiting for the
-	 * previous OpenGL calls to finish. For more information, see:
-	 * https://www.opengl.org/wiki/Performance
-	 *
-	 * Skipping glFinish() may result in a slight performance increase
-	 * and may have a detrimental impact on our latency reduction
-	 * code.
-	 */
-	//glFinish();
 	long preswap = kuhl_microseconds();
-	glfwSwapBuffers(window);
+	trace_begin("glfwSwapBuffers");
+	glfwSwapBuffers(kuhl_get_window());
+	trace_end("glfwSwapBuffers");
 	bufferswap_stats_fps();
 	long postswap = kuhl_microseconds();
-
-
-
-	int timeWaitingForVsync = postswap - preswap;
+	bufferswap_stats_swap(postswap);
 
 	if(count < 10) // initialize averages, skip first few frames.
 	{
 		if(count > 2)
-			avgRenderingLastFrame = (float) (preswap - postsleep_prev);
-		
-		avgWaitingForVsync = (float) timeWaitingForVsync;
+			avgRender = (float) (rendered - postsleep_prev);
 		postswap_prev = postswap;
 		postsleep_prev = postswap; // we aren't sleeping.
 		return;
 	}
 
-	/* Figure out if we missed a frame */
-	float missedFrames = 0.0f;
+	/* Figure out if we missed a frame. With a fixed refresh rate, a
+	 * late frame is displayed a whole refresh later. With a variable
+	 * refresh rate, it is displayed as soon as it is ready. */
 	long elapsed = postswap - postswap_prev;
-	
-	if(elapsed > (((long)vsyncTime)*3)/2)
-	{
-		static int maxMessages = 20;
-		missedFrames = elapsed / (float) vsyncTime - 1.0f;
-		if(count > 60) // don't print message for first 60 frames.
-		{
-			if(maxMessages >= 0)
-				maxMessages--;
-
-			if(maxMessages > 0)
-				msg(MSG_INFO, "Missed approximately %0.2f frame(s), %ld usec have elapsed", missedFrames, elapsed);
-			else
-			{
-				if(maxMessages == 0)
-					msg(MSG_INFO, "No more messages about dropped frames, but messages will still be saved to log file.");
-				msg(MSG_DEBUG, "Missed approximately %0.2f frame(s), %ld usec have elapsed", missedFrames, elapsed);
-			}
-#if 0				
-			msg(MSG_WARNING, "Displayed previous frame at  %ld", postswap_prev);
-			msg(MSG_WARNING, "Displayed this frame at      %ld", postswap);
-			msg(MSG_WARNING, "Expected this frame before   %ld", postswap_prev+(((long)vsyncTime)*3)/2);
-#endif
-		}
-	}
+	int missed = paceVrr ? elapsed > vsyncTime + vsyncTime/10
+	                     : elapsed > (((long)vsyncTime)*3)/2;
+	int timeRendering = (int) (rendered - postsleep_prev);
 
 	const float alpha = .95f; // weight to put on running average
 
-	// Update average waiting for vsync time. Note: The wait time can
-	// get large if the frame rate is low. I.e., if we miss a vsync,
-	// we have to wait until the next vsync. We calculate the time
-	// waiting for vsync for informational purposes only.
-	avgWaitingForVsync    = alpha * avgWaitingForVsync    + (1-alpha) * timeWaitingForVsync;
-
 	/* Update our estimates of the time it takes to render a
 	 * frame---both the average and our estimate of the deviation.  */
-	int timeRenderingLastFrame = preswap - postsleep_prev;
-	avgRenderingLastFrame    = alpha * avgRenderingLastFrame + (1-alpha) * timeRenderingLastFrame;
-	avgRenderingLastFrameDev = alpha * avgRenderingLastFrameDev + (1-alpha)*(fabsf(avgRenderingLastFrame-timeRenderingLastFrame));
-	
+	avgRender    = alpha * avgRender    + (1-alpha) * timeRendering;
+	avgRenderDev = alpha * avgRenderDev + (1-alpha) * fabsf(avgRender-timeRendering);
+	avgRenderTime = avgRender + avgRenderDev * 2;
+
 	if(count < 60) // collected enough data so our averages are reasonable.
 	{
 		postswap_prev = postswap;
@@ -227,37 +344,44 @@ static void bufferswap_latencyreduce()
 		return;
 	}
 
-	/* Add in more time based on our deviation estimate */
-	float renderingTimeMax = avgRenderingLastFrame + avgRenderingLastFrameDev * 2;
-
-	/** The ideal time that we want to save in microseconds. If we set
-	 * this to 1000, and we have 16666 microseconds per frame, then we
-	 * will try to sleep such that the rendering will finish at
-	 * 16666-1000=15666 microseconds. If we set this value to 0, then
-	 * we won't save any extra time and we risk missing a frame. */
-	const int buffer_time = 1500;
+	/* Adapt the margin: Back off quickly after a late frame, then
+	 * creep back toward lower latency while we are missing fewer
+	 * frames than we are willing to. */
+	paceFrames++;
+	paceMissRate = .98f * paceMissRate + .02f * missed;
+	if(missed)
+	{
+		paceMissed++;
+		paceMargin = paceMargin * 1.5f + 250;
+		msg(MSG_DEBUG, "Missed a frame, %ld usec have elapsed. Margin is now %.0f usec", elapsed, paceMargin);
+	}
+	else if(paceMissRate < paceTargetMiss)
+		paceMargin -= 5;
+	if(paceMargin < paceMarginMin)
+		paceMargin = paceMarginMin;
+	if(paceMargin > vsyncTime/2)
+		paceMargin = (float) (vsyncTime/2);
 
 	/* We have vsyncTime until the next vsync. Subtract out expected
-	 * rendering time and the buffer time. Also subtract out
-	 * additional time if we missed one or more frames. */
-	int sleepTime = (int) (vsyncTime - renderingTimeMax - buffer_time - missedFrames*1000);
-
-#if 0
-	msg(MSG_INFO, "Sleeping for %6d = %6d(avail) - %6.0f(rendermax) - %d(buf) - %6.0f(missedframe)\n", sleepTime, vsyncTime, renderingTimeMax, buffer_time, missedFrames*1000);
-	msg(MSG_INFO, "LastRender=%d AvgRender=%.0f AvgRenderDev=%.0f VsyncWait=%d AvgVsyncWait=%.0f",
-	    timeRenderingLastFrame, avgRenderingLastFrame, avgRenderingLastFrameDev, timeWaitingForVsync, avgWaitingForVsync);
-#endif
-	
+	 * rendering time and the margin. */
+	int sleepTime = (int) (vsyncTime - avgRenderTime - paceMargin);
+
+	bufferswap_pace_hist(0, elapsed);
+	bufferswap_pace_hist(1, timeRendering);
+	bufferswap_pace_hist(2, sleepTime > 0 ? sleepTime : 0);
+	bufferswap_pace_hist(3, postswap - preswap);
+	trace_counter("render_usec", timeRendering);
+	trace_counter("margin_usec", paceMargin);
+	trace_counter("sleep_usec", sleepTime > 0 ? sleepTime : 0);
+	trace_counter("missed_frames", missed);
+
 	postsleep_prev = postswap;
 	postswap_prev = postswap;
-
 	if(sleepTime > 0)
 	{
 		usleep(sleepTime);
 		postsleep_prev = kuhl_microseconds();
 	}
-
-	return;
 }
 
 /** Get swap interval settings and apply them by calling glfwSwapInterval().
@@ -266,6 +390,10 @@ static void bufferswap_init(void)
 {
 	viewmat_swapinterval = kuhl_config_int("bufferswap.swapinterval", -1, -1);
 
+	int refreshRate = bufferswap_get_refresh_rate();
+	// 1 / (frames/second) * 1000000 microseconds/second = microseconds/frame
+	vsyncTime = (int) (1.0/refreshRate * 1000000);
+
 	/* If swap_control_tear extension doesn't exist, don't use it. */
 	if(!glfwExtensionSupported("GLX_EXT_swap_control_tear") &&
 	   !glfwExtensionSupported("WGL_EXT_swap_control_tear"))
@@ -278,11 +406,22 @@ static void bufferswap_init(void)
 			viewmat_swapinterval = 1;
 	}
 
-	if(viewmat_swapinterval < -1 || viewmat_swapinterval > 1)
+	/* With a variable refresh rate display, bufferswap_latencyreduce()
+	 * paces the frames. */
+	paceVrr = kuhl_config_boolean("bufferswap.vrr", 0, 0);
+
+	/* Benchmarks measure how quickly frames can be rendered, so don't
+	 * wait for the monitor. */
+	if(benchmark_enabled() || kuhl_headless())
+	{
+		viewmat_swapinterval = 0;
+		paceVrr = 0;
+	}
+	else if(viewmat_swapinterval < -1 || viewmat_swapinterval > 1)
 		msg(MSG_WARNING, "viewmat.swapinterval should be set to -1, 0 or 1. You have set it to %d\n", viewmat_swapinterval);
 
 	/* If configuration requested 0 */
-	if(viewmat_swapinterval == 0)
+	if(viewmat_swapinterval == 0 && !benchmark_enabled() && !kuhl_headless())
 	{
 		msg(MSG_WARNING, "Buffer swapping can happen at any time; FPS can go above monitor refresh rate; tearing may occur.");
 		msg(MSG_WARNING, "Set viewmat.swapinterval to -1 to swap buffers during monitor refresh (except when FPS drops below monitor refresh rate).");
@@ -299,7 +438,52 @@ static void bufferswap_init(void)
 	        enough. If FPS drops below monitor refresh, tearing can
 	        occur.
 	*/
-	glfwSwapInterval(viewmat_swapinterval);
+	if(!kuhl_headless())
+		glfwSwapInterval(viewmat_swapinterval);
+}
+
+/** Estimates when the frame that is currently being rendered will be
+    visible to the user. This can be used to predict where a tracked
+    object will be when the frame is displayed. The estimate is based
+    on how long previous frames took to render, the monitor refresh
+    rate, and the time of the previous buffer swap.
+
+    The returned time is halfway through the refresh of the display
+    (i.e., when the middle of the screen is updated) plus the
+    bufferswap.displaylatency configuration variable (microseconds,
+    default 0) which can be used to account for additional latency in
+    the display itself.
+
+    @return The predicted display time in microseconds (see
+    kuhl_microseconds()).
+*/
+long bufferswap_predict_display_time(void)
+{
+	long now = kuhl_microseconds();
+	if(vsyncTime <= 0 || lastSwapTime < 0 || avgRenderTime < 0)
+		return now;
+
+	/* When will we finish rendering? */
+	long finished = now + (long) avgRenderTime;
+
+	/* Buffers are swapped at the first vsync after we finish
+	 * rendering. If swaps aren't synchronized with vsync, we swap as
+	 * soon as we finish. */
+	long swap = finished;
+	if(viewmat_swapinterval != 0)
+	{
+		long frames = (finished - lastSwapTime + vsyncTime - 1) / vsyncTime;
+		if(frames < 1)
+			frames = 1;
+		swap = lastSwapTime + frames * vsyncTime;
+	}
+	if(predictedSwapTime < 0)
+		predictedSwapTime = swap;
+
+	static kuhl_config_handle latencyHandle = KUHL_CONFIG_HANDLE("bufferswap.displaylatency");
+	int displayLatency = kuhl_config_handle_int(&latencyHandle, 0, 0);
+
+	return swap + vsyncTime/2 + displayLatency;
 }
 
 /** Swaps the buffers using the appropriate settings based on the
@@ -316,14 +500,23 @@ void bufferswap(void)
 		needsInit = 0;
 	}
 	
+	trace_begin("bufferswap");
 	dgr_update(1,0); // DGR Master should send before blocking at swap.
 
+	gputimer_frame();
+	benchmark_before_swap();
+
 	/* Swap the buffers */
-	if(viewmat_swapinterval == 0 ||
-	   kuhl_config_boolean("bufferswap.latencyreduce", 1,1) == 0) // if FPS is unrestricted.
+	static kuhl_config_handle latencyReduce = KUHL_CONFIG_HANDLE("bufferswap.latencyreduce");
+	if((viewmat_swapinterval == 0 && !paceVrr) ||
+	   kuhl_config_handle_boolean(&latencyReduce, 1,1) == 0) // if FPS is unrestricted.
 		bufferswap_simple();
 	else
 		bufferswap_latencyreduce();
 
 	dgr_update(0,1); // DGR Slave should receive after swap (and before drawing)
+	capture_poll(); // hand finished screenshot/video readbacks to the encoder threads
+	benchmark_frame();
+	trace_end("bufferswap");
+	trace_frame();
 }
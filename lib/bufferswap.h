@@ -20,6 +20,26 @@
       before the vsync, (2) render graphics, (3) wait until vsync to
       swap buffers (hopefully not long!), (4) swap buffers.
 
+      The render time is measured up to when the GPU finishes (using
+      a fence) and the safety margin left before the vsync adapts to
+      how often frames are late. Settings:
+
+      - bufferswap.latencyreduce: Set to 0 to disable (default: 1).
+      - bufferswap.fence: Set to 0 to measure the render time on the
+        CPU only (default: 1).
+      - bufferswap.margin: Initial margin in microseconds (default:
+        1500). bufferswap.margin.min is the smallest margin that will
+        be used (default: 250).
+      - bufferswap.missrate: Fraction of frames that may be late
+        before the margin stops shrinking (default: 0.01).
+      - bufferswap.vrr: Set to 1 on displays with a variable refresh
+        rate (G-Sync, FreeSync). Frames are then paced to
+        bufferswap.vrr.hz (default: the monitor refresh rate).
+      - bufferswap.csv: When the program exits, write histograms of
+        the frame interval, render time, sleep time and time waiting
+        in glfwSwapBuffers() to this file. bufferswap.csv.bin is the
+        width of each bin in microseconds (default: 250).
+
     * It allows you to change the "Swap interval". Historically, you
       could only say "wait for vsync" to swap buffers (then your FPS
       is typically limited to 60fps or the refresh rate of your
@@ -39,6 +59,10 @@
       send/receive appropriately.
 
     * Monitors FPS and allows the user to retrieve the current FPS.
+
+    * Predicts when the frame currently being rendered will be
+      displayed so that tracked poses can be extrapolated to that
+      time. See bufferswap_predict_display_time().
     
     @author Scott Kuhl
  */
@@ -50,6 +74,8 @@ extern "C" {
 
 void bufferswap(void);
 float bufferswap_fps(void);
+int bufferswap_get_refresh_rate(void);
+long bufferswap_predict_display_time(void);
 
 #ifdef __cplusplus
 } // end extern "C"
@@ -23,17 +23,29 @@ camcontrolMouse::camcontrolMouse(dispmode *currentDisplayMode, const float pos[3
 
 viewmat_eye camcontrolMouse::get_separate(float pos[3], float rot[16], viewmat_eye requestedEye)
 {
-	float look[3], up[3];
-	mousemove_get(pos, look, up);
-	mat4f_lookatVec_new(rot, pos, look, up);
+	double posd[3];
+	viewmat_eye actualEye = get_separate_double(posd, rot, requestedEye);
+	vec3f_from_vec3d(pos, posd);
+	return actualEye;
+}
+
+viewmat_eye camcontrolMouse::get_separate_double(double pos[3], float rot[16], viewmat_eye requestedEye)
+{
+	/* mousemove stores the camera in double precision. Calculate the
+	 * rotation in double too so that it doesn't become jittery when
+	 * the camera is far from the origin. */
+	double look[3], up[3], rotd[16];
+	mousemove_getd(pos, look, up);
+	mat4d_lookatVec_new(rotd, pos, look, up);
 
 	// Translation will be in outPos, not in the rotation matrix.
-	float zero[4] = { 0,0,0,1 };
-	mat4f_setColumn(rot, zero, 3);
+	double zero[4] = { 0,0,0,1 };
+	mat4d_setColumn(rotd, zero, 3);
 
 	// Invert matrix because the rotation matrix will be inverted
 	// again later.
-	mat4f_invert(rot);
+	mat4d_invert(rotd);
+	mat4f_from_mat4d(rot, rotd);
 	
 	return VIEWMAT_EYE_MIDDLE;
 }
@@ -11,4 +11,5 @@ class camcontrolMouse : public camcontrol
 public:
 	camcontrolMouse(dispmode *currentDisplayMode, const float pos[3], const float look[3], const float up[3]);
 	viewmat_eye get_separate(float pos[3], float rot[16], viewmat_eye requestedEye);
+	viewmat_eye get_separate_double(double pos[3], float rot[16], viewmat_eye requestedEye);
 };
@@ -3,6 +3,7 @@
 #include "camcontrol-orientsensor.h"
 #include "vecmat.h"
 #include "orient-sensor.h"
+#include "bufferswap.h"
 
 
 camcontrolOrientSensor::camcontrolOrientSensor(dispmode *currentDisplayMode, const float initialPos[3])
@@ -27,11 +28,18 @@ camcontrolOrientSensor::camcontrolOrientSensor(dispmode *currentDisplayMode, con
 
 	orientsense = orient_sensor_init(kuhl_config_get("orientsensor.tty"),
 	                                 orientSensorType);
+
+	predict = kuhl_config_boolean("viewmat.predict", 0, 0);
+	history = pose_ring_new(32);
+	pose_predict_stats_init(&stats);
+	statsPrinted = 0;
 }
 
 
 camcontrolOrientSensor::~camcontrolOrientSensor()
 {
+	orient_sensor_close(&orientsense);
+	pose_ring_free(history);
 }
 
 viewmat_eye camcontrolOrientSensor::get_separate(float pos[3], float orient[16], viewmat_eye requestedEye)
@@ -42,6 +50,45 @@ viewmat_eye camcontrolOrientSensor::get_separate(float pos[3], float orient[16],
 	// Retrieve quaternion from sensor, convert it into a matrix.
 	float quaternion[4];
 	orient_sensor_get(&orientsense, quaternion);
+
+	/* When the sensor is read on a background thread, it keeps a
+	 * history of orientations timestamped when they arrived. Otherwise,
+	 * the sensor doesn't provide timestamps or velocities: Record when
+	 * we receive each new orientation so that the velocity can be
+	 * estimated from the history. */
+	const pose_ring *ring = orient_sensor_history(&orientsense);
+	pose_sample newest;
+	if(ring != NULL)
+	{
+		if(!pose_ring_newest(ring, &newest))
+			memset(&newest, 0, sizeof(pose_sample));
+	}
+	else
+	{
+		ring = history;
+		if(!pose_ring_newest(history, &newest) ||
+		   memcmp(newest.quat, quaternion, sizeof(float)*4) != 0)
+		{
+			memset(&newest, 0, sizeof(pose_sample));
+			newest.usec = kuhl_microseconds();
+			vec4f_copy(newest.quat, quaternion);
+			pose_ring_add(history, &newest);
+		}
+	}
+
+	pose_sample predicted;
+	if(predict && pose_ring_predict(ring, bufferswap_predict_display_time(), &predicted))
+	{
+		pose_predict_stats_update(&stats, ring);
+		if(predicted.usec > newest.usec)
+			pose_predict_stats_add(&stats, &predicted, &newest);
+		if(stats.count - statsPrinted >= 1000)
+		{
+			pose_predict_stats_print(&stats, "orientation sensor");
+			statsPrinted = stats.count;
+		}
+		vec4f_copy(quaternion, predicted.quat);
+	}
 	mat4f_rotateQuatVec_new(orient, quaternion);
 
 	// Correct rotation
@@ -6,12 +6,17 @@
 
 #include "camcontrol.h"
 #include "orient-sensor.h"
+#include "posering.h"
 
 class camcontrolOrientSensor : public camcontrol
 {
 private:
 	OrientSensorState orientsense;
 	float position[3];
+	int predict;              /**< Predict orientation at the time the frame is displayed */
+	pose_ring *history;       /**< Recent orientations, used to estimate angular velocity */
+	pose_predict_stats stats; /**< Accuracy of predictions */
+	long statsPrinted;        /**< stats.count when stats were last printed */
 
 public:
 	camcontrolOrientSensor(dispmode *currentDisplayMode, const float pos[3]);
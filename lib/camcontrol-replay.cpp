@@ -0,0 +1,117 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Replays tracking data recorded in a TDL file. Unlike using a
+    "replay:" VRPN server (see vrpn-help.cpp), the pose is looked up
+    directly from the playback time (see tdl_lookup()), so the replay
+    doesn't depend on a background thread. In benchmark mode (see
+    benchmark.c), the playback time is the benchmark time, so every
+    run sees exactly the same poses.
+
+    Configuration settings:
+
+    - viewmat.replay.file: The TDL file to replay (required).
+
+    - viewmat.replay.hz: The rate the records were recorded at
+      (default: 100). Only used for version 1 TDL files, which don't
+      contain timestamps.
+
+    - viewmat.replay.speed: Playback speed. 1 plays the recording at
+      the rate it was recorded, 2 plays it twice as fast (default: 1).
+
+    - viewmat.replay.loop: Start over at the end of the recording
+      (default: 1). Otherwise, the last pose is held.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include "kuhl-util.h"
+#include "camcontrol-replay.h"
+#include "vecmat.h"
+#include "tdl-util.h"
+#include "benchmark.h"
+
+camcontrolReplay::camcontrolReplay(dispmode *currentDisplayMode, const char *filename)
+	:camcontrol(currentDisplayMode)
+{
+	if(filename == NULL)
+	{
+		msg(MSG_FATAL, "viewmat.replay.file must be set to use the replay control mode.");
+		exit(EXIT_FAILURE);
+	}
+
+	recording = tdl_open(filename);
+	if(recording == NULL || recording->count == 0)
+	{
+		msg(MSG_FATAL, "Unable to read tracker data from TDL file '%s'", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	double hz = kuhl_config_float("viewmat.replay.hz", 100, 100);
+	double speed = kuhl_config_float("viewmat.replay.speed", 1, 1);
+	loop = kuhl_config_boolean("viewmat.replay.loop", 1, 1);
+	if(hz <= 0)
+		hz = 100;
+	if(speed <= 0)
+		speed = 1;
+
+	/* Version 1 files have no timestamps; tdl_open() assigns times as
+	 * if they were recorded at TDL_V1_HZ. */
+	scale = speed;
+	if(!recording->hasTimestamps)
+		scale = speed * hz / TDL_V1_HZ;
+
+	/* Leave an average record period between the last record and the
+	 * first record when looping. */
+	double first = (double) recording->records[0].usec;
+	double last = (double) recording->records[recording->count-1].usec;
+	duration = last - first;
+	if(recording->count > 1)
+		duration += duration / (double) (recording->count-1);
+
+	msg(MSG_INFO, "Replaying %lu records of object '%s' from '%s' (%.1f seconds at %.2fx speed)",
+	    (unsigned long) recording->count, recording->name, filename, duration/scale/1000000.0, speed);
+	startTime = -1;
+	finished = 0;
+}
+
+camcontrolReplay::~camcontrolReplay()
+{
+	tdl_close(recording);
+}
+
+viewmat_eye camcontrolReplay::get_separate(float pos[3], float rot[16], viewmat_eye requestedEye)
+{
+	/* Time since playback started in microseconds. */
+	double elapsed;
+	long benchTime = benchmark_time();
+	if(benchTime >= 0)
+		elapsed = (double) benchTime;
+	else
+	{
+		long now = kuhl_microseconds();
+		if(startTime < 0)
+			startTime = now;
+		elapsed = (double) (now - startTime);
+	}
+
+	/* Convert into a time in the recording. */
+	double t = elapsed * scale;
+	if(loop && duration > 0)
+		t = fmod(t, duration);
+	else if(t > duration)
+	{
+		if(!finished)
+			msg(MSG_INFO, "Reached the end of the replayed tracker data.");
+		finished = 1;
+	}
+
+	float quat[4];
+	tdl_lookup(recording, recording->records[0].usec + (int64_t) t, pos, quat);
+	mat4f_rotateQuatVec_new(rot, quat);
+
+	return VIEWMAT_EYE_MIDDLE;
+}
@@ -0,0 +1,25 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+#pragma once
+
+#include "camcontrol.h"
+#include "tdl-util.h"
+
+/** Controls the camera with tracking data recorded in a TDL file (see
+ * vrpn/recorder.c and tdl-util.c). */
+class camcontrolReplay : public camcontrol
+{
+private:
+	tdl_log *recording;
+	double scale;      /**< Microseconds of recording per microsecond of playback */
+	double duration;   /**< Length of one loop through the recording in microseconds */
+	int loop;          /**< Start over at the end of the recording */
+	long startTime;    /**< kuhl_microseconds() when playback started, -1 if not started */
+	int finished;      /**< Set once the end of a non-looping recording is reached */
+
+public:
+	camcontrolReplay(dispmode *currentDisplayMode, const char *filename);
+	~camcontrolReplay();
+	viewmat_eye get_separate(float pos[3], float rot[16], viewmat_eye requestedEye);
+};
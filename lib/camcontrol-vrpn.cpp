@@ -3,6 +3,7 @@
 #include "camcontrol-vrpn.h"
 #include "vecmat.h"
 #include "vrpn-help.h"
+#include "bufferswap.h"
 
 camcontrolVrpn::camcontrolVrpn(dispmode *currentDisplayMode, const char *inObject, const char *inHostname)
 	:camcontrol(currentDisplayMode)
@@ -16,6 +17,9 @@ camcontrolVrpn::camcontrolVrpn(dispmode *currentDisplayMode, const char *inObjec
 		hostname = NULL;
 	else
 		hostname = strdup(inHostname);
+
+	handle = -1;
+	predict = kuhl_config_boolean("viewmat.predict", 0, 0);
 }
 
 camcontrolVrpn::~camcontrolVrpn()
@@ -30,7 +34,14 @@ camcontrolVrpn::~camcontrolVrpn()
 viewmat_eye camcontrolVrpn::get_separate(float pos[3], float rot[16], viewmat_eye requestedEye)
 {
 	viewmat_eye returnVal = VIEWMAT_EYE_MIDDLE;
-	vrpn_get(object, hostname, pos, rot);
+	if(handle < 0)
+		handle = vrpn_open(object, hostname);
+	/* This is called right before each viewport is drawn, so the
+	 * prediction uses the newest tracker data available. */
+	if(predict)
+		vrpn_get_handle_predicted(handle, bufferswap_predict_display_time(), pos, rot);
+	else
+		vrpn_get_handle(handle, pos, rot);
 
 	/* In many cases, the code above is all we need to do. Some
 	 * objects, need to be adjusted or rotated, however. */
@@ -10,6 +10,8 @@ class camcontrolVrpn : public camcontrol
 private:
 	char *object;
 	char *hostname;
+	int handle; /**< Handle from vrpn_open(), -1 if not opened yet */
+	int predict; /**< Predict the pose at the time the frame is displayed */
 public:
 	camcontrolVrpn(dispmode *currentDisplayMode, const char *object, const char *hostname);
 	~camcontrolVrpn();
@@ -51,33 +51,57 @@ viewmat_eye camcontrol::get_separate(float outPos[3], float outRot[16], viewmat_
 	return VIEWMAT_EYE_MIDDLE;
 }
 
-/** Gets a view matrix.
-	    
-    @param matrix The requested view matrix.
-	    
+/** Gets camera position in double precision and a rotation matrix
+    for the camera. The default implementation calls get_separate()
+    and converts the position to double. Camera controllers which
+    track the position in double precision should override this
+    function and implement get_separate() by calling it.
+
+    @param outPos The position of the camera.
+
+    @param outRot A rotation matrix for the camera.
+
+    @param requestedEye Specifies the eye that we wish to get the
+    position/orientation of.
+
+    @return The eye that the matrix is actually for. See get_separate().
+*/
+viewmat_eye camcontrol::get_separate_double(double outPos[3], float outRot[16], viewmat_eye requestedEye)
+{
+	float posf[3];
+	viewmat_eye actualEye = this->get_separate(posf, outRot, requestedEye);
+	vec3d_from_vec3f(outPos, posf);
+	return actualEye;
+}
+
+/** Gets a view matrix relative to the camera position. The matrix
+    contains the camera rotation and the eye offset but not the
+    translation to the camera position---the world is translated so
+    that the camera is at the origin. The camera position is returned
+    separately in double precision.
+
+    To draw an object whose model matrix is stored in double
+    precision, use mat4f_from_mat4d_relative() to subtract the camera
+    position from the model matrix and then multiply the result by
+    this matrix. This avoids the loss of precision that occurs when
+    the camera and the objects near it are far from the origin.
+
+    @param matrix The requested view matrix without the camera translation.
+
+    @param outPos The position of the camera in world coordinates.
+
     @param requestedEye The eye that we are requesting.
 
     @return The eye that the matrix is actually for. In almost all
     cases the returned value should match the requested eye.
 */
-viewmat_eye camcontrol::get(float matrix[16], viewmat_eye requestedEye) {
-
+viewmat_eye camcontrol::get_relative(float matrix[16], double outPos[3], viewmat_eye requestedEye)
+{
 	/* Get the eye's position and orientation */
-	float pos[3], rot[16];
-	viewmat_eye actualEye = this->get_separate(pos, rot, requestedEye);
-
-	/* Create a translation matrix based on the eye position. Note
-	 * that the eye position is negated because we are translating the
-	 * camera (or, equivalently, translating the world)---not an
-	 * object. */
-	float trans[16];
-	mat4f_translate_new(trans, -pos[0],-pos[1],-pos[2]);
+	viewmat_eye actualEye = this->get_separate_double(outPos, matrix, requestedEye);
 
 	/* We invert the rotation matrix because we are rotating the camera, not an object. */
-	mat4f_transpose(rot);
-
-	/* Combine into a single view matrix. */
-	mat4f_mult_mat4f_new(matrix, rot, trans);
+	mat4f_transpose(matrix);
 
 	/* Determine if the view matrix needs to be updated to get it to
 	 * be appropriate for the requested eye. */
@@ -104,3 +128,32 @@ viewmat_eye camcontrol::get(float matrix[16], viewmat_eye requestedEye) {
 		
 	return actualEye;
 }
+
+/** Gets a view matrix.
+	    
+    @param matrix The requested view matrix.
+	    
+    @param requestedEye The eye that we are requesting.
+
+    @return The eye that the matrix is actually for. In almost all
+    cases the returned value should match the requested eye.
+*/
+viewmat_eye camcontrol::get(float matrix[16], viewmat_eye requestedEye) {
+
+	double pos[3];
+	viewmat_eye actualEye = this->get_relative(matrix, pos, requestedEye);
+
+	/* Create a translation matrix based on the eye position. Note
+	 * that the eye position is negated because we are translating the
+	 * camera (or, equivalently, translating the world)---not an
+	 * object. */
+	double trans[16];
+	mat4d_translate_new(trans, -pos[0],-pos[1],-pos[2]);
+
+	/* Combine into a single view matrix. */
+	double relative[16];
+	mat4d_from_mat4f(relative, matrix);
+	mat4d_mult_mat4d_new(relative, relative, trans);
+	mat4f_from_mat4d(matrix, relative);
+	return actualEye;
+}
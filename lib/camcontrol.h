@@ -17,5 +17,7 @@ public:
 	camcontrol(dispmode *currentDisplayMode);
 	camcontrol(dispmode *currentDisplayMode, const float inPos[3], const float inLook[3], const float inUp[3]);
 	virtual viewmat_eye get_separate(float outPos[3], float outRot[16], viewmat_eye requestedEye);
+	virtual viewmat_eye get_separate_double(double outPos[3], float outRot[16], viewmat_eye requestedEye);
 	virtual viewmat_eye get(float matrix[16], viewmat_eye requestedEye);
+	viewmat_eye get_relative(float matrix[16], double outPos[3], viewmat_eye requestedEye);
 };
@@ -0,0 +1,547 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   Captures screenshots and video frames without stalling the render
+   thread.
+
+   A synchronous glReadPixels() waits for the GPU to finish drawing
+   the frame and then copies the pixels while the render thread
+   waits. Instead, capture_image() and capture_video_frame() read the
+   framebuffer into one of a small ring of pixel buffer objects
+   (PBOs) and insert a fence. The copy happens on the GPU while the
+   program continues. Once the fence has been passed (checked by
+   capture_poll(), which bufferswap() calls every frame), the pixels
+   are copied out of the PBO and handed to worker threads which flip
+   the image and encode it.
+
+   Image files (screenshots, or the numbered images written by
+   kuhl_video_record()) are encoded by a pool of worker threads.
+   Video frames are written, in order, by one thread to the standard
+   input of an ffmpeg process that encodes the video file. If the
+   encoders can't keep up, video frames and the numbered images
+   written by capture_image_frame() are dropped instead of slowing
+   down the program. Screenshots taken with capture_image() are never
+   dropped: if CAPTURE_MAX_QUEUED images are already waiting to be
+   encoded, or all of the PBOs are in use, capture_image() waits
+   until there is room, so at most CAPTURE_MAX_QUEUED images are held
+   in memory.
+
+   capture_finish() waits for everything to be written. It is called
+   automatically when the program exits.
+ */
+
+#include "windows-compat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <pthread.h> // windows-compat.h provides pthreads on Visual Studio
+#endif
+#include <signal.h>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "capture.h"
+#include "kuhl-util.h"
+#include "msg.h"
+#ifdef KUHL_UTIL_USE_IMAGEMAGICK
+#include "imageio.h"
+#else
+#include "stb_image_write.h"
+#endif
+
+#define CAPTURE_BUFFERS 4     /**< Number of readbacks that can be in flight */
+#define CAPTURE_WORKERS 2     /**< Number of threads encoding image files */
+#define CAPTURE_MAX_QUEUED 16 /**< Frames waiting in a queue before we drop frames (or wait, for screenshots) */
+
+/** A captured frame waiting to be encoded. */
+typedef struct capture_job {
+	unsigned char *pixels; /**< RGB pixels, first row at the bottom */
+	int width, height;
+	char *filename;        /**< Image file to write, NULL for a video frame */
+	struct capture_job *next;
+} capture_job;
+
+/** Jobs waiting for a set of worker threads. */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;   /**< Signalled when a job is finished */
+	capture_job *head, *tail;
+	int count;
+	int quit;
+	int numThreads;
+	pthread_t threads[CAPTURE_WORKERS];
+} capture_queue;
+
+/** A readback from the framebuffer into a PBO. */
+typedef struct {
+	GLuint pbo;
+	GLsizeiptr size;
+	GLsync fence;
+	int width, height;
+	char *filename;        /**< NULL for a video frame */
+	int droppable;         /**< 1 if the frame can be dropped */
+} capture_readback;
+
+static capture_readback readbacks[CAPTURE_BUFFERS];
+static int readbackNext = 0;  /**< Slot for the next readback */
+static int readbackCount = 0; /**< Number of readbacks in flight */
+
+static capture_queue imageQueue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, { 0 } };
+static capture_queue videoQueue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, { 0 } };
+
+/* The video file being recorded. Set before the video thread starts. */
+static char *videoFilename = NULL;
+static int videoFps = 0;
+static FILE *videoPipe = NULL;   /**< Only used by the video thread */
+static int videoWidth, videoHeight; /**< Only used by the video thread */
+static int videoDropped = 0;     /**< Frames dropped (render thread only) */
+static int imageDropped = 0;     /**< Images from capture_image_frame() dropped (render thread only) */
+
+
+/** Returns 1 if filename ends with the given extension (such as ".png"). */
+static int capture_has_extension(const char *filename, const char *exten)
+{
+	size_t len = strlen(filename), extenLen = strlen(exten);
+	return len > extenLen && strcasecmp(filename + len - extenLen, exten) == 0;
+}
+
+/** Writes an image file. Called by the image worker threads. */
+static void capture_write_image(capture_job *job)
+{
+#ifdef KUHL_UTIL_USE_IMAGEMAGICK
+	/* imageout() flips the image itself. Only one thread uses
+	 * ImageMagick at a time. */
+	static pthread_mutex_t imageMagickLock = PTHREAD_MUTEX_INITIALIZER;
+	imageio_info info_out;
+	info_out.width    = job->width;
+	info_out.height   = job->height;
+	info_out.depth    = 8; // bits/color in output image
+	info_out.quality  = 85;
+	info_out.colorspace = sRGBColorspace;
+	info_out.filename = job->filename;
+	info_out.comment  = NULL;
+	info_out.type     = CharPixel;
+	info_out.map      = "RGB";
+	pthread_mutex_lock(&imageMagickLock);
+	imageout(&info_out, job->pixels);
+	pthread_mutex_unlock(&imageMagickLock);
+#else
+	kuhl_flip_texture_array(job->pixels, job->width, job->height, 3);
+	const char *s = job->filename;
+	int ok = 0;
+	if(capture_has_extension(s, ".png"))
+		ok = stbi_write_png(s, job->width, job->height, 3, job->pixels, job->width*3);
+	else if(capture_has_extension(s, ".tga"))
+		ok = stbi_write_tga(s, job->width, job->height, 3, job->pixels);
+	else if(capture_has_extension(s, ".bmp"))
+		ok = stbi_write_bmp(s, job->width, job->height, 3, job->pixels);
+	if(!ok)
+		msg(MSG_ERROR, "Failed to write screenshot to %s\n", s);
+#endif
+}
+
+/** Writes a frame to the video encoder. Called by the video thread. */
+static void capture_write_video(capture_job *job)
+{
+#ifndef _WIN32
+	if(videoPipe == NULL)
+	{
+		char command[2048];
+		snprintf(command, sizeof(command),
+		         "ffmpeg -loglevel error -y -f rawvideo -pixel_format rgb24 -video_size %dx%d "
+		         "-framerate %d -i - -pix_fmt yuv420p '%s'",
+		         job->width, job->height, videoFps, videoFilename);
+		msg(MSG_INFO, "Recording video: %s", command);
+		videoPipe = popen(command, "w");
+		if(videoPipe == NULL)
+		{
+			msg(MSG_ERROR, "Unable to run ffmpeg to record %s", videoFilename);
+			return;
+		}
+		videoWidth = job->width;
+		videoHeight = job->height;
+	}
+	if(job->width != videoWidth || job->height != videoHeight)
+	{
+		msg(MSG_WARNING, "Window size changed while recording %s, skipping frame.", videoFilename);
+		return;
+	}
+
+	kuhl_flip_texture_array(job->pixels, job->width, job->height, 3);
+	size_t size = (size_t) job->width*job->height*3;
+	if(fwrite(job->pixels, 1, size, videoPipe) != size)
+	{
+		msg(MSG_ERROR, "Failed to write a frame to ffmpeg. Is ffmpeg installed?");
+		pclose(videoPipe);
+		videoPipe = NULL;
+	}
+#endif
+}
+
+static void* capture_thread(void *arg)
+{
+	capture_queue *q = (capture_queue*) arg;
+
+#ifndef _WIN32
+	/* If ffmpeg exits, writing to the pipe should fail instead of
+	 * killing the program with SIGPIPE. */
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+#endif
+
+	pthread_mutex_lock(&q->lock);
+	while(1)
+	{
+		capture_job *job = q->head;
+		if(job == NULL)
+		{
+			if(q->quit)
+				break;
+			pthread_cond_wait(&q->wake, &q->lock);
+			continue;
+		}
+		q->head = job->next;
+		if(q->head == NULL)
+			q->tail = NULL;
+		pthread_mutex_unlock(&q->lock);
+
+		if(job->filename)
+			capture_write_image(job);
+		else
+			capture_write_video(job);
+		free(job->filename);
+		free(job->pixels);
+		free(job);
+
+		pthread_mutex_lock(&q->lock);
+		q->count--;
+		pthread_cond_signal(&q->done);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/** Adds a job to a queue, starting its threads if needed. If
+ * CAPTURE_MAX_QUEUED jobs are already in the queue, waits for one of
+ * them to finish. Callers that can't wait should drop the job instead
+ * (see capture_retire()). */
+static void capture_queue_push(capture_queue *q, capture_job *job, int numThreads)
+{
+	pthread_mutex_lock(&q->lock);
+	while(q->numThreads < numThreads)
+	{
+		if(pthread_create(&q->threads[q->numThreads], NULL, capture_thread, q) != 0)
+		{
+			msg(MSG_FATAL, "Unable to create capture thread.");
+			exit(EXIT_FAILURE);
+		}
+		q->numThreads++;
+	}
+	while(q->count >= CAPTURE_MAX_QUEUED)
+		pthread_cond_wait(&q->done, &q->lock);
+	job->next = NULL;
+	if(q->tail)
+		q->tail->next = job;
+	else
+		q->head = job;
+	q->tail = job;
+	q->count++;
+	pthread_cond_signal(&q->wake);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/** Returns the number of jobs waiting in a queue or being encoded. */
+static int capture_queue_count(capture_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	int count = q->count;
+	pthread_mutex_unlock(&q->lock);
+	return count;
+}
+
+/** Waits for the threads to finish all of the jobs in a queue and
+ * stops them. */
+static void capture_queue_stop(capture_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->quit = 1;
+	pthread_cond_broadcast(&q->wake);
+	int numThreads = q->numThreads;
+	pthread_mutex_unlock(&q->lock);
+
+	for(int i=0; i<numThreads; i++)
+		pthread_join(q->threads[i], NULL);
+	q->numThreads = 0;
+	q->quit = 0;
+}
+
+/** Hands readbacks which the GPU has finished to the worker threads.
+
+    @param wait The number of readbacks to wait for (oldest first) if
+    they are not finished yet. The rest are only handed over if they
+    are already finished.
+*/
+static void capture_retire(int wait)
+{
+	while(readbackCount > 0)
+	{
+		capture_readback *r = &readbacks[(readbackNext - readbackCount + CAPTURE_BUFFERS) % CAPTURE_BUFFERS];
+		if(r->fence)
+		{
+			GLenum status;
+			do {
+				status = glClientWaitSync(r->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait > 0 ? 100000000 : 0);
+			} while(wait > 0 && status == GL_TIMEOUT_EXPIRED);
+			if(status == GL_TIMEOUT_EXPIRED)
+				return;
+			glDeleteSync(r->fence);
+			r->fence = 0;
+		}
+		wait--;
+		readbackCount--;
+
+		/* Video frames and recorded images are dropped if the
+		 * encoders can't keep up. */
+		if(r->filename == NULL &&
+		   (videoFilename == NULL || capture_queue_count(&videoQueue) >= CAPTURE_MAX_QUEUED))
+		{
+			videoDropped++;
+			continue;
+		}
+		if(r->filename && r->droppable &&
+		   capture_queue_count(&imageQueue) >= CAPTURE_MAX_QUEUED)
+		{
+			imageDropped++;
+			free(r->filename);
+			r->filename = NULL;
+			continue;
+		}
+
+		capture_job *job = (capture_job*) kuhl_malloc(sizeof(capture_job));
+		job->width = r->width;
+		job->height = r->height;
+		job->filename = r->filename;
+		r->filename = NULL;
+		job->pixels = (unsigned char*) kuhl_malloc(r->size);
+
+		GLint prevPack;
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &prevPack);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo);
+		void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, r->size, GL_MAP_READ_BIT);
+		if(mapped)
+		{
+			memcpy(job->pixels, mapped, r->size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, prevPack);
+		kuhl_errorcheck();
+
+		if(mapped == NULL)
+		{
+			msg(MSG_ERROR, "Unable to map the capture buffer.");
+			free(job->filename);
+			free(job->pixels);
+			free(job);
+		}
+		else if(job->filename)
+			capture_queue_push(&imageQueue, job, CAPTURE_WORKERS);
+		else
+			capture_queue_push(&videoQueue, job, 1);
+	}
+}
+
+/** Starts reading the framebuffer into the next PBO.
+
+    @param filename The image file to write, or NULL for a video frame.
+
+    @param droppable 1 if the frame should be dropped when all of the
+    PBOs are in use, 0 to wait for the oldest readback to finish.
+ */
+static void capture_readback_start(const char *filename, int droppable)
+{
+	static int atexitRegistered = 0;
+	if(!atexitRegistered)
+	{
+		atexit(capture_finish);
+		atexitRegistered = 1;
+	}
+
+	/* Hand off anything that is done to make room. */
+	capture_retire(0);
+	if(readbackCount == CAPTURE_BUFFERS)
+	{
+		if(filename == NULL)
+		{
+			videoDropped++;
+			return;
+		}
+		if(droppable)
+		{
+			imageDropped++;
+			return;
+		}
+		capture_retire(1);
+	}
+
+	capture_readback *r = &readbacks[readbackNext];
+	glfwGetFramebufferSize(kuhl_get_window(), &r->width, &r->height);
+	GLsizeiptr size = (GLsizeiptr) r->width * r->height * 3;
+
+	GLint prevPack, prevAlignment;
+	glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &prevPack);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &prevAlignment);
+	if(r->pbo == 0)
+		glGenBuffers(1, &r->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo);
+	if(r->size != size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		r->size = size;
+	}
+	/* Rows are tightly packed (the default alignment of 4 would pad
+	 * RGB rows if the width isn't a multiple of 4). */
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, r->width, r->height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, prevAlignment);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, prevPack);
+
+	/* Without sync objects, the buffer is mapped (and waited on) the
+	 * next time capture_poll() is called. */
+	r->fence = GLEW_ARB_sync ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+	r->filename = filename ? strdup(filename) : NULL;
+	r->droppable = droppable;
+	kuhl_errorcheck();
+
+	readbackNext = (readbackNext+1) % CAPTURE_BUFFERS;
+	readbackCount++;
+}
+
+/** Exits if filename isn't a type of image file that we can write. */
+static void capture_check_image_filename(const char *filename)
+{
+#ifndef KUHL_UTIL_USE_IMAGEMAGICK
+	if(!capture_has_extension(filename, ".png") &&
+	   !capture_has_extension(filename, ".tga") &&
+	   !capture_has_extension(filename, ".bmp"))
+	{
+		msg(MSG_FATAL, "Failed write screenshot to %s (note: STB can only write png, tga, and bmp files.)\n", filename);
+		exit(EXIT_FAILURE);
+	}
+#else
+	(void) filename;
+#endif
+}
+
+/** Captures the current framebuffer to an image file. The pixels are
+ * read and the file is written in the background, so the file may
+ * not exist until a few frames later (or until capture_finish() is
+ * called). The image is never dropped; if the encoders are behind,
+ * this waits for them (see CAPTURE_MAX_QUEUED).
+
+    @param filename The image file to write. Without ImageMagick, the
+    filename must end in .png, .tga or .bmp.
+*/
+void capture_image(const char *filename)
+{
+	capture_check_image_filename(filename);
+	capture_readback_start(filename, 0);
+}
+
+/** Like capture_image(), but the image is dropped instead of waiting
+ * if the encoders can't keep up. Used for the numbered images written
+ * by kuhl_video_record(); the number of dropped images is printed by
+ * capture_finish().
+
+    @param filename The image file to write.
+*/
+void capture_image_frame(const char *filename)
+{
+	capture_check_image_filename(filename);
+	capture_readback_start(filename, 1);
+}
+
+/** Starts recording a video file. Each call to capture_video_frame()
+ * adds the current framebuffer to the video. The frames are encoded
+ * by ffmpeg, which must be installed.
+
+    @param filename The video file to write (for example, "video.mp4").
+
+    @param fps The frame rate of the video.
+
+    @return 1 if successful, 0 if video can't be recorded on this system.
+*/
+int capture_video_open(const char *filename, int fps)
+{
+#ifdef _WIN32
+	msg(MSG_ERROR, "Recording video is not supported on Windows.");
+	return 0;
+#else
+	if(strchr(filename, '\'') != NULL)
+	{
+		msg(MSG_ERROR, "Video filename can't contain a quote: %s", filename);
+		return 0;
+	}
+	capture_video_close();
+	videoFilename = strdup(filename);
+	videoFps = fps;
+	videoDropped = 0;
+	return 1;
+#endif
+}
+
+/** Adds the current framebuffer to the video started with
+ * capture_video_open(). */
+void capture_video_frame(void)
+{
+	if(videoFilename)
+		capture_readback_start(NULL, 1);
+}
+
+/** Finishes writing the video started with capture_video_open(). */
+void capture_video_close(void)
+{
+	if(videoFilename == NULL)
+		return;
+	capture_retire(CAPTURE_BUFFERS);
+	capture_queue_stop(&videoQueue);
+#ifndef _WIN32
+	if(videoPipe)
+		pclose(videoPipe);
+#endif
+	videoPipe = NULL;
+	if(videoDropped > 0)
+		msg(MSG_WARNING, "Dropped %d frames while recording %s because the encoder couldn't keep up.", videoDropped, videoFilename);
+	free(videoFilename);
+	videoFilename = NULL;
+}
+
+/** Hands finished readbacks to the encoding threads. This is called
+ * by bufferswap() every frame and returns immediately if there is
+ * nothing to do. */
+void capture_poll(void)
+{
+	if(readbackCount > 0)
+		capture_retire(0);
+}
+
+/** Waits until all captured images and video frames have been
+ * written. Called automatically when the program exits. */
+void capture_finish(void)
+{
+	capture_retire(CAPTURE_BUFFERS);
+	capture_video_close();
+	capture_queue_stop(&imageQueue);
+	if(imageDropped > 0)
+	{
+		msg(MSG_WARNING, "Dropped %d recorded images because the encoders couldn't keep up.", imageDropped);
+		imageDropped = 0;
+	}
+}
@@ -0,0 +1,25 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Captures screenshots and video frames without stalling the render
+ * thread. See capture.c for details.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void capture_image(const char *filename);
+void capture_image_frame(const char *filename);
+int capture_video_open(const char *filename, int fps);
+void capture_video_frame(void);
+void capture_video_close(void);
+void capture_poll(void);
+void capture_finish(void);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -17,15 +17,27 @@ struct cfg_node
 {
   char *key;
   char *value;
+  unsigned int hash;
 
+  /* all nodes, most recently added first (used by cfg_save) */
   struct cfg_node *next;
+  /* next node in the same hash bucket */
+  struct cfg_node *bucket_next;
 };
 
 struct cfg_struct
 {
   struct cfg_node *head;
+
+  /* hash index of the nodes so lookups don't need to walk the list */
+  struct cfg_node **buckets;
+  unsigned int bucket_count; /* always a power of two */
+  unsigned int count;
 };
 
+/* Number of buckets in a new cfg_struct */
+#define CFG_INITIAL_BUCKETS 64
+
 /* Helper functions
     A malloc() wrapper which handles null return values, and zeroes memory too */
 static void *cfg_malloc(const unsigned int size)
@@ -79,6 +91,73 @@ static char *cfg_trim(const char *str)
   return tstr;
 }
 
+/* Copies str into buf (which must hold CFG_MAX_LINE bytes) without
+    leading / trailing whitespace and converted to lowercase. Unlike
+    cfg_trim(), this doesn't allocate memory, so cfg_get() is cheap.
+    Returns the length of the key, or -1 if it doesn't fit in buf. */
+static int cfg_key_copy(const char *str, char *buf)
+{
+  int temp_len, i;
+
+  while (cfg_is_whitespace(*str))
+    str ++;
+
+  temp_len = strlen(str);
+  while (temp_len > 0 && cfg_is_whitespace(str[temp_len-1]))
+    temp_len --;
+
+  if (temp_len >= CFG_MAX_LINE) return -1;
+
+  for (i = 0; i < temp_len; i++)
+    buf[i] = tolower(str[i]);
+  buf[temp_len] = '\0';
+  return temp_len;
+}
+
+/* FNV-1a hash of a (trimmed, lowercase) key */
+static unsigned int cfg_hash(const char *key)
+{
+  unsigned int hash = 2166136261u;
+  while (*key)
+  {
+    hash ^= (unsigned char) *key++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Finds the node for a trimmed, lowercase key, or NULL if there isn't one. */
+static struct cfg_node *cfg_find(const struct cfg_struct *cfg, const char *tkey, unsigned int hash)
+{
+  struct cfg_node *temp = cfg->buckets[hash & (cfg->bucket_count-1)];
+  while (temp != NULL)
+  {
+    if (temp->hash == hash && ! strcmp(tkey, temp->key))
+      return temp;
+    temp = temp->bucket_next;
+  }
+  return NULL;
+}
+
+/* Doubles the number of buckets and moves the nodes into them. */
+static void cfg_rehash(struct cfg_struct *cfg)
+{
+  unsigned int new_count = cfg->bucket_count * 2;
+  struct cfg_node **new_buckets = (struct cfg_node **)cfg_malloc(new_count * sizeof(struct cfg_node *));
+  struct cfg_node *temp;
+
+  for (temp = cfg->head; temp != NULL; temp = temp->next)
+  {
+    unsigned int b = temp->hash & (new_count-1);
+    temp->bucket_next = new_buckets[b];
+    new_buckets[b] = temp;
+  }
+
+  free(cfg->buckets);
+  cfg->buckets = new_buckets;
+  cfg->bucket_count = new_count;
+}
+
 /**
  * This function loads data from a file, and inserts / updates the specified cfg_struct.
  * New keys will be inserted.  Existing keys can optionally have values overwritten by those read from the file.
@@ -175,39 +254,18 @@ int cfg_save(const struct cfg_struct *cfg, const char *filename)
  */
 const char * cfg_get(const struct cfg_struct *cfg, const char *key)
 {
-  unsigned int i, len;
-  char *tkey;
+  char tkey[CFG_MAX_LINE];
   struct cfg_node *temp;
 
   /* safety check: null input */
   if (cfg == NULL || key == NULL) return NULL;
 
-  /* Trim input search key */
-  tkey = cfg_trim(key);
-
-  /* Exclude empty key */
-  if (! strcmp(tkey,"")) { free(tkey); return NULL; }
-
-  /* Lowercase key */
-  len = strlen(tkey);
-  for (i = 0; i < len; i++)
-    tkey[i] = tolower(tkey[i]);
+  /* Trim and lowercase input search key. Exclude empty keys (and keys
+     too long to have been stored). */
+  if (cfg_key_copy(key, tkey) <= 0) return NULL;
 
-  /* set up pointer to start of list */
-  temp = cfg->head;
-
-  while (temp != NULL)
-  {
-    if (! strcmp(tkey, temp->key))
-    {
-      free(tkey);
-      return temp->value;
-    }
-    temp = temp->next;
-  }
-
-  free(tkey);
-  return NULL;
+  temp = cfg_find(cfg, tkey, cfg_hash(tkey));
+  return temp == NULL ? NULL : temp->value;
 }
 
 /**
@@ -222,7 +280,7 @@ const char * cfg_get(const struct cfg_struct *cfg, const char *key)
  */
 void cfg_set(struct cfg_struct *cfg, const char *key, const char *value)
 {
-  unsigned int i, len;
+  unsigned int i, len, hash;
   char *tkey, *tvalue;
   struct cfg_node *temp;
 
@@ -239,6 +297,10 @@ void cfg_set(struct cfg_struct *cfg, const char *key, const char *value)
   for (i = 0; i < len; i++)
     tkey[i] = tolower(tkey[i]);
 
+  /* Exclude keys that cfg_get() can't look up (they can't be read
+     from a file either, see CFG_MAX_LINE) */
+  if (len >= CFG_MAX_LINE) { free(tkey); return; }
+
   /* Trim value. */
   tvalue = cfg_trim(value);
 
@@ -246,23 +308,18 @@ void cfg_set(struct cfg_struct *cfg, const char *key, const char *value)
      as a "delete" operation */
   /* if (! strcmp(tvalue,"")) { free(tvalue); cfg_delete(cfg,tkey); free(tkey); return; } */
 
-  /* point at first item in list */
-  temp = cfg->head;
-
-  /* search list for existing key */
-  while (temp != NULL)
+  /* search for existing key */
+  hash = cfg_hash(tkey);
+  temp = cfg_find(cfg, tkey, hash);
+  if (temp != NULL)
   {
-    if (! strcmp(tkey, temp->key))
-    {
-      /* found a match: no longer need temp key */
-      free(tkey);
+    /* found a match: no longer need temp key */
+    free(tkey);
 
-      /* update value */
-      free(temp->value);
-      temp->value = tvalue;
-      return;
-    }
-    temp = temp->next;
+    /* update value */
+    free(temp->value);
+    temp->value = tvalue;
+    return;
   }
 
   /* not found: create new element */
@@ -271,10 +328,18 @@ void cfg_set(struct cfg_struct *cfg, const char *key, const char *value)
   /* assign key, value */
   temp->key = tkey;
   temp->value = tvalue;
+  temp->hash = hash;
 
   /* prepend */
   temp->next = cfg->head;
   cfg->head = temp;
+
+  /* add to the hash index */
+  temp->bucket_next = cfg->buckets[hash & (cfg->bucket_count-1)];
+  cfg->buckets[hash & (cfg->bucket_count-1)] = temp;
+  cfg->count ++;
+  if (cfg->count > cfg->bucket_count)
+    cfg_rehash(cfg);
 }
 
 /**
@@ -285,58 +350,36 @@ void cfg_set(struct cfg_struct *cfg, const char *key, const char *value)
  */
 void cfg_delete(struct cfg_struct *cfg, const char *key)
 {
-  unsigned int i, len;
-  char *tkey;
-  struct cfg_node *temp, *temp2 = NULL;
+  char tkey[CFG_MAX_LINE];
+  struct cfg_node *node, **link;
 
   /* safety check: null input */
   if (cfg == NULL || key == NULL) return;
 
-  /* trim input key */
-  tkey = cfg_trim(key);
-  /* Exclude empty key */
-  if (! strcmp(tkey,"")) { free(tkey); return; }
-
-  /* Lowercase key */
-  len = strlen(tkey);
-  for (i = 0; i < len; i++)
-    tkey[i] = tolower(tkey[i]);
-
-  /* set pointer to start of list */
-  temp = cfg->head;
-
-  /* search list for existing key */
-  while (temp != NULL)
-  {
-    if (! strcmp(tkey, temp->key))
-    {
-      /* cleanup trimmed key */
-      free(tkey);
-
-      if (temp == cfg->head)
-      {
-        /* first element */
-        cfg->head = temp->next;
-      } else {
-        /* splice out element */
-        temp2->next = temp->next;
-      }
-
-      /* delete element */
-      free(temp->value);
-      free(temp->key);
-      free(temp);
-
-      return;
-    }
-
-    temp2 = temp;
-    temp = temp->next;
-  }
+  /* trim and lowercase input key, exclude empty key */
+  if (cfg_key_copy(key, tkey) <= 0) return;
 
+  node = cfg_find(cfg, tkey, cfg_hash(tkey));
   /* not found */
-  /* cleanup trimmed key */
-  free(tkey);
+  if (node == NULL) return;
+
+  /* splice out of the hash bucket */
+  link = &cfg->buckets[node->hash & (cfg->bucket_count-1)];
+  while (*link != node)
+    link = &(*link)->bucket_next;
+  *link = node->bucket_next;
+
+  /* splice out of the list */
+  link = &cfg->head;
+  while (*link != node)
+    link = &(*link)->next;
+  *link = node->next;
+  cfg->count --;
+
+  /* delete element */
+  free(node->value);
+  free(node->key);
+  free(node);
 }
 
 /**
@@ -349,6 +392,9 @@ struct cfg_struct * cfg_init()
   struct cfg_struct *temp;
   temp = (struct cfg_struct *)cfg_malloc(sizeof(struct cfg_struct));
   temp->head = NULL;
+  temp->bucket_count = CFG_INITIAL_BUCKETS;
+  temp->buckets = (struct cfg_node **)cfg_malloc(CFG_INITIAL_BUCKETS * sizeof(struct cfg_node *));
+  temp->count = 0;
   return temp;
 }
 
@@ -369,5 +415,6 @@ void cfg_free(struct cfg_struct *cfg)
     free(temp);
     temp = temp2;
   }
+  free (cfg->buckets);
   free (cfg);
 }
@@ -36,6 +36,7 @@
 #include "msg.h"
 #include "kuhl-config.h"
 #include "dgr.h"
+#include "trace.h"
 
 /** The dgr_record struct is used internally by DGR to hold a single
  * variable that DGR is keeping track of. */
@@ -673,7 +674,8 @@ void dgr_update(int send, int receive)
 {
 	if(dgr_disabled)
 		return;
-	
+
+	trace_begin("dgr_update");
 	if(dgr_is_master() && send == 1)
 		dgr_send();
 	
@@ -691,4 +693,5 @@ void dgr_update(int send, int receive)
 		else
 			dgr_receive(0);
 	}
+	trace_end("dgr_update");
 }
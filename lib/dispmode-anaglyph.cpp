@@ -1,4 +1,7 @@
+#include <stdlib.h>
+#include <GL/glew.h>
 #include "bufferswap.h"
+#include "kuhl-util.h"
 #include "msg.h"
 #include "viewmat.h"
 #include "vecmat.h"
@@ -7,6 +10,14 @@
 
 dispmodeAnaglyph::dispmodeAnaglyph()
 {
+	passFramebuffer = 0;
+	passTexture = 0;
+	passDepth = 0;
+	passWidth = passHeight = 0;
+	passPrevFramebuffer = 0;
+	compositeProgram = 0;
+	compositeVao = 0;
+
 	ipd = 6.0;
 	if(kuhl_config_get("ipd") == NULL)
 	{
@@ -109,9 +120,12 @@ void dispmodeAnaglyph::get_frustum(float result[6], int viewportID)
 	int viewportH = viewport[3];
 
 	float aspect = viewportW/(float)viewportH;
-	float nearPlane = kuhl_config_float("nearplane", 0.1f, 0.1f);
-	float farPlane = kuhl_config_float("farplane", 200.0f, 200.0f);
-	float vfov = kuhl_config_float("vfov", 65.0f, 65.0f);
+	static kuhl_config_handle nearHandle = KUHL_CONFIG_HANDLE("nearplane");
+	static kuhl_config_handle farHandle = KUHL_CONFIG_HANDLE("farplane");
+	static kuhl_config_handle vfovHandle = KUHL_CONFIG_HANDLE("vfov");
+	float nearPlane = kuhl_config_handle_float(&nearHandle, 0.1f, 0.1f);
+	float farPlane = kuhl_config_handle_float(&farHandle, 200.0f, 200.0f);
+	float vfov = kuhl_config_handle_float(&vfovHandle, 65.0f, 65.0f);
 	float fovyRad = (float) (vfov * M_PI/180.0f);
 	float height = nearPlane * tanf(fovyRad/2.0f);
 	float width = height * aspect;
@@ -142,3 +156,134 @@ void dispmodeAnaglyph::begin_eye(int viewportID)
 
 	dispmode::begin_eye(viewportID);
 }
+
+
+/* Programs which draw both eyes in one pass draw them side by side
+ * into an offscreen texture. end_single_pass() then combines the
+ * left half (red) and the right half (green and blue) on the screen,
+ * shifting each eye by the same amount as its viewport. */
+static const char *compositeVertex =
+	"#version 150\n"
+	"void main()\n"
+	"{\n"
+	"	// a triangle which covers the whole screen\n"
+	"	vec2 pos = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);\n"
+	"	gl_Position = vec4(pos, 0, 1);\n"
+	"}\n";
+
+static const char *compositeFragment =
+	"#version 150\n"
+	"uniform sampler2D eyes;\n"
+	"uniform int leftX;  // x coordinate of the left eye viewport\n"
+	"uniform int rightX; // x coordinate of the right eye viewport\n"
+	"uniform int width;  // width of each eye\n"
+	"out vec4 fragColor;\n"
+	"void main()\n"
+	"{\n"
+	"	ivec2 p = ivec2(gl_FragCoord.xy);\n"
+	"	int l = p.x - leftX;\n"
+	"	int r = p.x - rightX;\n"
+	"	float red = 0;\n"
+	"	vec2 cyan = vec2(0);\n"
+	"	if(l >= 0 && l < width)\n"
+	"		red = texelFetch(eyes, ivec2(l, p.y), 0).r;\n"
+	"	if(r >= 0 && r < width)\n"
+	"		cyan = texelFetch(eyes, ivec2(width + r, p.y), 0).gb;\n"
+	"	fragColor = vec4(red, cyan, 1);\n"
+	"}\n";
+
+int dispmodeAnaglyph::supports_single_pass()
+{
+	return 1;
+}
+
+void dispmodeAnaglyph::begin_single_pass()
+{
+	int windowWidth, windowHeight;
+	viewmat_window_size(&windowWidth, &windowHeight);
+
+	/* (Re)create the offscreen framebuffer when the window size changes. */
+	if(windowWidth != passWidth || windowHeight != passHeight)
+	{
+		if(passFramebuffer != 0)
+		{
+			glDeleteFramebuffers(1, &passFramebuffer);
+			glDeleteTextures(1, &passTexture);
+			glDeleteRenderbuffers(1, &passDepth);
+		}
+		passWidth = windowWidth;
+		passHeight = windowHeight;
+
+		glGenTextures(1, &passTexture);
+		glBindTexture(GL_TEXTURE_2D, passTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, passWidth*2, passHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenRenderbuffers(1, &passDepth);
+		glBindRenderbuffer(GL_RENDERBUFFER, passDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, passWidth*2, passHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &passFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, passFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, passTexture, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, passDepth);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			msg(MSG_FATAL, "Failed to create the framebuffer for single pass anaglyph rendering.");
+			exit(EXIT_FAILURE);
+		}
+		kuhl_errorcheck();
+	}
+
+	if(compositeProgram == 0)
+	{
+		compositeProgram = glCreateProgram();
+		glAttachShader(compositeProgram, kuhl_create_shader_source(compositeVertex, GL_VERTEX_SHADER, "compositeVertex"));
+		glAttachShader(compositeProgram, kuhl_create_shader_source(compositeFragment, GL_FRAGMENT_SHADER, "compositeFragment"));
+		glBindFragDataLocation(compositeProgram, 0, "fragColor");
+		kuhl_link_program(compositeProgram, "anaglyph composite");
+		glGenVertexArrays(1, &compositeVao);
+		kuhl_errorcheck();
+	}
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &passPrevFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, passFramebuffer);
+	glViewport(0, 0, passWidth*2, passHeight);
+	glEnable(GL_CLIP_DISTANCE0);
+}
+
+void dispmodeAnaglyph::end_single_pass()
+{
+	glDisable(GL_CLIP_DISTANCE0);
+	glBindFramebuffer(GL_FRAMEBUFFER, passPrevFramebuffer);
+	glViewport(0, 0, passWidth, passHeight);
+
+	int left[4], right[4];
+	this->get_viewport(left, 0);
+	this->get_viewport(right, 1);
+
+	GLint prevProgram;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(compositeProgram);
+	glUniform1i(glGetUniformLocation(compositeProgram, "eyes"), 0);
+	glUniform1i(glGetUniformLocation(compositeProgram, "leftX"), left[0]);
+	glUniform1i(glGetUniformLocation(compositeProgram, "rightX"), right[0]);
+	glUniform1i(glGetUniformLocation(compositeProgram, "width"), passWidth);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, passTexture);
+	glBindVertexArray(compositeVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glUseProgram(prevProgram);
+	if(depthTest)
+		glEnable(GL_DEPTH_TEST);
+	kuhl_errorcheck();
+}
@@ -5,6 +5,13 @@ class dispmodeAnaglyph : public dispmode
 {
 private:
 	float ipd;
+
+	/* Offscreen framebuffer for single pass rendering. The left eye
+	 * is drawn in the left half and the right eye in the right half. */
+	GLuint passFramebuffer, passTexture, passDepth;
+	int passWidth, passHeight;
+	GLint passPrevFramebuffer;
+	GLuint compositeProgram, compositeVao;
 	
 public:
 	dispmodeAnaglyph();
@@ -17,4 +24,8 @@ public:
 	virtual void end_frame();
 	virtual void begin_eye(int viewportID);
 
+	virtual int supports_single_pass();
+	virtual void begin_single_pass();
+	virtual void end_single_pass();
+
 };
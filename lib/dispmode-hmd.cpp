@@ -82,9 +82,12 @@ void dispmodeHMD::get_frustum(float result[6], int viewportID)
 	int viewportH = viewport[3];
 
 	float aspect = viewportW/(float)viewportH;
-	float nearPlane = kuhl_config_float("nearplane", 0.1f, 0.1f);
-	float farPlane = kuhl_config_float("farplane", 200.0f, 200.0f);
-	float vfov = kuhl_config_float("vfov", 65.0f, 65.0f);
+	static kuhl_config_handle nearHandle = KUHL_CONFIG_HANDLE("nearplane");
+	static kuhl_config_handle farHandle = KUHL_CONFIG_HANDLE("farplane");
+	static kuhl_config_handle vfovHandle = KUHL_CONFIG_HANDLE("vfov");
+	float nearPlane = kuhl_config_handle_float(&nearHandle, 0.1f, 0.1f);
+	float farPlane = kuhl_config_handle_float(&farHandle, 200.0f, 200.0f);
+	float vfov = kuhl_config_handle_float(&vfovHandle, 65.0f, 65.0f);
 	float fovyRad = (float) (vfov * M_PI/180.0f);
 	float height = nearPlane * tanf(fovyRad/2.0f);
 	float width = height * aspect;
@@ -95,3 +98,8 @@ void dispmodeHMD::get_frustum(float result[6], int viewportID)
 	result[4] = nearPlane;
 	result[5] = farPlane;
 }
+
+int dispmodeHMD::supports_single_pass()
+{
+	return 1; // the viewports are side by side
+}
@@ -12,4 +12,5 @@ public:
 	virtual int num_viewports(void);
 	virtual void get_viewport(int viewportValue[4], int viewportId);
 	virtual void get_frustum(float result[6], int viewportID);
+	virtual int supports_single_pass();
 };
@@ -158,3 +158,31 @@ void dispmode::end_eye(int viewportID)
 {
 
 }
+
+/** Returns 1 if this display mode can draw both eyes in a single pass
+ * (see viewmat_begin_single_pass()). Display modes which return 1
+ * must have exactly two viewports. */
+int dispmode::supports_single_pass()
+{
+	return 0;
+}
+
+/** Prepares to draw both eyes in a single pass. The default
+ * implementation is for modes where viewport 0 and 1 are side by
+ * side on the same framebuffer: It sets a viewport covering both of
+ * them and enables the clip plane that the vertex program uses to
+ * keep each eye in its own half. */
+void dispmode::begin_single_pass()
+{
+	int left[4], right[4];
+	this->get_viewport(left, 0);
+	this->get_viewport(right, 1);
+	glViewport(left[0], left[1], right[0]+right[2]-left[0], left[3]);
+	glEnable(GL_CLIP_DISTANCE0);
+}
+
+/** To be called when done drawing both eyes in a single pass. */
+void dispmode::end_single_pass()
+{
+	glDisable(GL_CLIP_DISTANCE0);
+}
@@ -19,5 +19,8 @@ public:
 	virtual void end_frame();
 	virtual void begin_eye(int viewportID);
 	virtual void end_eye(int viewportID);
+	virtual int supports_single_pass();
+	virtual void begin_single_pass();
+	virtual void end_single_pass();
 
 };
@@ -0,0 +1,362 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   dynres.c implements dynamic resolution scaling. When a frame takes
+   longer to render than the display allows, frames are dropped (see
+   bufferswap.c). With dynamic resolution, each viewport is instead
+   drawn into an offscreen framebuffer at a fraction of its size and
+   then stretched over the viewport. The fraction is adjusted every
+   frame based on how long the GPU spent on previous frames so that
+   the frame rate stays at the refresh rate of the display on slower
+   machines.
+
+   viewmat.cpp calls these functions; programs don't need to do
+   anything besides using viewmat_get_viewport() (which returns the
+   reduced viewport) and drawing between viewmat_begin_eye() and
+   viewmat_end_eye(). Dynamic resolution draws each viewport
+   separately, so viewmat_single_pass() returns 0 when it is
+   enabled. Settings:
+
+   - viewmat.dynres: Set to 1 to enable dynamic resolution (default: 0).
+
+   - viewmat.dynres.min: The smallest fraction of the width and height
+     of each viewport which will be drawn (default: 0.5).
+
+   - viewmat.dynres.target: The GPU time (milliseconds) that we try to
+     keep each frame under (default: 90% of the time between
+     refreshes of the monitor).
+
+   The GPU time is measured with GL_TIMESTAMP queries which are read
+   a few frames later so that we never wait for the GPU.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <GL/glew.h>
+
+#include "dynres.h"
+#include "msg.h"
+#include "kuhl-config.h"
+#include "kuhl-util.h"
+#include "bufferswap.h"
+#include "trace.h"
+
+#define DYNRES_QUERIES 4 /**< Frames of timer queries in flight */
+
+static int dynres_state = 0;     /**< 0=uninitialized, 1=enabled, -1=disabled */
+static float dynres_current = 1; /**< Fraction of each viewport that is drawn */
+static float dynres_min = .5f;
+static float dynres_target = -1; /**< GPU microseconds per frame we try to stay under */
+
+static GLuint dynres_queries[DYNRES_QUERIES][2]; /**< Timestamps at the start and end of each frame */
+static int dynres_query_pending[DYNRES_QUERIES];
+static int dynres_query_index = 0;
+
+static GLuint dynres_framebuffer = 0;
+static GLuint dynres_texture = 0;
+static GLuint dynres_depth = 0;
+static int dynres_width = 0, dynres_height = 0; /**< Size of the offscreen framebuffer */
+static GLint dynres_target_framebuffer = 0; /**< Framebuffer the viewport should be drawn into */
+
+static GLuint dynres_program = 0;
+static GLuint dynres_vao = 0;
+
+/* Draws a triangle covering the viewport that samples the reduced
+ * resolution image with bilinear filtering. */
+static const char *dynresVertex =
+	"#version 150\n"
+	"uniform vec4 region; // part of the texture to use (x, y, width, height)\n"
+	"out vec2 texCoord;\n"
+	"void main()\n"
+	"{\n"
+	"	// a triangle which covers the whole viewport\n"
+	"	vec2 pos = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);\n"
+	"	texCoord = region.xy + (pos*.5+.5) * region.zw;\n"
+	"	gl_Position = vec4(pos, 0, 1);\n"
+	"}\n";
+
+static const char *dynresFragment =
+	"#version 150\n"
+	"uniform sampler2D image;\n"
+	"in vec2 texCoord;\n"
+	"out vec4 fragColor;\n"
+	"void main()\n"
+	"{\n"
+	"	fragColor = texture(image, texCoord);\n"
+	"}\n";
+
+/** Returns 1 if dynamic resolution is enabled. */
+int dynres_enabled(void)
+{
+	if(dynres_state == 0)
+	{
+		dynres_state = -1;
+		if(kuhl_config_boolean("viewmat.dynres", 0, 0) == 0)
+			return 0;
+		if(!GLEW_ARB_timer_query && !GLEW_VERSION_3_3)
+		{
+			msg(MSG_WARNING, "Dynamic resolution requires timer queries which aren't supported, it is disabled.");
+			return 0;
+		}
+
+		dynres_min = kuhl_config_float("viewmat.dynres.min", .5f, .5f);
+		if(dynres_min < .1f)
+			dynres_min = .1f;
+		if(dynres_min > 1)
+			dynres_min = 1;
+
+		float targetMs = kuhl_config_float("viewmat.dynres.target", -1, -1);
+		if(targetMs > 0)
+			dynres_target = targetMs * 1000;
+		else
+		{
+			int refreshRate = bufferswap_get_refresh_rate();
+			dynres_target = .9f * 1000000.0f / (refreshRate > 0 ? refreshRate : 60);
+		}
+
+		glGenQueries(DYNRES_QUERIES*2, &dynres_queries[0][0]);
+		dynres_state = 1;
+		msg(MSG_INFO, "Dynamic resolution: keeping GPU time under %.2f ms, drawing at least %.0f%% of the width and height of each viewport.",
+		    dynres_target/1000, dynres_min*100);
+	}
+	return dynres_state == 1;
+}
+
+/** Returns the fraction of the width and height of each viewport that
+ * is currently being drawn. Returns 1 when dynamic resolution is
+ * disabled. */
+float dynres_scale(void)
+{
+	return dynres_state == 1 ? dynres_current : 1;
+}
+
+/** Adjusts the scale based on the GPU time of a frame.
+
+    Since the time to draw a frame is roughly proportional to the
+    number of pixels, we scale by the square root of the ratio of the
+    target time to the measured time. The scale drops quickly when we
+    are over the target and rises slowly when we are well below it;
+    in between, it doesn't change (so that it doesn't flicker back and
+    forth).
+*/
+static void dynres_update(float gpuUsec)
+{
+	if(gpuUsec <= 0)
+		return;
+	float change = sqrtf(dynres_target / gpuUsec);
+	if(gpuUsec > dynres_target)
+	{
+		if(change < .85f)
+			change = .85f;
+		dynres_current *= change;
+	}
+	else if(gpuUsec < .8f * dynres_target)
+	{
+		if(change > 1.02f)
+			change = 1.02f;
+		dynres_current *= change;
+	}
+
+	if(dynres_current < dynres_min)
+		dynres_current = dynres_min;
+	if(dynres_current > 1)
+		dynres_current = 1;
+	trace_counter("dynres_scale", dynres_current);
+}
+
+/** Called at the start of each frame by viewmat_begin_frame(). */
+void dynres_begin_frame(void)
+{
+	if(!dynres_enabled())
+		return;
+
+	/* Use the results from earlier frames if they are ready, oldest
+	 * first. The oldest is in the slot that we are about to reuse. */
+	for(int i=0; i<DYNRES_QUERIES; i++)
+	{
+		int q = (dynres_query_index + i) % DYNRES_QUERIES;
+		if(!dynres_query_pending[q])
+			continue;
+		GLint available = 0;
+		glGetQueryObjectiv(dynres_queries[q][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available)
+			break;
+		GLuint64 start, end;
+		glGetQueryObjectui64v(dynres_queries[q][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(dynres_queries[q][1], GL_QUERY_RESULT, &end);
+		dynres_query_pending[q] = 0;
+		if(end > start)
+			dynres_update((end - start) / 1000.0f);
+	}
+
+	/* If the GPU is so far behind that the query we are about to
+	 * reuse still isn't finished after checking it above, don't wait
+	 * for it. */
+	dynres_query_pending[dynres_query_index] = 0;
+	glQueryCounter(dynres_queries[dynres_query_index][0], GL_TIMESTAMP);
+}
+
+/** Called at the end of each frame (before the buffers are swapped)
+ * by viewmat_end_frame(). */
+void dynres_end_frame(void)
+{
+	if(dynres_state != 1)
+		return;
+	glQueryCounter(dynres_queries[dynres_query_index][1], GL_TIMESTAMP);
+	dynres_query_pending[dynres_query_index] = 1;
+	dynres_query_index = (dynres_query_index + 1) % DYNRES_QUERIES;
+}
+
+/** Makes sure that the offscreen framebuffer can hold the viewport. */
+static void dynres_resize(const int viewport[4])
+{
+	int width = viewport[0] + viewport[2];
+	int height = viewport[1] + viewport[3];
+	if(width <= dynres_width && height <= dynres_height)
+		return;
+	if(width < dynres_width)
+		width = dynres_width;
+	if(height < dynres_height)
+		height = dynres_height;
+
+	if(dynres_framebuffer != 0)
+	{
+		glDeleteFramebuffers(1, &dynres_framebuffer);
+		glDeleteTextures(1, &dynres_texture);
+		glDeleteRenderbuffers(1, &dynres_depth);
+	}
+	dynres_width = width;
+	dynres_height = height;
+
+	GLint prevTexture, prevRenderbuffer;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+	glGetIntegerv(GL_RENDERBUFFER_BINDING, &prevRenderbuffer);
+
+	glGenTextures(1, &dynres_texture);
+	glBindTexture(GL_TEXTURE_2D, dynres_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, prevTexture);
+
+	glGenRenderbuffers(1, &dynres_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, dynres_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, prevRenderbuffer);
+
+	glGenFramebuffers(1, &dynres_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, dynres_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dynres_texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, dynres_depth);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		msg(MSG_FATAL, "Failed to create the framebuffer for dynamic resolution.");
+		exit(EXIT_FAILURE);
+	}
+	kuhl_errorcheck();
+}
+
+/** Reduces a viewport to the part of the offscreen framebuffer that
+ * it is drawn into. viewmat_get_viewport() calls this. */
+void dynres_scale_viewport(int viewport[4])
+{
+	if(dynres_state != 1)
+		return;
+	for(int i=0; i<4; i++)
+		viewport[i] = (int) (viewport[i] * dynres_current + .5f);
+	if(viewport[2] < 1)
+		viewport[2] = 1;
+	if(viewport[3] < 1)
+		viewport[3] = 1;
+}
+
+/** Called by viewmat_begin_eye() after the display mode has bound the
+ * framebuffer for the viewport. Redirects drawing into the offscreen
+ * framebuffer.
+
+    @param viewport The full size viewport (from the display mode).
+*/
+void dynres_begin_eye(const int viewport[4])
+{
+	if(dynres_state != 1)
+		return;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &dynres_target_framebuffer);
+	dynres_resize(viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, dynres_framebuffer);
+}
+
+/** Called by viewmat_end_eye(). Stretches the reduced resolution
+ * image over the viewport in the framebuffer that the display mode
+ * expects it in.
+
+    @param viewport The full size viewport (from the display mode).
+*/
+void dynres_end_eye(const int viewport[4])
+{
+	if(dynres_state != 1)
+		return;
+
+	if(dynres_program == 0)
+	{
+		dynres_program = glCreateProgram();
+		glAttachShader(dynres_program, kuhl_create_shader_source(dynresVertex, GL_VERTEX_SHADER, "dynresVertex"));
+		glAttachShader(dynres_program, kuhl_create_shader_source(dynresFragment, GL_FRAGMENT_SHADER, "dynresFragment"));
+		glBindFragDataLocation(dynres_program, 0, "fragColor");
+		kuhl_link_program(dynres_program, "dynres");
+		glGenVertexArrays(1, &dynres_vao);
+		kuhl_errorcheck();
+	}
+
+	int scaled[4] = { viewport[0], viewport[1], viewport[2], viewport[3] };
+	dynres_scale_viewport(scaled);
+
+	/* Save the state that we change. Color masks are left alone
+	 * since display modes such as anaglyph rely on them. */
+	GLint prevProgram, prevVao, prevTexture, prevActive, prevViewport[4];
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVao);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &prevActive);
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+	glGetIntegerv(GL_VIEWPORT, prevViewport);
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	GLboolean blend = glIsEnabled(GL_BLEND);
+	GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+	GLboolean cull = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_CULL_FACE);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, dynres_target_framebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glUseProgram(dynres_program);
+	glUniform1i(glGetUniformLocation(dynres_program, "image"), 0);
+	glUniform4f(glGetUniformLocation(dynres_program, "region"),
+	            scaled[0] / (float) dynres_width, scaled[1] / (float) dynres_height,
+	            scaled[2] / (float) dynres_width, scaled[3] / (float) dynres_height);
+	glBindTexture(GL_TEXTURE_2D, dynres_texture);
+	glBindVertexArray(dynres_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glBindVertexArray(prevVao);
+	glBindTexture(GL_TEXTURE_2D, prevTexture);
+	glActiveTexture(prevActive);
+	glUseProgram(prevProgram);
+	glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+	if(depthTest)
+		glEnable(GL_DEPTH_TEST);
+	if(blend)
+		glEnable(GL_BLEND);
+	if(scissor)
+		glEnable(GL_SCISSOR_TEST);
+	if(cull)
+		glEnable(GL_CULL_FACE);
+	kuhl_errorcheck();
+}
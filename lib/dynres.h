@@ -0,0 +1,25 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Dynamic resolution scaling: renders each viewport at a reduced
+ * resolution when frames take too long. See dynres.c for details.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int   dynres_enabled(void);
+float dynres_scale(void);
+void  dynres_begin_frame(void);
+void  dynres_end_frame(void);
+void  dynres_begin_eye(const int viewport[4]);
+void  dynres_end_eye(const int viewport[4]);
+void  dynres_scale_viewport(int viewport[4]);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
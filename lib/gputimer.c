@@ -0,0 +1,352 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   gputimer.c measures how much GPU time is spent in named sections of
+   each frame. bufferswap_fps() and the render time estimate in
+   bufferswap.c only measure the CPU; they can't tell us which part of
+   a frame the GPU spends its time on.
+
+   Sections are marked with gputimer_begin() and gputimer_end(). Each
+   one records a GL_TIMESTAMP query when the GPU reaches it
+   (timestamps, unlike GL_TIME_ELAPSED queries, can be nested and
+   don't interfere with the query used by benchmark.c). The results
+   are read a few frames later, once the GPU has finished with them,
+   so that the CPU never waits for the GPU. If the GPU falls so far
+   behind that the results still aren't available, they are
+   discarded.
+
+   viewmat_begin_eye()/viewmat_end_eye() time each viewport ("viewport
+   0", "viewport 1", ...) and kuhl_geometry_draw() times all geometry
+   drawn with it ("kuhl_geometry_draw"). Programs can add their own
+   sections. If a section is entered again before it ends (for
+   example, a recursive draw), only the outermost one is timed. The
+   time of a section is summed over each frame and averaged over
+   several frames. gputimer_get() returns the average for one section
+   and gputimer_summary() makes a string with all of them which can
+   be displayed with kuhl_label_geom().
+
+   GPU timing is disabled by default. Set "gputimer.enabled=1" in the
+   configuration file to enable it. It requires OpenGL 3.3 or the
+   ARB_timer_query extension. If tracing is enabled (see trace.c), the
+   time of each section is also written to the trace as a counter.
+
+   These functions should only be called from the thread which
+   renders.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "gputimer.h"
+#include "trace.h"
+#include "msg.h"
+#include "kuhl-config.h"
+
+#define GPUTIMER_MAX_NAMES 64     /**< Maximum number of unique section names */
+#define GPUTIMER_NAME_LEN 32      /**< Maximum length of a section name (including NUL) */
+#define GPUTIMER_MAX_EVENTS 1024  /**< Maximum number of sections timed in one frame */
+#define GPUTIMER_FRAMES 4         /**< Number of frames we wait for results before discarding them */
+
+/** A section which was timed during a frame. */
+typedef struct {
+	int name;   /**< Index into the name table */
+	int begin;  /**< Index of the query at the start of the section */
+	int end;    /**< Index of the query at the end of the section (-1 if still open) */
+} gputimer_event;
+
+/** Queries for one frame. */
+typedef struct {
+	GLuint queries[GPUTIMER_MAX_EVENTS*2];
+	int generated;  /**< Number of queries which have been generated */
+	int queryCount; /**< Number of queries used this frame */
+	gputimer_event events[GPUTIMER_MAX_EVENTS];
+	int eventCount;
+	int pending;    /**< 1 if we are waiting for the results */
+} gputimer_frame_data;
+
+static int gputimer_state = 0; /**< 0=uninitialized, 1=enabled, -1=disabled */
+static gputimer_frame_data gputimer_frames[GPUTIMER_FRAMES];
+static int gputimer_current = 0; /**< Frame that we are issuing queries for */
+static long gputimer_dropped = 0; /**< Number of frames discarded because the results were late */
+
+static char gputimer_names[GPUTIMER_MAX_NAMES][GPUTIMER_NAME_LEN];
+static char gputimer_trace_names[GPUTIMER_MAX_NAMES][GPUTIMER_NAME_LEN+4]; /**< Names of trace counters */
+static const char *gputimer_name_ptrs[GPUTIMER_MAX_NAMES]; /**< Pointers passed to us, used as a fast lookup */
+static int gputimer_name_count = 0;
+static int gputimer_depth[GPUTIMER_MAX_NAMES]; /**< Number of times each section has been entered */
+static int gputimer_open[GPUTIMER_MAX_NAMES];  /**< Event of the outermost open section */
+static float gputimer_avg[GPUTIMER_MAX_NAMES]; /**< Average milliseconds per frame, -1 if unknown */
+
+
+/** Returns 1 if GPU timing is enabled. */
+int gputimer_enabled(void)
+{
+	if(gputimer_state == 0)
+	{
+		gputimer_state = -1;
+		if(kuhl_config_boolean("gputimer.enabled", 0, 0) == 0)
+			return 0;
+		if(!GLEW_ARB_timer_query && !GLEW_VERSION_3_3)
+		{
+			msg(MSG_WARNING, "gputimer: Timer queries aren't supported, GPU timing is disabled.");
+			return 0;
+		}
+		memset(gputimer_frames, 0, sizeof(gputimer_frames));
+		gputimer_state = 1;
+		msg(MSG_INFO, "gputimer: Measuring GPU time of viewports and draw calls.");
+	}
+	return gputimer_state == 1;
+}
+
+/** Returns the index of a name in the name table, adding it if
+ * necessary. Returns -1 if the table is full or the name is too
+ * long. */
+static int gputimer_name(const char *name)
+{
+	/* Names are usually string literals, so check the pointers first.
+	 * A buffer may be reused for a different name, so the string
+	 * must still match. */
+	for(int i=0; i<gputimer_name_count; i++)
+	{
+		if(gputimer_name_ptrs[i] == name && strcmp(gputimer_names[i], name) == 0)
+			return i;
+	}
+	for(int i=0; i<gputimer_name_count; i++)
+	{
+		if(strcmp(gputimer_names[i], name) == 0)
+		{
+			gputimer_name_ptrs[i] = name;
+			return i;
+		}
+	}
+	if(strlen(name) >= GPUTIMER_NAME_LEN)
+	{
+		static int warned = 0;
+		if(!warned)
+			msg(MSG_WARNING, "gputimer: Section name '%s' is longer than %d characters and won't be timed.", name, GPUTIMER_NAME_LEN-1);
+		warned = 1;
+		return -1;
+	}
+	if(gputimer_name_count == GPUTIMER_MAX_NAMES)
+	{
+		static int warned = 0;
+		if(!warned)
+			msg(MSG_WARNING, "gputimer: Too many sections, '%s' won't be timed.", name);
+		warned = 1;
+		return -1;
+	}
+
+	int i = gputimer_name_count++;
+	snprintf(gputimer_names[i], GPUTIMER_NAME_LEN, "%s", name);
+	snprintf(gputimer_trace_names[i], GPUTIMER_NAME_LEN+4, "gpu %s", gputimer_names[i]);
+	gputimer_name_ptrs[i] = name;
+	gputimer_depth[i] = 0;
+	gputimer_open[i] = -1;
+	gputimer_avg[i] = -1;
+	return i;
+}
+
+/** Issues a timestamp query for the current frame. Returns the index
+ * of the query. */
+static int gputimer_query(gputimer_frame_data *f)
+{
+	if(f->queryCount == f->generated)
+	{
+		/* Generate queries in batches the first time they are needed. */
+		int count = 64;
+		if(f->generated + count > GPUTIMER_MAX_EVENTS*2)
+			count = GPUTIMER_MAX_EVENTS*2 - f->generated;
+		glGenQueries(count, f->queries + f->generated);
+		f->generated += count;
+	}
+	glQueryCounter(f->queries[f->queryCount], GL_TIMESTAMP);
+	return f->queryCount++;
+}
+
+/** Marks the start of a section of a frame that should be timed.
+
+    @param name The name of the section (at most 31 characters).
+    Calls to gputimer_begin() and gputimer_end() should be paired and
+    use the same name.
+*/
+void gputimer_begin(const char *name)
+{
+	if(!gputimer_enabled())
+		return;
+	int n = gputimer_name(name);
+	if(n < 0)
+		return;
+	if(gputimer_depth[n]++ > 0)
+		return;
+
+	gputimer_frame_data *f = &gputimer_frames[gputimer_current];
+	if(f->eventCount == GPUTIMER_MAX_EVENTS)
+	{
+		static int warned = 0;
+		if(!warned)
+			msg(MSG_WARNING, "gputimer: More than %d sections in one frame, some won't be timed.", GPUTIMER_MAX_EVENTS);
+		warned = 1;
+		return;
+	}
+	gputimer_event *e = &f->events[f->eventCount];
+	e->name = n;
+	e->begin = gputimer_query(f);
+	e->end = -1;
+	gputimer_open[n] = f->eventCount++;
+}
+
+/** Marks the end of a section started with gputimer_begin(). */
+void gputimer_end(const char *name)
+{
+	if(!gputimer_enabled())
+		return;
+	int n = gputimer_name(name);
+	if(n < 0)
+		return;
+	if(gputimer_depth[n] == 0)
+	{
+		msg(MSG_WARNING, "gputimer: gputimer_end(\"%s\") was called without gputimer_begin().", name);
+		return;
+	}
+	if(--gputimer_depth[n] > 0 || gputimer_open[n] < 0)
+		return;
+
+	gputimer_frame_data *f = &gputimer_frames[gputimer_current];
+	f->events[gputimer_open[n]].end = gputimer_query(f);
+	gputimer_open[n] = -1;
+}
+
+/** Reads the results for a frame if they are available. Returns 1 if
+ * the results were read. */
+static int gputimer_collect(gputimer_frame_data *f)
+{
+	/* Timestamps are recorded in order, so all of the results are
+	 * available when the last one is. */
+	GLint available = 0;
+	glGetQueryObjectiv(f->queries[f->queryCount-1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if(!available)
+		return 0;
+
+	static GLuint64 times[GPUTIMER_MAX_EVENTS*2];
+	for(int i=0; i<f->queryCount; i++)
+		glGetQueryObjectui64v(f->queries[i], GL_QUERY_RESULT, &times[i]);
+
+	double frameSum[GPUTIMER_MAX_NAMES];
+	for(int i=0; i<gputimer_name_count; i++)
+		frameSum[i] = 0;
+	for(int i=0; i<f->eventCount; i++)
+	{
+		gputimer_event *e = &f->events[i];
+		if(e->end >= 0 && times[e->end] > times[e->begin])
+			frameSum[e->name] += (times[e->end] - times[e->begin]) / 1000000.0;
+	}
+
+	/* A section that wasn't drawn this frame took no time. */
+	for(int i=0; i<gputimer_name_count; i++)
+	{
+		if(gputimer_avg[i] < 0)
+			gputimer_avg[i] = (float) frameSum[i];
+		else
+			gputimer_avg[i] = .9f * gputimer_avg[i] + .1f * (float) frameSum[i];
+		trace_counter(gputimer_trace_names[i], frameSum[i]);
+	}
+	f->pending = 0;
+	return 1;
+}
+
+/** Should be called at the end of each frame (bufferswap() calls it
+ * before swapping the buffers). Reads the results of previous frames
+ * without waiting for the GPU. */
+void gputimer_frame(void)
+{
+	if(gputimer_state != 1)
+		return;
+
+	/* Sections that are still open at the end of a frame aren't
+	 * timed. */
+	gputimer_frame_data *f = &gputimer_frames[gputimer_current];
+	for(int i=0; i<gputimer_name_count; i++)
+	{
+		if(gputimer_open[i] >= 0)
+		{
+			f->events[gputimer_open[i]].end = -1;
+			gputimer_open[i] = -1;
+			gputimer_depth[i] = 0;
+		}
+	}
+	f->pending = f->queryCount > 0;
+
+	/* Read the results of older frames, oldest first. */
+	for(int i=1; i<=GPUTIMER_FRAMES; i++)
+	{
+		gputimer_frame_data *old = &gputimer_frames[(gputimer_current+i) % GPUTIMER_FRAMES];
+		if(old->pending && !gputimer_collect(old))
+			break;
+	}
+
+	/* If the results for the frame that we are about to reuse still
+	 * aren't available, discard them rather than waiting. */
+	gputimer_current = (gputimer_current+1) % GPUTIMER_FRAMES;
+	f = &gputimer_frames[gputimer_current];
+	if(f->pending)
+	{
+		if(gputimer_dropped++ == 0)
+			msg(MSG_DEBUG, "gputimer: GPU is more than %d frames behind, discarding timing results.", GPUTIMER_FRAMES);
+		f->pending = 0;
+	}
+	f->queryCount = 0;
+	f->eventCount = 0;
+}
+
+/** Returns the average number of milliseconds the GPU spends on a
+ * section each frame, or -1 if the section hasn't been measured. */
+float gputimer_get(const char *name)
+{
+	if(gputimer_state != 1)
+		return -1;
+	for(int i=0; i<gputimer_name_count; i++)
+	{
+		if(strcmp(gputimer_names[i], name) == 0)
+			return gputimer_avg[i];
+	}
+	return -1;
+}
+
+/** Writes the average GPU time of each section into a string such as
+    "GPU ms: viewport 0 1.52, kuhl_geometry_draw 1.20".
+
+    @param buf The buffer to write into.
+
+    @param len The size of the buffer.
+
+    @return The length of the string, or 0 if nothing has been measured.
+*/
+int gputimer_summary(char *buf, size_t len)
+{
+	if(len == 0)
+		return 0;
+	buf[0] = '\0';
+	if(gputimer_state != 1)
+		return 0;
+
+	size_t used = 0;
+	for(int i=0; i<gputimer_name_count && used < len; i++)
+	{
+		if(gputimer_avg[i] < 0)
+			continue;
+		int ret = snprintf(buf+used, len-used, "%s%s %.2f", used == 0 ? "GPU ms: " : ", ",
+		                   gputimer_names[i], gputimer_avg[i]);
+		if(ret < 0)
+			break;
+		used += (size_t) ret;
+	}
+	if(used >= len)
+		used = len-1;
+	return (int) used;
+}
@@ -0,0 +1,36 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Measures how much GPU time is spent in named sections of each
+ * frame. See gputimer.c for details.
+ */
+
+#pragma once
+#include <stddef.h> // size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int   gputimer_enabled(void);
+void  gputimer_begin(const char *name);
+void  gputimer_end(const char *name);
+void  gputimer_frame(void);
+float gputimer_get(const char *name);
+int   gputimer_summary(char *buf, size_t len);
+
+#ifdef __cplusplus
+} // end extern "C"
+
+/** Calls gputimer_begin() when constructed and gputimer_end() when
+ * the object goes out of scope. */
+class gputimer_scope
+{
+	const char *name;
+public:
+	gputimer_scope(const char *scopeName) : name(scopeName) { gputimer_begin(name); }
+	~gputimer_scope() { gputimer_end(name); }
+};
+#endif
@@ -0,0 +1,460 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Runs many Kalman filters in parallel. See kalman-batch.h for details.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "kalman-batch.h"
+#include "msg.h"
+
+/* Quaternions are stored as (x,y,z,w) like the rest of libkuhl. */
+
+static void kb_quat_mult(double result[4], const double a[4], const double b[4])
+{
+	double r[4];
+	r[0] = a[3]*b[0] + b[3]*a[0] + a[1]*b[2] - a[2]*b[1];
+	r[1] = a[3]*b[1] + b[3]*a[1] + a[2]*b[0] - a[0]*b[2];
+	r[2] = a[3]*b[2] + b[3]*a[2] + a[0]*b[1] - a[1]*b[0];
+	r[3] = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+	memcpy(result, r, sizeof(r));
+}
+
+static void kb_quat_normalize(double q[4])
+{
+	double len = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+	for(int i=0; i<4; i++)
+		q[i] /= len;
+}
+
+/** Converts a unit quaternion into a rotation vector (axis * angle in
+ * radians). Picks the shorter of the two rotations that q and -q
+ * represent. */
+static void kb_quat_log(double rv[3], const double q[4])
+{
+	double sign = q[3] < 0 ? -1 : 1;
+	double len = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2]);
+	double scale;
+	if(len < 1e-12)
+		scale = 2*sign; // small angle approximation
+	else
+		scale = 2*atan2(len, sign*q[3]) / len * sign;
+	for(int i=0; i<3; i++)
+		rv[i] = q[i] * scale;
+}
+
+/** Converts a rotation vector into a unit quaternion. */
+static void kb_quat_exp(double q[4], const double rv[3])
+{
+	double angle = sqrt(rv[0]*rv[0] + rv[1]*rv[1] + rv[2]*rv[2]);
+	double scale = angle < 1e-12 ? 0.5 : sin(angle/2)/angle;
+	for(int i=0; i<3; i++)
+		q[i] = rv[i] * scale;
+	q[3] = cos(angle/2);
+}
+
+/** Creates a filter for a set of objects.
+
+    @param numObjects The number of objects to filter.
+
+    @param posSigma Standard deviation of the position measurement
+    noise.
+
+    @param posQScale Scaling factor for the position system noise. A
+    value near 0 indicates high confidence in the model. Larger values
+    allow the filter to follow large jumps in the data. See
+    kalman_initialize().
+
+    @param rotSigma Standard deviation of the orientation measurement
+    noise (radians).
+
+    @param rotQScale Scaling factor for the orientation system noise.
+
+    @return A new kalman_batch which should be free'd with
+    kalman_batch_free().
+*/
+kalman_batch* kalman_batch_new(int numObjects, float posSigma, float posQScale, float rotSigma, float rotQScale)
+{
+	if(numObjects < 1)
+	{
+		msg(MSG_ERROR, "Invalid number of objects: %d", numObjects);
+		return NULL;
+	}
+	kalman_batch *kb = (kalman_batch*) malloc(sizeof(kalman_batch));
+	memset(kb, 0, sizeof(kalman_batch));
+	kb->numObjects = numObjects;
+	kb->numChannels = numObjects * KALMAN_BATCH_CHANNELS;
+
+	size_t n = (size_t) kb->numChannels;
+	double **perChannel[] = { &kb->x, &kb->v, &kb->a,
+	                          &kb->p00, &kb->p01, &kb->p02, &kb->p11, &kb->p12, &kb->p22,
+	                          &kb->r, &kb->qScale, &kb->z, &kb->mask, &kb->dt,
+	                          &kb->q00, &kb->q01, &kb->q02, &kb->q11, &kb->q12, &kb->q22 };
+	for(unsigned int i=0; i<sizeof(perChannel)/sizeof(perChannel[0]); i++)
+		*perChannel[i] = (double*) calloc(n, sizeof(double));
+
+	kb->quat     = (double*) calloc((size_t) numObjects*4, sizeof(double));
+	kb->timePrev = (long*) calloc((size_t) numObjects, sizeof(long));
+	kb->timeNext = (long*) calloc((size_t) numObjects, sizeof(long));
+	kb->staged   = (int*) calloc((size_t) numObjects, sizeof(int));
+	kb->cachedDt = -1;
+
+	for(int i=0; i<numObjects; i++)
+	{
+		for(int j=0; j<3; j++)
+		{
+			int c = i*KALMAN_BATCH_CHANNELS + j;
+			kb->r[c]        = (double) posSigma * posSigma;
+			kb->qScale[c]   = posQScale;
+			kb->r[c+3]      = (double) rotSigma * rotSigma;
+			kb->qScale[c+3] = rotQScale;
+		}
+		kalman_batch_reset(kb, i);
+	}
+	return kb;
+}
+
+/** Increases the number of objects that a filter handles. The state
+    of the existing objects is kept. The new objects use the same noise
+    settings as object 0. kalman_batch_run() takes time proportional to
+    the number of objects, so start with the number of objects that
+    are actually used and grow the filter as more are added.
+
+    @param numObjects The new number of objects. Nothing happens if the
+    filter already has at least this many objects.
+
+    @return 1 on success, 0 if memory couldn't be allocated (the filter
+    is unchanged).
+*/
+int kalman_batch_resize(kalman_batch *kb, int numObjects)
+{
+	if(numObjects <= kb->numObjects)
+		return 1;
+
+	size_t oldChannels = (size_t) kb->numChannels;
+	size_t n = (size_t) numObjects * KALMAN_BATCH_CHANNELS;
+	double **perChannel[] = { &kb->x, &kb->v, &kb->a,
+	                          &kb->p00, &kb->p01, &kb->p02, &kb->p11, &kb->p12, &kb->p22,
+	                          &kb->r, &kb->qScale, &kb->z, &kb->mask, &kb->dt,
+	                          &kb->q00, &kb->q01, &kb->q02, &kb->q11, &kb->q12, &kb->q22 };
+	/* Arrays which were already grown stay grown if a later realloc()
+	 * fails; numObjects is only changed once all of them succeed. */
+	for(unsigned int i=0; i<sizeof(perChannel)/sizeof(perChannel[0]); i++)
+	{
+		double *bigger = (double*) realloc(*perChannel[i], n*sizeof(double));
+		if(bigger == NULL)
+			return 0;
+		memset(bigger+oldChannels, 0, (n-oldChannels)*sizeof(double));
+		*perChannel[i] = bigger;
+	}
+	double *quat = (double*) realloc(kb->quat, (size_t) numObjects*4*sizeof(double));
+	if(quat == NULL)
+		return 0;
+	kb->quat = quat;
+	long *timePrev = (long*) realloc(kb->timePrev, (size_t) numObjects*sizeof(long));
+	if(timePrev == NULL)
+		return 0;
+	kb->timePrev = timePrev;
+	long *timeNext = (long*) realloc(kb->timeNext, (size_t) numObjects*sizeof(long));
+	if(timeNext == NULL)
+		return 0;
+	kb->timeNext = timeNext;
+	int *staged = (int*) realloc(kb->staged, (size_t) numObjects*sizeof(int));
+	if(staged == NULL)
+		return 0;
+	kb->staged = staged;
+
+	int oldObjects = kb->numObjects;
+	kb->numObjects = numObjects;
+	kb->numChannels = numObjects * KALMAN_BATCH_CHANNELS;
+	for(int i=oldObjects; i<numObjects; i++)
+	{
+		for(int j=0; j<KALMAN_BATCH_CHANNELS; j++)
+		{
+			int c = i*KALMAN_BATCH_CHANNELS + j;
+			kb->r[c]      = kb->r[j];
+			kb->qScale[c] = kb->qScale[j];
+		}
+		kalman_batch_reset(kb, i);
+	}
+	return 1;
+}
+
+void kalman_batch_free(kalman_batch *kb)
+{
+	if(kb == NULL)
+		return;
+	double *perChannel[] = { kb->x, kb->v, kb->a,
+	                         kb->p00, kb->p01, kb->p02, kb->p11, kb->p12, kb->p22,
+	                         kb->r, kb->qScale, kb->z, kb->mask, kb->dt,
+	                         kb->q00, kb->q01, kb->q02, kb->q11, kb->q12, kb->q22 };
+	for(unsigned int i=0; i<sizeof(perChannel)/sizeof(perChannel[0]); i++)
+		free(perChannel[i]);
+	free(kb->quat);
+	free(kb->timePrev);
+	free(kb->timeNext);
+	free(kb->staged);
+	free(kb);
+}
+
+/** Forgets everything about an object. The next measurement for the
+ * object will be used as-is to initialize the filter. */
+void kalman_batch_reset(kalman_batch *kb, int object)
+{
+	for(int j=0; j<KALMAN_BATCH_CHANNELS; j++)
+	{
+		int c = object*KALMAN_BATCH_CHANNELS + j;
+		kb->x[c] = kb->v[c] = kb->a[c] = 0;
+		kb->p00[c] = kb->p11[c] = kb->p22[c] = 1;
+		kb->p01[c] = kb->p02[c] = kb->p12[c] = 0;
+		kb->mask[c] = 0;
+	}
+	double identity[4] = { 0,0,0,1 };
+	memcpy(kb->quat + object*4, identity, sizeof(identity));
+	kb->timePrev[object] = -1;
+	kb->staged[object] = 0;
+}
+
+/** Provides a new measurement for an object. The measurement is not
+    filtered until kalman_batch_run() is called. Only one measurement
+    per object can wait to be filtered at a time.
+
+    @param object The object the measurement is for.
+
+    @param pos The measured position.
+
+    @param quat The measured orientation (x,y,z,w). Does not need to be
+    unit length.
+
+    @param usec The time of the measurement in microseconds. Only
+    differences between times are used, so any clock may be used as
+    long as it is used consistently for the object.
+
+    @return 1 on success, 0 if a measurement for this object is
+    already waiting to be filtered (call kalman_batch_run() first).
+*/
+int kalman_batch_set(kalman_batch *kb, int object, const float pos[3], const float quat[4], long usec)
+{
+	if(object < 0 || object >= kb->numObjects)
+	{
+		msg(MSG_ERROR, "Invalid object: %d", object);
+		return 0;
+	}
+	if(kb->staged[object])
+		return 0;
+
+	double *q = kb->quat + object*4;
+	int c = object*KALMAN_BATCH_CHANNELS;
+	double measured[4] = { quat[0], quat[1], quat[2], quat[3] };
+	kb_quat_normalize(measured);
+
+	if(kb->timePrev[object] < 0)
+	{
+		/* First measurement, initialize the state with it. */
+		for(int j=0; j<3; j++)
+			kb->x[c+j] = pos[j];
+		memcpy(q, measured, sizeof(measured));
+		kb->timePrev[object] = usec;
+		return 1;
+	}
+
+	/* Position: filtered directly */
+	for(int j=0; j<3; j++)
+		kb->z[c+j] = pos[j];
+
+	/* Orientation: filter the rotation from our current estimate to
+	 * the measurement (in the object's own coordinate system). */
+	double qInv[4] = { -q[0], -q[1], -q[2], q[3] };
+	double diff[4];
+	kb_quat_mult(diff, qInv, measured);
+	kb_quat_log(kb->z+c+3, diff);
+
+	kb->timeNext[object] = usec;
+	kb->staged[object] = 1;
+	return 1;
+}
+
+/** Calculates the system noise for a time step. From pg 156 of
+    "Fundamentals of Kalman filtering: a practical approach"; see
+    kalman_estimate(). */
+static void kalman_batch_q(double q[6], double dt)
+{
+	double dt2 = dt*dt, dt3 = dt2*dt, dt4 = dt3*dt, dt5 = dt4*dt;
+	q[0] = dt5/20; q[1] = dt4/8; q[2] = dt3/6;
+	q[3] = dt3/3;  q[4] = dt2/2;
+	q[5] = dt;
+}
+
+/** Filters all of the measurements provided by kalman_batch_set()
+ * since the last call to this function. */
+void kalman_batch_run(kalman_batch *kb)
+{
+	/* Calculate the terms which depend on the time step once per
+	 * object. Trackers usually report at a fixed rate, so the
+	 * previous calculation can often be reused. */
+	for(int i=0; i<kb->numObjects; i++)
+	{
+		int c = i*KALMAN_BATCH_CHANNELS;
+		double dt = 0, mask = 0;
+		double q[6] = { 0,0,0,0,0,0 };
+		if(kb->staged[i])
+		{
+			dt = (kb->timeNext[i] - kb->timePrev[i]) / 1000000.0;
+			if(dt <= 0)
+				dt = 1e-6;
+			if(dt != kb->cachedDt)
+			{
+				kalman_batch_q(kb->cachedQ, dt);
+				kb->cachedDt = dt;
+			}
+			memcpy(q, kb->cachedQ, sizeof(q));
+			mask = 1;
+		}
+		for(int j=0; j<KALMAN_BATCH_CHANNELS; j++)
+		{
+			kb->dt[c+j] = dt;
+			kb->mask[c+j] = mask;
+			kb->q00[c+j] = q[0]; kb->q01[c+j] = q[1]; kb->q02[c+j] = q[2];
+			kb->q11[c+j] = q[3]; kb->q12[c+j] = q[4]; kb->q22[c+j] = q[5];
+		}
+	}
+
+	/* Update every channel. Channels without a measurement have
+	 * dt=0 and mask=0 which leaves them unchanged. This loop has no
+	 * branches and no dependencies between iterations so it can be
+	 * vectorized. H=[1 0 0] and the transition matrix is
+	 *   1 dt dt^2/2
+	 *   0 1  dt
+	 *   0 0  1
+	 * which lets us write out A*P*A^T and the update of P by hand. */
+	const int n = kb->numChannels;
+	double * restrict x = kb->x;
+	double * restrict v = kb->v;
+	double * restrict a = kb->a;
+	double * restrict p00 = kb->p00;
+	double * restrict p01 = kb->p01;
+	double * restrict p02 = kb->p02;
+	double * restrict p11 = kb->p11;
+	double * restrict p12 = kb->p12;
+	double * restrict p22 = kb->p22;
+	const double * restrict r = kb->r;
+	const double * restrict qs = kb->qScale;
+	const double * restrict z = kb->z;
+	const double * restrict mask = kb->mask;
+	const double * restrict dtArray = kb->dt;
+	const double * restrict q00 = kb->q00;
+	const double * restrict q01 = kb->q01;
+	const double * restrict q02 = kb->q02;
+	const double * restrict q11 = kb->q11;
+	const double * restrict q12 = kb->q12;
+	const double * restrict q22 = kb->q22;
+	for(int c=0; c<n; c++)
+	{
+		double dt = dtArray[c];
+		double h = 0.5*dt*dt;
+
+		/* Project the state ahead: x = A*x */
+		double xp = x[c] + dt*v[c] + h*a[c];
+		double vp = v[c] + dt*a[c];
+		double ap = a[c];
+
+		/* Project the error covariance ahead: P = A*P*A^T + Q */
+		double r00 = p00[c] + dt*p01[c] + h*p02[c];
+		double r01 = p01[c] + dt*p11[c] + h*p12[c];
+		double r02 = p02[c] + dt*p12[c] + h*p22[c];
+		double r11 = p11[c] + dt*p12[c];
+		double r12 = p12[c] + dt*p22[c];
+		double m00 = r00 + dt*r01 + h*r02 + qs[c]*q00[c];
+		double m01 = r01 + dt*r02         + qs[c]*q01[c];
+		double m02 = r02                  + qs[c]*q02[c];
+		double m11 = r11 + dt*r12         + qs[c]*q11[c];
+		double m12 = r12                  + qs[c]*q12[c];
+		double m22 = p22[c]               + qs[c]*q22[c];
+
+		/* Kalman gain: K = P*H^T / (H*P*H^T + R) */
+		double inv_s = mask[c] / (m00 + r[c]);
+		double k0 = m00*inv_s, k1 = m01*inv_s, k2 = m02*inv_s;
+
+		/* Update the estimate with the measurement */
+		double y = z[c] - xp;
+		x[c] = xp + k0*y;
+		v[c] = vp + k1*y;
+		a[c] = ap + k2*y;
+
+		/* Update the error covariance: P = P - K*H*P */
+		p00[c] = m00 - k0*m00;
+		p01[c] = m01 - k0*m01;
+		p02[c] = m02 - k0*m02;
+		p11[c] = m11 - k1*m01;
+		p12[c] = m12 - k1*m02;
+		p22[c] = m22 - k2*m02;
+	}
+
+	/* Apply the filtered rotation to each orientation and start the
+	 * next rotation from there. */
+	for(int i=0; i<kb->numObjects; i++)
+	{
+		if(!kb->staged[i])
+			continue;
+		int c = i*KALMAN_BATCH_CHANNELS + 3;
+		double rot[4];
+		double *q = kb->quat + i*4;
+		kb_quat_exp(rot, kb->x + c);
+		kb_quat_mult(q, q, rot);
+		kb_quat_normalize(q);
+		kb->x[c] = kb->x[c+1] = kb->x[c+2] = 0;
+
+		kb->timePrev[i] = kb->timeNext[i];
+		kb->staged[i] = 0;
+	}
+}
+
+/** Retrieves the filtered pose of an object.
+
+    @param pos Location to store the filtered position (may be NULL).
+
+    @param quat Location to store the filtered orientation (x,y,z,w)
+    (may be NULL).
+
+    @param vel Location to store the velocity in units per second (may
+    be NULL).
+
+    @param quatVel Location to store the rate of change of each
+    component of quat per second (may be NULL). This is the
+    derivative of the quaternion and can be used with
+    pose_sample_extrapolate().
+*/
+void kalman_batch_get(const kalman_batch *kb, int object, float pos[3], float quat[4], float vel[3], float quatVel[4])
+{
+	if(object < 0 || object >= kb->numObjects)
+	{
+		msg(MSG_ERROR, "Invalid object: %d", object);
+		return;
+	}
+	int c = object*KALMAN_BATCH_CHANNELS;
+	const double *q = kb->quat + object*4;
+	for(int j=0; j<3; j++)
+	{
+		if(pos)
+			pos[j] = (float) kb->x[c+j];
+		if(vel)
+			vel[j] = (float) kb->v[c+j];
+	}
+	if(quat)
+		for(int j=0; j<4; j++)
+			quat[j] = (float) q[j];
+	if(quatVel)
+	{
+		/* dq/dt = 1/2 * q * (angular velocity, 0) where the angular
+		 * velocity is in the object's coordinate system. */
+		double omega[4] = { kb->v[c+3], kb->v[c+4], kb->v[c+5], 0 };
+		double dq[4];
+		kb_quat_mult(dq, q, omega);
+		for(int j=0; j<4; j++)
+			quatVel[j] = (float) (0.5*dq[j]);
+	}
+}
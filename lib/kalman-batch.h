@@ -0,0 +1,75 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Kalman filter for the position and orientation of many tracked
+    objects at once. It uses the same constant-acceleration model as
+    kalman.c but is faster and handles orientation correctly:
+
+    - All of the filters are stored in arrays (one entry per channel)
+      and updated in a single loop which the compiler can vectorize.
+
+    - The terms that depend on the time between measurements are
+      calculated once per object (and reused if the time step did not
+      change) instead of once per channel with pow().
+
+    - Orientation is filtered on the rotation manifold. Each object
+      keeps an orientation quaternion. Measurements are converted into
+      a small rotation (a rotation vector) relative to that
+      orientation, the three components of the rotation vector are
+      filtered, and the result is applied to the orientation. The
+      quaternion therefore always stays unit length, unlike filtering
+      the four quaternion components independently.
+
+    Usage: Call kalman_batch_set() for each object that has a new
+    measurement, call kalman_batch_run() to filter all of them, then
+    call kalman_batch_get() to retrieve the filtered poses.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of channels per object: 3 position and 3 rotation. */
+#define KALMAN_BATCH_CHANNELS 6
+
+typedef struct {
+	int numObjects;
+	int numChannels;  /**< numObjects * KALMAN_BATCH_CHANNELS */
+
+	/* One entry per channel. The state for object i is in entries
+	 * i*6 to i*6+5. The first three are position, the last three are
+	 * rotation (relative to the object's quaternion). */
+	double *x, *v, *a;  /**< State: value, velocity, acceleration */
+	double *p00, *p01, *p02, *p11, *p12, *p22; /**< Error covariance (symmetric) */
+	double *r;       /**< Variance of measurement error */
+	double *qScale;  /**< Scaling factor for the system error */
+	double *z;       /**< Measurement waiting to be filtered */
+	double *mask;    /**< 1 if channel has a measurement waiting, 0 otherwise */
+	double *dt;      /**< Time step for the waiting measurement (seconds) */
+	double *q00, *q01, *q02, *q11, *q12, *q22; /**< System error for dt (before qScale) */
+
+	/* One entry per object */
+	double *quat;    /**< Filtered orientation (x,y,z,w), 4 per object */
+	long *timePrev;  /**< Time of the previous measurement, -1 if none */
+	long *timeNext;  /**< Time of the waiting measurement */
+	int *staged;     /**< 1 if a measurement is waiting */
+
+	double cachedDt; /**< Time step that cachedQ was calculated for */
+	double cachedQ[6];
+} kalman_batch;
+
+kalman_batch* kalman_batch_new(int numObjects, float posSigma, float posQScale, float rotSigma, float rotQScale);
+int kalman_batch_resize(kalman_batch *kb, int numObjects);
+void kalman_batch_free(kalman_batch *kb);
+void kalman_batch_reset(kalman_batch *kb, int object);
+int kalman_batch_set(kalman_batch *kb, int object, const float pos[3], const float quat[4], long usec);
+void kalman_batch_run(kalman_batch *kb);
+void kalman_batch_get(const kalman_batch *kb, int object, float pos[3], float quat[4], float vel[3], float quatVel[4]);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
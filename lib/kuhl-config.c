@@ -24,6 +24,10 @@
 static struct cfg_struct *cfg = NULL;
 static char *cfg_filename = NULL;  /*< Filename that holds the configuration */
 
+/** Incremented whenever the loaded settings are discarded so that
+ * kuhl_config_handle variables know to look up their values again. */
+int kuhl_config_generation = 1;
+
 /** Set the configuration file to be used. If another configuration
     file is already loaded, it will be unloaded and the new file will
     later be loaded when a key is requested.
@@ -43,14 +47,16 @@ void kuhl_config_filename(const char *filename)
 	{
 		cfg_free(cfg);
 		cfg = NULL;
+		kuhl_config_generation++;
 	}
 
-	if(cfg_filename != NULL)
+	// Unloading on purpose (filename == NULL) isn't worth a warning.
+	if(cfg_filename != NULL && filename != NULL)
 		msg(MSG_WARNING, "We have already loaded config file '%s' but we are now switching to file '%s'. This can happen when the program requests a configuration value and then kuhl_config_filename is called.", cfg_filename, filename);
 
 	if(cfg_filename)
 		free(cfg_filename);
-	cfg_filename = strdup(filename);
+	cfg_filename = filename ? strdup(filename) : NULL;
 }
 
 
@@ -69,7 +75,7 @@ const char* kuhl_config_get(const char *key)
 		int using_defaultFile = 0;
 		if(cfg_filename == NULL)
 		{
-			cfg_filename = "settings.ini";
+			cfg_filename = strdup("settings.ini");
 			using_defaultFile = 1;
 		}
 		cfg = cfg_init();
@@ -116,19 +122,14 @@ const char* kuhl_config_get(const char *key)
     empty string. */
 int kuhl_config_isset(const char *key)
 {
-	return (kuhl_config_get(key) == NULL);
+	return (kuhl_config_get(key) != NULL);
 }
 
-/** Returns 1 if the key is set to true in the config file. Returns 0
- * if it is set to false. Returns returnWhenMissing if the key is
- * missing. Returns returnInvalidValue if the key is set to a
- * non-boolean value. */
-int kuhl_config_boolean(const char *key, int returnWhenMissing, int returnInvalidValue)
+/** Parses a boolean value. Returns 1 for true, 0 for false, and -1
+ * if the value isn't a boolean. */
+static int kuhl_config_parse_boolean(const char *value)
 {
-	const char *value = kuhl_config_get(key);
-	if(value == NULL)
-		return returnWhenMissing;
-	else if(strcasecmp(value, "true") == 0 ||
+	if(strcasecmp(value, "true") == 0 ||
 	   strcasecmp(value, "yes") == 0 ||
 	   strcasecmp(value, "y") == 0 ||
 	   strcasecmp(value, "t") == 0 ||
@@ -141,7 +142,20 @@ int kuhl_config_boolean(const char *key, int returnWhenMissing, int returnInvali
 	        strcmp(value, "0") == 0)
 		return 0;
 	else
-		return returnInvalidValue;
+		return -1;
+}
+
+/** Returns 1 if the key is set to true in the config file. Returns 0
+ * if it is set to false. Returns returnWhenMissing if the key is
+ * missing. Returns returnInvalidValue if the key is set to a
+ * non-boolean value. */
+int kuhl_config_boolean(const char *key, int returnWhenMissing, int returnInvalidValue)
+{
+	const char *value = kuhl_config_get(key);
+	if(value == NULL)
+		return returnWhenMissing;
+	int b = kuhl_config_parse_boolean(value);
+	return b < 0 ? returnInvalidValue : b;
 }
 
 /** Reads a floating point number from the config file. Returns returnWhenMissing if the key is missing. Returns returnInvalidValue if they key is set to a non-floating point number. */
@@ -171,3 +185,33 @@ int kuhl_config_int(const char *key, int returnWhenMissing, int returnInvalidVal
 	else
 		return returnInvalidValue;
 }
+
+/** Looks up the value of a kuhl_config_handle and parses it as a
+ * boolean, int and float. This is called by the
+ * kuhl_config_handle_*() functions when the handle has never been
+ * used or when a different config file has been loaded since it was
+ * last used.
+
+    @param h The handle to update.
+*/
+void kuhl_config_handle_refresh(kuhl_config_handle *h)
+{
+	h->value = kuhl_config_get(h->key);
+	h->flags = 0;
+	if(h->value != NULL)
+	{
+		int b = kuhl_config_parse_boolean(h->value);
+		if(b >= 0)
+		{
+			h->boolValue = b;
+			h->flags |= KUHL_CONFIG_HANDLE_BOOLEAN;
+		}
+		if(sscanf(h->value, "%d", &h->intValue) == 1)
+			h->flags |= KUHL_CONFIG_HANDLE_INT;
+		if(sscanf(h->value, "%f", &h->floatValue) == 1)
+			h->flags |= KUHL_CONFIG_HANDLE_FLOAT;
+	}
+	/* Read the generation after kuhl_config_get() in case it loaded
+	 * the config file. */
+	h->generation = kuhl_config_generation;
+}
@@ -12,6 +12,7 @@
  */
 
 #pragma once
+#include <stddef.h> // NULL
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,7 +25,71 @@ int kuhl_config_isset(const char *key);
 int kuhl_config_boolean(const char *key, int returnWhenMissing, int returnInvalidValue);
 float kuhl_config_float(const char *key, float returnWhenMissing, float returnInvalidValue);
 int kuhl_config_int(const char *key, int returnWhenMissing, int returnInvalidValue);
-	
+
+/** A config value which is looked up and parsed once and then cached,
+ * so it can be read every frame for free. Declare handles as static
+ * variables initialized with KUHL_CONFIG_HANDLE() and read them with
+ * the kuhl_config_handle_*() functions:
+
+ static kuhl_config_handle nearPlane = KUHL_CONFIG_HANDLE("nearplane");
+ float near = kuhl_config_handle_float(&nearPlane, 0.1f, 0.1f);
+
+ The cached value is refreshed if kuhl_config_filename() switches to
+ a different file. Like the rest of kuhl-config, handles should only
+ be used from one thread.
+*/
+typedef struct
+{
+	const char *key;
+	int generation; /**< kuhl_config_generation when the value was cached */
+	const char *value; /**< NULL if the key is missing or empty */
+	int flags; /**< Which of the values below are valid */
+	int boolValue;
+	int intValue;
+	float floatValue;
+} kuhl_config_handle;
+
+#define KUHL_CONFIG_HANDLE_BOOLEAN 1
+#define KUHL_CONFIG_HANDLE_INT 2
+#define KUHL_CONFIG_HANDLE_FLOAT 4
+#define KUHL_CONFIG_HANDLE(key) { key, 0, NULL, 0, 0, 0, 0.0f }
+
+extern int kuhl_config_generation;
+void kuhl_config_handle_refresh(kuhl_config_handle *h);
+
+/** Same as kuhl_config_get() but uses a cached handle. */
+static inline const char* kuhl_config_handle_get(kuhl_config_handle *h)
+{
+	if(h->generation != kuhl_config_generation)
+		kuhl_config_handle_refresh(h);
+	return h->value;
+}
+
+/** Same as kuhl_config_boolean() but uses a cached handle. */
+static inline int kuhl_config_handle_boolean(kuhl_config_handle *h, int returnWhenMissing, int returnInvalidValue)
+{
+	if(kuhl_config_handle_get(h) == NULL)
+		return returnWhenMissing;
+	return (h->flags & KUHL_CONFIG_HANDLE_BOOLEAN) ? h->boolValue : returnInvalidValue;
+}
+
+/** Same as kuhl_config_int() but uses a cached handle. */
+static inline int kuhl_config_handle_int(kuhl_config_handle *h, int returnWhenMissing, int returnInvalidValue)
+{
+	if(kuhl_config_handle_get(h) == NULL)
+		return returnWhenMissing;
+	return (h->flags & KUHL_CONFIG_HANDLE_INT) ? h->intValue : returnInvalidValue;
+}
+
+/** Same as kuhl_config_float() but uses a cached handle. */
+static inline float kuhl_config_handle_float(kuhl_config_handle *h, float returnWhenMissing, float returnInvalidValue)
+{
+	if(kuhl_config_handle_get(h) == NULL)
+		return returnWhenMissing;
+	return (h->flags & KUHL_CONFIG_HANDLE_FLOAT) ? h->floatValue : returnInvalidValue;
+}
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,6 +36,10 @@
 #endif
 
 #include "kuhl-nodep.h"
+#include "capture.h"
+#include "trace.h"
+#include "gputimer.h"
+#include "benchmark.h"
 
 #ifdef KUHL_UTIL_USE_ASSIMP
 #include <assimp/cimport.h>
@@ -57,6 +61,7 @@
 #endif
 
 static GLFWwindow *the_window = NULL;
+static GLuint kuhl_headless_framebuffer = 0; /**< Framebuffer we draw into when there is no window (0 otherwise) */
 
 
 #ifdef KUHL_UTIL_USE_ASSIMP
@@ -97,6 +102,44 @@ GLFWwindow* kuhl_get_window(void)
 	return the_window;
 }
 
+/** Returns 1 if we are rendering into an offscreen framebuffer
+ * instead of a window (see kuhl_ogl_init()). */
+int kuhl_headless(void)
+{
+	return kuhl_headless_framebuffer != 0;
+}
+
+/** Returns the framebuffer that should be bound when a program is
+ * done drawing into its own framebuffer object and wants to draw to
+ * the screen again. This is 0 (the window) unless we are running
+ * headless.
+ */
+GLuint kuhl_default_framebuffer(void)
+{
+	return kuhl_headless_framebuffer;
+}
+
+/** Reads the "window.headless" setting.
+
+    @return 0 if we should create a window, otherwise the GLFW context
+    creation API that should be used for the offscreen context.
+ */
+static int kuhl_headless_api(void)
+{
+	const char *headless = kuhl_config_get("window.headless");
+	if(headless == NULL || !kuhl_config_boolean("window.headless", 1, 1))
+		return 0;
+#ifdef GLFW_PLATFORM_NULL
+	if(strcasecmp(headless, "osmesa") == 0)
+		return GLFW_OSMESA_CONTEXT_API;
+	return GLFW_EGL_CONTEXT_API;
+#else
+	msg(MSG_FATAL, "window.headless requires GLFW 3.4 or newer (this program was compiled with GLFW %d.%d.%d).",
+	    GLFW_VERSION_MAJOR, GLFW_VERSION_MINOR, GLFW_VERSION_REVISION);
+	exit(EXIT_FAILURE);
+#endif
+}
+
 
 /** Write diagnostic information to the log file. Should be called
  * after GLFW and GLEW are initialized. */
@@ -296,6 +339,17 @@ void kuhl_glfw_move_window(GLFWwindow *window)
 
     @param msaaSamples Number of samples to use for multisampling
     antialiasing. Set to 0 for no antialiasing.
+
+    If the "window.headless" config setting is set, no window is
+    shown and no display is needed (useful for running benchmarks,
+    see benchmark.c, on servers). Instead, an OpenGL context is
+    created with EGL (or OSMesa if the setting is "osmesa") and
+    everything is drawn into a framebuffer object that is the size
+    of the window that would have been created. Mesa's llvmpipe
+    software renderer works if there is no GPU. Programs that bind
+    their own framebuffers should switch back with
+    glBindFramebuffer(GL_FRAMEBUFFER, kuhl_default_framebuffer())
+    instead of binding framebuffer 0.
  */
 void kuhl_ogl_init(int *argcp, char **argv, int width, int height, int oglProfile, int msaaSamples)
 {
@@ -331,6 +385,13 @@ void kuhl_ogl_init(int *argcp, char **argv, int width, int height, int oglProfil
 
 	// Tell GLFW to call our function when an error occurs.
 	glfwSetErrorCallback(kuhl_glfw_error);
+
+	int headlessApi = kuhl_headless_api();
+#ifdef GLFW_PLATFORM_NULL
+	/* GLFW's null platform doesn't need a display. */
+	if(headlessApi)
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
 	if(!glfwInit()) // initialize glfw
 	{
 		msg(MSG_FATAL, "Failed to initialize GLFW.\n");
@@ -354,9 +415,19 @@ void kuhl_ogl_init(int *argcp, char **argv, int width, int height, int oglProfil
 	   use an sRGB internalformat. */
 	glfwWindowHint(GLFW_SRGB_CAPABLE, 1);
 
-	if(msaaSamples > 1)
+	if(msaaSamples > 1 && !headlessApi)
 		glfwWindowHint(GLFW_SAMPLES, msaaSamples);
 
+	/* Nobody watches a benchmark, so don't show the window. */
+	if(benchmark_enabled() || headlessApi)
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	if(headlessApi)
+	{
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, headlessApi);
+		msg(MSG_INFO, "Running headless: drawing into an offscreen framebuffer using %s.",
+		    headlessApi == GLFW_EGL_CONTEXT_API ? "EGL" : "OSMesa");
+	}
+
 	/* Create a GLFW window */
 	
 	GLFWwindow *window = kuhl_glfw_create_window(width, height, argv[0]);
@@ -371,6 +442,12 @@ void kuhl_ogl_init(int *argcp, char **argv, int width, int height, int oglProfil
 	/* Initialize GLEW (must be done after context is made current) */
 	glewExperimental = GL_TRUE;
 	GLenum glewError = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	/* GLEW looks for GLX extensions which don't exist without a
+	 * display. The OpenGL functions were loaded anyway. */
+	if(headlessApi && glewError == GLEW_ERROR_NO_GLX_DISPLAY)
+		glewError = GLEW_OK;
+#endif
 	if(glewError)
 	{
 		msg(MSG_FATAL, "Error initializing GLEW: %s\n", glewGetErrorString(glewError));
@@ -384,9 +461,26 @@ void kuhl_ogl_init(int *argcp, char **argv, int width, int height, int oglProfil
 	 * http://www.opengl.org/wiki/OpenGL_Loading_Library */
 	glGetError();
 
+	/* Without a window, draw into a framebuffer object
+	 * instead. Leave it bound, everything that would be drawn in the
+	 * window goes there. */
+	if(headlessApi)
+	{
+		int fbWidth, fbHeight;
+		glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+		GLuint colorTexture = 0;
+		kuhl_headless_framebuffer = kuhl_gen_framebuffer(fbWidth, fbHeight, &colorTexture, NULL);
+		glBindFramebuffer(GL_FRAMEBUFFER, kuhl_headless_framebuffer);
+		glViewport(0, 0, fbWidth, fbHeight);
+		kuhl_errorcheck();
+	}
 
 	kuhl_diagnostics(); /* print additional information in log file */
 
+	/* Benchmarks start at time 0 (see benchmark.c). */
+	if(benchmark_enabled())
+		glfwSetTime(0);
+
 	the_window = window;
 }
 
@@ -427,12 +521,32 @@ GLuint kuhl_create_shader(const char *filename, GLuint shader_type)
 
 	/* read in program from the text file */
 	// printf("%s shader: %s\n", shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment" , filename);
+	char *text = kuhl_text_read(filename);
+	GLuint shader = kuhl_create_shader_source(text, shader_type, filename);
+	free(text);
+	return shader;
+}
+
+/** Creates a shader from a string. This is useful for small shaders
+ * that are used inside of libkuhl (and therefore can't be loaded from
+ * a file). Compile errors are handled the same way as
+ * kuhl_create_shader().
+ *
+ * @param source The GLSL source code.
+ *
+ * @param shader_type The type of shader (for example,
+ * GL_VERTEX_SHADER or GL_FRAGMENT_SHADER).
+ *
+ * @param name A name for the shader to use in error messages.
+ *
+ * @return The ID for the shader. Exits if an error occurs.
+ */
+GLuint kuhl_create_shader_source(const char *source, GLuint shader_type, const char *name)
+{
 	GLuint shader = glCreateShader(shader_type);
 	kuhl_errorcheck();
-	char *text = kuhl_text_read(filename);
-	glShaderSource(shader, 1, (const char**) &text, NULL);
+	glShaderSource(shader, 1, &source, NULL);
 	kuhl_errorcheck();
-	free(text);
 
 	/* compile program */
 	glCompileShader(shader);
@@ -442,7 +556,7 @@ GLuint kuhl_create_shader(const char *filename, GLuint shader_type)
 	GLsizei actualLen = 0;
 	glGetShaderInfoLog(shader, 1024, &actualLen, logString);
 	if(actualLen > 0)
-		msg(MSG_WARNING, "%s Shader log for %s:\n%s\n", shader_type == GL_VERTEX_SHADER ? "Vertex" : "Fragment", filename, kuhl_trim_whitespace(logString));
+		msg(MSG_WARNING, "%s Shader log for %s:\n%s\n", shader_type == GL_VERTEX_SHADER ? "Vertex" : "Fragment", name, kuhl_trim_whitespace(logString));
 	kuhl_errorcheck();
 
 	/* If shader compilation wasn't successful, exit. */
@@ -450,7 +564,7 @@ GLuint kuhl_create_shader(const char *filename, GLuint shader_type)
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &shaderCompileStatus);
 	if(shaderCompileStatus == GL_FALSE)
 	{
-		msg(MSG_FATAL, "Failed to compile '%s'\n", filename);
+		msg(MSG_FATAL, "Failed to compile '%s'\n", name);
 		exit(EXIT_FAILURE);
 	}
 
@@ -615,6 +729,46 @@ GLuint kuhl_create_program(const char *vertexFilename, const char *fragFilename)
 	return program;
 }
 
+/** Links a program whose shaders were created with
+ * kuhl_create_shader_source(). Anything that must be set before
+ * linking (such as glBindAttribLocation(),
+ * glBindFragDataLocation() or glTransformFeedbackVaryings()) should
+ * be done before calling this function. After linking, the shaders
+ * are detached and deleted since the program no longer needs them.
+ *
+ * @param program A program with a vertex and fragment shader
+ * attached.
+ *
+ * @param name A name for the program to use in error messages.
+ *
+ * @return The program. Exits if the program fails to link.
+ */
+GLuint kuhl_link_program(GLuint program, const char *name)
+{
+	glLinkProgram(program);
+	kuhl_errorcheck();
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if(linked == GL_FALSE)
+	{
+		kuhl_print_program_log(program);
+		msg(MSG_FATAL, "Failed to link GLSL program '%s'.\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	GLuint shaders[8];
+	GLsizei count = 0;
+	glGetAttachedShaders(program, 8, &count, shaders);
+	for(int i=0; i<count; i++)
+	{
+		glDetachShader(program, shaders[i]);
+		glDeleteShader(shaders[i]);
+	}
+	kuhl_errorcheck();
+	return program;
+}
+
 /** Prints a program log if there is one for an OpenGL program.
  *
  * @param program The OpenGL program that we want to print the log for.
@@ -850,12 +1004,12 @@ void kuhl_bbox_transform(float bbox[6], float mat[16])
 	                       {bbox[xmin], bbox[ymin], bbox[zmax] },
 	                       {bbox[xmin], bbox[ymax], bbox[zmin] },
 	                       {bbox[xmin], bbox[ymax], bbox[zmax] },
+	                       {bbox[xmax], bbox[ymin], bbox[zmin] },
 	                       {bbox[xmax], bbox[ymin], bbox[zmax] },
 	                       {bbox[xmax], bbox[ymax], bbox[zmin] },
 	                       {bbox[xmax], bbox[ymax], bbox[zmax] } };
 	// Transform the 8 vertices of the bounding box
-	for(int i=0; i<8; i++)
-		mat4f_mult_vec4f_new(coords[i], mat, coords[i]);
+	mat4f_mult_point3f_array(coords[0], mat, coords[0], 8);
 	
 	/* Calculate new axis aligned bounding box */
 	for(int i=0; i<6; i=i+2) // set min values to the largest float
@@ -1480,19 +1634,16 @@ void kuhl_geometry_init(kuhl_geometry *geom)
 }
 #endif
 
-/** Draws a kuhl_geometry struct to the screen. The struct passed into
- * this function should have been set up with kuhl_geometry_new() and
- * at least one position attribute with kuhl_geometry_attrib() before
- * calling this function.
-
- @param geom The geometry to draw to the screen. If the kuhl_geometry
- object is a part of a linked list, this function will draw each of
- the objects in order. */
-void kuhl_geometry_draw(kuhl_geometry *geom)
+/** Draws a kuhl_geometry struct (and the rest of the list that it is
+ * a part of). Implements kuhl_geometry_draw() and
+ * kuhl_geometry_draw_instanced(). If instanceCount is 0, the geometry
+ * is drawn without instancing. */
+static void kuhl_private_geometry_draw(kuhl_geometry *geom, GLsizei instanceCount)
 {
 	if(geom == NULL)
 		return;
-	
+
+	trace_begin("kuhl_geometry_draw");
 	kuhl_errorcheck();
 	
 	/* Record the OpenGL state so that we can restore it when we have
@@ -1511,12 +1662,14 @@ void kuhl_geometry_draw(kuhl_geometry *geom)
 	{
 		msg(MSG_ERROR, "Program (%d) is invalid. Have you initialized this kuhl_geometry object?\n", geom->program);
 		kuhl_errorcheck();
+		trace_end("kuhl_geometry_draw");
 		return;
 	}
 	else if (glIsVertexArray(geom->vao) == 0)
 	{
 		msg(MSG_ERROR, "Vertex array object (%d) is invalid.\n", geom->vao);
 		kuhl_errorcheck();
+		trace_end("kuhl_geometry_draw");
 		return;
 	}
 	glUseProgram(geom->program);
@@ -1624,17 +1777,26 @@ void kuhl_geometry_draw(kuhl_geometry *geom)
 	 * draw the geometry. */
 	if(geom->indices_len > 0 && glIsBuffer(geom->indices_bufferobject))
 	{
-		glDrawElements(geom->primitive_type,
-		               geom->indices_len,
-		               GL_UNSIGNED_INT,
-		               NULL);
+		if(instanceCount > 0)
+			glDrawElementsInstanced(geom->primitive_type,
+			                        geom->indices_len,
+			                        GL_UNSIGNED_INT,
+			                        NULL, instanceCount);
+		else
+			glDrawElements(geom->primitive_type,
+			               geom->indices_len,
+			               GL_UNSIGNED_INT,
+			               NULL);
 		kuhl_errorcheck();
 	}
 	else
 	{
 		/* If the user didn't provide us with indices, just draw the
 		 * vertices in order. */
-		glDrawArrays(geom->primitive_type, 0, geom->vertex_count);
+		if(instanceCount > 0)
+			glDrawArraysInstanced(geom->primitive_type, 0, geom->vertex_count, instanceCount);
+		else
+			glDrawArrays(geom->primitive_type, 0, geom->vertex_count);
 		kuhl_errorcheck();
 	}
 
@@ -1669,9 +1831,166 @@ void kuhl_geometry_draw(kuhl_geometry *geom)
 	/* Unbind the VAO */
 	glBindVertexArray(previousVAO);
 	kuhl_errorcheck();
+	trace_end("kuhl_geometry_draw");
 
 	/* Draw the next nodes in the list. */
-	kuhl_geometry_draw(geom->next);
+	kuhl_private_geometry_draw(geom->next, instanceCount);
+}
+
+/** Draws a kuhl_geometry struct to the screen. The struct passed into
+ * this function should have been set up with kuhl_geometry_new() and
+ * at least one position attribute with kuhl_geometry_attrib() before
+ * calling this function.
+
+ @param geom The geometry to draw to the screen. If the kuhl_geometry
+ object is a part of a linked list, this function will draw each of
+ the objects in order. */
+void kuhl_geometry_draw(kuhl_geometry *geom)
+{
+	gputimer_begin("kuhl_geometry_draw");
+	kuhl_private_geometry_draw(geom, 0);
+	gputimer_end("kuhl_geometry_draw");
+}
+
+/** Draws several instances of a kuhl_geometry struct with a single
+ * draw call. Use kuhl_geometry_instance_attrib() to provide the
+ * per-instance data (such as a position for each instance) that the
+ * vertex program uses to tell the instances apart. The vertex
+ * program can also use gl_InstanceID.
+
+ @param geom The geometry to draw to the screen. If the kuhl_geometry
+ object is a part of a linked list, each object in the list is drawn
+ instanceCount times.
+
+ @param instanceCount The number of instances to draw. If 0, nothing
+ is drawn. */
+void kuhl_geometry_draw_instanced(kuhl_geometry *geom, GLsizei instanceCount)
+{
+	if(instanceCount > 0)
+	{
+		gputimer_begin("kuhl_geometry_draw");
+		kuhl_private_geometry_draw(geom, instanceCount);
+		gputimer_end("kuhl_geometry_draw");
+	}
+}
+
+/* Connects an attribute to a buffer object which the caller
+ * owns. See kuhl_geometry_instance_attrib() and
+ * kuhl_geometry_buffer_attrib(). */
+static void kuhl_geometry_external_attrib(kuhl_geometry *geom, GLuint bufferObject, GLintptr offset,
+                                          GLuint components, const char *name, int warnIfAttribMissing,
+                                          GLuint divisor)
+{
+	if(geom == NULL || name == NULL || !glIsVertexArray(geom->vao))
+	{
+		msg(MSG_WARNING, "Unable to add attribute '%s' to an invalid geometry object.\n",
+		    name ? name : "(null)");
+		return;
+	}
+	GLint attribLocation = glGetAttribLocation(geom->program, name);
+	if(attribLocation == -1)
+	{
+		if(warnIfAttribMissing)
+			msg(MSG_WARNING, "Unable to add attribute '%s' to the geometry object because it was missing or inactive in program %d\n",
+			    name, geom->program);
+		return;
+	}
+
+	GLint previousVAO=0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+	glBindVertexArray(geom->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
+	glEnableVertexAttribArray(attribLocation);
+	glVertexAttribPointer(attribLocation, components, GL_FLOAT, GL_FALSE, 0,
+	                      (const GLvoid*) offset);
+	glVertexAttribDivisor(attribLocation, divisor);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(previousVAO);
+	kuhl_errorcheck();
+}
+
+/** Connects an attribute in the vertex program to per-instance data
+ * stored in a buffer object which the caller owns. The attribute
+ * advances once per instance instead of once per vertex when the
+ * geometry is drawn with kuhl_geometry_draw_instanced().
+ *
+ * Unlike kuhl_geometry_attrib(), the data is not copied: Several
+ * kuhl_geometry objects can share one buffer of instance data, and
+ * the caller can update the buffer every frame. This function is
+ * cheap enough to call before each draw to point the attribute at a
+ * different part of the buffer. kuhl_geometry_delete() does not
+ * delete the buffer.
+ *
+ * @param geom The geometry to add the attribute to.
+ *
+ * @param bufferObject An OpenGL buffer object containing tightly
+ * packed floats with components floats per instance.
+ *
+ * @param offset Offset (in bytes) of the data for the first instance
+ * in the buffer.
+ *
+ * @param components The number of floats per instance.
+ *
+ * @param name The name of the attribute in the vertex program.
+ *
+ * @param warnIfAttribMissing If nonzero, print a warning if the
+ * attribute isn't present in the GLSL program for this geometry
+ * object.
+ */
+void kuhl_geometry_instance_attrib(kuhl_geometry *geom, GLuint bufferObject, GLintptr offset,
+                                   GLuint components, const char *name, int warnIfAttribMissing)
+{
+	/* Advance the attribute once per instance. */
+	kuhl_geometry_external_attrib(geom, bufferObject, offset, components, name, warnIfAttribMissing, 1);
+}
+
+/** Connects an attribute in the vertex program to per-vertex data
+ * stored in a buffer object which the caller owns, replacing any data
+ * given to kuhl_geometry_attrib() for the same attribute. This allows
+ * vertex data that is computed on the GPU (for example, particle
+ * positions from particles.c) to be drawn without copying it to the
+ * CPU. Like kuhl_geometry_instance_attrib(), it is cheap enough to
+ * call before each draw and kuhl_geometry_delete() does not delete
+ * the buffer.
+ *
+ * @param geom The geometry to add the attribute to.
+ *
+ * @param bufferObject An OpenGL buffer object containing tightly
+ * packed floats with components floats per vertex.
+ *
+ * @param offset Offset (in bytes) of the data for the first vertex of
+ * geom in the buffer.
+ *
+ * @param components The number of floats per vertex.
+ *
+ * @param name The name of the attribute in the vertex program.
+ *
+ * @param warnIfAttribMissing If nonzero, print a warning if the
+ * attribute isn't present in the GLSL program for this geometry
+ * object.
+ */
+void kuhl_geometry_buffer_attrib(kuhl_geometry *geom, GLuint bufferObject, GLintptr offset,
+                                 GLuint components, const char *name, int warnIfAttribMissing)
+{
+	kuhl_geometry_external_attrib(geom, bufferObject, offset, components, name, warnIfAttribMissing, 0);
+}
+
+/** Returns the buffer object which holds the data for an attribute
+ * that was given to kuhl_geometry_attrib(), or 0 if the geometry
+ * doesn't have the attribute. Unlike kuhl_geometry_attrib_get(), the
+ * buffer isn't mapped, so the data can be copied on the GPU (for
+ * example, with glCopyBufferSubData()).
+ *
+ * @param geom The geometry object.
+ *
+ * @param name The name of the attribute in the vertex program.
+ */
+GLuint kuhl_geometry_attrib_buffer(kuhl_geometry *geom, const char *name)
+{
+	int index = kuhl_geometry_attrib_index(geom, name);
+	if(index < 0)
+		return 0;
+	return geom->attribs[index].bufferobject;
 }
 
 /** Deletes kuhl_geometry struct by freeing the OpenGL buffers that
@@ -2177,105 +2496,35 @@ float kuhl_read_texture_file(const char *filename, GLuint *texName)
 	return kuhl_read_texture_file_wrap(filename, texName, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
 }
 
-#ifdef KUHL_UTIL_USE_IMAGEMAGICK
-static void kuhl_screenshot_im(const char *outputImageFilename)
-{
-	// Get window size
-	//int windowWidth  = glutGet(GLUT_WINDOW_WIDTH);
-	//int windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
-	int windowWidth,windowHeight;
-	glfwGetFramebufferSize(kuhl_get_window(), &windowWidth, &windowHeight);
-
-	// Allocate space for data from window
-	char *data = kuhl_malloc(windowWidth * windowHeight * 3);
-	// Read pixels from the window
-	glReadPixels(0,0,windowWidth,windowHeight,
-	             GL_RGB,GL_UNSIGNED_BYTE, data);
-	kuhl_errorcheck();
-	// Set up image output settings
-	imageio_info info_out;
-	info_out.width    = windowWidth;
-	info_out.height   = windowHeight;
-	info_out.depth    = 8; // bits/color in output image
-	info_out.quality  = 85;
-	info_out.colorspace = sRGBColorspace;
-	info_out.filename = strdup(outputImageFilename);
-	info_out.comment  = NULL;
-	info_out.type     = CharPixel;
-	info_out.map      = "RGB";
-	// Write image to disk
-	imageout(&info_out, data);
-	free(info_out.filename); // cleanup
-	free(data);
-}
-#else // KUHL_UTIL_USE_IMAGEMAGICK
-
-static void kuhl_screenshot_stb(const char *outputImageFilename)
-{
-	// Get window size
-	//int windowWidth  = glutGet(GLUT_WINDOW_WIDTH);
-	//int windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
-	int windowWidth,windowHeight;
-	glfwGetFramebufferSize(kuhl_get_window(), &windowWidth, &windowHeight);
-
-	
-	int comp = 3; // 3 = RGB, 4 = RGBA
-	int stride_in_bytes = windowWidth*comp*sizeof(char);
-	// Allocate space for data from window
-	unsigned char *data = kuhl_malloc(stride_in_bytes*windowHeight);
-	// Read pixels from the window
-	glReadPixels(0,0,windowWidth,windowHeight,
-	             GL_RGB,GL_UNSIGNED_BYTE, data);
-	kuhl_errorcheck();
-
-	kuhl_flip_texture_array(data, windowWidth, windowHeight, 3);
-
-	int ok=0;
-	const char *s = outputImageFilename;
-	if(strlen(s) > 4 && !strcmp(s + strlen(s) - 4, ".png"))
-		ok = stbi_write_png(s, windowWidth, windowHeight, comp, data, stride_in_bytes);
-	else if(strlen(s) > 4 && !strcmp(s + strlen(s) - 4, ".tga"))
-		ok = stbi_write_tga(s, windowWidth, windowHeight, comp, data);
-	else if(strlen(s) > 4 && !strcmp(s + strlen(s) - 4, ".bmp"))
-		ok = stbi_write_bmp(s, windowWidth, windowHeight, comp, data);
-	free(data);
-	
-	if (!ok)
-	{
-		msg(MSG_FATAL, "Failed write screenshot to %s (note: STB can only write png, tga, and bmp files.)\n", outputImageFilename);
-		exit(EXIT_FAILURE);
-	}
-
-}
-#endif // end else part of ifdef KUHL_UTIL_USE_IMAGEMAGICK
-
 /** Takes a screenshot of the current OpenGL screen and writes it to an image file.
 
     @param outputImageFilename The name of the image file that you want to record the screenshot in. The type of image file is determined by the filename extension. This function will allow you to write to any image format that ImageMagick supports. Suggestion: PNG files often work best for screenshots; try "output.png".
+
+    The image is read and written in the background (see capture.c),
+    so the file is written a few frames later.
 */
 void kuhl_screenshot(const char *outputImageFilename)
 {
-#ifdef KUHL_UTIL_USE_IMAGEMAGICK
-	kuhl_screenshot_im(outputImageFilename);
-#else
-	kuhl_screenshot_stb(outputImageFilename);
-#endif
+	capture_image(outputImageFilename);
 }
 
 
-/** Records individual frames to image files that can later be
-  combined into a single video file. Call this function every frame
-  and it will capture the image data from the frame buffer and write
-  it to an image file if enough time has elapsed to record a
-  frame. Each image filename will include a frame number. This
-  function writes TIFF files to avoid unnecessary computation
-  compressing images. Instructions for converting the image files into
-  a video file using ffmpeg or avconv will be printed to standard
-  out. This may run slowly if you are saving files to a non-local
-  filesystem.
+/** Records frames to a video file or to individual image files that
+  can later be combined into a single video file. Call this function
+  every frame and it will capture the image data from the frame
+  buffer if enough time has elapsed to record a frame. Frames are
+  read and encoded in the background (see capture.c), so recording
+  doesn't slow down the program much.
 
-    @param fileLabel If fileLabel is set to "label", this function
-    will create files such as "label-00000000.tif"
+  If fileLabel ends in .mp4, .mkv, .webm or .ogv, the frames are
+  piped into ffmpeg, which writes the video file. Otherwise, each
+  frame is written to an image file whose name includes a frame
+  number. Instructions for converting the image files into a video
+  file using ffmpeg or avconv will be printed to standard out.
+
+    @param fileLabel The video file to write, or a label for the
+    image files. If fileLabel is set to "label", this function will
+    create files such as "label-00000000.tif"
     
     @param fps The number of frames per second to record. Suggested value: 30.
  */
@@ -2296,16 +2545,28 @@ void kuhl_video_record(const char *fileLabel, int fps)
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 
+	static int videoFile = 0;
 	if(kuhl_video_record_prev_sec == 0) // first time
 	{
 		kuhl_video_record_prev_sec  = tv.tv_sec;
 		kuhl_video_record_prev_usec = tv.tv_usec;
-		msg(MSG_INFO, "Recording %d frames per second. NOTE: If your screen is too large, then we may be unable to actually record images at the requested FPS rate.\n", fps);
-		msg(MSG_INFO, "Use either of the following commands to assemble Ogg video (Ogg video files are widely supported and not encumbered by patent restrictions):\n");
-		msg(MSG_INFO, "ffmpeg -r %d -f image2 -i %s-%%08d.%s -qscale:v 7 %s.ogv\n", fps, fileLabel, exten, fileLabel);
-		msg(MSG_INFO, " - or -\n");
-		msg(MSG_INFO, "avconv -r %d -f image2 -i %s-%%08d.%s -qscale:v 7 %s.ogv\n", fps, fileLabel, exten, fileLabel);
-		msg(MSG_INFO, "In either program, the -qscale:v parameter sets the quality: 0 (lowest) to 10 (highest)\n");
+		const char *dot = strrchr(fileLabel, '.');
+		if(dot && (strcasecmp(dot, ".mp4") == 0 || strcasecmp(dot, ".mkv") == 0 ||
+		           strcasecmp(dot, ".webm") == 0 || strcasecmp(dot, ".ogv") == 0))
+		{
+			videoFile = capture_video_open(fileLabel, fps);
+			if(videoFile)
+				msg(MSG_INFO, "Recording %d frames per second to %s\n", fps, fileLabel);
+		}
+		if(!videoFile)
+		{
+			msg(MSG_INFO, "Recording %d frames per second. NOTE: If your screen is too large, then we may be unable to actually record images at the requested FPS rate.\n", fps);
+			msg(MSG_INFO, "Use either of the following commands to assemble Ogg video (Ogg video files are widely supported and not encumbered by patent restrictions):\n");
+			msg(MSG_INFO, "ffmpeg -r %d -f image2 -i %s-%%08d.%s -qscale:v 7 %s.ogv\n", fps, fileLabel, exten, fileLabel);
+			msg(MSG_INFO, " - or -\n");
+			msg(MSG_INFO, "avconv -r %d -f image2 -i %s-%%08d.%s -qscale:v 7 %s.ogv\n", fps, fileLabel, exten, fileLabel);
+			msg(MSG_INFO, "In either program, the -qscale:v parameter sets the quality: 0 (lowest) to 10 (highest)\n");
+		}
 	}
 
 	time_t sec       = tv.tv_sec;
@@ -2325,9 +2586,14 @@ void kuhl_video_record(const char *fileLabel, int fps)
 	{
 		kuhl_video_record_prev_sec  = sec;
 		kuhl_video_record_prev_usec = usec;
+		if(videoFile)
+		{
+			capture_video_frame();
+			return;
+		}
 		char filename[1024];
 		snprintf(filename, 1024, "%s-%08d.%s", fileLabel, kuhl_video_record_frame, exten);
-		kuhl_screenshot(filename); // TODO: Should we check if the screenshot writes?
+		capture_image_frame(filename); // dropped if the encoders fall behind
 		kuhl_video_record_frame++;
 	}
 #endif // end ifndef _WIN32
@@ -2836,14 +3102,15 @@ static const struct aiScene* kuhl_private_assimp_load(const char *modelFilename,
 	return scene;
 }
 
-/** Given a aiNodeAnim object and a time, return an appropriate
- * transformation matrix.
+/** Given a aiNodeAnim object and a time, return the interpolated
+ * translation, rotation and scale as a TRS transform (see trsf in
+ * vecmat.h).
  *
- * @param transformResult The resulting transformation matrix.
- * @param na The aiNodeAnim to generate the matrix form.
+ * @param result The resulting transform.
+ * @param na The aiNodeAnim to generate the transform from.
  * @param ticks The time of the animation in TICKS (not seconds!)
  */
-static void kuhl_private_anim_matrix(float transformResult[16], const struct aiNodeAnim *na, double ticks)
+static void kuhl_private_anim_trs(trsf *result, const struct aiNodeAnim *na, double ticks)
 {
 
 	/* Find indices of start and stop position keys */
@@ -2866,18 +3133,12 @@ static void kuhl_private_anim_matrix(float transformResult[16], const struct aiN
 		factor = 0;
 	
 	/* Interpolate between two nearest keys */
-	float positionValStart[3] = { na->mPositionKeys[positionStart].mValue.x,
-	                              na->mPositionKeys[positionStart].mValue.y,
-	                              na->mPositionKeys[positionStart].mValue.z };
-	float positionValEnd[3] = { na->mPositionKeys[positionEnd].mValue.x,
-	                            na->mPositionKeys[positionEnd].mValue.y,
-	                            na->mPositionKeys[positionEnd].mValue.z };
-	float positionValMid[3];
-	vec3f_scalarMult(positionValStart, (1-factor));
-	vec3f_scalarMult(positionValEnd, factor);
-	vec3f_add_new(positionValMid, positionValStart, positionValEnd);
-	float positionMatrix[16];
-	mat4f_translateVec_new(positionMatrix, positionValMid);
+	const struct aiVector3D *posStart = &na->mPositionKeys[positionStart].mValue;
+	const struct aiVector3D *posEnd   = &na->mPositionKeys[positionEnd].mValue;
+	vec3f_set(result->pos,
+	          (1-factor)*posStart->x + factor*posEnd->x,
+	          (1-factor)*posStart->y + factor*posEnd->y,
+	          (1-factor)*posStart->z + factor*posEnd->z);
 
 	/* Find indices of start and stop rotation keys */
 	unsigned int rotationStart = 0;
@@ -2905,12 +3166,13 @@ static void kuhl_private_anim_matrix(float transformResult[16], const struct aiN
 	                            na->mRotationKeys[rotationEnd].mValue.y,
 	                            na->mRotationKeys[rotationEnd].mValue.z,
 	                            na->mRotationKeys[rotationEnd].mValue.w };
-	float rotationValMid[4];
-	//vec4f_normalize(rotationValStart);
-	//vec4f_normalize(rotationValEnd);
-	quatf_slerp_new(rotationValMid, rotationValStart, rotationValEnd, factor);
-	float rotationMatrix[16];
-	mat4f_rotateQuatVec_new(rotationMatrix, rotationValMid);
+	/* Keys are usually close together; nlerp is indistinguishable
+	 * from slerp there and doesn't need any trigonometry. Use slerp
+	 * for keys that are more than about 25 degrees apart. */
+	if(fabsf(vec4f_dot(rotationValStart, rotationValEnd)) > 0.975f)
+		quatf_nlerp_new(result->quat, rotationValStart, rotationValEnd, factor);
+	else
+		quatf_slerp_new(result->quat, rotationValStart, rotationValEnd, factor);
 
 	/* Find indices of start and stop scaling keys */
 	unsigned int scalingStart = 0;
@@ -2930,32 +3192,25 @@ static void kuhl_private_anim_matrix(float transformResult[16], const struct aiN
 	else
 		factor = 0;
 	/* Interpolate between two nearest keys */
-	float scalingValStart[3] = { na->mScalingKeys[scalingStart].mValue.x,
-	                             na->mScalingKeys[scalingStart].mValue.y,
-	                             na->mScalingKeys[scalingStart].mValue.z };
-	float scalingValEnd[3] = { na->mScalingKeys[scalingEnd].mValue.x,
-	                           na->mScalingKeys[scalingEnd].mValue.y,
-	                           na->mScalingKeys[scalingEnd].mValue.z };
-	float scalingValMid[3];
-	vec3f_scalarMult(scalingValStart, (1-factor));
-	vec3f_scalarMult(scalingValEnd, factor);
-	vec3f_add_new(scalingValMid, scalingValStart, scalingValEnd);
-	float scalingMatrix[16];
-	mat4f_scaleVec_new(scalingMatrix, scalingValMid);
-	
-	// transformResult = translation * rotation * scaling
-	mat4f_mult_mat4f_new(transformResult, positionMatrix, rotationMatrix);
-	mat4f_mult_mat4f_new(transformResult, transformResult, scalingMatrix);
+	const struct aiVector3D *scaleStart = &na->mScalingKeys[scalingStart].mValue;
+	const struct aiVector3D *scaleEnd   = &na->mScalingKeys[scalingEnd].mValue;
+	vec3f_set(result->scale,
+	          (1-factor)*scaleStart->x + factor*scaleEnd->x,
+	          (1-factor)*scaleStart->y + factor*scaleEnd->y,
+	          (1-factor)*scaleStart->z + factor*scaleEnd->z);
 }
 
-/* Returns the transformation matrix for a node (without considering
- * the transformations of the parent node). If there is no animation
+/* Returns the transformation for a node (without considering the
+ * transformations of the parent node). If there is no animation
  * information, the matrix is stored in the node itself. If there is
  * animation information, we ignore the matrix in the node and instead
- * calculate a matrix based on the animation information.
+ * calculate a TRS transform based on the animation information.
+ *
+ * @param trs To be filled in with the transform for the requested
+ * node if it can be represented as a TRS transform.
  *
- * @param transformResult To be filled in with the matrix for the
- * requested node.
+ * @param matrix To be filled in with the matrix in the node if the
+ * node isn't animated.
  *
  * @param scene The ASSIMP scene object containing the node.
  *
@@ -2965,53 +3220,95 @@ static void kuhl_private_anim_matrix(float transformResult[16], const struct aiN
  * @param animationNum If the file contains more than one animation,
  * indicates which animation to use. If you don't know, set this to 0.
  *
- * @param t The time in seconds that you want the animation matrix
+ * @param t The time in seconds that you want the animation transform
  * for. If time is negative, this function is guaranteed to return the
  * transformation matrix in the node.
  *
- * @return Returns 1 if we successfully returned a matrix based on
- * animation information. Returns 0 if we simply returned the
- * transformation matrix in the node itself.
+ * @return Returns 1 if trs was filled in (from the animation
+ * information or from the node's matrix). Returns 0 if the node's
+ * matrix can't be represented as a TRS transform; only matrix is
+ * filled in.
  */
-static int kuhl_private_node_matrix(float transformResult[16],
-                                    const struct aiScene *scene,
-                                    const struct aiNode *node,
-                                    unsigned int animationNum, double t)
-{
-	/* Copy the transform matrix from the node itself. This is the
-	 * matrix that the user will see if we are unable to find the
-	 * requested animation matrix for this node. */
-	mat4f_from_aiMatrix4x4(transformResult, node->mTransformation);
-	
-	/* Return the transformation matrix from the node if: (1) The
-	 * requested animation number is too large. (2) A negative time
-	 * value is requested. */
-	if(animationNum >= scene->mNumAnimations || t < 0)
-		return 0;
-
-	struct aiAnimation *anim = scene->mAnimations[animationNum];
-
-	/* If the time value too large for the animation, return the
-	 * transformation matrix form the node. */
-	double currentTick = t * anim->mTicksPerSecond;
-	if(currentTick > anim->mDuration)
-		return 0;
-
+static int kuhl_private_node_transform(trsf *trs, float matrix[16],
+                                       const struct aiScene *scene,
+                                       const struct aiNode *node,
+                                       unsigned int animationNum, double t)
+{
 	/* Find the channel corresponding to the node name passed in as
-	 * parameter. */
-	for(unsigned int i=0; i<anim->mNumChannels; i++)
-	{
-		if(strcmp(anim->mChannels[i]->mNodeName.data, node->mName.data) == 0)
+	 * parameter. Use the transformation matrix from the node if: (1)
+	 * The requested animation number is too large. (2) A negative
+	 * time value is requested. (3) The time value is too large for
+	 * the animation. */
+	if(animationNum < scene->mNumAnimations && t >= 0)
+	{
+		struct aiAnimation *anim = scene->mAnimations[animationNum];
+		double currentTick = t * anim->mTicksPerSecond;
+		if(currentTick <= anim->mDuration)
 		{
-			/* Get this node's matrix according to the animation
-			 * information. */
-			struct aiNodeAnim *na = anim->mChannels[i];
-			kuhl_private_anim_matrix(transformResult, na, currentTick);
-			return 1;
+			for(unsigned int i=0; i<anim->mNumChannels; i++)
+			{
+				if(strcmp(anim->mChannels[i]->mNodeName.data, node->mName.data) == 0)
+				{
+					/* Get this node's transform according to the
+					 * animation information. */
+					kuhl_private_anim_trs(trs, anim->mChannels[i], currentTick);
+					return 1;
+				}
+			}
 		}
 	}
 
-	return 0;
+	/* Copy the transform matrix from the node itself. */
+	mat4f_from_aiMatrix4x4(matrix, node->mTransformation);
+	return trsf_from_mat4f(trs, matrix);
+}
+
+/* Calculates the matrix which transforms a node into the coordinates
+ * of the model by walking up the hierarchy to the root node.
+ *
+ * The transforms are composed as TRS transforms and converted into a
+ * matrix once at the end. If a node has a transform that can't be
+ * composed that way (a non-uniform scale on a node with rotated
+ * children, or a node matrix that includes shear), the rest of the
+ * walk multiplies matrices instead.
+ *
+ * @param result To be filled in with the matrix.
+ *
+ * See kuhl_private_node_transform() for the other parameters.
+ */
+static void kuhl_private_node_world_matrix(float result[16],
+                                           const struct aiScene *scene,
+                                           const struct aiNode *node,
+                                           unsigned int animationNum, double t)
+{
+	trsf accum;
+	trsf_identity(&accum);
+	int useMatrix = 0; // set to 1 once we switch to multiplying matrices
+	int first = 1;
+	for(; node != NULL; node = node->mParent)
+	{
+		trsf trs;
+		float matrix[16];
+		int isTrs = kuhl_private_node_transform(&trs, matrix, scene, node, animationNum, t);
+
+		/* accum = trs * accum */
+		if(!useMatrix && isTrs && (first || trsf_is_uniform(&trs)))
+			trsf_mult_trsf_new(&accum, &trs, &accum);
+		else
+		{
+			if(!useMatrix)
+			{
+				mat4f_from_trsf(result, &accum);
+				useMatrix = 1;
+			}
+			if(isTrs)
+				mat4f_from_trsf(matrix, &trs);
+			mat4f_mult_mat4f_new(result, matrix, result);
+		}
+		first = 0;
+	}
+	if(!useMatrix)
+		mat4f_from_trsf(result, &accum);
 }
 
 
@@ -3426,21 +3723,16 @@ void kuhl_update_model(kuhl_geometry *first_geom, unsigned int animationNum, flo
 			 * recalculate the transformation matrices for the nodes
 			 * near the root---potentially reducing performance.
 			 */
-			mat4f_identity(g->matrix);
-			do
-			{
-				float transform[16];
-				kuhl_private_node_matrix(transform, scene, node, animationNum, time);
-				mat4f_mult_mat4f_new(g->matrix, transform, g->matrix);
-				node = node->mParent;
-			} while(node != NULL);
+			kuhl_private_node_world_matrix(g->matrix, scene, node, animationNum, time);
 		}
 
 		/* Don't process bones if there aren't any. */
 		if(g->bones == NULL)
 			continue;
 
-		/* Update the list of bone matrices. */
+		/* Update the list of bone matrices. The bone offsets are
+		 * applied to all of the bones at once afterwards. */
+		float offsets[MAX_BONES][16];
 		for(int b=0; b < g->bones->count; b++) // For each bone
 		{
 			// Find the bone node and the bone itself.
@@ -3460,21 +3752,13 @@ void kuhl_update_model(kuhl_geometry *first_geom, unsigned int animationNum, flo
 			 * recalculate the transformation matrices for the nodes
 			 * near the root---potentially reducing performance.
 			 */
-			mat4f_identity(g->bones->matrices[b]);
-			do
-			{
-				float transform[16];
-				kuhl_private_node_matrix(transform, scene, node, animationNum, time);
-				mat4f_mult_mat4f_new(g->bones->matrices[b], transform, g->bones->matrices[b]);
-				node = node->mParent; // move to next node up
-			} while(node != NULL);
-
-			/* Also apply the bone offset */
-			float offset[16];
-			mat4f_from_aiMatrix4x4(offset, bone->mOffsetMatrix);
-			mat4f_mult_mat4f_new(g->bones->matrices[b], g->bones->matrices[b], offset);
+			kuhl_private_node_world_matrix(g->bones->matrices[b], scene, node, animationNum, time);
 
+			mat4f_from_aiMatrix4x4(offsets[b], bone->mOffsetMatrix);
 		} // end for each bone
+
+		/* Also apply the bone offsets */
+		mat4f_mult_mat4f_array(g->bones->matrices[0], g->bones->matrices[0], offsets[0], g->bones->count);
 	} // end for each geometry
 }
 
@@ -3500,6 +3784,7 @@ void kuhl_update_model(kuhl_geometry *first_geom, unsigned int animationNum, flo
 kuhl_geometry* kuhl_load_model(const char *modelFilename, const char *textureDirname,
                                GLuint program, float bbox[6])
 {
+	trace_begin("kuhl_load_model");
 	char *newModelFilename = kuhl_find_file(modelFilename);
 	// Loads the model from the file and reads in all of the textures:
 	const struct aiScene *scene = kuhl_private_assimp_load(newModelFilename, textureDirname);
@@ -3542,6 +3827,7 @@ kuhl_geometry* kuhl_load_model(const char *modelFilename, const char *textureDir
 		for(int i=0; i<6; i++)
 			bbox[i] = bboxLocal[i];
 	}
+	trace_end("kuhl_load_model");
 	return ret;
 }
 #endif // KUHL_UTIL_USE_ASSIMP
@@ -167,10 +167,14 @@ int kuhl_errorcheckFileLine(const char *file, int line, const char *func);
 void* kuhl_mallocFileLine(size_t size, const char *file, int line);
 
 GLFWwindow* kuhl_get_window();
+int kuhl_headless(void);
+GLuint kuhl_default_framebuffer(void);
 void kuhl_ogl_init(int *argcp, char **argv, int width, int height, int oglProfile, int msaaSamples);
 
 GLuint kuhl_create_shader(const char *filename, GLuint shader_type);
+GLuint kuhl_create_shader_source(const char *source, GLuint shader_type, const char *name);
 GLuint kuhl_create_program(const char *vertexFilename, const char *fragFilename);
+GLuint kuhl_link_program(GLuint program, const char *name);
 void kuhl_delete_program(GLuint program);
 void kuhl_print_program_log(GLuint program);
 void kuhl_print_program_info(GLuint program);
@@ -188,6 +192,7 @@ int kuhl_geometry_collide(kuhl_geometry *geom1, float mat1[16],
 
 void kuhl_geometry_new(kuhl_geometry *geom, GLuint program, unsigned int vertexCount, GLint primitive_type);
 void kuhl_geometry_draw(kuhl_geometry *geom);
+void kuhl_geometry_draw_instanced(kuhl_geometry *geom, GLsizei instanceCount);
 void kuhl_geometry_delete(kuhl_geometry *geom);
 unsigned int kuhl_geometry_count(const kuhl_geometry *geom);
 
@@ -196,6 +201,11 @@ GLfloat* kuhl_geometry_attrib_get(kuhl_geometry *geom, const char *name, GLint *
 void kuhl_geometry_indices(kuhl_geometry *geom, GLuint *indices, GLuint indexCount);
 void kuhl_geometry_attrib(kuhl_geometry *geom, const GLfloat *data, GLuint components, const char* name, int kg_options);
 void kuhl_geometry_texture(kuhl_geometry *geom, GLuint texture, const char* name, int kg_options);
+void kuhl_geometry_instance_attrib(kuhl_geometry *geom, GLuint bufferObject, GLintptr offset,
+                                   GLuint components, const char *name, int warnIfAttribMissing);
+void kuhl_geometry_buffer_attrib(kuhl_geometry *geom, GLuint bufferObject, GLintptr offset,
+                                 GLuint components, const char *name, int warnIfAttribMissing);
+GLuint kuhl_geometry_attrib_buffer(kuhl_geometry *geom, const char *name);
 
 
 GLuint kuhl_read_texture_array(const unsigned char* array, int width, int height, int components, GLuint wrapS, GLuint wrapT);
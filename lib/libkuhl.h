@@ -12,10 +12,16 @@
 
 #pragma once
 
+#include "benchmark.h"
+#include "boids.h"
 #include "bufferswap.h"
+#include "capture.h"
 #include "dgr.h"
+#include "dynres.h"
 #include "font-helper.h"
+#include "gputimer.h"
 #include "kalman.h"
+#include "kalman-batch.h"
 #include "kuhl-config.h"
 #include "kuhl-nodep.h"
 #include "kuhl-util.h"	
@@ -23,14 +29,24 @@
 #include "mousemove.h"
 #include "msg.h"
 #include "orient-sensor.h"
+#include "particles.h"
+#include "pick.h"
+#include "posering.h"
 #include "queue.h"
+#include "ringqueue.h"
 #include "serial.h"
+#ifdef __linux__
+#include "serial-reader.h"
+#endif
 #include "tdl-util.h"
+#include "tlist.h"
+#include "trace.h"
 #include "vecmat.h"
 #include "video.h"
 #include "viewmat.h"
 #include "vrpn-help.h"
 #include "windows-compat.h"
+#include "world-grid.h"
 
 #ifdef KUHL_UTIL_USE_IMAGEMAGICK
 #include "imageio.h"
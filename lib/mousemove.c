@@ -19,15 +19,19 @@
 
 #define EPSILON 0.0001
 
+/* The camera state is stored in double precision so that the camera
+ * can move far away from the origin without the position becoming
+ * imprecise. See mousemove_getd(). */
+
 /** Current camera lookat *point*. A lookat vector is created by
  * subtracting the lookat point from the camera position. */
-static float cam_lookat[3];
+static double cam_lookat[3];
 /** Current camera position */
-static float cam_position[3]; 
+static double cam_position[3]; 
 /** Current camera up vector. Since mousemove does not support roll,
  * this value is only changed when a user specifically sets it with
  * mousemove_set() or mousemove_setVec() */
-static float cam_up[3] = { 0.0f, 1.0f, 0.0f };
+static double cam_up[3] = { 0.0, 1.0, 0.0 };
 
 
 static float settings_rot_scale = 0.5f;  /**< amount to scale rotations  */
@@ -38,18 +42,18 @@ static float settings_trans_scale = .01f;/**< amount to scale translations */
 static int cur_button = -1; 
 static int last_x; /**< Last X coordinate of the mouse cursor */
 static int last_y; /**< Last Y coordinate of the mouse cursor */
-static float cam_lookat_down[3]; /**< The lookat vector when the mouse button was last pressed down */
-static float cam_position_down[3]; /**< The camera position when the mouse button was last pressed down */
+static double cam_lookat_down[3]; /**< The lookat vector when the mouse button was last pressed down */
+static double cam_position_down[3]; /**< The camera position when the mouse button was last pressed down */
 
 /** Internal function to move camera along the look at vector
  * @param dy Amount to translate camera down the lookVec
  * @param lookVec Vector pointing where camera is looking
  */
-void mousemove_translate_inout(int dy, const float lookVec[3]){
+void mousemove_translate_inout(int dy, const double lookVec[3]){
 	// Move the camera and lookat point along the look vector
 	for(int i=0; i<3; i++)
 	{
-		float offset = lookVec[i] * -dy * settings_trans_scale;
+		double offset = lookVec[i] * -dy * settings_trans_scale;
 		cam_position[i] = cam_position_down[i] - offset;
 		cam_lookat[i]   = cam_lookat_down[i]   - offset;
 	}
@@ -75,9 +79,24 @@ void mousemove_speed(float translationSpeed, float rotationSpeed)
  */
 void mousemove_get(float position[3], float lookAt[3], float up[3])
 {
-	vec3f_copy(position, cam_position);
-	vec3f_copy(lookAt, cam_lookat);
-	vec3f_copy(up, cam_up);
+	vec3f_from_vec3d(position, cam_position);
+	vec3f_from_vec3d(lookAt, cam_lookat);
+	vec3f_from_vec3d(up, cam_up);
+}
+
+/** Gets the currently used camera position, look at point, and up
+ * vector in double precision. Use this instead of mousemove_get()
+ * if the camera may be far away from the origin.
+ *
+ * @param position To be filled with the viewpoint position.
+ * @param lookAt To be filled with a point that the viewer is looking at.
+ * @param up To be filled with an up vector.
+ */
+void mousemove_getd(double position[3], double lookAt[3], double up[3])
+{
+	vec3d_copy(position, cam_position);
+	vec3d_copy(lookAt, cam_lookat);
+	vec3d_copy(up, cam_up);
 }
 
 /** Sets the currently used camera position, look at point, and up
@@ -91,9 +110,24 @@ void mousemove_get(float position[3], float lookAt[3], float up[3])
  */    
 void mousemove_setVec(const float position[3], const float lookAt[3], const float up[3])
 {
-	vec3f_copy(cam_position, position);
-	vec3f_copy(cam_lookat, lookAt);
-	vec3f_copy(cam_up, up);
+	vec3d_from_vec3f(cam_position, position);
+	vec3d_from_vec3f(cam_lookat, lookAt);
+	vec3d_from_vec3f(cam_up, up);
+}
+
+/** Sets the currently used camera position, look at point, and up
+ * vector in double precision.
+ *
+ * @param position The position to place the camera.
+ * @param lookAt The point that the camera is pointing at.
+ * @param up The camera's up vector.
+ * @see mousemove_setVec()
+ */
+void mousemove_setVecd(const double position[3], const double lookAt[3], const double up[3])
+{
+	vec3d_copy(cam_position, position);
+	vec3d_copy(cam_lookat, lookAt);
+	vec3d_copy(cam_up, up);
 }
 
 /** Sets the currently used camera position, look at point, and up
@@ -117,9 +151,9 @@ void mousemove_set(float posX, float posY, float posZ,
                    float lookX, float lookY, float lookZ,
                    float upX, float upY, float upZ)
 {
-	vec3f_set(cam_position, posX, posY, posZ);
-	vec3f_set(cam_lookat, lookX, lookY, lookZ);
-	vec3f_set(cam_up, upX, upY, upZ);
+	vec3d_set(cam_position, posX, posY, posZ);
+	vec3d_set(cam_lookat, lookX, lookY, lookZ);
+	vec3d_set(cam_up, upX, upY, upZ);
 }
 
 /** Creates a rotation matrix and multiplies a point by the rotation
@@ -132,14 +166,14 @@ void mousemove_set(float posX, float posY, float posZ,
  * @param point The point that should be rotated and the location to
  * store the result in.
  */
-static void mousemove_private_rotate_point(float degrees, float axis[3], float point[3])
+static void mousemove_private_rotate_point(double degrees, double axis[3], double point[3])
 {
 	if(fabs(degrees) < EPSILON)
 		return;
 
-	float m[9];
-	mat3f_rotateAxisVec_new(m,degrees,axis);
-	mat3f_mult_vec3f_new(point, m, point);
+	double m[9];
+	mat3d_rotateAxisVec_new(m,degrees,axis);
+	mat3d_mult_vec3d_new(point, m, point);
 }
 
 
@@ -163,14 +197,14 @@ void mousemove_buttonPress(int down, int leftMidRight, int x, int y)
 		last_y = y;
 
 		// Store camera position & lookat when mouse button is pressed
-		vec3f_copy(cam_lookat_down, cam_lookat);
-		vec3f_copy(cam_position_down, cam_position);
+		vec3d_copy(cam_lookat_down, cam_lookat);
+		vec3d_copy(cam_position_down, cam_position);
 		if(leftMidRight>2)
 		{
-			float lookAt[3];
+			double lookAt[3];
 			// Calculate a new vector pointing from the camera to the
 			// look at point and normalize it.
-			vec3f_sub_new(lookAt,cam_lookat_down,cam_position_down);
+			vec3d_sub_new(lookAt,cam_lookat_down,cam_position_down);
 			if(cur_button == 3) // scroll up (zoom in)
 				mousemove_translate_inout(y,lookAt);
 			else // cur_button = 4
@@ -198,34 +232,34 @@ int mousemove_movement(int x, int y)
 	int dx = x-last_x;
 	int dy = y-last_y;
 	/* Vectors to store our orthonormal basis. */
-	float f[3], r[3], u[3];
+	double f[3], r[3], u[3];
 
 	// Calculate a new vector pointing from the camera to the
 	// look at point and normalize it.
-	vec3f_sub_new(f,cam_lookat_down,cam_position_down);
-	vec3f_normalize(f);
+	vec3d_sub_new(f,cam_lookat_down,cam_position_down);
+	vec3d_normalize(f);
 
 	// Get our up vector
-	vec3f_copy(u,cam_up);
+	vec3d_copy(u,cam_up);
 
 	// Get a right vector based on the up and lookat vector.
-	vec3f_cross_new(r, f, u);
+	vec3d_cross_new(r, f, u);
 
 	// If right vector was short, then look vector was pointing in
 	// nearly the same direction as the up vector.
-	if(vec3f_normSq(r) < EPSILON)
+	if(vec3d_normSq(r) < EPSILON)
 	{
 		//printf("mousemove: whoops, pointed camera at up vector.");
 		// move the up vector slightly and try again:
-		u[0] += 0.05f;
-		vec3f_cross_new(r,f,u);
+		u[0] += 0.05;
+		vec3d_cross_new(r,f,u);
 	}
-	vec3f_normalize(r);
+	vec3d_normalize(r);
 
 	// recalculate the up vector from the right vector and up vector
 	// to ensure we have a an orthonormal basis.
-	vec3f_cross_new(u, r, f);
-	vec3f_normalize(u);
+	vec3d_cross_new(u, r, f);
+	vec3d_normalize(u);
 
 	switch(cur_button)
 	{
@@ -235,7 +269,7 @@ int mousemove_movement(int x, int y)
 			 * appropriately depending on the type of mouse movement.  */
 			for(int i=0; i<3; i++)
 			{
-				float offset = r[i]*dx*settings_trans_scale + -u[i]*dy*settings_trans_scale;
+				double offset = r[i]*dx*settings_trans_scale + -u[i]*dy*settings_trans_scale;
 				cam_position[i] = cam_position_down[i] - offset;
 				cam_lookat[i]   = cam_lookat_down[i]   - offset;
 			}
@@ -253,12 +287,12 @@ int mousemove_movement(int x, int y)
 			// If the mouse is moved up/down, rotate the facing vector
 			// around the right vector.
 			mousemove_private_rotate_point(dy*settings_rot_scale, r, f);
-			vec3f_normalize(f);
+			vec3d_normalize(f);
 
 			// Add new facing vector to the position that the camera
 			// was at when the button was first pressed to get a new
 			// lookat point.
-			vec3f_add_new(cam_lookat, cam_position_down, f);
+			vec3d_add_new(cam_lookat, cam_position_down, f);
 			break;
 	}
 
@@ -62,7 +62,9 @@ void mousemove_setVec(const float position[3], const float lookAt[3], const floa
 void mousemove_set(float posX, float posY, float posZ,
                    float lookX, float lookY, float lookZ,
                    float upX, float upY, float upZ);
+void mousemove_setVecd(const double position[3], const double lookAt[3], const double up[3]);
 void mousemove_get(float position[3], float lookAt[3], float up[3]);
+void mousemove_getd(double position[3], double lookAt[3], double up[3]);
 void mousemove_speed(float translationSpeed, float rotationSpeed);
 
 #ifdef __cplusplus
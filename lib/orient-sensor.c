@@ -23,6 +23,40 @@
 #include <stdlib.h>
 #include <stdint.h> /* uint8_t */
 #include <time.h>
+#ifdef ORIENT_SENSOR_THREADED
+#include "serial-reader.h"
+#endif
+
+/* Each BNO055 record contains 1 sanity check float, 4 floats for the
+ * quaternion and 4 more bytes for calibration data. The sanity check
+ * float is always 123.456. */
+#define BNO055_RECORD_SIZE (4+4*4+4)
+#define BNO055_MAGIC 0x42f6e979 // hex for the 123.456 float sent from arduino
+
+#ifdef ORIENT_SENSOR_THREADED
+/** State shared with the thread that reads from the sensor. */
+struct orient_sensor_thread
+{
+	serial_reader *reader;
+	pose_ring *ring;      /**< Orientations received from the sensor */
+	uint32_t calibration; /**< Calibration bytes from the newest record */
+};
+
+/** Called on the reader thread for each record from a BNO055 sensor. */
+static void orient_sensor_bno055_record(const unsigned char *record, long usec, void *userdata)
+{
+	struct orient_sensor_thread *t = (struct orient_sensor_thread*) userdata;
+	pose_sample s;
+	memset(&s, 0, sizeof(pose_sample));
+	s.usec = usec;
+	memcpy(s.quat, record+4, sizeof(float)*4);
+	pose_ring_add(t->ring, &s);
+
+	uint32_t calibration;
+	memcpy(&calibration, record+4*5, 4);
+	__atomic_store_n(&t->calibration, calibration, __ATOMIC_RELAXED);
+}
+#endif
 
 /** Opens a connection to the orientation sensor.
 
@@ -74,12 +108,26 @@ OrientSensorState orient_sensor_init(const char* deviceFileIn, int sensorType)
 	state.isWorking = 0;
 	state.type = sensorType;
 	state.lastDataTime = 0;
+	state.thread = NULL;
 	for(int i=0; i<4; i++)
 		state.lastData[i] = 0.0;
+	state.lastData[3] = 1; // identity until we receive data
 
 	/* Create connection, apply proper tty settings */
 	if(sensorType == ORIENT_SENSOR_BNO055)
 	{
+#ifdef ORIENT_SENSOR_THREADED
+		struct orient_sensor_thread *t = (struct orient_sensor_thread*) calloc(1, sizeof(struct orient_sensor_thread));
+		t->ring = pose_ring_new(64);
+		unsigned char magic[4];
+		int32_t v = BNO055_MAGIC;
+		memcpy(magic, &v, 4);
+		t->reader = serial_reader_new(deviceFile, 115200, magic, 4, BNO055_RECORD_SIZE,
+		                              orient_sensor_bno055_record, t);
+		state.thread = t;
+		state.fd = -1;
+		return state;
+#endif
 		state.fd = serial_open(deviceFile, 115200, 0, 1, 5);
 		// we will find the magic byte at the start of a record in our get() function.
 	}
@@ -91,16 +139,87 @@ OrientSensorState orient_sensor_init(const char* deviceFileIn, int sensorType)
 
 
 
+/** Periodically prints messages about the calibration status bytes
+ * sent by the BNO055 sensor. */
+static void orient_sensor_bno055_calibration(const uint8_t calib[4])
+{
+	static int calibrationMessage = 100;
+	uint8_t sys, gyro, accel, mag;
+	sys    = calib[0];
+	gyro   = calib[1];
+	accel  = calib[2];
+	mag    = calib[3];
+	calibrationMessage--;
+	if(calibrationMessage < 0)
+	{
+		calibrationMessage = 1000;
+		
+		if(sys == 0)
+			msg(MSG_ERROR, "Sensor is uncalibrated.");
+		else if (sys == 1)
+			msg(MSG_WARNING, "Sensor calibration is poor.");
+
+		if(gyro == 0)
+			msg(MSG_WARNING, "Gyro is uncalibrated. Let sensor sit still.");
+		else if(gyro == 1)
+			msg(MSG_WARNING, "Gyro calibration is poor. Let sensor sit still.");
+
+		if(accel == 0)
+			msg(MSG_WARNING, "Accelerometer is uncalibrated. Place sensor on 6 sides of block.");
+		else if(accel == 1)
+			msg(MSG_WARNING, "Accelerometer calibration is poor. Place sensor on 6 sides of block.");
+		
+		if(mag == 0)
+			msg(MSG_WARNING, "Magnetometer is uncalibrated. Use figure 8 motion.");
+		else if(mag == 1)
+			msg(MSG_WARNING, "Magnetometer calibration is poor. Use figure 8 motion.");
+
+		if(sys < 2 || gyro < 2 || accel < 2 || mag < 2)
+			msg(MSG_BLUE, "Raw orientation sensor calib data: sys=%d gyro=%d accel=%d mag=%d", sys, gyro, accel, mag);
+	}
+}
+
 static void orient_sensor_get_dsight(OrientSensorState *state, float quaternion[4])
 {
 
 }
 
+#ifdef ORIENT_SENSOR_THREADED
+/** Gets the newest orientation received by the reader thread. Never
+ * blocks. */
 static void orient_sensor_get_bno055(OrientSensorState *state, float quaternion[4])
 {
-// 1 sanity check float, 4 floats for quat, 4 more bytes for calibration data
-#define RECORD_SIZE 4+4*4+4
-	static int calibrationMessage = 100;
+	struct orient_sensor_thread *t = state->thread;
+	pose_sample newest;
+	int haveData = pose_ring_newest(t->ring, &newest);
+
+	/* Check how old the newest data is. */
+	if(!haveData || kuhl_microseconds() - newest.usec >= 2000000)
+	{
+		if(state->isWorking)
+			msg(MSG_WARNING, "We haven't received a new record from the orientation sensor in the past couple seconds. Is sensor still connected?");
+		state->isWorking = 0;
+	}
+	else if(state->isWorking == 0)
+	{
+		msg(MSG_INFO, "Receiving data from orientation sensor.\n");
+		state->isWorking = 1;
+	}
+
+	if(haveData)
+	{
+		memcpy(state->lastData, newest.quat, sizeof(float)*4);
+		state->lastDataTime = (int) (newest.usec / 1000000);
+
+		uint32_t calibration = __atomic_load_n(&t->calibration, __ATOMIC_RELAXED);
+		orient_sensor_bno055_calibration((const uint8_t*) &calibration);
+	}
+	memcpy(quaternion, state->lastData, sizeof(float)*4);
+}
+#else
+static void orient_sensor_get_bno055(OrientSensorState *state, float quaternion[4])
+{
+#define RECORD_SIZE BNO055_RECORD_SIZE
 
 	int options = SERIAL_NONE;
 	if(state->isWorking == 0)
@@ -150,7 +269,7 @@ static void orient_sensor_get_bno055(OrientSensorState *state, float quaternion[
 
 
 	/* Look for magic bytes at beginning of record */
-	int32_t v = 0x42f6e979; // hex for the 123.456 float sent from arduino	
+	int32_t v = BNO055_MAGIC;
 	while(memcmp(temp, &v, 4) != 0)
 	{
 		/* While we are here, the first bytes of the record didn't
@@ -199,45 +318,13 @@ static void orient_sensor_get_bno055(OrientSensorState *state, float quaternion[
 	state->lastDataTime = time(NULL);
 	// msg(MSG_GREEN, "Record OK");
 
-	uint8_t sys, gyro, accel, mag;
-	sys    = temp[4*5+0];
-	gyro   = temp[4*5+1];
-	accel  = temp[4*5+2];
-	mag    = temp[4*5+3];
-	calibrationMessage--;
-	if(calibrationMessage < 0)
-	{
-		calibrationMessage = 1000;
-		
-		if(sys == 0)
-			msg(MSG_ERROR, "Sensor is uncalibrated.");
-		else if (sys == 1)
-			msg(MSG_WARNING, "Sensor calibration is poor.");
-
-		if(gyro == 0)
-			msg(MSG_WARNING, "Gyro is uncalibrated. Let sensor sit still.");
-		else if(gyro == 1)
-			msg(MSG_WARNING, "Gyro calibration is poor. Let sensor sit still.");
-
-		if(accel == 0)
-			msg(MSG_WARNING, "Accelerometer is uncalibrated. Place sensor on 6 sides of block.");
-		else if(accel == 1)
-			msg(MSG_WARNING, "Accelerometer calibration is poor. Place sensor on 6 sides of block.");
-		
-		if(mag == 0)
-			msg(MSG_WARNING, "Magnetometer is uncalibrated. Use figure 8 motion.");
-		else if(mag == 1)
-			msg(MSG_WARNING, "Magnetometer calibration is poor. Use figure 8 motion.");
-
-		if(sys < 2 || gyro < 2 || accel < 2 || mag < 2)
-			msg(MSG_BLUE, "Raw orientation sensor calib data: sys=%d gyro=%d accel=%d mag=%d", sys, gyro, accel, mag);
-	}
-	// msg(MSG_INFO, "sys=%d gyro=%d accel=%d mag=%d", sys, gyro, accel, mag);
+	orient_sensor_bno055_calibration((const uint8_t*) temp+4*5);
 
 	/* Copy data from our buffer into quaternion buffer and into the lastData buffer */
 	memcpy(quaternion, temp+4, sizeof(float)*4);
 	memcpy(state->lastData, quaternion, sizeof(float)*4);
 }
+#endif
 
 
 
@@ -258,3 +345,35 @@ void orient_sensor_get(OrientSensorState *state, float quaternion[4])
 			orient_sensor_get_dsight(state, quaternion);
 	}
 }
+
+/** Returns the recent orientations received from the sensor along with
+    the time each one was received, or NULL if they are not
+    available. The history can be used to estimate the angular
+    velocity of the sensor.
+*/
+const pose_ring* orient_sensor_history(const OrientSensorState *state)
+{
+#ifdef ORIENT_SENSOR_THREADED
+	if(state->thread != NULL)
+		return state->thread->ring;
+#endif
+	return NULL;
+}
+
+/** Stops reading from the sensor and closes the connection. */
+void orient_sensor_close(OrientSensorState *state)
+{
+#ifdef ORIENT_SENSOR_THREADED
+	if(state->thread)
+	{
+		serial_reader_free(state->thread->reader);
+		pose_ring_free(state->thread->ring);
+		free(state->thread);
+		state->thread = NULL;
+		return;
+	}
+#endif
+	if(state->fd >= 0)
+		serial_close(state->fd);
+	state->fd = -1;
+}
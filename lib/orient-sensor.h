@@ -8,10 +8,19 @@
 */
 
 #pragma once
+#include "posering.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* On Linux, the sensor is read on a background thread (see
+ * serial-reader.c) so that orient_sensor_get() never blocks. */
+#ifdef __linux__
+#define ORIENT_SENSOR_THREADED 1
+#endif
+
+struct orient_sensor_thread;
+
 /** This enum is used by some serial related functions */
 enum
 {
@@ -28,11 +37,14 @@ typedef struct
 	int lastDataTime; /**< What time did we receive the data in lastData? */
 	int isWorking; /**< Set to 1 when we have successfully received data */
 	int type;
+	struct orient_sensor_thread *thread; /**< Background reader, NULL if not used */
 } OrientSensorState;
 
 	
 OrientSensorState orient_sensor_init(const char* deviceFile, int sensorType);
 void orient_sensor_get(OrientSensorState *state, float quaternion[4]);
+const pose_ring* orient_sensor_history(const OrientSensorState *state);
+void orient_sensor_close(OrientSensorState *state);
 
 	
 #ifdef __cplusplus
@@ -0,0 +1,453 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   particles.c simulates particles on the GPU. The position and
+   velocity of each particle are stored in OpenGL buffer objects and
+   are updated with transform feedback, so they never need to be
+   copied to or from the CPU. This allows millions of particles to be
+   updated every frame.
+
+   Each particle has a position and a velocity (three floats each,
+   tightly packed, in separate buffers). There are two copies of each
+   buffer: particles_update() reads one and writes the other, then the
+   two are swapped. After each update, particles_position_buffer()
+   returns the buffer with the new positions. It can be drawn directly,
+   for example, by connecting it to a kuhl_geometry with
+   kuhl_geometry_buffer_attrib().
+
+   Particles are accelerated by gravity and can bounce off of a
+   horizontal floor. The initial state can be uploaded from the CPU
+   (particles_upload()) or filled in on the GPU from other buffers,
+   such as the vertices and normals of a model
+   (particles_copy_positions() and particles_set_velocities()).
+
+   Transform feedback is part of OpenGL 3.0, so this works with the
+   OpenGL 3.2 core profile that the rest of the library uses (compute
+   shaders would require OpenGL 4.3).
+ */
+
+#include <stdlib.h>
+#include <GL/glew.h>
+
+#include "particles.h"
+#include "msg.h"
+#include "kuhl-util.h"
+
+/** A GPU particle system. Use particles_new() to create one. */
+struct particles
+{
+	GLuint count;
+	GLuint position[2];    /**< Two copies of the positions */
+	GLuint velocity[2];    /**< Two copies of the velocities */
+	int current;           /**< Which copy holds the current state */
+	GLuint updateVao[2];   /**< Reads from copy 0 or 1 */
+	GLuint velocityVao;
+	float gravity[3];
+	int floorEnabled;
+	float floorHeight;
+	float floorEnergyKept;
+	unsigned int seed;     /**< Changes every time random velocities are generated */
+};
+
+/* Moves each particle forward in time. */
+static const char *particlesUpdateVertex =
+	"#version 150\n"
+	"in vec3 in_Position;\n"
+	"in vec3 in_Velocity;\n"
+	"uniform float dt;\n"
+	"uniform vec3 gravity;\n"
+	"uniform int floorEnabled;\n"
+	"uniform float floorHeight;\n"
+	"uniform float floorEnergyKept;\n"
+	"out vec3 out_Position;\n"
+	"out vec3 out_Velocity;\n"
+	"void main()\n"
+	"{\n"
+	"	vec3 pos = in_Position + dt * (in_Velocity + dt * gravity / 2);\n"
+	"	vec3 vel = in_Velocity + dt * gravity;\n"
+	"	if(floorEnabled != 0 && pos.y < floorHeight)\n"
+	"	{\n"
+	"		// reflect off of the floor and lose energy\n"
+	"		pos.y = floorHeight + (floorHeight - pos.y) * floorEnergyKept;\n"
+	"		vel.y = -vel.y;\n"
+	"		vel *= floorEnergyKept;\n"
+	"	}\n"
+	"	out_Position = pos;\n"
+	"	out_Velocity = vel;\n"
+	"}\n";
+
+/* Sets velocities from a buffer of vectors (such as normals). */
+static const char *particlesVelocityVertex =
+	"#version 150\n"
+	"in vec3 in_Source;\n"
+	"uniform float scale;\n"
+	"uniform vec3 add;\n"
+	"uniform float jitter;\n"
+	"uniform uint seed;\n"
+	"out vec3 out_Velocity;\n"
+	"float random(uint n) // hash an integer into [0,1]\n"
+	"{\n"
+	"	n = (n << 13u) ^ n;\n"
+	"	n = n * (n * n * 15731u + 789221u) + 1376312589u;\n"
+	"	return float(n & 0x7fffffffu) / float(0x7fffffff);\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"	uint n = (uint(gl_VertexID) + seed) * 3u;\n"
+	"	vec3 r = vec3(random(n), random(n+1u), random(n+2u)) - .5;\n"
+	"	out_Velocity = in_Source * scale + add + r * jitter;\n"
+	"}\n";
+
+/* A fragment program is required to link, but nothing is rasterized. */
+static const char *particlesFragment =
+	"#version 150\n"
+	"void main()\n"
+	"{\n"
+	"}\n";
+
+static GLuint particles_update_program = 0;
+static GLuint particles_velocity_program = 0;
+
+/** Creates a program which writes the given outputs with transform
+ * feedback. The name is used in error messages. */
+static GLuint particles_link(const char *vertex, const char *name, const char **varyings, int varyingCount)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, kuhl_create_shader_source(vertex, GL_VERTEX_SHADER, name));
+	glAttachShader(program, kuhl_create_shader_source(particlesFragment, GL_FRAGMENT_SHADER, "particlesFragment"));
+	glTransformFeedbackVaryings(program, varyingCount, varyings, GL_SEPARATE_ATTRIBS);
+	return kuhl_link_program(program, name);
+}
+
+/** Connects a buffer of vec3s to an attribute in the current VAO. */
+static void particles_attrib(GLuint program, const char *name, GLuint buffer, GLintptr offset)
+{
+	GLint location = glGetAttribLocation(program, name);
+	if(location < 0)
+		return;
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(location);
+	glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*) offset);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/** Creates a particle system. All particles start at the origin and
+    are not moving. Gravity is (0,-1,0) and the floor is disabled.
+
+    @param count The number of particles.
+
+    @return The new particle system. Exits if the particle system
+    can't be created.
+*/
+particles* particles_new(GLuint count)
+{
+	if(particles_update_program == 0)
+	{
+		const char *updateVaryings[] = { "out_Position", "out_Velocity" };
+		const char *velocityVaryings[] = { "out_Velocity" };
+		particles_update_program = particles_link(particlesUpdateVertex, "particlesUpdateVertex", updateVaryings, 2);
+		particles_velocity_program = particles_link(particlesVelocityVertex, "particlesVelocityVertex", velocityVaryings, 1);
+	}
+
+	particles *p = (particles*) kuhl_malloc(sizeof(particles));
+	p->count = count;
+	p->current = 0;
+	p->gravity[0] = 0;
+	p->gravity[1] = -1;
+	p->gravity[2] = 0;
+	p->floorEnabled = 0;
+	p->floorHeight = 0;
+	p->floorEnergyKept = 1;
+	p->seed = 0;
+
+	GLsizeiptr size = (GLsizeiptr) count * 3 * sizeof(float);
+	glGenBuffers(2, p->position);
+	glGenBuffers(2, p->velocity);
+	float *zeros = (float*) calloc(count > 0 ? count*3 : 1, sizeof(float));
+	if(zeros == NULL)
+	{
+		msg(MSG_FATAL, "Unable to allocate memory for %u particles.", count);
+		exit(EXIT_FAILURE);
+	}
+	for(int i=0; i<2; i++)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, p->position[i]);
+		glBufferData(GL_ARRAY_BUFFER, size, zeros, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, p->velocity[i]);
+		glBufferData(GL_ARRAY_BUFFER, size, zeros, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(zeros);
+
+	GLint previousVAO = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+	glGenVertexArrays(2, p->updateVao);
+	for(int i=0; i<2; i++)
+	{
+		glBindVertexArray(p->updateVao[i]);
+		particles_attrib(particles_update_program, "in_Position", p->position[i], 0);
+		particles_attrib(particles_update_program, "in_Velocity", p->velocity[i], 0);
+	}
+	glGenVertexArrays(1, &p->velocityVao);
+	glBindVertexArray(previousVAO);
+
+	kuhl_errorcheck();
+	return p;
+}
+
+/** Deletes a particle system and the buffers it created. */
+void particles_delete(particles *p)
+{
+	if(p == NULL)
+		return;
+	glDeleteBuffers(2, p->position);
+	glDeleteBuffers(2, p->velocity);
+	glDeleteVertexArrays(2, p->updateVao);
+	glDeleteVertexArrays(1, &p->velocityVao);
+	free(p);
+}
+
+/** Returns the number of particles in the particle system. */
+GLuint particles_count(const particles *p)
+{
+	return p->count;
+}
+
+/** Returns 1 if the range of particles is valid. */
+static int particles_check_range(const particles *p, GLuint first, GLuint count)
+{
+	if(first > p->count || count > p->count - first)
+	{
+		msg(MSG_ERROR, "Particles %u to %u don't exist (there are %u particles).",
+		    first, first+count, p->count);
+		return 0;
+	}
+	return 1;
+}
+
+/** Copies positions and/or velocities from the CPU into the particle
+    system.
+
+    @param p The particle system.
+
+    @param first The first particle to change.
+
+    @param count The number of particles to change.
+
+    @param positions count*3 floats, or NULL to leave the positions
+    unchanged.
+
+    @param velocities count*3 floats, or NULL to leave the velocities
+    unchanged.
+*/
+void particles_upload(particles *p, GLuint first, GLuint count,
+                      const float *positions, const float *velocities)
+{
+	if(!particles_check_range(p, first, count))
+		return;
+	GLintptr offset = (GLintptr) first * 3 * sizeof(float);
+	GLsizeiptr size = (GLsizeiptr) count * 3 * sizeof(float);
+	if(positions != NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, p->position[p->current]);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, positions);
+	}
+	if(velocities != NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, p->velocity[p->current]);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, velocities);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	kuhl_errorcheck();
+}
+
+/** Copies positions from another buffer object into the particle
+    system without going through the CPU. For example, the vertices
+    of a model (see kuhl_geometry_attrib_buffer()) can be turned into
+    particles.
+
+    @param p The particle system.
+
+    @param first The first particle to change.
+
+    @param count The number of particles to change.
+
+    @param buffer A buffer containing three floats per particle.
+
+    @param offset The offset (in bytes) of the first position in buffer.
+*/
+void particles_copy_positions(particles *p, GLuint first, GLuint count,
+                              GLuint buffer, GLintptr offset)
+{
+	if(!particles_check_range(p, first, count))
+		return;
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, p->position[p->current]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset,
+	                    (GLintptr) first * 3 * sizeof(float),
+	                    (GLsizeiptr) count * 3 * sizeof(float));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	kuhl_errorcheck();
+}
+
+/** Sets the velocities of particles on the GPU. Each velocity is set
+    to:
+
+    source * scale + add + random
+
+    where source is a vector from a buffer (for example, the normals
+    of a model), and each component of random is between -jitter/2
+    and jitter/2.
+
+    @param p The particle system.
+
+    @param first The first particle to change.
+
+    @param count The number of particles to change.
+
+    @param buffer A buffer containing three floats per particle, or 0
+    to use (0,0,0) as the source for all of the particles.
+
+    @param offset The offset (in bytes) of the first vector in buffer.
+
+    @param scale The amount to scale the source vectors by.
+
+    @param add A vector added to each velocity (NULL for none).
+
+    @param jitter The amount of randomness to add.
+*/
+void particles_set_velocities(particles *p, GLuint first, GLuint count,
+                              GLuint buffer, GLintptr offset,
+                              float scale, const float add[3], float jitter)
+{
+	if(!particles_check_range(p, first, count) || count == 0)
+		return;
+
+	GLint previousProgram = 0, previousVAO = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+
+	GLuint program = particles_velocity_program;
+	glUseProgram(program);
+	glBindVertexArray(p->velocityVao);
+	GLint location = glGetAttribLocation(program, "in_Source");
+	if(location >= 0)
+	{
+		if(buffer != 0)
+			particles_attrib(program, "in_Source", buffer, offset);
+		else
+		{
+			glDisableVertexAttribArray(location);
+			glVertexAttrib3f(location, 0, 0, 0);
+		}
+	}
+	glUniform1f(glGetUniformLocation(program, "scale"), scale);
+	if(add != NULL)
+		glUniform3fv(glGetUniformLocation(program, "add"), 1, add);
+	else
+		glUniform3f(glGetUniformLocation(program, "add"), 0, 0, 0);
+	glUniform1f(glGetUniformLocation(program, "jitter"), jitter);
+	glUniform1ui(glGetUniformLocation(program, "seed"), p->seed);
+	p->seed += count;
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, p->velocity[p->current],
+	                  (GLintptr) first * 3 * sizeof(float), (GLsizeiptr) count * 3 * sizeof(float));
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, count);
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	glBindVertexArray(previousVAO);
+	glUseProgram(previousProgram);
+	kuhl_errorcheck();
+}
+
+/** Sets the acceleration due to gravity (default: 0,-1,0). */
+void particles_set_gravity(particles *p, const float accel[3])
+{
+	for(int i=0; i<3; i++)
+		p->gravity[i] = accel[i];
+}
+
+/** Makes particles bounce off of a horizontal floor.
+
+    @param p The particle system.
+
+    @param enabled 1 to enable the floor, 0 to disable it (the default).
+
+    @param height The y coordinate of the floor.
+
+    @param energyKept The fraction of the velocity that a particle
+    keeps when it bounces (1 is a perfect bounce).
+*/
+void particles_set_floor(particles *p, int enabled, float height, float energyKept)
+{
+	p->floorEnabled = enabled;
+	p->floorHeight = height;
+	p->floorEnergyKept = energyKept;
+}
+
+/** Moves all of the particles forward in time.
+
+    @param p The particle system.
+
+    @param dt The amount of time to move forward.
+*/
+void particles_update(particles *p, float dt)
+{
+	if(p->count == 0)
+		return;
+
+	GLint previousProgram = 0, previousVAO = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+
+	GLuint program = particles_update_program;
+	glUseProgram(program);
+	glUniform1f(glGetUniformLocation(program, "dt"), dt);
+	glUniform3fv(glGetUniformLocation(program, "gravity"), 1, p->gravity);
+	glUniform1i(glGetUniformLocation(program, "floorEnabled"), p->floorEnabled);
+	glUniform1f(glGetUniformLocation(program, "floorHeight"), p->floorHeight);
+	glUniform1f(glGetUniformLocation(program, "floorEnergyKept"), p->floorEnergyKept);
+
+	/* Read the current copy and write into the other one. */
+	int next = 1 - p->current;
+	glBindVertexArray(p->updateVao[p->current]);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, p->position[next]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, p->velocity[next]);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, p->count);
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	p->current = next;
+
+	glBindVertexArray(previousVAO);
+	glUseProgram(previousProgram);
+	kuhl_errorcheck();
+}
+
+/** Returns the buffer holding the current position of each particle
+ * (three floats per particle). The buffer changes after each call to
+ * particles_update(). */
+GLuint particles_position_buffer(const particles *p)
+{
+	return p->position[p->current];
+}
+
+/** Returns the buffer holding the current velocity of each particle
+ * (three floats per particle). The buffer changes after each call to
+ * particles_update(). */
+GLuint particles_velocity_buffer(const particles *p)
+{
+	return p->velocity[p->current];
+}
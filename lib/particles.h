@@ -0,0 +1,40 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * A particle system which is simulated entirely on the GPU. See
+ * particles.c for details.
+ */
+
+#pragma once
+#include <GL/glew.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct particles particles;
+
+particles* particles_new(GLuint count);
+void   particles_delete(particles *p);
+GLuint particles_count(const particles *p);
+
+void particles_upload(particles *p, GLuint first, GLuint count,
+                      const float *positions, const float *velocities);
+void particles_copy_positions(particles *p, GLuint first, GLuint count,
+                              GLuint buffer, GLintptr offset);
+void particles_set_velocities(particles *p, GLuint first, GLuint count,
+                              GLuint buffer, GLintptr offset,
+                              float scale, const float add[3], float jitter);
+
+void particles_set_gravity(particles *p, const float accel[3]);
+void particles_set_floor(particles *p, int enabled, float height, float energyKept);
+void particles_update(particles *p, float dt);
+
+GLuint particles_position_buffer(const particles *p);
+GLuint particles_velocity_buffer(const particles *p);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -0,0 +1,447 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   Finds which object is under a pixel (e.g., under a cursor) without
+   stalling the GPU.
+
+   Reading a pixel from the framebuffer with glReadPixels() makes the
+   CPU wait until the GPU has finished drawing everything that was
+   drawn before it. Instead, pick.c draws the objects a second time
+   into a small offscreen framebuffer (created with
+   kuhl_gen_framebuffer()) which has an integer color attachment. Each
+   pixel stores an object ID and the ID of the primitive (triangle,
+   line, etc.) within that object. The pixels are copied into a pixel
+   buffer object and a fence is inserted. On a later frame, after the
+   fence signals, the pixels are read from the buffer object without
+   waiting and a callback receives the result.
+
+   The offscreen framebuffer only covers the pixels around the
+   requested pixel: The projection matrix is adjusted so that just
+   those pixels fill the framebuffer (like gluPickMatrix()), so
+   drawing the IDs is cheap. Nothing is drawn or read unless a pick
+   has been requested, so picking costs nothing when it isn't used.
+
+   Usage:
+   - Call pick_request() to ask for a pick at a pixel.
+   - Each frame, after drawing the scene into a viewport, call
+     pick_begin(). If it returns 1, call pick_draw() for each object
+     that can be picked (and for anything that might hide those
+     objects, with an object ID of 0) and then call pick_end().
+   - The callback is called from pick_begin() or pick_poll() during a
+     later frame.
+   - viewmat_end_frame() calls pick_end_frame(). If a whole frame
+     passes without a pick_begin() call whose viewport contains the
+     pixel, the pick ends and the callback receives an object ID of 0.
+     Programs that don't use viewmat_end_frame() should call
+     pick_end_frame() at the end of each frame.
+   - pick_cancel() abandons a pick without calling the callback.
+
+   Only one pick can be in progress at a time. pick_draw() draws only
+   vertex positions and ignores bones, so animated characters are
+   picked in their rest pose. See samples/picker.c for an example.
+ */
+
+#include <stdlib.h>
+#include <GL/glew.h>
+
+#include "pick.h"
+#include "msg.h"
+#include "kuhl-util.h"
+#include "vecmat.h"
+
+/** Largest radius (in pixels) around the requested pixel that can be
+ * searched for an object. */
+#define PICK_MAX_RADIUS 16
+#define PICK_MAX_SIZE (PICK_MAX_RADIUS*2+1)
+
+/** One ID program is linked for each attribute location that
+ * in_Position is found at (see pick_program()). */
+#define PICK_MAX_LOCATIONS 16
+
+enum { PICK_IDLE, PICK_REQUESTED, PICK_DRAWING, PICK_READING };
+
+static int pick_state = PICK_IDLE;
+static pick_result pick_current;
+static int pick_radius;
+static int pick_framesWaiting; /**< Calls to pick_end_frame() since the pick was requested */
+static pick_callback pick_cb;
+static void *pick_userdata;
+
+static GLuint pick_framebuffer = 0;
+static GLuint pick_texture = 0;
+static GLuint pick_pbo = 0;
+static GLsync pick_fence = 0;
+static GLuint pick_programs[PICK_MAX_LOCATIONS];
+static float pick_matrix[16]; /**< Makes the pixels around the requested pixel fill the framebuffer */
+
+/* State saved by pick_begin() and restored by pick_end(). */
+static GLint pick_prevDrawFramebuffer, pick_prevReadFramebuffer;
+static GLint pick_prevViewport[4];
+static GLint pick_prevProgram;
+static GLboolean pick_prevDepthTest, pick_prevScissorTest, pick_prevBlend;
+static GLboolean pick_prevColorMask[4], pick_prevDepthMask;
+
+static const char *pickVertex =
+	"#version 150\n"
+	"in vec3 in_Position;\n"
+	"uniform mat4 ModelView;\n"
+	"uniform mat4 Projection;\n"
+	"uniform mat4 GeomTransform;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = Projection * ModelView * GeomTransform * vec4(in_Position, 1);\n"
+	"}\n";
+
+static const char *pickFragment =
+	"#version 150\n"
+	"uniform uint ObjectID;\n"
+	"out uvec2 fragID;\n"
+	"void main()\n"
+	"{\n"
+	"	fragID = uvec2(ObjectID, uint(gl_PrimitiveID));\n"
+	"}\n";
+
+
+/** Returns a program which draws IDs. A kuhl_geometry's vertex array
+ * object connects in_Position to the attribute location that the
+ * geometry's own program uses, so the ID program must use the same
+ * location. */
+static GLuint pick_program(GLint location)
+{
+	if(location < 0 || location >= PICK_MAX_LOCATIONS)
+		return 0;
+	if(pick_programs[location] != 0)
+		return pick_programs[location];
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, kuhl_create_shader_source(pickVertex, GL_VERTEX_SHADER, "pickVertex"));
+	glAttachShader(program, kuhl_create_shader_source(pickFragment, GL_FRAGMENT_SHADER, "pickFragment"));
+	glBindAttribLocation(program, location, "in_Position");
+	glBindFragDataLocation(program, 0, "fragID");
+	pick_programs[location] = kuhl_link_program(program, "pick");
+	return program;
+}
+
+/** Creates the framebuffer and pixel buffer object the first time
+ * that something is picked. */
+static void pick_init(void)
+{
+	if(pick_framebuffer != 0)
+		return;
+
+	/* kuhl_gen_framebuffer() provides the depth buffer; attach an
+	 * integer texture to hold the IDs. */
+	pick_framebuffer = kuhl_gen_framebuffer(PICK_MAX_SIZE, PICK_MAX_SIZE, NULL, NULL);
+
+	GLint prevTexture = 0, prevFramebuffer = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+
+	glGenTextures(1, &pick_texture);
+	glBindTexture(GL_TEXTURE_2D, pick_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, PICK_MAX_SIZE, PICK_MAX_SIZE, 0,
+	             GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, pick_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pick_texture, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	GLenum fbStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(fbStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		msg(MSG_FATAL, "Picking framebuffer is incomplete (status 0x%x).", fbStatus);
+		exit(EXIT_FAILURE);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+	glBindTexture(GL_TEXTURE_2D, prevTexture);
+
+	glGenBuffers(1, &pick_pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pick_pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, PICK_MAX_SIZE*PICK_MAX_SIZE*2*sizeof(GLuint), NULL, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	kuhl_errorcheck();
+}
+
+/** Requests that the object at a pixel be found. The objects are
+    drawn during the next call to pick_begin() whose viewport contains
+    the pixel, and the callback is called during a later frame.
+
+    @param x The X coordinate of the pixel in window coordinates
+    (i.e., the same coordinates as glViewport()).
+
+    @param y The Y coordinate of the pixel. The origin is in the lower
+    left corner. Mouse positions from GLFW have the origin in the upper
+    left corner and may need to be scaled to the framebuffer size.
+
+    @param radius If nothing is at the pixel, the object closest to it
+    within this many pixels is found (0 to 16).
+
+    @param callback Function to call with the result.
+
+    @param userdata Passed to the callback.
+
+    @return 1 if the pick was requested, 0 if another pick is still in
+    progress (see pick_cancel()).
+*/
+int pick_request(int x, int y, int radius, pick_callback callback, void *userdata)
+{
+	if(pick_state != PICK_IDLE)
+		return 0;
+	if(radius < 0)
+		radius = 0;
+	if(radius > PICK_MAX_RADIUS)
+		radius = PICK_MAX_RADIUS;
+
+	pick_current.x = x;
+	pick_current.y = y;
+	pick_current.hitX = x;
+	pick_current.hitY = y;
+	pick_current.object = 0;
+	pick_current.primitive = 0;
+	pick_radius = radius;
+	pick_cb = callback;
+	pick_userdata = userdata;
+	pick_framesWaiting = 0;
+	pick_state = PICK_REQUESTED;
+	return 1;
+}
+
+/** Returns 1 if a pick has been requested and its callback hasn't
+ * been called yet. */
+int pick_pending(void)
+{
+	return pick_state != PICK_IDLE;
+}
+
+/** Abandons the pick in progress (if any) without calling its
+ * callback, so that another pick can be requested. Does nothing
+ * between pick_begin() and pick_end(). */
+void pick_cancel(void)
+{
+	if(pick_state == PICK_DRAWING)
+		return;
+	if(pick_fence)
+	{
+		glDeleteSync(pick_fence);
+		pick_fence = 0;
+	}
+	pick_state = PICK_IDLE;
+}
+
+/** Ends the pick and calls the callback with pick_current. */
+static void pick_finish(void)
+{
+	/* The callback may request another pick. */
+	pick_result result = pick_current;
+	pick_state = PICK_IDLE;
+	if(pick_cb)
+		pick_cb(&result, pick_userdata);
+}
+
+/** Should be called at the end of each frame (viewmat_end_frame()
+ * calls it). If a frame has passed since the pick was requested and
+ * no viewport contained the requested pixel, the pick ends and the
+ * callback receives an object ID of 0. Otherwise, later calls to
+ * pick_request() would fail forever. */
+void pick_end_frame(void)
+{
+	pick_poll();
+	if(pick_state != PICK_REQUESTED)
+		return;
+	/* The pick may be requested while a frame is drawn (after the
+	 * viewport containing the pixel), so wait for one full frame. */
+	if(pick_framesWaiting++ >= 1)
+	{
+		msg(MSG_DEBUG, "Pixel %d,%d wasn't in any viewport, nothing picked.", pick_current.x, pick_current.y);
+		pick_finish();
+	}
+}
+
+/** Calls the callback if the result of a pick has been read back
+ * from the GPU. Never waits for the GPU. pick_begin() and
+ * pick_end_frame() call this, so programs rarely need to call it. */
+void pick_poll(void)
+{
+	if(pick_state != PICK_READING)
+		return;
+
+	GLenum status = glClientWaitSync(pick_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if(status == GL_TIMEOUT_EXPIRED)
+		return;
+	glDeleteSync(pick_fence);
+	pick_fence = 0;
+
+	/* Find the object closest to the requested pixel. */
+	int size = pick_radius*2+1;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pick_pbo);
+	const GLuint *ids = (const GLuint*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+	                                                     size*size*2*sizeof(GLuint), GL_MAP_READ_BIT);
+	if(ids != NULL && status != GL_WAIT_FAILED)
+	{
+		int bestDist = -1;
+		for(int j=0; j<size; j++)
+		{
+			for(int i=0; i<size; i++)
+			{
+				const GLuint *id = ids + (j*size+i)*2;
+				int dist = (i-pick_radius)*(i-pick_radius) + (j-pick_radius)*(j-pick_radius);
+				if(id[0] == 0 || dist > pick_radius*pick_radius ||
+				   (bestDist >= 0 && dist >= bestDist))
+					continue;
+				bestDist = dist;
+				pick_current.object = id[0];
+				pick_current.primitive = id[1];
+				pick_current.hitX = pick_current.x + i - pick_radius;
+				pick_current.hitY = pick_current.y + j - pick_radius;
+			}
+		}
+	}
+	else
+		msg(MSG_ERROR, "Unable to read picking results.");
+	if(ids != NULL)
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	kuhl_errorcheck();
+
+	pick_finish();
+}
+
+/** Prepares to draw the objects that can be picked if a pick has been
+    requested at a pixel inside of the viewport.
+
+    @param viewport The viewport (x, y, width, height) that the scene
+    was drawn into.
+
+    @return 1 if the caller should call pick_draw() for each object
+    and then call pick_end(). 0 if nothing needs to be drawn.
+*/
+int pick_begin(const int viewport[4])
+{
+	pick_poll();
+	if(pick_state != PICK_REQUESTED)
+		return 0;
+	int x = pick_current.x, y = pick_current.y;
+	if(x < viewport[0] || x >= viewport[0]+viewport[2] ||
+	   y < viewport[1] || y >= viewport[1]+viewport[3])
+		return 0;
+
+	pick_init();
+
+	/* Scale and translate the projection so that the pixels around
+	 * the requested pixel fill the framebuffer. */
+	int size = pick_radius*2+1;
+	float scale[16], translate[16];
+	mat4f_scale_new(scale, viewport[2]/(float)size, viewport[3]/(float)size, 1);
+	mat4f_translate_new(translate,
+	                    (viewport[2] - 2*(x + .5f - viewport[0])) / size,
+	                    (viewport[3] - 2*(y + .5f - viewport[1])) / size, 0);
+	mat4f_mult_mat4f_new(pick_matrix, translate, scale);
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &pick_prevDrawFramebuffer);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &pick_prevReadFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, pick_prevViewport);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &pick_prevProgram);
+	pick_prevDepthTest = glIsEnabled(GL_DEPTH_TEST);
+	pick_prevScissorTest = glIsEnabled(GL_SCISSOR_TEST);
+	pick_prevBlend = glIsEnabled(GL_BLEND);
+	glGetBooleanv(GL_COLOR_WRITEMASK, pick_prevColorMask);
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &pick_prevDepthMask);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, pick_framebuffer);
+	glViewport(0, 0, size, size);
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_BLEND);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); // anaglyph rendering changes the color mask
+	glDepthMask(GL_TRUE);
+	const GLuint none[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, none);
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1, 0);
+	kuhl_errorcheck();
+
+	pick_state = PICK_DRAWING;
+	return 1;
+}
+
+/** Draws the IDs of an object. Call between pick_begin() and
+    pick_end().
+
+    @param geom The geometry to draw. If it is a part of a linked
+    list, all of the objects in the list are drawn with the same
+    object ID.
+
+    @param object The ID for this object. Use 0 for objects that can
+    hide other objects but can't be picked themselves.
+
+    @param modelview The modelview matrix used to draw the object.
+
+    @param projection The projection matrix used to draw the object.
+*/
+void pick_draw(kuhl_geometry *geom, GLuint object, const float modelview[16], const float projection[16])
+{
+	if(pick_state != PICK_DRAWING)
+		return;
+
+	float pickProjection[16];
+	mat4f_mult_mat4f_new(pickProjection, pick_matrix, projection);
+
+	GLint prevVAO = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVAO);
+	for(kuhl_geometry *g = geom; g != NULL; g = g->next)
+	{
+		GLuint program = pick_program(glGetAttribLocation(g->program, "in_Position"));
+		if(program == 0 || !glIsVertexArray(g->vao))
+			continue;
+		glUseProgram(program);
+		glUniformMatrix4fv(glGetUniformLocation(program, "Projection"), 1, 0, pickProjection);
+		glUniformMatrix4fv(glGetUniformLocation(program, "ModelView"), 1, 0, modelview);
+		glUniformMatrix4fv(glGetUniformLocation(program, "GeomTransform"), 1, 0, g->matrix);
+		glUniform1ui(glGetUniformLocation(program, "ObjectID"), object);
+
+		glBindVertexArray(g->vao);
+		if(g->indices_len > 0 && glIsBuffer(g->indices_bufferobject))
+			glDrawElements(g->primitive_type, g->indices_len, GL_UNSIGNED_INT, NULL);
+		else
+			glDrawArrays(g->primitive_type, 0, g->vertex_count);
+		kuhl_errorcheck();
+	}
+	glBindVertexArray(prevVAO);
+	glUseProgram(pick_prevProgram);
+	kuhl_errorcheck();
+}
+
+/** Starts copying the IDs drawn since pick_begin() into a pixel
+ * buffer object and restores the state that pick_begin() changed. */
+void pick_end(void)
+{
+	if(pick_state != PICK_DRAWING)
+		return;
+
+	int size = pick_radius*2+1;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pick_pbo);
+	glReadPixels(0, 0, size, size, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	pick_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	pick_state = PICK_READING;
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pick_prevDrawFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, pick_prevReadFramebuffer);
+	glViewport(pick_prevViewport[0], pick_prevViewport[1], pick_prevViewport[2], pick_prevViewport[3]);
+	glUseProgram(pick_prevProgram);
+	if(!pick_prevDepthTest)
+		glDisable(GL_DEPTH_TEST);
+	if(pick_prevScissorTest)
+		glEnable(GL_SCISSOR_TEST);
+	if(pick_prevBlend)
+		glEnable(GL_BLEND);
+	glColorMask(pick_prevColorMask[0], pick_prevColorMask[1], pick_prevColorMask[2], pick_prevColorMask[3]);
+	glDepthMask(pick_prevDepthMask);
+	kuhl_errorcheck();
+}
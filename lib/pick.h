@@ -0,0 +1,43 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Finds the object under a pixel by rendering object IDs into an
+ * offscreen buffer and reading the result back asynchronously. See
+ * pick.c for details.
+ */
+
+#pragma once
+#include <GL/glew.h>
+#include "kuhl-util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The result of a pick. */
+typedef struct {
+	int x, y;          /**< Pixel that was requested (window coordinates, origin in lower left) */
+	int hitX, hitY;    /**< Pixel where the object was found */
+	GLuint object;     /**< ID passed to pick_draw(), or 0 if nothing was found */
+	GLuint primitive;  /**< Primitive (e.g., triangle) within the kuhl_geometry that was found */
+} pick_result;
+
+/** Called when the result of a pick is available (usually during the
+    frame after the pick was drawn). The result is only valid during
+    the call. */
+typedef void (*pick_callback)(const pick_result *result, void *userdata);
+
+int  pick_request(int x, int y, int radius, pick_callback callback, void *userdata);
+int  pick_pending(void);
+void pick_poll(void);
+void pick_cancel(void);
+void pick_end_frame(void);
+int  pick_begin(const int viewport[4]);
+void pick_draw(kuhl_geometry *geom, GLuint object, const float modelview[16], const float projection[16]);
+void pick_end(void);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -0,0 +1,363 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * History of tracker poses which can be read without locks. Uses the
+ * GCC/Clang __atomic builtins (which windows-compat.h provides on
+ * Visual Studio).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "windows-compat.h"
+#include "posering.h"
+#include "vecmat.h"
+#include "msg.h"
+
+/** Creates a new pose history.
+
+    @param capacity Number of samples to keep (rounded up to a power
+    of two).
+
+    @return A new pose_ring which should eventually be free'd with
+    pose_ring_free() or NULL on failure.
+*/
+pose_ring* pose_ring_new(int capacity)
+{
+	if(capacity < 2 || capacity > (1<<20))
+	{
+		msg(MSG_ERROR, "Invalid capacity: %d", capacity);
+		return NULL;
+	}
+	size_t cap = 1;
+	while(cap < (size_t) capacity)
+		cap *= 2;
+
+	pose_ring *r = (pose_ring*) malloc(sizeof(pose_ring));
+	if(r == NULL)
+		return NULL;
+	memset(r, 0, sizeof(pose_ring));
+	r->slots = (pose_ring_slot*) calloc(cap, sizeof(pose_ring_slot));
+	if(r->slots == NULL)
+	{
+		free(r);
+		return NULL;
+	}
+	r->mask = cap-1;
+	return r;
+}
+
+void pose_ring_free(pose_ring *r)
+{
+	if(r == NULL)
+		return;
+	free(r->slots);
+	free(r);
+}
+
+/** Adds a sample to the history, overwriting the oldest sample if the
+ * history is full. Only one thread may call this function. */
+void pose_ring_add(pose_ring *r, const pose_sample *s)
+{
+	size_t index = __atomic_load_n(&r->count, __ATOMIC_RELAXED);
+	pose_ring_slot *slot = &r->slots[index & r->mask];
+
+	__atomic_store_n(&slot->seq, 2*index+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->sample = *s;
+	__atomic_store_n(&slot->seq, 2*index+2, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->count, index+1, __ATOMIC_RELEASE);
+}
+
+/** Returns the number of samples that have been added since the
+ * history was created (including samples which have since been
+ * overwritten). */
+size_t pose_ring_count(const pose_ring *r)
+{
+	return __atomic_load_n(&r->count, __ATOMIC_ACQUIRE);
+}
+
+/** Copies a specific sample out of the history.
+
+    @param index The sample to get. 0 is the first sample ever added
+    and pose_ring_count()-1 is the newest sample.
+
+    @param s Location to store the sample.
+
+    @return 1 on success, 0 if the sample has not been added yet or
+    has already been overwritten.
+*/
+int pose_ring_get(const pose_ring *r, size_t index, pose_sample *s)
+{
+	const pose_ring_slot *slot = &r->slots[index & r->mask];
+	size_t expected = 2*index+2;
+	if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != expected)
+		return 0;
+	*s = slot->sample;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expected;
+}
+
+/** Copies the newest sample out of the history.
+
+    @return 1 on success, 0 if no samples have been added.
+*/
+int pose_ring_newest(const pose_ring *r, pose_sample *s)
+{
+	for(;;)
+	{
+		size_t count = pose_ring_count(r);
+		if(count == 0)
+			return 0;
+		if(pose_ring_get(r, count-1, s))
+			return 1;
+		/* The writer wrapped around and overwrote the sample while
+		 * we were reading it; a newer sample is now available. */
+	}
+}
+
+/** Estimates the pose at a specific time by interpolating between the
+    two samples on either side of that time. Positions are linearly
+    interpolated and orientations are interpolated with slerp.
+
+    If the time is newer than the newest sample, the newest sample is
+    returned (no extrapolation). If the time is older than the oldest
+    sample in the history, the oldest sample is returned.
+
+    @param usec The time to estimate the pose at (same clock as
+    pose_sample.usec).
+
+    @param s Location to store the estimated pose. s->usec is set to
+    usec if interpolation was performed.
+
+    @return 1 on success, 0 if no samples have been added.
+*/
+int pose_ring_at(const pose_ring *r, int64_t usec, pose_sample *s)
+{
+	pose_sample after, before;
+	size_t count;
+	do
+	{
+		count = pose_ring_count(r);
+		if(count == 0)
+			return 0;
+	} while(!pose_ring_get(r, count-1, &after));
+
+	if(after.usec <= usec)
+	{
+		*s = after;
+		return 1;
+	}
+
+	/* Walk backwards until we find a sample at or before the
+	 * requested time. */
+	size_t oldest = count > r->mask+1 ? count-(r->mask+1) : 0;
+	for(size_t i=count-1; i-- > oldest; )
+	{
+		if(!pose_ring_get(r, i, &before))
+			break; // overwritten while we were searching
+		if(before.usec <= usec)
+		{
+			float t = 0;
+			if(after.usec > before.usec)
+				t = (float) (usec - before.usec) / (float) (after.usec - before.usec);
+			*s = before;
+			s->usec = usec;
+			for(int j=0; j<3; j++)
+			{
+				s->pos[j] = before.pos[j] + t*(after.pos[j]-before.pos[j]);
+				s->vel[j] = before.vel[j] + t*(after.vel[j]-before.vel[j]);
+			}
+			quatf_slerp_new(s->quat, before.quat, after.quat, t);
+			return 1;
+		}
+		after = before;
+	}
+
+	/* The requested time is older than anything we have. */
+	*s = after;
+	return 1;
+}
+
+/** Extrapolates a sample forward in time using its velocity. The
+    position and each quaternion component are assumed to change at a
+    constant rate; the quaternion is normalized afterwards. This is
+    only accurate for short periods of time, so the prediction is
+    limited to POSE_PREDICT_MAX_USEC.
+
+    @param s The sample to extrapolate from. If s->hasVelocity is 0,
+    the sample is copied without any changes.
+
+    @param usec The time to predict the pose at.
+
+    @param result Location to store the predicted pose. result->usec is
+    set to usec.
+*/
+void pose_sample_extrapolate(const pose_sample *s, int64_t usec, pose_sample *result)
+{
+	*result = *s;
+	result->usec = usec;
+	if(!s->hasVelocity)
+		return;
+
+	int64_t horizon = usec - s->usec;
+	if(horizon > POSE_PREDICT_MAX_USEC)
+		horizon = POSE_PREDICT_MAX_USEC;
+	if(horizon <= 0)
+		return;
+	float dt = horizon / 1000000.0f;
+	for(int i=0; i<3; i++)
+		result->pos[i] = s->pos[i] + s->vel[i]*dt;
+	for(int i=0; i<4; i++)
+		result->quat[i] = s->quat[i] + s->quatVel[i]*dt;
+	quatf_normalize(result->quat);
+}
+
+/** Predicts the pose at a time in the future. If the newest sample
+    includes a velocity (for example, from a Kalman filter), it is
+    used. Otherwise, the velocity is estimated from the two newest
+    samples that are at least 5 milliseconds apart.
+
+    @param usec The time to predict the pose at. If usec is older than
+    the newest sample, this function behaves like pose_ring_at().
+
+    @param result Location to store the predicted pose.
+
+    @return 1 on success, 0 if no samples have been added.
+*/
+int pose_ring_predict(const pose_ring *r, int64_t usec, pose_sample *result)
+{
+	pose_sample newest;
+	if(!pose_ring_newest(r, &newest))
+		return 0;
+	if(usec <= newest.usec)
+		return pose_ring_at(r, usec, result);
+
+	if(!newest.hasVelocity)
+	{
+		/* Estimate the velocity with a finite difference. */
+		size_t count = pose_ring_count(r);
+		size_t oldest = count > r->mask+1 ? count-(r->mask+1) : 0;
+		pose_sample older;
+		for(size_t i=count-1; i-- > oldest; )
+		{
+			if(!pose_ring_get(r, i, &older))
+				break;
+			if(newest.usec - older.usec < 5000)
+				continue;
+
+			float dt = (newest.usec - older.usec) / 1000000.0f;
+			/* q and -q are the same orientation; make sure we
+			 * don't go the long way around. */
+			float sign = vec4f_dot(newest.quat, older.quat) < 0 ? -1.0f : 1.0f;
+			for(int j=0; j<3; j++)
+				newest.vel[j] = (newest.pos[j] - older.pos[j]) / dt;
+			for(int j=0; j<4; j++)
+				newest.quatVel[j] = (newest.quat[j] - sign*older.quat[j]) / dt;
+			newest.hasVelocity = 1;
+			break;
+		}
+	}
+	pose_sample_extrapolate(&newest, usec, result);
+	return 1;
+}
+
+
+void pose_predict_stats_init(pose_predict_stats *stats)
+{
+	memset(stats, 0, sizeof(pose_predict_stats));
+}
+
+/** Remembers a prediction so that pose_predict_stats_update() can
+    compare it to the pose that is later measured.
+
+    @param predicted The predicted pose. predicted->usec must be the
+    time that the prediction was made for.
+
+    @param unpredicted The pose that would have been used if no
+    prediction was made (typically the newest sample).
+*/
+void pose_predict_stats_add(pose_predict_stats *stats, const pose_sample *predicted, const pose_sample *unpredicted)
+{
+	/* If the predictions can't be checked (no new samples are
+	 * arriving), forget the oldest one. */
+	if(stats->pendingCount == POSE_PREDICT_PENDING)
+	{
+		memmove(&stats->pending[0], &stats->pending[1], sizeof(stats->pending[0])*(POSE_PREDICT_PENDING-1));
+		stats->pendingCount--;
+	}
+	stats->pending[stats->pendingCount].predicted = *predicted;
+	stats->pending[stats->pendingCount].unpredicted = *unpredicted;
+	stats->pendingCount++;
+}
+
+/** Returns the distance between two positions. */
+static double pose_distance(const float a[3], const float b[3])
+{
+	float diff[3];
+	vec3f_sub_new(diff, a, b);
+	return vec3f_norm(diff);
+}
+
+/** Returns the angle in degrees between two orientations. */
+static double pose_angle_between(const float a[4], const float b[4])
+{
+	double d = fabs(vec4f_dot(a, b)) / (vec4f_norm(a)*vec4f_norm(b));
+	if(d > 1)
+		d = 1;
+	return 2*acos(d) * 180/M_PI;
+}
+
+/** Checks any predictions for times that the pose_ring now has samples
+ * for. */
+void pose_predict_stats_update(pose_predict_stats *stats, const pose_ring *r)
+{
+	pose_sample newest;
+	if(!pose_ring_newest(r, &newest))
+		return;
+
+	int done = 0;
+	while(done < stats->pendingCount &&
+	      stats->pending[done].predicted.usec <= newest.usec)
+	{
+		const pose_sample *p = &stats->pending[done].predicted;
+		const pose_sample *u = &stats->pending[done].unpredicted;
+		pose_sample actual;
+		pose_ring_at(r, p->usec, &actual);
+
+		double posErr = pose_distance(p->pos, actual.pos);
+		double angErr = pose_angle_between(p->quat, actual.quat);
+		stats->count++;
+		stats->horizonSum += (double) (p->usec - u->usec);
+		stats->posErrSum += posErr;
+		stats->angErrSum += angErr;
+		if(posErr > stats->posErrMax)
+			stats->posErrMax = posErr;
+		if(angErr > stats->angErrMax)
+			stats->angErrMax = angErr;
+		stats->posErrSumNone += pose_distance(u->pos, actual.pos);
+		stats->angErrSumNone += pose_angle_between(u->quat, actual.quat);
+		done++;
+	}
+	if(done > 0)
+	{
+		stats->pendingCount -= done;
+		memmove(&stats->pending[0], &stats->pending[done], sizeof(stats->pending[0])*(size_t)stats->pendingCount);
+	}
+}
+
+/** Prints a summary of the prediction errors at MSG_DEBUG. */
+void pose_predict_stats_print(const pose_predict_stats *stats, const char *name)
+{
+	if(stats->count == 0)
+		return;
+	double n = (double) stats->count;
+	msg(MSG_DEBUG, "Prediction for %s: %ld predictions, %.1f ms ahead on average", name, stats->count, stats->horizonSum/n/1000.0);
+	msg(MSG_DEBUG, "Prediction for %s: predicted error  pos avg=%.2fmm max=%.2fmm angle avg=%.3fdeg max=%.3fdeg",
+	    name, stats->posErrSum/n*1000, stats->posErrMax*1000, stats->angErrSum/n, stats->angErrMax);
+	msg(MSG_DEBUG, "Prediction for %s: unpredicted error pos avg=%.2fmm angle avg=%.3fdeg",
+	    name, stats->posErrSumNone/n*1000, stats->angErrSumNone/n);
+}
@@ -0,0 +1,102 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    A fixed-size history of timestamped poses from a tracking
+    system. One thread (typically a tracker I/O thread) adds samples
+    and any number of other threads can read the newest sample or a
+    sample interpolated to a specific time without taking a lock.
+
+    Each slot is protected by a sequence number (a "seqlock"). The
+    writer makes the sequence number odd while it is changing a slot
+    and even when it is done. A reader copies a slot and then checks
+    that the sequence number did not change while it was copying. The
+    writer never waits for readers. If the writer overwrites a slot
+    while a reader is copying it, the reader simply tries again with a
+    newer sample.
+
+    The pose at a future time (for example, when the frame currently
+    being rendered will appear on the screen) can be estimated with
+    pose_ring_predict(). pose_predict_stats compares predictions with
+    the poses that were later received.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A single position and orientation measurement. */
+typedef struct {
+	int64_t usec;  /**< Time the sample was received (kuhl_microseconds()) */
+	float pos[3];  /**< Position */
+	float quat[4]; /**< Orientation as a quaternion (x,y,z,w) */
+	int hasVelocity;   /**< 1 if vel and quatVel are valid */
+	float vel[3];      /**< Change in position per second */
+	float quatVel[4];  /**< Change in each quaternion component per second */
+} pose_sample;
+
+typedef struct {
+	size_t seq;    /**< Odd while the slot is being written */
+	pose_sample sample;
+} pose_ring_slot;
+
+typedef struct {
+	char pad0[64];
+	size_t count;  /**< Number of samples ever added */
+	char pad1[64 - sizeof(size_t)];
+	size_t mask;   /**< capacity-1 */
+	pose_ring_slot *slots;
+} pose_ring;
+
+pose_ring* pose_ring_new(int capacity);
+void pose_ring_free(pose_ring *r);
+void pose_ring_add(pose_ring *r, const pose_sample *s);
+size_t pose_ring_count(const pose_ring *r);
+int pose_ring_get(const pose_ring *r, size_t index, pose_sample *s);
+int pose_ring_newest(const pose_ring *r, pose_sample *s);
+int pose_ring_at(const pose_ring *r, int64_t usec, pose_sample *s);
+
+/** Predictions are never made more than this far past the newest
+ * sample. */
+#define POSE_PREDICT_MAX_USEC 100000
+
+void pose_sample_extrapolate(const pose_sample *s, int64_t usec, pose_sample *result);
+int pose_ring_predict(const pose_ring *r, int64_t usec, pose_sample *result);
+
+#define POSE_PREDICT_PENDING 64
+
+/** Accumulates the difference between predicted poses and the poses
+ * that were actually measured at the predicted time. For comparison,
+ * it also accumulates the error we would have had if we used the
+ * newest sample without any prediction. */
+typedef struct {
+	struct {
+		pose_sample predicted;   /**< Predicted pose (usec is the time predicted for) */
+		pose_sample unpredicted; /**< Newest sample when the prediction was made */
+	} pending[POSE_PREDICT_PENDING]; /**< Predictions that can't be checked yet */
+	int pendingCount;
+
+	long count;            /**< Number of predictions checked */
+	double horizonSum;     /**< Sum of prediction horizons (usec) */
+	double posErrSum;      /**< Sum of position errors with prediction */
+	double posErrMax;
+	double angErrSum;      /**< Sum of orientation errors (degrees) with prediction */
+	double angErrMax;
+	double posErrSumNone;  /**< Sum of position errors without prediction */
+	double angErrSumNone;  /**< Sum of orientation errors without prediction */
+} pose_predict_stats;
+
+void pose_predict_stats_init(pose_predict_stats *stats);
+void pose_predict_stats_add(pose_predict_stats *stats, const pose_sample *predicted, const pose_sample *unpredicted);
+void pose_predict_stats_update(pose_predict_stats *stats, const pose_ring *r);
+void pose_predict_stats_print(const pose_predict_stats *stats, const char *name);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -0,0 +1,254 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Lock-free queues. Uses the GCC/Clang __atomic builtins (which
+ * windows-compat.h provides on Visual Studio).
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "windows-compat.h"
+#include "ringqueue.h"
+#include "msg.h"
+
+/** Rounds capacity up to a power of two. Returns 0 if the capacity is
+ * invalid. */
+static size_t ringqueue_round_capacity(int capacity)
+{
+	if(capacity < 1 || capacity > (1<<30))
+	{
+		msg(MSG_ERROR, "Invalid capacity: %d", capacity);
+		return 0;
+	}
+	size_t c = 1;
+	while(c < (size_t) capacity)
+		c *= 2;
+	return c;
+}
+
+/** Creates a new single-producer, single-consumer queue.
+
+    @param capacity Number of items the queue can hold (rounded up to a
+    power of two).
+
+    @param itemSize The size of each item in bytes.
+
+    @return A new queue which should eventually be free'd with
+    ringqueue_spsc_free() or NULL on failure.
+*/
+ringqueue_spsc* ringqueue_spsc_new(int capacity, int itemSize)
+{
+	size_t cap = ringqueue_round_capacity(capacity);
+	if(cap == 0 || itemSize <= 0)
+		return NULL;
+
+	ringqueue_spsc *q = (ringqueue_spsc*) malloc(sizeof(ringqueue_spsc));
+	if(q == NULL)
+		return NULL;
+	memset(q, 0, sizeof(ringqueue_spsc));
+	q->data = (char*) malloc(cap * (size_t) itemSize);
+	if(q->data == NULL)
+	{
+		msg(MSG_ERROR, "Unable to allocate space for %lu items", (unsigned long) cap);
+		free(q);
+		return NULL;
+	}
+	q->mask = cap-1;
+	q->itemSize = itemSize;
+	return q;
+}
+
+void ringqueue_spsc_free(ringqueue_spsc *q)
+{
+	if(q == NULL)
+		return;
+	free(q->data);
+	free(q);
+}
+
+/** Adds an item to the queue. Must only be called by the producer
+    thread.
+
+    @return 1 if the item was added, 0 if the queue was full.
+*/
+int ringqueue_spsc_add(ringqueue_spsc *q, const void *item)
+{
+	size_t write = __atomic_load_n(&q->write, __ATOMIC_RELAXED);
+	if(write - q->cachedRead > q->mask)
+	{
+		/* The queue looked full last time we checked, see if the
+		 * consumer has removed anything since then. */
+		q->cachedRead = __atomic_load_n(&q->read, __ATOMIC_ACQUIRE);
+		if(write - q->cachedRead > q->mask)
+			return 0;
+	}
+	memcpy(q->data + (write & q->mask) * (size_t) q->itemSize, item, (size_t) q->itemSize);
+	__atomic_store_n(&q->write, write+1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/** Removes the oldest item from the queue. Must only be called by the
+    consumer thread.
+
+    @param result Location to copy the item into.
+
+    @return 1 if an item was removed, 0 if the queue was empty.
+*/
+int ringqueue_spsc_remove(ringqueue_spsc *q, void *result)
+{
+	size_t read = __atomic_load_n(&q->read, __ATOMIC_RELAXED);
+	if(read == q->cachedWrite)
+	{
+		q->cachedWrite = __atomic_load_n(&q->write, __ATOMIC_ACQUIRE);
+		if(read == q->cachedWrite)
+			return 0;
+	}
+	memcpy(result, q->data + (read & q->mask) * (size_t) q->itemSize, (size_t) q->itemSize);
+	__atomic_store_n(&q->read, read+1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/** Returns the number of items in the queue. If other threads are
+ * using the queue, the value may be out of date as soon as it is
+ * returned. */
+int ringqueue_spsc_length(ringqueue_spsc *q)
+{
+	size_t read  = __atomic_load_n(&q->read,  __ATOMIC_ACQUIRE);
+	size_t write = __atomic_load_n(&q->write, __ATOMIC_ACQUIRE);
+	return (int) (write - read);
+}
+
+int ringqueue_spsc_capacity(const ringqueue_spsc *q)
+{
+	return (int) (q->mask+1);
+}
+
+
+/** Creates a new multi-producer, multi-consumer queue.
+
+    @param capacity Number of items the queue can hold (rounded up to a
+    power of two).
+
+    @param itemSize The size of each item in bytes.
+
+    @return A new queue which should eventually be free'd with
+    ringqueue_mpmc_free() or NULL on failure.
+*/
+ringqueue_mpmc* ringqueue_mpmc_new(int capacity, int itemSize)
+{
+	size_t cap = ringqueue_round_capacity(capacity);
+	if(cap == 0 || itemSize <= 0)
+		return NULL;
+
+	ringqueue_mpmc *q = (ringqueue_mpmc*) malloc(sizeof(ringqueue_mpmc));
+	if(q == NULL)
+		return NULL;
+	memset(q, 0, sizeof(ringqueue_mpmc));
+	q->seq  = (size_t*) malloc(cap * sizeof(size_t));
+	q->data = (char*) malloc(cap * (size_t) itemSize);
+	if(q->seq == NULL || q->data == NULL)
+	{
+		msg(MSG_ERROR, "Unable to allocate space for %lu items", (unsigned long) cap);
+		free(q->seq);
+		free(q->data);
+		free(q);
+		return NULL;
+	}
+	for(size_t i=0; i<cap; i++)
+		q->seq[i] = i;
+	q->mask = cap-1;
+	q->itemSize = itemSize;
+	return q;
+}
+
+void ringqueue_mpmc_free(ringqueue_mpmc *q)
+{
+	if(q == NULL)
+		return;
+	free(q->seq);
+	free(q->data);
+	free(q);
+}
+
+/** Adds an item to the queue. Can be called from any thread.
+
+    @return 1 if the item was added, 0 if the queue was full.
+*/
+int ringqueue_mpmc_add(ringqueue_mpmc *q, const void *item)
+{
+	size_t pos = __atomic_load_n(&q->write, __ATOMIC_RELAXED);
+	for(;;)
+	{
+		size_t *seq = &q->seq[pos & q->mask];
+		size_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		ptrdiff_t diff = (ptrdiff_t) (s - pos); // long is 32 bits on 64-bit Windows
+		if(diff == 0)
+		{
+			/* The slot is free, try to claim it. On failure, pos is
+			 * updated with the current value of write. */
+			if(__atomic_compare_exchange_n(&q->write, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				memcpy(q->data + (pos & q->mask) * (size_t) q->itemSize, item, (size_t) q->itemSize);
+				__atomic_store_n(seq, pos+1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+		else if(diff < 0) // slot still holds an item from the previous lap
+			return 0;
+		else // another producer claimed this slot
+			pos = __atomic_load_n(&q->write, __ATOMIC_RELAXED);
+	}
+}
+
+/** Removes the oldest item from the queue. Can be called from any
+    thread.
+
+    @param result Location to copy the item into.
+
+    @return 1 if an item was removed, 0 if the queue was empty.
+*/
+int ringqueue_mpmc_remove(ringqueue_mpmc *q, void *result)
+{
+	size_t pos = __atomic_load_n(&q->read, __ATOMIC_RELAXED);
+	for(;;)
+	{
+		size_t *seq = &q->seq[pos & q->mask];
+		size_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		ptrdiff_t diff = (ptrdiff_t) (s - (pos+1));
+		if(diff == 0)
+		{
+			if(__atomic_compare_exchange_n(&q->read, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				memcpy(result, q->data + (pos & q->mask) * (size_t) q->itemSize, (size_t) q->itemSize);
+				/* Mark the slot as free for the producer on the next lap. */
+				__atomic_store_n(seq, pos+q->mask+1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+		else if(diff < 0) // slot hasn't been written yet
+			return 0;
+		else // another consumer took this slot
+			pos = __atomic_load_n(&q->read, __ATOMIC_RELAXED);
+	}
+}
+
+/** Returns the number of items in the queue. If other threads are
+ * using the queue, the value is approximate. */
+int ringqueue_mpmc_length(ringqueue_mpmc *q)
+{
+	size_t read  = __atomic_load_n(&q->read,  __ATOMIC_ACQUIRE);
+	size_t write = __atomic_load_n(&q->write, __ATOMIC_ACQUIRE);
+	if(write < read) // read was updated between our two loads.
+		return 0;
+	return (int) (write - read);
+}
+
+int ringqueue_mpmc_capacity(const ringqueue_mpmc *q)
+{
+	return (int) (q->mask+1);
+}
@@ -0,0 +1,87 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    Provides fixed-capacity queues which can be used to pass items
+    between threads without locks.
+
+    - ringqueue_spsc: One thread adds items and one (other) thread
+      removes items.
+
+    - ringqueue_mpmc: Any number of threads add and remove items.
+
+    Unlike queue, these queues never grow. If the queue is full,
+    adding fails and the caller must decide what to do (drop the item,
+    try again later, etc). The capacity is rounded up to a power of
+    two.
+
+    Like queue, the queues store a *copy* of each item. To pass
+    pointers through a queue, pass a pointer to the pointer.
+
+    The indices which are written by producers and by consumers are
+    placed in separate cache lines so that a producer and a consumer
+    running on different cores do not slow each other down.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define RINGQUEUE_CACHE_LINE 64
+
+/** Single-producer, single-consumer queue. */
+typedef struct {
+	char pad0[RINGQUEUE_CACHE_LINE];
+	/* Written by the consumer. */
+	size_t read;       /*< Number of items removed so far. */
+	size_t cachedWrite; /*< Consumer's last copy of write. */
+	char pad1[RINGQUEUE_CACHE_LINE - 2*sizeof(size_t)];
+	/* Written by the producer. */
+	size_t write;      /*< Number of items added so far. */
+	size_t cachedRead; /*< Producer's last copy of read. */
+	char pad2[RINGQUEUE_CACHE_LINE - 2*sizeof(size_t)];
+	/* Never changes after ringqueue_spsc_new() */
+	size_t mask;       /*< capacity-1 */
+	int itemSize;
+	char *data;
+	char pad3[RINGQUEUE_CACHE_LINE];
+} ringqueue_spsc;
+
+/** Multi-producer, multi-consumer queue. Based on Dmitry Vyukov's
+ * bounded MPMC queue: each slot has a sequence number which tells
+ * producers and consumers if the slot is ready for them. */
+typedef struct {
+	char pad0[RINGQUEUE_CACHE_LINE];
+	size_t read;  /*< Claimed by consumers with compare-and-swap. */
+	char pad1[RINGQUEUE_CACHE_LINE - sizeof(size_t)];
+	size_t write; /*< Claimed by producers with compare-and-swap. */
+	char pad2[RINGQUEUE_CACHE_LINE - sizeof(size_t)];
+	size_t mask;
+	int itemSize;
+	size_t *seq;  /*< Sequence number for each slot. */
+	char *data;
+	char pad3[RINGQUEUE_CACHE_LINE];
+} ringqueue_mpmc;
+
+ringqueue_spsc* ringqueue_spsc_new(int capacity, int itemSize);
+void ringqueue_spsc_free(ringqueue_spsc *q);
+int ringqueue_spsc_add(ringqueue_spsc *q, const void *item);
+int ringqueue_spsc_remove(ringqueue_spsc *q, void *result);
+int ringqueue_spsc_length(ringqueue_spsc *q);
+int ringqueue_spsc_capacity(const ringqueue_spsc *q);
+
+ringqueue_mpmc* ringqueue_mpmc_new(int capacity, int itemSize);
+void ringqueue_mpmc_free(ringqueue_mpmc *q);
+int ringqueue_mpmc_add(ringqueue_mpmc *q, const void *item);
+int ringqueue_mpmc_remove(ringqueue_mpmc *q, void *result);
+int ringqueue_mpmc_length(ringqueue_mpmc *q);
+int ringqueue_mpmc_capacity(const ringqueue_mpmc *q);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
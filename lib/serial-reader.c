@@ -0,0 +1,351 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   Reads fixed-size records which begin with "magic" bytes from a
+   serial device on a background thread, so that the thread which
+   renders never waits for serial I/O.
+
+   The thread sleeps in epoll_wait() until data arrives, reads
+   whatever is available into a ring buffer and then looks for
+   complete records in the buffer. Records are found incrementally: a
+   partial record stays in the buffer until the rest of it arrives,
+   and if the bytes at the start of the buffer aren't the magic bytes,
+   bytes are discarded until the magic bytes are found. No blocking
+   resynchronization is needed. Records are passed to a callback
+   directly from the ring buffer; a record is only copied if it wraps
+   around the end of the buffer.
+
+   The callback typically decodes the record and publishes it with a
+   pose_ring (see posering.h) so that other threads can read the
+   newest record without locks.
+
+   If the device disconnects, the thread tries to reopen it once a
+   second.
+
+   This file requires Linux (epoll and eventfd).
+ */
+
+#ifdef __linux__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "serial-reader.h"
+#include "serial.h"
+#include "kuhl-nodep.h"
+#include "msg.h"
+
+#define SERIAL_READER_MASK (SERIAL_READER_BUFFER-1)
+#define SERIAL_READER_RETRY_MSEC 1000 /**< Time between attempts to reopen the device */
+
+/** Opens the device (if needed) and adds it to the epoll set. */
+static int serial_reader_connect(serial_reader *r)
+{
+	r->fd = serial_try_open(r->deviceFile, r->speed, 0, 0, 0);
+	if(r->fd < 0)
+		return 0;
+	fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) | O_NONBLOCK);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = r->fd;
+	if(epoll_ctl(r->epollFd, EPOLL_CTL_ADD, r->fd, &ev) != 0)
+	{
+		msg(MSG_ERROR, "epoll_ctl: %s", strerror(errno));
+		close(r->fd);
+		r->fd = -1;
+		return 0;
+	}
+	r->head = r->tail = 0;
+	r->synchronized = 0;
+	__atomic_store_n(&r->connected, 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void serial_reader_disconnect(serial_reader *r)
+{
+	if(r->fd < 0)
+		return;
+	epoll_ctl(r->epollFd, EPOLL_CTL_DEL, r->fd, NULL);
+	close(r->fd);
+	r->fd = -1;
+	__atomic_store_n(&r->connected, 0, __ATOMIC_RELEASE);
+}
+
+/** Returns 1 if the magic bytes are at the position "count" in the
+ * ring buffer. The caller must make sure that the bytes have been
+ * received. */
+static int serial_reader_magic_at(const serial_reader *r, size_t count)
+{
+	for(int i=0; i<r->magicLen; i++)
+		if(r->buffer[(count+i) & SERIAL_READER_MASK] != r->magic[i])
+			return 0;
+	return 1;
+}
+
+/** Finds and delivers all complete records in the ring buffer. */
+static void serial_reader_frame(serial_reader *r, long now)
+{
+	unsigned char wrapped[SERIAL_READER_BUFFER/2];
+	long records = 0, dropped = 0, resyncs = 0;
+
+	for(;;)
+	{
+		size_t available = r->head - r->tail;
+		if(available < (size_t) r->magicLen)
+			break;
+
+		if(!serial_reader_magic_at(r, r->tail))
+		{
+			if(r->synchronized)
+				resyncs++;
+			r->synchronized = 0;
+
+			/* Skip ahead to the next byte that could start the
+			 * magic bytes. Only look at the contiguous part of the
+			 * buffer; the rest is handled in the next iteration. */
+			size_t start = r->tail & SERIAL_READER_MASK;
+			size_t len = available;
+			if(start + len > SERIAL_READER_BUFFER)
+				len = SERIAL_READER_BUFFER - start;
+			const unsigned char *next = (const unsigned char*) memchr(r->buffer+start+1, r->magic[0], len-1);
+			size_t skip = next ? (size_t) (next - (r->buffer+start)) : len;
+			r->tail += skip;
+			dropped += (long) skip;
+			continue;
+		}
+
+		if(available < (size_t) r->recordSize)
+			break; // wait for the rest of the record
+
+		size_t start = r->tail & SERIAL_READER_MASK;
+		const unsigned char *record = r->buffer + start;
+		if(start + (size_t) r->recordSize > SERIAL_READER_BUFFER)
+		{
+			size_t first = SERIAL_READER_BUFFER - start;
+			memcpy(wrapped, r->buffer+start, first);
+			memcpy(wrapped+first, r->buffer, (size_t) r->recordSize - first);
+			record = wrapped;
+		}
+		r->callback(record, now, r->userdata);
+		r->tail += (size_t) r->recordSize;
+		r->synchronized = 1;
+		records++;
+	}
+
+	if(records)
+		__atomic_add_fetch(&r->records, records, __ATOMIC_RELAXED);
+	if(dropped)
+		__atomic_add_fetch(&r->dropped, dropped, __ATOMIC_RELAXED);
+	if(resyncs)
+		__atomic_add_fetch(&r->resyncs, resyncs, __ATOMIC_RELAXED);
+}
+
+/** Reads everything that is available from the device.
+
+    @return 1 on success, 0 if the device was disconnected.
+*/
+static int serial_reader_read(serial_reader *r)
+{
+	for(;;)
+	{
+		size_t start = r->head & SERIAL_READER_MASK;
+		size_t space = SERIAL_READER_BUFFER - (r->head - r->tail);
+		if(start + space > SERIAL_READER_BUFFER)
+			space = SERIAL_READER_BUFFER - start;
+		if(space == 0)
+		{
+			/* The buffer is full of bytes that aren't a complete
+			 * record (records are smaller than the buffer, so
+			 * this only happens if the magic bytes were found
+			 * but the record is still incomplete). Drop a byte so
+			 * that we can make progress. */
+			r->tail++;
+			__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		ssize_t n = read(r->fd, r->buffer+start, space);
+		if(n > 0)
+		{
+			r->head += (size_t) n;
+			serial_reader_frame(r, kuhl_microseconds());
+			continue;
+		}
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 1;
+
+		/* End of file or an error. */
+		msg(MSG_WARNING, "Lost connection to serial device '%s': %s", r->deviceFile, n == 0 ? "end of file" : strerror(errno));
+		return 0;
+	}
+}
+
+static void* serial_reader_thread(void *arg)
+{
+	serial_reader *r = (serial_reader*) arg;
+	int warned = 0;
+	for(;;)
+	{
+		struct epoll_event events[2];
+		int timeout = r->fd < 0 ? SERIAL_READER_RETRY_MSEC : -1;
+		int n = epoll_wait(r->epollFd, events, 2, timeout);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			msg(MSG_ERROR, "epoll_wait: %s", strerror(errno));
+			break;
+		}
+
+		int stop = 0;
+		for(int i=0; i<n; i++)
+		{
+			if(events[i].data.fd == r->stopFd)
+				stop = 1;
+			else if(events[i].data.fd == r->fd)
+			{
+				/* Read even if EPOLLHUP is set; there may be data
+				 * left. read() tells us when it is gone. */
+				if(!serial_reader_read(r))
+					serial_reader_disconnect(r);
+			}
+		}
+		if(stop)
+			break;
+
+		if(r->fd < 0 && n == 0) // timed out while disconnected
+		{
+			if(serial_reader_connect(r))
+			{
+				msg(MSG_INFO, "Reconnected to serial device '%s'", r->deviceFile);
+				warned = 0;
+			}
+			else if(!warned)
+			{
+				msg(MSG_WARNING, "Unable to reopen serial device '%s', will keep trying.", r->deviceFile);
+				warned = 1;
+			}
+		}
+	}
+	serial_reader_disconnect(r);
+	return NULL;
+}
+
+/** Opens a serial device and starts a thread which reads records from
+    it. If the device can't be opened, the thread keeps trying to
+    open it.
+
+    @param deviceFile The serial device to open (for example, /dev/ttyACM0).
+
+    @param speed The baud rate (see serial_open()).
+
+    @param magic The bytes at the start of each record.
+
+    @param magicLen The number of magic bytes (at most
+    SERIAL_READER_MAX_MAGIC).
+
+    @param recordSize The size of each record including the magic
+    bytes.
+
+    @param callback Function that is called on the reader thread for
+    each record.
+
+    @param userdata Passed to the callback.
+
+    @return A new serial_reader which should be stopped with
+    serial_reader_free().
+*/
+serial_reader* serial_reader_new(const char *deviceFile, int speed,
+                                 const unsigned char *magic, int magicLen, int recordSize,
+                                 serial_reader_func callback, void *userdata)
+{
+	if(magicLen < 1 || magicLen > SERIAL_READER_MAX_MAGIC ||
+	   recordSize < magicLen || recordSize > SERIAL_READER_BUFFER/2)
+	{
+		msg(MSG_FATAL, "Invalid record format: %d magic bytes, %d byte records", magicLen, recordSize);
+		exit(EXIT_FAILURE);
+	}
+
+	serial_reader *r = (serial_reader*) calloc(1, sizeof(serial_reader));
+	if(r == NULL)
+	{
+		msg(MSG_FATAL, "Unable to allocate memory for serial reader.");
+		exit(EXIT_FAILURE);
+	}
+	snprintf(r->deviceFile, sizeof(r->deviceFile), "%s", deviceFile);
+	r->speed = speed;
+	memcpy(r->magic, magic, (size_t) magicLen);
+	r->magicLen = magicLen;
+	r->recordSize = recordSize;
+	r->callback = callback;
+	r->userdata = userdata;
+	r->fd = -1;
+
+	r->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	r->stopFd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	if(r->epollFd < 0 || r->stopFd < 0)
+	{
+		msg(MSG_FATAL, "Unable to create epoll/eventfd: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = r->stopFd;
+	epoll_ctl(r->epollFd, EPOLL_CTL_ADD, r->stopFd, &ev);
+
+	/* If the device isn't available yet, the reader thread keeps
+	 * trying to open it. */
+	if(!serial_reader_connect(r))
+		msg(MSG_WARNING, "Unable to open serial device '%s', will keep trying.", deviceFile);
+
+	if(pthread_create(&r->thread, NULL, serial_reader_thread, r) != 0)
+	{
+		msg(MSG_FATAL, "Unable to create serial reader thread.");
+		exit(EXIT_FAILURE);
+	}
+	return r;
+}
+
+/** Stops the reader thread and closes the device. */
+void serial_reader_free(serial_reader *r)
+{
+	if(r == NULL)
+		return;
+	uint64_t one = 1;
+	if(write(r->stopFd, &one, sizeof(one)) != sizeof(one))
+		msg(MSG_ERROR, "Unable to stop serial reader thread: %s", strerror(errno));
+	pthread_join(r->thread, NULL);
+	close(r->stopFd);
+	close(r->epollFd);
+	free(r);
+}
+
+/** Retrieves statistics about the records that have been
+ * received. Any of the pointers may be NULL. */
+void serial_reader_stats(const serial_reader *r, long *records, long *resyncs, long *dropped, int *connected)
+{
+	if(records)
+		*records = __atomic_load_n(&r->records, __ATOMIC_RELAXED);
+	if(resyncs)
+		*resyncs = __atomic_load_n(&r->resyncs, __ATOMIC_RELAXED);
+	if(dropped)
+		*dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	if(connected)
+		*connected = __atomic_load_n(&r->connected, __ATOMIC_ACQUIRE);
+}
+#endif // __linux__
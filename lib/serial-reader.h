@@ -0,0 +1,68 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Reads fixed-size records from a serial device on a background
+ * thread. See serial-reader.c for details.
+ */
+
+#pragma once
+#ifdef __linux__ // see serial-reader.c
+#include <pthread.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SERIAL_READER_BUFFER 4096 /**< Size of the receive buffer (power of two) */
+#define SERIAL_READER_MAX_MAGIC 8
+
+/** Called by the reader thread for each complete record.
+
+    @param record The record, starting with the magic bytes. The
+    pointer is only valid during the call.
+
+    @param usec kuhl_microseconds() when the record was received.
+
+    @param userdata The pointer passed to serial_reader_new().
+*/
+typedef void (*serial_reader_func)(const unsigned char *record, long usec, void *userdata);
+
+typedef struct {
+	char deviceFile[256];
+	int speed;
+	int fd;       /**< Serial connection, -1 if disconnected (reader thread only) */
+	int epollFd;
+	int stopFd;   /**< eventfd used to wake up the reader thread when it should stop */
+	pthread_t thread;
+
+	unsigned char magic[SERIAL_READER_MAX_MAGIC];
+	int magicLen;
+	int recordSize;
+	serial_reader_func callback;
+	void *userdata;
+
+	/* Receive buffer, only used by the reader thread. head and tail
+	 * are byte counts; the buffer index is count%SERIAL_READER_BUFFER. */
+	unsigned char buffer[SERIAL_READER_BUFFER];
+	size_t head;  /**< Number of bytes received */
+	size_t tail;  /**< Number of bytes consumed */
+	int synchronized; /**< 1 if tail is at the start of a record */
+
+	/* Statistics, can be read by any thread with serial_reader_stats() */
+	long records;    /**< Complete records received */
+	long resyncs;    /**< Times we lost track of where records start */
+	long dropped;    /**< Bytes discarded while searching for a record */
+	int connected;   /**< 1 if the device is open */
+} serial_reader;
+
+serial_reader* serial_reader_new(const char *deviceFile, int speed,
+                                 const unsigned char *magic, int magicLen, int recordSize,
+                                 serial_reader_func callback, void *userdata);
+void serial_reader_free(serial_reader *r);
+void serial_reader_stats(const serial_reader *r, long *records, long *resyncs, long *dropped, int *connected);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
+#endif // __linux__
@@ -372,6 +372,44 @@ void serial_close(int fd)
 #endif
 }
 
+/** Tries once to open a serial connection and apply settings to the
+    connection. Unlike serial_open(), this function does not retry or
+    exit if the connection can't be opened.
+
+    @param deviceFile The serial device to open (often /dev/ttyUSB0 or /dev/ttyACM0)
+    @param speed The baud rate to be applied to the connection.
+    @param parity 0=no parity; 1=odd parity; 2=even parity
+    @param vmin 0 = nonblocking; if >1, block until we have received at least vmin bytes
+    @param vtime If blocking, tenths of a second we should block until we give up.
+
+    @return The file descriptor for the serial connection or -1 on failure.
+*/
+int serial_try_open(const char *deviceFile, int speed, int parity, int vmin, int vtime)
+{
+#ifdef _WIN32
+	msg(MSG_ERROR, "This function is not defined on Windows.");
+	return -1;
+#else
+#ifndef __MINGW32__
+	int fd = open(deviceFile, O_RDWR | O_NOCTTY);
+#else
+	int fd = open(deviceFile, O_RDWR);
+#endif
+	if(fd == -1)
+		return -1;
+	if(!isatty(fd))
+	{
+		msg(MSG_ERROR, "'%s' is not a tty.\n", deviceFile);
+		close(fd);
+		return -1;
+	}
+#ifndef __MINGW32__
+	serial_settings(fd, speed, parity, vmin, vtime);
+#endif
+	return fd;
+#endif
+}
+
 /** Open a serial connection and applies settings to the connection.
 
     @param deviceFile The serial device to open (often /dev/ttyUSB0 or /dev/ttyACM0)
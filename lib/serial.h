@@ -33,6 +33,7 @@ void serial_discard(int fd);
 void serial_write(const int fd, const char* buf, size_t numBytes);
 int serial_read(int fd, char* buf, size_t numBytes, int options);
 int serial_open(const char *deviceFile, int speed, int parity, int vmin, int vtime);
+int serial_try_open(const char *deviceFile, int speed, int parity, int vmin, int vtime);
 void serial_close(int fd);
 
 #ifdef __cplusplus
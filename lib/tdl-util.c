@@ -12,8 +12,17 @@
 #include <stdlib.h>
 #endif
 
+#include <errno.h>
+#ifndef _WIN32
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "tdl-util.h"
 #include "msg.h"
+#include "vecmat.h"
 /**
  * Moves the cursor to the first data point entry.
  * This MUST be called before any calls to tdl_read.
@@ -268,3 +277,493 @@ int tdl_validate(FILE *f)
 }
 
 
+
+/*
+ * Version 2 files
+ *
+ * Version 1 files have no timestamps, store a 3x3 matrix for each
+ * record, and must be read one record at a time from the beginning of
+ * the file. Version 2 files are designed to be mapped into memory and
+ * accessed randomly:
+ *
+ * - A tdl_header (128 bytes) which contains the number of records, the
+ *   time of the first and last record, and the object name.
+ *
+ * - The records: an array of tdl_record structs (48 bytes each) which
+ *   are sorted by time. Record i is at byte
+ *   headerSize + i*recordSize.
+ *
+ * - An index: the time of every TDL_V2_INDEX_STRIDE'th record
+ *   (int64_t). The index is small enough to stay in the cache, so
+ *   finding a record by time only touches a few records.
+ *
+ * The record count and the index are written by tdl_writer_close(). If
+ * a recording is interrupted before that, tdl_open() calculates the
+ * number of records from the file size and searches the records
+ * directly.
+ */
+
+static const unsigned char tdl_v2_magic[8] = { 219, 'T', 'D', 'L', '2', '\r', '\n', 26 };
+
+#ifndef _WIN32
+/** Reads a version 1 file into memory. Version 1 files don't have
+ * timestamps, so the records are assumed to be TDL_V1_HZ apart. */
+static tdl_log* tdl_open_v1(const char *path, tdl_log *log)
+{
+	FILE *f = fopen(path, "rb");
+	char *name = NULL;
+	if(f == NULL || tdl_prepare(f, &name) != 1)
+	{
+		if(f)
+			fclose(f);
+		return NULL;
+	}
+	snprintf(log->name, sizeof(log->name), "%s", name ? name : "");
+	free(name);
+
+	size_t capacity = 1024;
+	tdl_record *records = (tdl_record*) malloc(sizeof(tdl_record)*capacity);
+	float pos[3], orient[9];
+	while(records != NULL && tdl_read(f, pos, orient) == 0)
+	{
+		if(log->count == capacity)
+		{
+			capacity *= 2;
+			tdl_record *bigger = (tdl_record*) realloc(records, sizeof(tdl_record)*capacity);
+			if(bigger == NULL)
+				free(records);
+			records = bigger;
+			if(records == NULL)
+				break;
+		}
+		tdl_record *r = &records[log->count];
+		memset(r, 0, sizeof(tdl_record));
+		r->usec = (int64_t) log->count * (1000000 / TDL_V1_HZ);
+		vec3f_copy(r->pos, pos);
+		quatf_from_mat3f(r->quat, orient);
+		log->count++;
+	}
+	fclose(f);
+	if(records == NULL)
+	{
+		msg(MSG_ERROR, "Unable to allocate memory for records in '%s'", path);
+		return NULL;
+	}
+	log->records = records;
+	log->hasTimestamps = 0;
+	return log;
+}
+#endif
+
+/**
+ * Maps a whole file into memory. Files which are too small to be a
+ * version 2 file are not mapped; log->map is then NULL.
+ *
+ * On Windows, the file is read into memory instead.
+ *
+ * @return 1 on success, 0 if the file could not be opened or mapped.
+ */
+static int tdl_map(const char *path, tdl_log *log)
+{
+#ifdef _WIN32
+	FILE *f = fopen(path, "rb");
+	if(f == NULL)
+	{
+		msg(MSG_ERROR, "Unable to open '%s': %s", path, strerror(errno));
+		return 0;
+	}
+	long size = -1;
+	if(fseek(f, 0, SEEK_END) == 0)
+		size = ftell(f);
+	rewind(f);
+	if(size < 0)
+	{
+		msg(MSG_ERROR, "Unable to read '%s': %s", path, strerror(errno));
+		fclose(f);
+		return 0;
+	}
+	log->mapSize = (size_t) size;
+	if(log->mapSize >= sizeof(tdl_header))
+	{
+		log->map = malloc(log->mapSize);
+		if(log->map == NULL || fread(log->map, 1, log->mapSize, f) != log->mapSize)
+		{
+			msg(MSG_ERROR, "Unable to read '%s' into memory.", path);
+			free(log->map);
+			log->map = NULL;
+			fclose(f);
+			return 0;
+		}
+	}
+	fclose(f);
+	return 1;
+#else
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		msg(MSG_ERROR, "Unable to open '%s': %s", path, strerror(errno));
+		return 0;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		msg(MSG_ERROR, "Unable to stat '%s': %s", path, strerror(errno));
+		close(fd);
+		return 0;
+	}
+	log->mapSize = (size_t) st.st_size;
+	if(log->mapSize >= sizeof(tdl_header))
+	{
+		log->map = mmap(NULL, log->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(log->map == MAP_FAILED)
+		{
+			msg(MSG_ERROR, "Unable to map '%s' into memory: %s", path, strerror(errno));
+			log->map = NULL;
+			close(fd);
+			return 0;
+		}
+		/* Tell the OS that we will likely read through the records
+		 * in order. */
+		madvise(log->map, log->mapSize, MADV_SEQUENTIAL);
+	}
+	close(fd); // the mapping stays valid
+	return 1;
+#endif
+}
+
+/** Releases the memory from tdl_map(). */
+static void tdl_unmap(tdl_log *log)
+{
+	if(log->map == NULL)
+		return;
+#ifdef _WIN32
+	free(log->map);
+#else
+	munmap(log->map, log->mapSize);
+#endif
+	log->map = NULL;
+	log->mapSize = 0;
+}
+
+/**
+ * Opens a TDL file for reading. Version 2 files are mapped into memory
+ * and no records are read until they are used (on Windows, the file
+ * is read into memory). Version 1 files are read into memory and
+ * converted into version 2 records (with timestamps assigned at
+ * TDL_V1_HZ); they can't be read on Windows.
+ *
+ * @param path The file to open.
+ *
+ * @return A tdl_log which should be closed with tdl_close() or NULL
+ * on error.
+ */
+tdl_log* tdl_open(const char *path)
+{
+	tdl_log *log = (tdl_log*) calloc(1, sizeof(tdl_log));
+	if(log == NULL)
+		return NULL;
+
+	if(!tdl_map(path, log))
+	{
+		free(log);
+		return NULL;
+	}
+	tdl_header header;
+	if(log->map == NULL || memcmp(log->map, tdl_v2_magic, 8) != 0)
+	{
+		/* Not a version 2 file, try version 1. */
+		tdl_unmap(log);
+#ifndef _WIN32
+		if(tdl_open_v1(path, log) != NULL)
+			return log;
+#endif
+		msg(MSG_ERROR, "'%s' is not a TDL file.", path);
+		free(log);
+		return NULL;
+	}
+	memcpy(&header, log->map, sizeof(header));
+
+	if(header.version != 2 || header.headerSize < sizeof(tdl_header) ||
+	   header.recordSize < sizeof(tdl_record) || header.recordSize % 8 != 0)
+	{
+		msg(MSG_ERROR, "'%s' uses an unsupported TDL format (version %u).", path, header.version);
+		tdl_unmap(log);
+		free(log);
+		return NULL;
+	}
+	/* The records are accessed as an array, so the record size must
+	 * match our struct. Newer versions may append fields to the
+	 * header, but not to the records. */
+	if(header.recordSize != sizeof(tdl_record))
+	{
+		msg(MSG_ERROR, "'%s' has %u byte records, expected %u.", path, header.recordSize, (unsigned) sizeof(tdl_record));
+		tdl_unmap(log);
+		free(log);
+		return NULL;
+	}
+	/* A corrupt or truncated file could claim to have a header or
+	 * records which extend past the end of the file. */
+	if(header.headerSize > (uint64_t) log->mapSize ||
+	   (header.indexOffset != 0 &&
+	    header.recordCount > ((uint64_t) log->mapSize - header.headerSize) / sizeof(tdl_record)))
+	{
+		msg(MSG_ERROR, "'%s' is truncated or corrupt.", path);
+		tdl_unmap(log);
+		free(log);
+		return NULL;
+	}
+
+	const char *base = (const char*) log->map;
+	log->records = (const tdl_record*) (base + header.headerSize);
+	log->hasTimestamps = 1;
+	memcpy(log->name, header.name, sizeof(header.name));
+	log->name[sizeof(header.name)] = '\0';
+
+	size_t available = (log->mapSize - header.headerSize) / sizeof(tdl_record);
+	if(header.indexOffset != 0 && header.recordCount <= available &&
+	   header.indexStride > 0 &&
+	   header.indexOffset == header.headerSize + header.recordCount*sizeof(tdl_record))
+	{
+		log->count = (size_t) header.recordCount;
+		log->indexStride = header.indexStride;
+		log->indexCount = (log->count + log->indexStride - 1) / log->indexStride;
+		if(header.indexOffset + log->indexCount*sizeof(int64_t) <= log->mapSize)
+			log->index = (const int64_t*) (base + header.indexOffset);
+		else
+			log->indexCount = 0;
+	}
+	else
+	{
+		msg(MSG_WARNING, "'%s' was not closed properly; reading records without an index.", path);
+		log->count = available;
+	}
+	return log;
+}
+
+/** Closes a file opened with tdl_open(). */
+void tdl_close(tdl_log *log)
+{
+	if(log == NULL)
+		return;
+	if(log->map)
+		tdl_unmap(log);
+	else
+		free((void*) log->records);
+	free(log);
+}
+
+/**
+ * Finds the newest record at or before a specific time.
+ *
+ * Records are usually recorded at a steady rate, so we first guess
+ * where the record is from the average rate. If the guess is close,
+ * this only reads a few records. Otherwise, the index (or the records
+ * if there is no index) is searched.
+ *
+ * @param log The file to search.
+ *
+ * @param usec The time to search for.
+ *
+ * @return The index of the record. If usec is earlier than the first
+ * record, 0 is returned. If the file has no records, 0 is returned.
+ */
+size_t tdl_find(const tdl_log *log, int64_t usec)
+{
+	const tdl_record *r = log->records;
+	size_t n = log->count;
+	if(n == 0 || usec <= r[0].usec)
+		return 0;
+	if(usec >= r[n-1].usec)
+		return n-1;
+
+	/* Guess based on the average rate. */
+	double fraction = (double) (usec - r[0].usec) / (double) (r[n-1].usec - r[0].usec);
+	size_t guess = (size_t) (fraction * (double) (n-1));
+	if(guess > n-2)
+		guess = n-2;
+	for(int i=0; i<8; i++)
+	{
+		if(r[guess].usec > usec)
+			guess--;
+		else if(r[guess+1].usec <= usec)
+			guess++;
+		else
+			return guess;
+	}
+
+	/* Binary search for a range of records which contains usec. lo is
+	 * always at or before usec; hi is always after it. */
+	size_t lo = 0, hi = n-1;
+	if(log->index != NULL)
+	{
+		size_t ilo = 0, ihi = log->indexCount;
+		while(ihi - ilo > 1)
+		{
+			size_t mid = (ilo+ihi)/2;
+			if(log->index[mid] <= usec)
+				ilo = mid;
+			else
+				ihi = mid;
+		}
+		lo = ilo * log->indexStride;
+		if(ihi < log->indexCount)
+			hi = ihi * log->indexStride;
+	}
+	while(hi - lo > 1)
+	{
+		size_t mid = (lo+hi)/2;
+		if(r[mid].usec <= usec)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Estimates the pose at a specific time by interpolating between the
+ * records on either side of it. Positions are linearly interpolated
+ * and orientations are interpolated with slerp. Times before the
+ * first record or after the last record use the first or last record.
+ *
+ * @return 1 on success, 0 if the file has no records.
+ */
+int tdl_lookup(const tdl_log *log, int64_t usec, float pos[3], float quat[4])
+{
+	if(log->count == 0)
+		return 0;
+	size_t i = tdl_find(log, usec);
+	const tdl_record *a = &log->records[i];
+	if(i+1 >= log->count || usec <= a->usec)
+	{
+		vec3f_copy(pos, a->pos);
+		vec4f_copy(quat, a->quat);
+		return 1;
+	}
+	const tdl_record *b = a+1;
+	float t = (float) (usec - a->usec) / (float) (b->usec - a->usec);
+	for(int j=0; j<3; j++)
+		pos[j] = a->pos[j] + t*(b->pos[j]-a->pos[j]);
+	quatf_slerp_new(quat, a->quat, b->quat, t);
+	return 1;
+}
+
+/**
+ * Creates a version 2 TDL file. Records are added with
+ * tdl_writer_add() and the file must be closed with
+ * tdl_writer_close() to write the index.
+ *
+ * @param path The file to create. ".tdl" is NOT appended.
+ *
+ * @param name The name of the tracked object (at most 63 characters
+ * are stored).
+ *
+ * @return A tdl_writer or NULL on error.
+ */
+tdl_writer* tdl_writer_open(const char *path, const char *name)
+{
+	FILE *f = fopen(path, "wb");
+	if(f == NULL)
+	{
+		msg(MSG_ERROR, "Unable to create '%s': %s", path, strerror(errno));
+		return NULL;
+	}
+	tdl_writer *w = (tdl_writer*) calloc(1, sizeof(tdl_writer));
+	if(w == NULL)
+	{
+		fclose(f);
+		return NULL;
+	}
+	w->f = f;
+	memcpy(w->header.magic, tdl_v2_magic, 8);
+	w->header.version = 2;
+	w->header.headerSize = sizeof(tdl_header);
+	w->header.recordSize = sizeof(tdl_record);
+	w->header.indexStride = TDL_V2_INDEX_STRIDE;
+	snprintf(w->header.name, sizeof(w->header.name), "%s", name ? name : "");
+
+	/* recordCount and indexOffset are 0 until tdl_writer_close(). */
+	if(fwrite(&w->header, sizeof(tdl_header), 1, f) != 1)
+	{
+		msg(MSG_ERROR, "Unable to write to '%s': %s", path, strerror(errno));
+		fclose(f);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+/**
+ * Adds a record to a version 2 TDL file.
+ *
+ * @param usec The time of the record. Records must be added in order;
+ * records which are older than the previous record are discarded.
+ *
+ * @return 1 on success, 0 if the record was discarded or could not be
+ * written.
+ */
+int tdl_writer_add(tdl_writer *w, int64_t usec, const float pos[3], const float quat[4])
+{
+	uint64_t n = w->header.recordCount;
+	if(n > 0 && usec < w->header.lastUsec)
+		return 0;
+
+	if(n % TDL_V2_INDEX_STRIDE == 0)
+	{
+		if(w->indexCount == w->indexCapacity)
+		{
+			size_t capacity = w->indexCapacity ? w->indexCapacity*2 : 256;
+			int64_t *bigger = (int64_t*) realloc(w->index, sizeof(int64_t)*capacity);
+			if(bigger == NULL)
+				return 0;
+			w->index = bigger;
+			w->indexCapacity = capacity;
+		}
+		w->index[w->indexCount++] = usec;
+	}
+
+	tdl_record r;
+	memset(&r, 0, sizeof(r));
+	r.usec = usec;
+	memcpy(r.pos, pos, sizeof(r.pos));
+	memcpy(r.quat, quat, sizeof(r.quat));
+	if(fwrite(&r, sizeof(r), 1, w->f) != 1)
+	{
+		perror("Writing record failed");
+		if(n % TDL_V2_INDEX_STRIDE == 0)
+			w->indexCount--;
+		return 0;
+	}
+
+	if(n == 0)
+		w->header.firstUsec = usec;
+	w->header.lastUsec = usec;
+	w->header.recordCount = n+1;
+	return 1;
+}
+
+/**
+ * Writes the index and the final header and closes the file.
+ *
+ * @return 1 on success, 0 on error.
+ */
+int tdl_writer_close(tdl_writer *w)
+{
+	if(w == NULL)
+		return 0;
+	int ok = 1;
+	w->header.indexOffset = sizeof(tdl_header) + w->header.recordCount*sizeof(tdl_record);
+	if(w->indexCount > 0 &&
+	   fwrite(w->index, sizeof(int64_t), w->indexCount, w->f) != w->indexCount)
+		ok = 0;
+	if(ok && (fseek(w->f, 0, SEEK_SET) != 0 ||
+	          fwrite(&w->header, sizeof(tdl_header), 1, w->f) != 1))
+		ok = 0;
+	if(fclose(w->f) != 0)
+		ok = 0;
+	if(!ok)
+		msg(MSG_ERROR, "Unable to finish writing TDL file: %s", strerror(errno));
+	free(w->index);
+	free(w);
+	return ok;
+}
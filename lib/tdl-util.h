@@ -4,10 +4,15 @@
  */
 
 #pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Version 1 files: A signature, the object name, and then a position
+ * and 3x3 rotation matrix for each record. There are no timestamps. */
 int tdl_prepare(FILE *f, char** name);
 FILE* tdl_create(const char* path, const char* name);
 int tdl_read(FILE *f, float pos[3], float orient[9]);
@@ -18,6 +23,70 @@ bool tdl_validate(FILE *f);
 int tdl_validate(FILE *f);
 #endif
 
+
+/* Version 2 files: A fixed-size header, fixed-size timestamped
+ * records, and an index of timestamps at the end of the file. See
+ * tdl-util.c for details. */
+
+#define TDL_V2_INDEX_STRIDE 64  /**< Records per index entry */
+#define TDL_V1_HZ 100           /**< Rate assumed for version 1 files, which lack timestamps */
+
+/** Header at the beginning of a version 2 file. All values are
+ * little-endian. */
+typedef struct {
+	unsigned char magic[8]; /**< 219 'T' 'D' 'L' '2' '\r' '\n' 26 */
+	uint32_t version;       /**< 2 */
+	uint32_t headerSize;    /**< sizeof(tdl_header) */
+	uint32_t recordSize;    /**< sizeof(tdl_record) */
+	uint32_t indexStride;   /**< Records per index entry */
+	uint64_t recordCount;   /**< Number of records, 0 if the file was not closed properly */
+	uint64_t indexOffset;   /**< Byte offset of the index, 0 if there is no index */
+	int64_t firstUsec;      /**< Time of the first record */
+	int64_t lastUsec;       /**< Time of the last record */
+	char name[64];          /**< Name of the tracked object (NUL terminated) */
+	uint32_t reserved[2];
+} tdl_header;
+
+/** A single pose in a version 2 file. */
+typedef struct {
+	int64_t usec;     /**< Time the pose was measured in microseconds */
+	float pos[3];     /**< Position */
+	float quat[4];    /**< Orientation quaternion (x,y,z,w) */
+	uint32_t flags;   /**< Reserved, 0 */
+	uint32_t reserved[2];
+} tdl_record;
+
+/** A TDL file opened for reading with tdl_open(). */
+typedef struct {
+	const tdl_record *records; /**< All of the records, sorted by time */
+	size_t count;              /**< Number of records */
+	const int64_t *index;      /**< Time of every indexStride'th record, NULL if there is no index */
+	size_t indexCount;
+	uint32_t indexStride;
+	int hasTimestamps;         /**< 0 for version 1 files (times were assigned at TDL_V1_HZ) */
+	char name[65];             /**< Name of the tracked object */
+
+	void *map;                 /**< mmap()'d file (malloc()'d on Windows), or NULL if records were malloc()'d */
+	size_t mapSize;
+} tdl_log;
+
+/** A version 2 file opened for writing with tdl_writer_open(). */
+typedef struct {
+	FILE *f;
+	tdl_header header;
+	int64_t *index;
+	size_t indexCount, indexCapacity;
+} tdl_writer;
+
+tdl_log* tdl_open(const char *path);
+void tdl_close(tdl_log *log);
+size_t tdl_find(const tdl_log *log, int64_t usec);
+int tdl_lookup(const tdl_log *log, int64_t usec, float pos[3], float quat[4]);
+
+tdl_writer* tdl_writer_open(const char *path, const char *name);
+int tdl_writer_add(tdl_writer *w, int64_t usec, const float pos[3], const float quat[4]);
+int tdl_writer_close(tdl_writer *w);
+
 #ifdef __cplusplus
 } // end extern "C"
 #endif
@@ -0,0 +1,324 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+
+    tlist provides a typed alternative to list for code where speed
+    matters. A tlist type is generated with the TLIST_DECLARE() macro
+    and all of its functions are static inline so that the compiler
+    can inline them.
+
+    Differences from list:
+
+    - Items are accessed by value through typed functions rather than
+      through memcpy().
+
+    - The first few items are stored inside of the struct itself. A
+      list which never grows beyond this inline capacity never calls
+      malloc().
+
+    - Index checks are only performed if NDEBUG is not defined (or if
+      TLIST_CHECKS is defined to 1). Out-of-range accesses in release
+      builds are undefined.
+
+    - Items can be appended or inserted in bulk.
+
+    For example, a list of floats which can store 8 items before it
+    allocates memory:
+
+    <pre>
+    TLIST_DECLARE(floatlist, float, 8)
+
+    floatlist l;
+    floatlist_init(&l);
+    floatlist_append(&l, 3.0f);
+    float x = floatlist_get(&l, 0);
+    floatlist_free(&l);
+    </pre>
+
+    Because data may point into the struct itself, a tlist must not be
+    copied with assignment or memcpy(). Use NAME_copy() instead.
+
+    The following variables can be read but should not be changed
+    outside of these functions:
+
+    l->length: Number of items in the list.
+
+    l->capacity: Number of items that can be stored without
+    reallocating.
+
+    l->data: Pointer to the first item.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "msg.h"
+
+#ifndef TLIST_CHECKS
+#ifdef NDEBUG
+#define TLIST_CHECKS 0
+#else
+#define TLIST_CHECKS 1
+#endif
+#endif
+
+#if TLIST_CHECKS
+#define TLIST_CHECK_INDEX(l, index, max) do {	  \
+		if((index) < 0 || (index) >= (max))	  \
+		{ \
+			msg(MSG_FATAL, "Index %d is out of range (length=%d)", (index), (l)->length); \
+			exit(EXIT_FAILURE); \
+		} \
+	} while(0)
+#else
+#define TLIST_CHECK_INDEX(l, index, max) do { } while(0)
+#endif
+
+/** Declares a tlist type named NAME that stores items of type TYPE and
+ * stores up to INLINE_COUNT items without allocating memory. */
+#define TLIST_DECLARE(NAME, TYPE, INLINE_COUNT)	  \
+	typedef struct { \
+		int length; \
+		int capacity; \
+		TYPE *data; \
+		TYPE inlineData[INLINE_COUNT]; \
+	} NAME; \
+	\
+	/** Initializes an empty list. */ \
+	static inline void NAME##_init(NAME *l) \
+	{ \
+		l->length = 0; \
+		l->capacity = INLINE_COUNT; \
+		l->data = l->inlineData; \
+	} \
+	\
+	/** Frees memory used by the list and leaves an empty list. */ \
+	static inline void NAME##_free(NAME *l) \
+	{ \
+		if(l->data != l->inlineData) \
+			free(l->data); \
+		NAME##_init(l); \
+	} \
+	\
+	/** Ensures that the list can hold at least capacity items. */ \
+	static inline int NAME##_reserve(NAME *l, int capacity) \
+	{ \
+		if(capacity <= l->capacity) \
+			return 1; \
+		int newCapacity = l->capacity * 2; \
+		if(newCapacity < capacity) \
+			newCapacity = capacity; \
+		TYPE *newData; \
+		if(l->data == l->inlineData) \
+		{ \
+			newData = (TYPE*) malloc(sizeof(TYPE) * (size_t) newCapacity); \
+			if(newData != NULL) \
+				memcpy(newData, l->inlineData, sizeof(TYPE) * (size_t) l->length); \
+		} \
+		else \
+			newData = (TYPE*) realloc(l->data, sizeof(TYPE) * (size_t) newCapacity); \
+		if(newData == NULL) \
+		{ \
+			msg(MSG_ERROR, "Failed to allocate space for %d items", newCapacity); \
+			return 0; \
+		} \
+		l->data = newData; \
+		l->capacity = newCapacity; \
+		return 1; \
+	} \
+	\
+	static inline TYPE NAME##_get(const NAME *l, int index) \
+	{ \
+		TLIST_CHECK_INDEX(l, index, l->length); \
+		return l->data[index]; \
+	} \
+	\
+	static inline TYPE* NAME##_getptr(NAME *l, int index) \
+	{ \
+		TLIST_CHECK_INDEX(l, index, l->length); \
+		return &(l->data[index]); \
+	} \
+	\
+	static inline void NAME##_set(NAME *l, int index, TYPE item) \
+	{ \
+		TLIST_CHECK_INDEX(l, index, l->length); \
+		l->data[index] = item; \
+	} \
+	\
+	static inline int NAME##_append(NAME *l, TYPE item) \
+	{ \
+		if(l->length == l->capacity && !NAME##_reserve(l, l->length+1)) \
+			return 0; \
+		l->data[l->length++] = item; \
+		return 1; \
+	} \
+	\
+	/** Returns the index that items points to if it points into the \
+	 * list, or -1 otherwise. NAME_reserve() may move the items, so \
+	 * the bulk functions use this to find them again. */ \
+	static inline int NAME##_offset(const NAME *l, const TYPE *items) \
+	{ \
+		uintptr_t diff = (uintptr_t) items - (uintptr_t) l->data; \
+		if(diff < sizeof(TYPE) * (size_t) l->length) \
+			return (int) (diff / sizeof(TYPE)); \
+		return -1; \
+	} \
+	\
+	/** Appends count items from an array to the end of the list. The \
+	 * items may be part of the list itself. */ \
+	static inline int NAME##_append_many(NAME *l, const TYPE *items, int count) \
+	{ \
+		if(count <= 0) \
+			return 1; \
+		int offset = NAME##_offset(l, items); \
+		if(!NAME##_reserve(l, l->length+count)) \
+			return 0; \
+		if(offset >= 0) \
+			items = l->data + offset; \
+		memcpy(l->data + l->length, items, sizeof(TYPE) * (size_t) count); \
+		l->length += count; \
+		return 1; \
+	} \
+	\
+	/** Inserts count items from an array so that the first inserted \
+	 * item is at index. The items may be part of the list itself. */ \
+	static inline int NAME##_insert_many(NAME *l, int index, const TYPE *items, int count) \
+	{ \
+		TLIST_CHECK_INDEX(l, index, l->length+1); \
+		if(count <= 0) \
+			return 1; \
+		int offset = NAME##_offset(l, items); \
+		if(!NAME##_reserve(l, l->length+count)) \
+			return 0; \
+		memmove(l->data + index + count, l->data + index, sizeof(TYPE) * (size_t) (l->length-index)); \
+		if(offset < 0) \
+			memcpy(l->data + index, items, sizeof(TYPE) * (size_t) count); \
+		else \
+		{ \
+			/* Items before index didn't move; the rest moved by count. */ \
+			int before = index - offset; \
+			if(before < 0) \
+				before = 0; \
+			if(before > count) \
+				before = count; \
+			memcpy(l->data + index, l->data + offset, sizeof(TYPE) * (size_t) before); \
+			memcpy(l->data + index + before, l->data + offset + before + count, \
+			       sizeof(TYPE) * (size_t) (count - before)); \
+		} \
+		l->length += count; \
+		return 1; \
+	} \
+	\
+	static inline int NAME##_insert(NAME *l, int index, TYPE item) \
+	{ \
+		return NAME##_insert_many(l, index, &item, 1); \
+	} \
+	\
+	/** Removes count items starting at index. */ \
+	static inline void NAME##_remove_many(NAME *l, int index, int count) \
+	{ \
+		if(count <= 0) \
+			return; \
+		TLIST_CHECK_INDEX(l, index, l->length); \
+		TLIST_CHECK_INDEX(l, index+count-1, l->length); \
+		memmove(l->data + index, l->data + index + count, sizeof(TYPE) * (size_t) (l->length-index-count)); \
+		l->length -= count; \
+	} \
+	\
+	static inline TYPE NAME##_remove(NAME *l, int index) \
+	{ \
+		TYPE item = NAME##_get(l, index); \
+		NAME##_remove_many(l, index, 1); \
+		return item; \
+	} \
+	\
+	/** Removes all items but keeps the allocated memory. */ \
+	static inline void NAME##_clear(NAME *l) \
+	{ \
+		l->length = 0; \
+	} \
+	\
+	/** Initializes dest to contain a copy of src. */ \
+	static inline int NAME##_copy(NAME *dest, const NAME *src) \
+	{ \
+		NAME##_init(dest); \
+		return NAME##_append_many(dest, src->data, src->length); \
+	} \
+	\
+	static inline void NAME##_sort(NAME *l, int (*compar)(const void *, const void *)) \
+	{ \
+		qsort(l->data, (size_t) l->length, sizeof(TYPE), compar); \
+	}
+
+/** Declares NAME_sort_fast() for a tlist type that was previously
+ * declared with TLIST_DECLARE(). Unlike NAME_sort(), which calls
+ * qsort(), the comparison is inlined. LESS(a,b) must be a macro (or
+ * function) which returns true if item a should come before item
+ * b. For example:
+
+    <pre>
+    #define FLOAT_LESS(a,b) ((a)<(b))
+    TLIST_DECLARE_SORT(floatlist, float, FLOAT_LESS)
+    </pre>
+*/
+#define TLIST_DECLARE_SORT(NAME, TYPE, LESS)	  \
+	static inline void NAME##_insertion_sort(TYPE *a, int n) \
+	{ \
+		for(int i=1; i<n; i++) \
+		{ \
+			TYPE item = a[i]; \
+			int j = i-1; \
+			while(j >= 0 && LESS(item, a[j])) \
+			{ \
+				a[j+1] = a[j]; \
+				j--; \
+			} \
+			a[j+1] = item; \
+		} \
+	} \
+	\
+	static inline void NAME##_quicksort(TYPE *a, int n) \
+	{ \
+		while(n > 16) \
+		{ \
+			/* Median of three pivot */ \
+			TYPE tmp; \
+			int mid = n/2; \
+			if(LESS(a[mid], a[0]))   { tmp=a[mid]; a[mid]=a[0]; a[0]=tmp; } \
+			if(LESS(a[n-1], a[0]))   { tmp=a[n-1]; a[n-1]=a[0]; a[0]=tmp; } \
+			if(LESS(a[n-1], a[mid])) { tmp=a[n-1]; a[n-1]=a[mid]; a[mid]=tmp; } \
+			TYPE pivot = a[mid]; \
+			int i = 0, j = n-1; \
+			for(;;) \
+			{ \
+				while(LESS(a[i], pivot)) i++; \
+				while(LESS(pivot, a[j])) j--; \
+				if(i >= j) \
+					break; \
+				tmp=a[i]; a[i]=a[j]; a[j]=tmp; \
+				i++; j--; \
+			} \
+			/* Recurse into the smaller half to bound the stack depth. */ \
+			if(j+1 < n-j-1) \
+			{ \
+				NAME##_quicksort(a, j+1); \
+				a += j+1; \
+				n -= j+1; \
+			} \
+			else \
+			{ \
+				NAME##_quicksort(a+j+1, n-j-1); \
+				n = j+1; \
+			} \
+		} \
+		NAME##_insertion_sort(a, n); \
+	} \
+	\
+	static inline void NAME##_sort_fast(NAME *l) \
+	{ \
+		NAME##_quicksort(l->data, l->length); \
+	}
@@ -0,0 +1,407 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   trace.c records timing events in a compact binary file so that
+   frame drops can be diagnosed after the fact. msg() is intended for
+   humans; this file is intended for tools.
+
+   Tracing is disabled by default. Set "trace.enabled=1" in the
+   configuration file to enable it. Other settings:
+
+   - trace.filename: The binary trace file (default: trace.bin).
+
+   - trace.records: Number of events the file can hold. When the file
+     is full, the oldest events are overwritten (default: 262144,
+     which is 6MB).
+
+   - trace.json: If set, the binary trace is converted into a Chrome
+     trace JSON file with this name when the program exits. The JSON
+     file can be loaded in chrome://tracing or https://ui.perfetto.dev
+
+   The binary file contains a header, a table of event names and then
+   a ring of fixed-size records. Events are buffered in memory and
+   written to the file when the buffer fills and when the program
+   exits. The trace functions are not thread safe and should only be
+   called from the thread which renders.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "msg.h"
+#include "kuhl-config.h"
+#include "kuhl-nodep.h"
+
+#define TRACE_MAGIC "KTRACE1"
+#define TRACE_VERSION 1
+#define TRACE_MAX_NAMES 256  /**< Maximum number of unique event names */
+#define TRACE_NAME_LEN 32    /**< Maximum length of an event name (including NUL) */
+#define TRACE_BUFFER_LEN 4096 /**< Number of events buffered in memory before writing */
+
+/** Header at the beginning of each trace file. */
+typedef struct {
+	char magic[8];      /**< TRACE_MAGIC */
+	uint32_t version;   /**< TRACE_VERSION */
+	uint32_t capacity;  /**< Number of record slots in the file */
+	uint64_t written;   /**< Number of records ever written (may exceed capacity) */
+	uint32_t nameCount; /**< Number of entries in the name table */
+	uint32_t nameLen;   /**< Length of each entry in the name table */
+	int64_t startTime;  /**< kuhl_microseconds() when tracing started */
+} trace_header;
+
+/** A single event stored in a trace file. */
+typedef struct {
+	int64_t usec;    /**< Time of the event relative to trace_header.startTime */
+	double value;    /**< Counter value or frame number */
+	uint16_t name;   /**< Index into the name table */
+	uint8_t type;    /**< A trace_type */
+	uint8_t pad[5];
+} trace_record;
+
+static int trace_state = 0; /**< 0=uninitialized, 1=enabled, -1=disabled */
+static FILE *trace_file = NULL;
+static trace_header header;
+static char trace_names[TRACE_MAX_NAMES][TRACE_NAME_LEN];
+static const char *trace_name_ptrs[TRACE_MAX_NAMES]; /**< Pointers passed to us, used as a fast lookup */
+static trace_record trace_buffer[TRACE_BUFFER_LEN];
+static int trace_buffer_len = 0;
+static uint32_t trace_frame_count = 0;
+
+static void trace_exit(void)
+{
+	if(trace_state != 1)
+		return;
+	trace_flush();
+	fclose(trace_file);
+	trace_file = NULL;
+	trace_state = -1;
+
+	const char *jsonFile = kuhl_config_get("trace.json");
+	const char *traceFile = kuhl_config_get("trace.filename");
+	if(traceFile == NULL)
+		traceFile = "trace.bin";
+	if(jsonFile != NULL && strlen(jsonFile) > 0)
+		trace_export_chrome(traceFile, jsonFile);
+}
+
+static void trace_init(void)
+{
+	trace_state = -1;
+	if(kuhl_config_boolean("trace.enabled", 0, 0) == 0)
+		return;
+
+	const char *filename = kuhl_config_get("trace.filename");
+	if(filename == NULL)
+		filename = "trace.bin";
+	int capacity = kuhl_config_int("trace.records", 262144, 262144);
+	if(capacity < TRACE_BUFFER_LEN)
+	{
+		msg(MSG_WARNING, "trace.records must be at least %d, using %d.", TRACE_BUFFER_LEN, TRACE_BUFFER_LEN);
+		capacity = TRACE_BUFFER_LEN;
+	}
+
+	trace_file = fopen(filename, "w+b");
+	if(trace_file == NULL)
+	{
+		msg(MSG_ERROR, "Unable to open trace file '%s'. Tracing is disabled.", filename);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.version = TRACE_VERSION;
+	header.capacity = (uint32_t) capacity;
+	header.nameLen = TRACE_NAME_LEN;
+	header.startTime = kuhl_microseconds();
+	memset(trace_names, 0, sizeof(trace_names));
+
+	msg(MSG_INFO, "Writing trace events to '%s' (up to %d events)", filename, capacity);
+	trace_state = 1;
+	atexit(trace_exit);
+}
+
+/** Returns 1 if tracing is enabled, 0 otherwise. Can be used to avoid
+ * computing values which are only needed for trace_counter(). */
+int trace_enabled(void)
+{
+	if(trace_state == 0)
+		trace_init();
+	return trace_state == 1;
+}
+
+/** Finds (or adds) a name in the name table. Names are usually string
+ * literals, so we compare pointers first and fall back to strcmp().
+ * A pointer match still has to compare equal since a buffer may be
+ * reused for a different name.
+ *
+ * @return The index of the name or -1 if the table is full or the
+ * name is too long.
+ */
+static int trace_name_index(const char *name)
+{
+	for(uint32_t i=0; i<header.nameCount; i++)
+		if(trace_name_ptrs[i] == name && strcmp(trace_names[i], name) == 0)
+			return (int) i;
+	for(uint32_t i=0; i<header.nameCount; i++)
+	{
+		if(strcmp(trace_names[i], name) == 0)
+		{
+			trace_name_ptrs[i] = name;
+			return (int) i;
+		}
+	}
+	/* Truncating would merge names that start the same way. */
+	if(strlen(name) >= TRACE_NAME_LEN)
+	{
+		static int warned = 0;
+		if(!warned)
+			msg(MSG_WARNING, "Trace event name '%s' is longer than %d characters. Ignoring it and any other long names.", name, TRACE_NAME_LEN-1);
+		warned = 1;
+		return -1;
+	}
+	if(header.nameCount >= TRACE_MAX_NAMES)
+	{
+		static int warned = 0;
+		if(!warned)
+			msg(MSG_WARNING, "Too many unique trace event names. Ignoring '%s' and any other new names.", name);
+		warned = 1;
+		return -1;
+	}
+	int index = (int) header.nameCount;
+	strcpy(trace_names[index], name);
+	trace_name_ptrs[index] = name;
+	header.nameCount++;
+	return index;
+}
+
+static void trace_add(trace_type type, const char *name, double value)
+{
+	if(trace_state != 1)
+	{
+		if(trace_state == -1)
+			return;
+		trace_init();
+		if(trace_state != 1)
+			return;
+	}
+
+	int index = trace_name_index(name);
+	if(index < 0)
+		return;
+
+	trace_record *r = &trace_buffer[trace_buffer_len];
+	r->usec  = kuhl_microseconds() - header.startTime;
+	r->value = value;
+	r->name  = (uint16_t) index;
+	r->type  = (uint8_t) type;
+	trace_buffer_len++;
+
+	if(trace_buffer_len == TRACE_BUFFER_LEN)
+		trace_flush();
+}
+
+/** Record the beginning of an event. Each call to trace_begin()
+ * should be paired with a call to trace_end() with the same name.
+ *
+ * @param name The name of the event (at most 31 characters). Longer
+ * names are ignored with a warning, here and in the other trace
+ * functions.
+ */
+void trace_begin(const char *name)
+{
+	trace_add(TRACE_BEGIN, name, 0);
+}
+
+/** Record the end of an event that was started with trace_begin().
+ *
+ * @param name The name of the event.
+ */
+void trace_end(const char *name)
+{
+	trace_add(TRACE_END, name, 0);
+}
+
+/** Record the current value of a counter.
+ *
+ * @param name The name of the counter.
+ * @param value The value of the counter.
+ */
+void trace_counter(const char *name, double value)
+{
+	trace_add(TRACE_COUNTER, name, value);
+}
+
+/** Record an event which has no duration.
+ *
+ * @param name The name of the event.
+ */
+void trace_instant(const char *name)
+{
+	trace_add(TRACE_INSTANT, name, 0);
+}
+
+/** Marks the end of a frame. Called by bufferswap(). */
+void trace_frame(void)
+{
+	trace_add(TRACE_FRAME, "frame", trace_frame_count);
+	trace_frame_count++;
+}
+
+/** Writes any buffered events and the header to the trace file. */
+void trace_flush(void)
+{
+	if(trace_state != 1 || trace_file == NULL)
+		return;
+
+	long recordsStart = (long) (sizeof(trace_header) + sizeof(trace_names));
+
+	/* Write the buffered records into the ring. The buffer may wrap
+	 * around the end of the ring, so we may need two writes. */
+	int done = 0;
+	while(done < trace_buffer_len)
+	{
+		uint32_t slot = (uint32_t) (header.written % header.capacity);
+		int count = trace_buffer_len - done;
+		if(slot + (uint32_t) count > header.capacity)
+			count = (int) (header.capacity - slot);
+		fseek(trace_file, recordsStart + (long) slot * (long) sizeof(trace_record), SEEK_SET);
+		if(fwrite(trace_buffer+done, sizeof(trace_record), (size_t) count, trace_file) != (size_t) count)
+		{
+			msg(MSG_ERROR, "Failed to write to trace file. Tracing is disabled.");
+			trace_state = -1;
+			return;
+		}
+		header.written += (uint64_t) count;
+		done += count;
+	}
+	trace_buffer_len = 0;
+
+	fseek(trace_file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, trace_file);
+	fwrite(trace_names, sizeof(trace_names), 1, trace_file);
+	fflush(trace_file);
+}
+
+/** Writes a string to a JSON file, escaping characters as needed. */
+static void trace_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for(; *s; s++)
+	{
+		if(*s == '"' || *s == '\\')
+			fputc('\\', f);
+		if((unsigned char)*s < 0x20)
+			continue;
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/** Converts a binary trace file into the Chrome trace event JSON
+ * format.
+ *
+ * @param traceFile The binary trace file to read.
+ * @param jsonFile The JSON file to write.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int trace_export_chrome(const char *traceFile, const char *jsonFile)
+{
+	FILE *in = fopen(traceFile, "rb");
+	if(in == NULL)
+	{
+		msg(MSG_ERROR, "Unable to open trace file '%s'", traceFile);
+		return 0;
+	}
+
+	trace_header h;
+	static char names[TRACE_MAX_NAMES][TRACE_NAME_LEN];
+	if(fread(&h, sizeof(h), 1, in) != 1 ||
+	   memcmp(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+	   h.version != TRACE_VERSION || h.nameLen != TRACE_NAME_LEN ||
+	   h.nameCount > TRACE_MAX_NAMES ||
+	   fread(names, sizeof(names), 1, in) != 1)
+	{
+		msg(MSG_ERROR, "'%s' is not a valid trace file.", traceFile);
+		fclose(in);
+		return 0;
+	}
+
+	FILE *out = fopen(jsonFile, "w");
+	if(out == NULL)
+	{
+		msg(MSG_ERROR, "Unable to open '%s' for writing.", jsonFile);
+		fclose(in);
+		return 0;
+	}
+
+	/* If the ring wrapped, the oldest record is the one that would
+	 * be overwritten next. */
+	uint64_t count = h.written;
+	uint32_t first = 0;
+	if(h.written > h.capacity)
+	{
+		count = h.capacity;
+		first = (uint32_t) (h.written % h.capacity);
+	}
+
+	long recordsStart = (long) (sizeof(trace_header) + sizeof(names));
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	int needComma = 0;
+	for(uint64_t i=0; i<count; i++)
+	{
+		uint32_t slot = (uint32_t) ((first + i) % h.capacity);
+		if(i == 0 || slot == 0)
+			fseek(in, recordsStart + (long) slot * (long) sizeof(trace_record), SEEK_SET);
+
+		trace_record r;
+		if(fread(&r, sizeof(r), 1, in) != 1)
+		{
+			msg(MSG_WARNING, "Trace file '%s' is truncated.", traceFile);
+			break;
+		}
+		if(r.name >= h.nameCount)
+			continue;
+
+		const char *name = names[r.name];
+		if(needComma)
+			fprintf(out, ",\n");
+		needComma = 1;
+		fprintf(out, "{\"name\":");
+		trace_json_string(out, name);
+		switch(r.type)
+		{
+			case TRACE_BEGIN:
+				fprintf(out, ",\"ph\":\"B\"");
+				break;
+			case TRACE_END:
+				fprintf(out, ",\"ph\":\"E\"");
+				break;
+			case TRACE_COUNTER:
+				fprintf(out, ",\"ph\":\"C\",\"args\":{");
+				trace_json_string(out, name);
+				fprintf(out, ":%.17g}", r.value);
+				break;
+			case TRACE_FRAME:
+				fprintf(out, ",\"ph\":\"i\",\"s\":\"g\",\"args\":{\"frame\":%.0f}", r.value);
+				break;
+			default:
+				fprintf(out, ",\"ph\":\"i\",\"s\":\"t\"");
+				break;
+		}
+		fprintf(out, ",\"ts\":%lld,\"pid\":0,\"tid\":0}", (long long) r.usec);
+	}
+	fprintf(out, "\n]}\n");
+
+	fclose(out);
+	fclose(in);
+	msg(MSG_INFO, "Wrote %llu trace events from '%s' into '%s'", (unsigned long long) count, traceFile, jsonFile);
+	return 1;
+}
@@ -0,0 +1,54 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * A low-overhead binary event trace which complements the text log
+ * written by msg(). See trace.c for details.
+ */
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Types of events which can be stored in a trace file. */
+typedef enum {
+	TRACE_BEGIN = 1,  /*< Start of a scoped event. */
+	TRACE_END,        /*< End of a scoped event. */
+	TRACE_COUNTER,    /*< A named value sampled at a point in time. */
+	TRACE_FRAME,      /*< Marks the end of a frame. */
+	TRACE_INSTANT     /*< An event without a duration. */
+} trace_type;
+
+int  trace_enabled(void);
+void trace_begin(const char *name);
+void trace_end(const char *name);
+void trace_counter(const char *name, double value);
+void trace_instant(const char *name);
+void trace_frame(void);
+void trace_flush(void);
+int  trace_export_chrome(const char *traceFile, const char *jsonFile);
+
+#ifdef __cplusplus
+} // end extern "C"
+
+/** Calls trace_begin() when constructed and trace_end() when the
+ * object goes out of scope. For example:
+
+ \code
+ void foo()
+ {
+    trace_scope t("foo");
+    ...
+ }
+ \endcode
+*/
+class trace_scope
+{
+	const char *name;
+public:
+	trace_scope(const char *scopeName) : name(scopeName) { trace_begin(name); }
+	~trace_scope() { trace_end(name); }
+};
+#endif
@@ -0,0 +1,443 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   Batch versions of the most common vecmat.h operations: transforming
+   many vectors or points by one matrix and multiplying many pairs of
+   matrices. Calling mat4f_mult_vec4f_new() once per vertex costs a
+   function call, a temporary copy and 16 scalar multiplies per
+   vertex; these functions instead keep the matrix in SIMD registers
+   and stream the vectors through it.
+
+   Each operation has a plain C version and versions that use SSE,
+   AVX (x86) or NEON (ARM). The best version that the CPU supports is
+   picked at runtime the first time one of the functions is called,
+   so programs compiled without -march=native still use AVX when it
+   is available. vecmat_simd_set() can be used to pick a different
+   version (for example, to compare them in a benchmark).
+
+   The multiplications and additions are performed in the same order
+   in every version, so the results normally match the scalar vecmat.h
+   functions exactly.
+ */
+
+#include <stdlib.h>
+#include "vecmat.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECMAT_HAVE_SSE 1
+#define VECMAT_HAVE_AVX 1
+#define VECMAT_TARGET_SSE __attribute__((target("sse")))
+#define VECMAT_TARGET_AVX __attribute__((target("avx")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define VECMAT_HAVE_SSE 1
+#define VECMAT_TARGET_SSE
+#include <xmmintrin.h>
+#endif
+
+/* NEON is selected at compile time: it is always available on 64-bit
+ * ARM, and 32-bit ARM compilers only define __ARM_NEON when they are
+ * told that the CPU has it. */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VECMAT_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+/** Functions that implement the batch operations with one instruction
+ * set. */
+typedef struct
+{
+	void (*mult_vec4f)(float *result, const float *m, const float *v, size_t count);
+	void (*mult_point3f)(float *result, const float *m, const float *p, size_t count);
+	/* result[i] = matA[i*strideA] * matB[i]; strideA is 0 or 16. */
+	void (*mult_mat4f)(float *result, const float *matA, size_t strideA, const float *matB, size_t count);
+} vecmat_kernels;
+
+
+/* ---------- Plain C ---------- */
+
+static void scalar_mult_vec4f(float *result, const float *m, const float *v, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		const float x = v[0], y = v[1], z = v[2], w = v[3];
+		float tmp[4];
+		for(int r=0; r<4; r++)
+			tmp[r] = m[r]*x + m[4+r]*y + m[8+r]*z + m[12+r]*w;
+		memcpy(result, tmp, sizeof(float)*4);
+		v += 4;
+		result += 4;
+	}
+}
+
+static void scalar_mult_point3f(float *result, const float *m, const float *p, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		const float x = p[0], y = p[1], z = p[2];
+		for(int r=0; r<3; r++)
+			result[r] = m[r]*x + m[4+r]*y + m[8+r]*z + m[12+r];
+		p += 3;
+		result += 3;
+	}
+}
+
+static void scalar_mult_mat4f(float *result, const float *matA, size_t strideA, const float *matB, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		/* Use a temporary matrix so that result can be the same as matA or matB. */
+		float tmp[16];
+		scalar_mult_vec4f(tmp, matA, matB, 4); // each column of B
+		memcpy(result, tmp, sizeof(float)*16);
+		matA += strideA;
+		matB += 16;
+		result += 16;
+	}
+}
+
+static const vecmat_kernels scalar_kernels = { scalar_mult_vec4f, scalar_mult_point3f, scalar_mult_mat4f };
+
+
+/* ---------- SSE ---------- */
+
+#ifdef VECMAT_HAVE_SSE
+/** Multiplies the matrix with columns c0...c3 by vector v. */
+#define VECMAT_SSE_MULT(c0,c1,c2,c3,v) \
+	_mm_add_ps(_mm_add_ps(_mm_add_ps( \
+		_mm_mul_ps(c0, _mm_shuffle_ps(v, v, 0x00)), \
+		_mm_mul_ps(c1, _mm_shuffle_ps(v, v, 0x55))), \
+		_mm_mul_ps(c2, _mm_shuffle_ps(v, v, 0xAA))), \
+		_mm_mul_ps(c3, _mm_shuffle_ps(v, v, 0xFF)))
+
+VECMAT_TARGET_SSE
+static void sse_mult_vec4f(float *result, const float *m, const float *v, size_t count)
+{
+	const __m128 c0 = _mm_loadu_ps(m),   c1 = _mm_loadu_ps(m+4);
+	const __m128 c2 = _mm_loadu_ps(m+8), c3 = _mm_loadu_ps(m+12);
+	for(size_t i=0; i<count; i++)
+	{
+		__m128 in = _mm_loadu_ps(v+i*4);
+		_mm_storeu_ps(result+i*4, VECMAT_SSE_MULT(c0,c1,c2,c3,in));
+	}
+}
+
+VECMAT_TARGET_SSE
+static void sse_mult_point3f(float *result, const float *m, const float *p, size_t count)
+{
+	const __m128 c0 = _mm_loadu_ps(m),   c1 = _mm_loadu_ps(m+4);
+	const __m128 c2 = _mm_loadu_ps(m+8), c3 = _mm_loadu_ps(m+12);
+	for(size_t i=0; i<count; i++)
+	{
+		const float *in = p+i*3;
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(c0, _mm_set1_ps(in[0])),
+			_mm_mul_ps(c1, _mm_set1_ps(in[1]))),
+			_mm_mul_ps(c2, _mm_set1_ps(in[2]))),
+			c3);
+		/* Store exactly 3 floats so that we don't overwrite the next
+		 * point when working in place. */
+		float *out = result+i*3;
+		_mm_storel_pi((__m64*) out, r);
+		_mm_store_ss(out+2, _mm_movehl_ps(r, r));
+	}
+}
+
+VECMAT_TARGET_SSE
+static void sse_mult_mat4f(float *result, const float *matA, size_t strideA, const float *matB, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		const float *a = matA + i*strideA;
+		const float *b = matB + i*16;
+		const __m128 c0 = _mm_loadu_ps(a),   c1 = _mm_loadu_ps(a+4);
+		const __m128 c2 = _mm_loadu_ps(a+8), c3 = _mm_loadu_ps(a+12);
+		const __m128 b0 = _mm_loadu_ps(b),   b1 = _mm_loadu_ps(b+4);
+		const __m128 b2 = _mm_loadu_ps(b+8), b3 = _mm_loadu_ps(b+12);
+		float *out = result + i*16;
+		_mm_storeu_ps(out,    VECMAT_SSE_MULT(c0,c1,c2,c3,b0));
+		_mm_storeu_ps(out+4,  VECMAT_SSE_MULT(c0,c1,c2,c3,b1));
+		_mm_storeu_ps(out+8,  VECMAT_SSE_MULT(c0,c1,c2,c3,b2));
+		_mm_storeu_ps(out+12, VECMAT_SSE_MULT(c0,c1,c2,c3,b3));
+	}
+}
+
+static const vecmat_kernels sse_kernels = { sse_mult_vec4f, sse_mult_point3f, sse_mult_mat4f };
+#endif
+
+
+/* ---------- AVX ---------- */
+
+#ifdef VECMAT_HAVE_AVX
+/* AVX registers hold two 4-component vectors. Each matrix column is
+ * copied into both halves of a register so that two vectors (or two
+ * columns of a matrix) are multiplied at once. */
+#define VECMAT_AVX_MULT(c0,c1,c2,c3,v) \
+	_mm256_add_ps(_mm256_add_ps(_mm256_add_ps( \
+		_mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00)), \
+		_mm256_mul_ps(c1, _mm256_permute_ps(v, 0x55))), \
+		_mm256_mul_ps(c2, _mm256_permute_ps(v, 0xAA))), \
+		_mm256_mul_ps(c3, _mm256_permute_ps(v, 0xFF)))
+
+VECMAT_TARGET_AVX
+static inline __m256 avx_column(const float *c)
+{
+	__m128 col = _mm_loadu_ps(c);
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(col), col, 1);
+}
+
+VECMAT_TARGET_AVX
+static void avx_mult_vec4f(float *result, const float *m, const float *v, size_t count)
+{
+	const __m256 c0 = avx_column(m),   c1 = avx_column(m+4);
+	const __m256 c2 = avx_column(m+8), c3 = avx_column(m+12);
+	size_t i = 0;
+	for(; i+2<=count; i+=2)
+	{
+		__m256 in = _mm256_loadu_ps(v+i*4);
+		_mm256_storeu_ps(result+i*4, VECMAT_AVX_MULT(c0,c1,c2,c3,in));
+	}
+	if(i < count)
+	{
+		__m128 in = _mm_loadu_ps(v+i*4);
+		_mm_storeu_ps(result+i*4, VECMAT_SSE_MULT(_mm256_castps256_ps128(c0), _mm256_castps256_ps128(c1),
+		                                          _mm256_castps256_ps128(c2), _mm256_castps256_ps128(c3), in));
+	}
+}
+
+VECMAT_TARGET_AVX
+static void avx_mult_mat4f(float *result, const float *matA, size_t strideA, const float *matB, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		const float *a = matA + i*strideA;
+		const float *b = matB + i*16;
+		const __m256 c0 = avx_column(a),   c1 = avx_column(a+4);
+		const __m256 c2 = avx_column(a+8), c3 = avx_column(a+12);
+		const __m256 b01 = _mm256_loadu_ps(b), b23 = _mm256_loadu_ps(b+8);
+		const __m256 r01 = VECMAT_AVX_MULT(c0,c1,c2,c3,b01);
+		const __m256 r23 = VECMAT_AVX_MULT(c0,c1,c2,c3,b23);
+		_mm256_storeu_ps(result+i*16,   r01);
+		_mm256_storeu_ps(result+i*16+8, r23);
+	}
+}
+
+/* Points have 3 components, so there is no benefit to processing two
+ * of them in one AVX register; use the SSE version. */
+static const vecmat_kernels avx_kernels = { avx_mult_vec4f, sse_mult_point3f, avx_mult_mat4f };
+#endif
+
+
+/* ---------- NEON ---------- */
+
+#ifdef VECMAT_HAVE_NEON
+static inline float32x4_t neon_mult(float32x4_t c0, float32x4_t c1, float32x4_t c2, float32x4_t c3, float32x4_t v)
+{
+	float32x4_t r = vmulq_n_f32(c0, vgetq_lane_f32(v, 0));
+	r = vaddq_f32(r, vmulq_n_f32(c1, vgetq_lane_f32(v, 1)));
+	r = vaddq_f32(r, vmulq_n_f32(c2, vgetq_lane_f32(v, 2)));
+	return vaddq_f32(r, vmulq_n_f32(c3, vgetq_lane_f32(v, 3)));
+}
+
+static void neon_mult_vec4f(float *result, const float *m, const float *v, size_t count)
+{
+	const float32x4_t c0 = vld1q_f32(m),   c1 = vld1q_f32(m+4);
+	const float32x4_t c2 = vld1q_f32(m+8), c3 = vld1q_f32(m+12);
+	for(size_t i=0; i<count; i++)
+		vst1q_f32(result+i*4, neon_mult(c0, c1, c2, c3, vld1q_f32(v+i*4)));
+}
+
+static void neon_mult_point3f(float *result, const float *m, const float *p, size_t count)
+{
+	const float32x4_t c0 = vld1q_f32(m),   c1 = vld1q_f32(m+4);
+	const float32x4_t c2 = vld1q_f32(m+8), c3 = vld1q_f32(m+12);
+	for(size_t i=0; i<count; i++)
+	{
+		const float *in = p+i*3;
+		float32x4_t r = vmulq_n_f32(c0, in[0]);
+		r = vaddq_f32(r, vmulq_n_f32(c1, in[1]));
+		r = vaddq_f32(r, vmulq_n_f32(c2, in[2]));
+		r = vaddq_f32(r, c3);
+		vst1_f32(result+i*3, vget_low_f32(r));
+		vst1q_lane_f32(result+i*3+2, r, 2);
+	}
+}
+
+static void neon_mult_mat4f(float *result, const float *matA, size_t strideA, const float *matB, size_t count)
+{
+	for(size_t i=0; i<count; i++)
+	{
+		const float *a = matA + i*strideA;
+		const float *b = matB + i*16;
+		const float32x4_t c0 = vld1q_f32(a),   c1 = vld1q_f32(a+4);
+		const float32x4_t c2 = vld1q_f32(a+8), c3 = vld1q_f32(a+12);
+		const float32x4_t r0 = neon_mult(c0, c1, c2, c3, vld1q_f32(b));
+		const float32x4_t r1 = neon_mult(c0, c1, c2, c3, vld1q_f32(b+4));
+		const float32x4_t r2 = neon_mult(c0, c1, c2, c3, vld1q_f32(b+8));
+		const float32x4_t r3 = neon_mult(c0, c1, c2, c3, vld1q_f32(b+12));
+		vst1q_f32(result+i*16,    r0);
+		vst1q_f32(result+i*16+4,  r1);
+		vst1q_f32(result+i*16+8,  r2);
+		vst1q_f32(result+i*16+12, r3);
+	}
+}
+
+static const vecmat_kernels neon_kernels = { neon_mult_vec4f, neon_mult_point3f, neon_mult_mat4f };
+#endif
+
+
+/* ---------- Dispatch ---------- */
+
+static const vecmat_kernels *vecmat_current = NULL;
+static int vecmat_current_level = VECMAT_SIMD_SCALAR;
+
+/** Returns the functions for an instruction set or NULL if it
+ * wasn't compiled in. */
+static const vecmat_kernels* vecmat_kernels_for(int level)
+{
+	switch(level)
+	{
+		case VECMAT_SIMD_SCALAR: return &scalar_kernels;
+#ifdef VECMAT_HAVE_SSE
+		case VECMAT_SIMD_SSE:    return &sse_kernels;
+#endif
+#ifdef VECMAT_HAVE_AVX
+		case VECMAT_SIMD_AVX:    return &avx_kernels;
+#endif
+#ifdef VECMAT_HAVE_NEON
+		case VECMAT_SIMD_NEON:   return &neon_kernels;
+#endif
+		default: return NULL;
+	}
+}
+
+/** Returns 1 if the batch operations can use the given instruction
+ * set (one of the VECMAT_SIMD_* values) on this computer. */
+int vecmat_simd_supported(int level)
+{
+	if(vecmat_kernels_for(level) == NULL)
+		return 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if(level == VECMAT_SIMD_SSE)
+		return __builtin_cpu_supports("sse");
+	if(level == VECMAT_SIMD_AVX) // also checks that the OS saves AVX registers
+		return __builtin_cpu_supports("avx");
+#endif
+	return 1;
+}
+
+/** Returns the fastest instruction set that is supported on this
+ * computer. */
+int vecmat_simd_best(void)
+{
+	const int preferred[] = { VECMAT_SIMD_AVX, VECMAT_SIMD_NEON, VECMAT_SIMD_SSE };
+	for(int i=0; i<3; i++)
+		if(vecmat_simd_supported(preferred[i]))
+			return preferred[i];
+	return VECMAT_SIMD_SCALAR;
+}
+
+/** Selects the instruction set used by the batch operations.
+
+    @param level One of the VECMAT_SIMD_* values.
+
+    @return 1 on success, 0 if the instruction set isn't supported (the
+    current setting is left unchanged).
+*/
+int vecmat_simd_set(int level)
+{
+	if(!vecmat_simd_supported(level))
+		return 0;
+	vecmat_current_level = level;
+	vecmat_current = vecmat_kernels_for(level);
+	return 1;
+}
+
+/** Returns the instruction set used by the batch operations. */
+int vecmat_simd_get(void)
+{
+	if(vecmat_current == NULL)
+		vecmat_simd_set(vecmat_simd_best());
+	return vecmat_current_level;
+}
+
+/** Returns a name for an instruction set (for example, "AVX"). */
+const char* vecmat_simd_name(int level)
+{
+	const char *names[VECMAT_SIMD_COUNT] = { "scalar", "SSE", "AVX", "NEON" };
+	if(level < 0 || level >= VECMAT_SIMD_COUNT)
+		return "unknown";
+	return names[level];
+}
+
+static inline const vecmat_kernels* vecmat_kernels_get(void)
+{
+	if(vecmat_current == NULL)
+		vecmat_simd_set(vecmat_simd_best());
+	return vecmat_current;
+}
+
+
+/** Multiplies many 4-component column vectors by the same matrix
+    (result[i] = m * v[i]).
+
+    @param result Location to store count vectors (count*4 floats). May
+    be the same as v.
+    @param m The 4x4 matrix.
+    @param v Array of count vectors, stored one after another.
+    @param count The number of vectors.
+*/
+void mat4f_mult_vec4f_array(float *result, const float m[16], const float *v, size_t count)
+{
+	vecmat_kernels_get()->mult_vec4f(result, m, v, count);
+}
+
+/** Transforms many 3D points by the same matrix. Each point is
+    treated as (x,y,z,1) and the x, y and z components of the result
+    are stored. No perspective divide is performed, so this is
+    intended for affine transformations.
+
+    @param result Location to store count points (count*3 floats). May
+    be the same as p.
+    @param m The 4x4 matrix.
+    @param p Array of count points, stored one after another.
+    @param count The number of points.
+*/
+void mat4f_mult_point3f_array(float *result, const float m[16], const float *p, size_t count)
+{
+	vecmat_kernels_get()->mult_point3f(result, m, p, count);
+}
+
+/** Multiplies many pairs of matrices (result[i] = matA[i] * matB[i]).
+
+    @param result Location to store count matrices. May be the same as
+    matA or matB.
+    @param matA Array of count 4x4 matrices.
+    @param matB Array of count 4x4 matrices.
+    @param count The number of matrices.
+*/
+void mat4f_mult_mat4f_array(float *result, const float *matA, const float *matB, size_t count)
+{
+	vecmat_kernels_get()->mult_mat4f(result, matA, 16, matB, count);
+}
+
+/** Multiplies one matrix by many matrices (result[i] = matA *
+    matB[i]). For example, this can compute the modelview matrix for
+    many objects at once.
+
+    @param result Location to store count matrices. May be the same as
+    matB but must not overlap matA.
+    @param matA A 4x4 matrix.
+    @param matB Array of count 4x4 matrices.
+    @param count The number of matrices.
+*/
+void mat4f_mult_mat4f_each(float *result, const float matA[16], const float *matB, size_t count)
+{
+	vecmat_kernels_get()->mult_mat4f(result, matA, 0, matB, count);
+}
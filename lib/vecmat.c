@@ -1300,7 +1300,7 @@ void quatf_from_mat3f(float quat[4], const float matrix[9])
 
 	   quat[X] = (matrix[mat3_getIndex(Z,Y)] - matrix[mat3_getIndex(Y,Z)]) * s;
 	   quat[Y] = (matrix[mat3_getIndex(X,Z)] - matrix[mat3_getIndex(Z,X)]) * s;
-	   quat[Z] = (matrix[mat3_getIndex(Y,Z)] - matrix[mat3_getIndex(X,Y)]) * s;
+	   quat[Z] = (matrix[mat3_getIndex(Y,X)] - matrix[mat3_getIndex(X,Y)]) * s;
    }
 
    else
@@ -1338,7 +1338,7 @@ void quatd_from_mat3d(double quat[4], const double matrix[9])
 
 	   quat[X] = (matrix[mat3_getIndex(Z,Y)] - matrix[mat3_getIndex(Y,Z)]) * s;
 	   quat[Y] = (matrix[mat3_getIndex(X,Z)] - matrix[mat3_getIndex(Z,X)]) * s;
-	   quat[Z] = (matrix[mat3_getIndex(Y,Z)] - matrix[mat3_getIndex(X,Y)]) * s;
+	   quat[Z] = (matrix[mat3_getIndex(Y,X)] - matrix[mat3_getIndex(X,Y)]) * s;
    }
 
    else
@@ -1502,7 +1502,7 @@ void quatf_slerp_new(float result[4], const float start[4], const float end[4],
 		{
 			float omega = acosf(cosOmega);
 			float sinOmega = sinf(omega);
-			startScale = sinf((1.0f-t)*omega / sinOmega);
+			startScale = sinf((1.0f-t)*omega) / sinOmega;
 			endScale = sinf(t*omega)/sinOmega;
 		}
 		else
@@ -1560,7 +1560,7 @@ void quatd_slerp_new(double result[4], const double start[4], const double end[4
 		{
 			double omega = acos(cosOmega);
 			double sinOmega = sin(omega);
-			startScale = sin((1.0-t)*omega / sinOmega);
+			startScale = sin((1.0-t)*omega) / sinOmega;
 			endScale = sin(t*omega)/sinOmega;
 		}
 		else
@@ -1586,6 +1586,221 @@ void quatd_slerp_new(double result[4], const double start[4], const double end[4
 	vec4d_normalize(result);
 }
 
+/** Multiplies two quaternions (x,y,z,w). The resulting quaternion
+    represents rotating by b and then by a (matching the order of
+    matrix multiplication: the matrix of the result is the matrix of a
+    times the matrix of b). Works even if result is the same as a or
+    b.
+ */
+void quatf_mult_quatf_new(float result[4], const float a[4], const float b[4])
+{
+	float tmp[4];
+	tmp[0] = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+	tmp[1] = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+	tmp[2] = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+	tmp[3] = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+	vec4f_copy(result, tmp);
+}
+/** Multiplies two quaternions (x,y,z,w). For full documentation, see
+ * quatf_mult_quatf_new() */
+void quatd_mult_quatd_new(double result[4], const double a[4], const double b[4])
+{
+	double tmp[4];
+	tmp[0] = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+	tmp[1] = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+	tmp[2] = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+	tmp[3] = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+	vec4d_copy(result, tmp);
+}
+
+/** Rotates a vector by a unit quaternion (x,y,z,w). This is cheaper
+    than converting the quaternion into a matrix when only a few
+    vectors are rotated. Works even if result is the same as v.
+ */
+void quatf_rotate_vec3f_new(float result[3], const float quat[4], const float v[3])
+{
+	/* v + 2w(q x v) + 2(q x (q x v)) */
+	float t[3], u[3];
+	vec3f_cross_new(t, quat, v);
+	vec3f_scalarMult(t, 2);
+	vec3f_cross_new(u, quat, t);
+	for(int i=0; i<3; i++)
+		result[i] = v[i] + quat[3]*t[i] + u[i];
+}
+/** Rotates a vector by a unit quaternion (x,y,z,w). For full
+ * documentation, see quatf_rotate_vec3f_new() */
+void quatd_rotate_vec3d_new(double result[3], const double quat[4], const double v[3])
+{
+	double t[3], u[3];
+	vec3d_cross_new(t, quat, v);
+	vec3d_scalarMult(t, 2);
+	vec3d_cross_new(u, quat, t);
+	for(int i=0; i<3; i++)
+		result[i] = v[i] + quat[3]*t[i] + u[i];
+}
+
+/** Normalized linear interpolation of unit quaternions. Linearly
+ interpolates the quaternions and normalizes the result. The result
+ follows the same path as quatf_slerp_new() but the rotation speed
+ isn't constant: it is slightly faster near t=0.5. The difference is
+ negligible when the quaternions are similar (for example, nearby
+ animation keyframes), and nlerp avoids all trigonometric functions.
+
+ @param result The interpolated quaternion.
+ @param start The starting quaternion.
+ @param end The ending quaternion.
+ @param t As t goes from 0 to 1, the "result" quaternion goes from the
+ "start" quaternion to the "end" quaternion along the shorter path.
+ */
+void quatf_nlerp_new(float result[4], const float start[4], const float end[4], float t)
+{
+	float endScale = t;
+	if(vec4f_dot(start, end) < 0)
+		endScale = -t;
+	for(int i=0; i<4; i++)
+		result[i] = (1.0f-t)*start[i] + endScale*end[i];
+	vec4f_normalize(result);
+}
+/** Normalized linear interpolation of unit quaternions. For full
+ * documentation, see quatf_nlerp_new() */
+void quatd_nlerp_new(double result[4], const double start[4], const double end[4], double t)
+{
+	double endScale = t;
+	if(vec4d_dot(start, end) < 0)
+		endScale = -t;
+	for(int i=0; i<4; i++)
+		result[i] = (1.0-t)*start[i] + endScale*end[i];
+	vec4d_normalize(result);
+}
+
+
+/** Sets a TRS transform to the identity. */
+void trsf_identity(trsf *result)
+{
+	vec3f_set(result->pos, 0, 0, 0);
+	vec4f_set(result->quat, 0, 0, 0, 1);
+	vec3f_set(result->scale, 1, 1, 1);
+}
+
+/** Returns 1 if the scale factors in a TRS transform are all the same
+ * (within a small tolerance). */
+int trsf_is_uniform(const trsf *t)
+{
+	float s = fabsf(t->scale[0]);
+	float tolerance = 1e-5f * s;
+	return fabsf(t->scale[1]-t->scale[0]) <= tolerance &&
+		fabsf(t->scale[2]-t->scale[0]) <= tolerance;
+}
+
+/** Composes two TRS transforms: The matrix of the result equals the
+    matrix of a times the matrix of b.
+
+    The result is only exact if a has a uniform scale (see
+    trsf_is_uniform()). Otherwise, a non-uniform scale applied after a
+    rotation produces a shear, which a TRS transform can't represent;
+    use mat4f_from_trsf() and multiply the matrices instead.
+
+    Works even if result is the same as a or b.
+*/
+void trsf_mult_trsf_new(trsf *result, const trsf *a, const trsf *b)
+{
+	trsf tmp;
+	float scaledPos[3];
+	for(int i=0; i<3; i++)
+		scaledPos[i] = a->scale[i] * b->pos[i];
+	quatf_rotate_vec3f_new(tmp.pos, a->quat, scaledPos);
+	vec3f_add_new(tmp.pos, tmp.pos, a->pos);
+	quatf_mult_quatf_new(tmp.quat, a->quat, b->quat);
+	for(int i=0; i<3; i++)
+		tmp.scale[i] = a->scale[i] * b->scale[i];
+	*result = tmp;
+}
+
+/** Interpolates between two TRS transforms. The translation and scale
+ * are linearly interpolated and the rotation is interpolated with
+ * quatf_nlerp_new(). */
+void trsf_lerp_new(trsf *result, const trsf *a, const trsf *b, float t)
+{
+	for(int i=0; i<3; i++)
+	{
+		result->pos[i]   = (1.0f-t)*a->pos[i]   + t*b->pos[i];
+		result->scale[i] = (1.0f-t)*a->scale[i] + t*b->scale[i];
+	}
+	quatf_nlerp_new(result->quat, a->quat, b->quat, t);
+}
+
+/** Interpolates between two TRS transforms. The translation and scale
+ * are linearly interpolated and the rotation is interpolated with
+ * quatf_slerp_new(). */
+void trsf_slerp_new(trsf *result, const trsf *a, const trsf *b, float t)
+{
+	for(int i=0; i<3; i++)
+	{
+		result->pos[i]   = (1.0f-t)*a->pos[i]   + t*b->pos[i];
+		result->scale[i] = (1.0f-t)*a->scale[i] + t*b->scale[i];
+	}
+	quatf_slerp_new(result->quat, a->quat, b->quat, t);
+}
+
+/** Converts a TRS transform into a 4x4 matrix (translation * rotation
+ * * scale). */
+void mat4f_from_trsf(float result[16], const trsf *t)
+{
+	float rot[9];
+	mat3f_rotateQuatVec_new(rot, t->quat);
+	for(int col=0; col<3; col++)
+	{
+		for(int row=0; row<3; row++)
+			result[col*4+row] = rot[col*3+row] * t->scale[col];
+		result[col*4+3] = 0;
+	}
+	result[12] = t->pos[0];
+	result[13] = t->pos[1];
+	result[14] = t->pos[2];
+	result[15] = 1;
+}
+
+/** Converts a 4x4 matrix into a TRS transform if the matrix can be
+    represented as one: The matrix must not contain a perspective
+    transformation, shear or reflection.
+
+    @param result The TRS transform. Only valid if 1 is returned.
+    @param m The matrix to convert.
+    @return 1 if the matrix was converted, 0 otherwise.
+*/
+int trsf_from_mat4f(trsf *result, const float m[16])
+{
+	const float tolerance = 1e-4f;
+	if(fabsf(m[3]) > tolerance || fabsf(m[7]) > tolerance ||
+	   fabsf(m[11]) > tolerance || fabsf(m[15]-1) > tolerance)
+		return 0;
+
+	float rot[9];
+	for(int col=0; col<3; col++)
+	{
+		float *c = rot+col*3;
+		vec3f_copy(c, m+col*4);
+		result->scale[col] = vec3f_norm(c);
+		if(result->scale[col] < 1e-12f)
+			return 0;
+		vec3f_scalarMult(c, 1.0f/result->scale[col]);
+	}
+	/* The columns must be perpendicular and form a right-handed
+	 * coordinate system. */
+	if(fabsf(vec3f_dot(rot, rot+3)) > tolerance ||
+	   fabsf(vec3f_dot(rot, rot+6)) > tolerance ||
+	   fabsf(vec3f_dot(rot+3, rot+6)) > tolerance)
+		return 0;
+	float cross[3];
+	vec3f_cross_new(cross, rot, rot+3);
+	if(vec3f_dot(cross, rot+6) < 0)
+		return 0;
+
+	quatf_from_mat3f(result->quat, rot);
+	vec3f_copy(result->pos, m+12);
+	return 1;
+}
+
 	
 
 
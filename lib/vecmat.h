@@ -1573,6 +1573,43 @@ static inline void mat3d_from_mat4d(double dest[ 9], const double src[16])
 			dest[mat3_getIndex(i,j)] = src[mat4_getIndex(i,j)];
 }
 
+/** Create a 3-component double vector from a float vector.
+    @param dest Location to store new vector.
+    @param src Location of the original vector.
+*/
+static inline void vec3d_from_vec3f(double dest[3], const float  src[3])
+{ for(int i=0; i<3; i++) dest[i] = (double) src[i]; }
+/** Create a 3-component float vector from a double vector.
+    @param dest Location to store new vector.
+    @param src Location of the original vector.
+*/
+static inline void vec3f_from_vec3d(float  dest[3], const double src[3])
+{ for(int i=0; i<3; i++) dest[i] = (float) src[i]; }
+
+/** Creates a 4x4 float matrix from a 4x4 double matrix after moving
+    the origin of the coordinate system to the given point. The result
+    is equivalent to translating by -origin and then applying the
+    double matrix, but the subtraction happens in double precision
+    before the values are converted to floats. This is useful for
+    rendering large worlds relative to the camera: Objects far from
+    the world origin can be positioned precisely in double, and the
+    float matrix sent to OpenGL only contains small values near the
+    camera.
+
+    @param dest Location to store new matrix.
+    @param src A double matrix which transforms an object into world coordinates.
+    @param origin The point (typically the camera position) that should become the origin.
+*/
+static inline void mat4f_from_mat4d_relative(float dest[16], const double src[16], const double origin[3])
+{
+	for(int col=0; col<4; col++)
+	{
+		for(int row=0; row<3; row++)
+			dest[col*4+row] = (float) (src[col*4+row] - origin[row]*src[col*4+3]);
+		dest[col*4+3] = (float) src[col*4+3];
+	}
+}
+
 
 /** Creates a new 4x4 float scale matrix with the rest of the matrix set to the identity.
     @param result The location to store the new scale matrix.
@@ -1665,7 +1702,29 @@ void mat4f_mult_mat4f_many(float  out[16], const float  *in, ...);
 void mat4d_mult_mat4d_many(double out[16], const double *in, ...);
 void mat3f_mult_mat3f_many(float  out[9],  const float  *in, ...);
 void mat3d_mult_mat3d_many(double out[9],  const double *in, ...);
-	
+
+/* Batch operations which apply the same operation to many vectors or
+ * matrices stored contiguously in memory. They use SSE, AVX or NEON
+ * when available (see vecmat-batch.c). */
+void mat4f_mult_vec4f_array(float *result, const float m[16], const float *v, size_t count);
+void mat4f_mult_point3f_array(float *result, const float m[16], const float *p, size_t count);
+void mat4f_mult_mat4f_array(float *result, const float *matA, const float *matB, size_t count);
+void mat4f_mult_mat4f_each(float *result, const float matA[16], const float *matB, size_t count);
+
+/** Instruction sets which the batch operations can use. */
+enum {
+	VECMAT_SIMD_SCALAR, /**< Plain C */
+	VECMAT_SIMD_SSE,
+	VECMAT_SIMD_AVX,
+	VECMAT_SIMD_NEON,
+	VECMAT_SIMD_COUNT
+};
+int vecmat_simd_supported(int level);
+int vecmat_simd_best(void);
+int vecmat_simd_set(int level);
+int vecmat_simd_get(void);
+const char* vecmat_simd_name(int level);
+
 /* mat[43][df]_invert_new() will invert a matrix and store the
  * inverted matrix at a new location. However, these functions work
  * correctly even if you try to invert a matrix in place. For example,
@@ -1741,6 +1800,34 @@ void quatd_rotateAxisVec_new(double quat[4], double degrees, const double axis[3
 /* Spherical linear interpolation of quaternions. */
 void quatf_slerp_new(float  result[4], const float  start[4], const float  end[4], float  t);
 void quatd_slerp_new(double result[4], const double start[4], const double end[4], double t);
+/* Normalized linear interpolation of quaternions (faster than slerp). */
+void quatf_nlerp_new(float  result[4], const float  start[4], const float  end[4], float  t);
+void quatd_nlerp_new(double result[4], const double start[4], const double end[4], double t);
+
+/* Multiply quaternions; rotate a vector by a quaternion. */
+void quatf_mult_quatf_new(float  result[4], const float  a[4], const float  b[4]);
+void quatd_mult_quatd_new(double result[4], const double a[4], const double b[4]);
+void quatf_rotate_vec3f_new(float  result[3], const float  quat[4], const float  v[3]);
+void quatd_rotate_vec3d_new(double result[3], const double quat[4], const double v[3]);
+
+/** A transformation stored as a translation, a rotation (unit
+ * quaternion) and a scale. The equivalent matrix is translation *
+ * rotation * scale. It uses 10 floats instead of 16 and two TRS
+ * transforms can be composed with much less work than multiplying
+ * two 4x4 matrices. */
+typedef struct {
+	float pos[3];
+	float quat[4]; /**< x,y,z,w */
+	float scale[3];
+} trsf;
+
+void trsf_identity(trsf *result);
+int  trsf_is_uniform(const trsf *t);
+void trsf_mult_trsf_new(trsf *result, const trsf *a, const trsf *b);
+void trsf_lerp_new(trsf *result, const trsf *a, const trsf *b, float t);
+void trsf_slerp_new(trsf *result, const trsf *a, const trsf *b, float t);
+void mat4f_from_trsf(float result[16], const trsf *t);
+int  trsf_from_mat4f(trsf *result, const float m[16]);
 
 /* Create a new translation matrix (rotation part set to
    identity). Any data in the 'result' matrix that you pass to these
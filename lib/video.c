@@ -30,12 +30,32 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
 
+#include "video.h" // includes GL/glew.h, which must come before kuhl-util.h
 #include "kuhl-util.h"
-#include "video.h"
+
+#ifdef HAVE_FFMPEG
+#ifdef _WIN32
+#include "windows-compat.h" // usleep() on windows
+#else
+#include <unistd.h> // usleep()
+#endif
+#ifndef _MSC_VER
+#include <pthread.h> // windows-compat.h provides pthreads on Visual Studio
+#endif
+#include "ringqueue.h"
+#endif
 
 #ifndef HAVE_FFMPEG
 
+video_state* video_open(const char *filename, video_format format)
+{
+	msg(MSG_FATAL, "Library is not compiled against FFMpeg. This function won't work.");
+	exit(EXIT_FAILURE);
+}
 video_state* video_get_next_frame(video_state *state, const char *filename)
 {
 	msg(MSG_FATAL, "Library is not compiled against FFMpeg. This function won't work.");
@@ -46,9 +66,57 @@ void video_cleanup(video_state *state)
 	msg(MSG_FATAL, "Library is not compiled against FFMpeg. This function won't work.");
 	exit(EXIT_FAILURE);
 }
+video_player* video_player_new(const char *filename, video_format format, int numFrames)
+{
+	msg(MSG_FATAL, "Library is not compiled against FFMpeg. This function won't work.");
+	exit(EXIT_FAILURE);
+}
+/* video_player_new() exits, so the following functions are never
+ * called with a valid player. */
+const video_state* video_player_info(const video_player *p) { return NULL; }
+const video_frame* video_player_get(video_player *p, int64_t usec) { return NULL; }
+const video_frame* video_player_next(video_player *p) { return NULL; }
+void video_player_seek(video_player *p, int64_t usec) { }
+int video_player_eof(video_player *p) { return 1; }
+void video_player_get_stats(video_player *p, video_player_stats *stats) { }
+void video_player_free(video_player *p) { }
 
 #else
 
+/** Copies the Y, U and V planes of the decoded frame into
+ * state->planes. If the video isn't already stored as 8-bit 4:2:0
+ * planes, it is converted with sws_scale(). Either way, this is
+ * considerably cheaper than converting to RGB on the CPU. */
+static void video_copy_planes(video_state *state)
+{
+	if(state->planes[0] == NULL)
+	{
+		for(int i=0; i<3; i++)
+			state->planes[i] = (unsigned char*) malloc(state->planeWidth[i]*state->planeHeight[i]);
+	}
+
+	if(state->sws_ctx != NULL)
+	{
+		uint8_t *outData[] = { state->planes[0], state->planes[1], state->planes[2] };
+		const int destStride[] = { state->planeWidth[0], state->planeWidth[1], state->planeWidth[2] };
+		sws_scale(state->sws_ctx, (const uint8_t**) state->frame->data, state->frame->linesize, 0, state->height, outData, destStride);
+		return;
+	}
+
+	/* The rows in the AVFrame may be padded, so copy one row at a time. */
+	for(int i=0; i<3; i++)
+	{
+		const uint8_t *src = state->frame->data[i];
+		unsigned char *dst = state->planes[i];
+		for(int row=0; row<state->planeHeight[i]; row++)
+		{
+			memcpy(dst, src, state->planeWidth[i]);
+			src += state->frame->linesize[i];
+			dst += state->planeWidth[i];
+		}
+	}
+}
+
 static int video_decode_packet(video_state *state, int cached)
 {
 	int ret = state->pkt.size;
@@ -92,18 +160,21 @@ static int video_decode_packet(video_state *state, int cached)
 			    state->video_frame_count++, state->frame->coded_picture_number, state->usec);
 #endif
 
-			/* Allocate final space that we will return to user. */
-			if(state->data == NULL)
-				state->data = (unsigned char*) malloc(state->width*state->height*3);
-
-			/* Convert from whatever colorspace the video is into 8-bit RGB.
-
-			   TODO: It would be significantly more efficient to do
-			   this conversion in a shader program.
-			*/
-			uint8_t *outData[] = { (uint8_t*) state->data };
-			const int destStride[] = {3*state->width};
-			sws_scale(state->sws_ctx, (const uint8_t**) state->frame->data, state->frame->linesize, 0, state->height, outData, destStride);
+			if(state->format == VIDEO_YUV420)
+				video_copy_planes(state);
+			else
+			{
+				/* Allocate final space that we will return to user. */
+				if(state->data == NULL)
+					state->data = (unsigned char*) malloc(state->width*state->height*3);
+
+				/* Convert from whatever colorspace the video is into
+				 * 8-bit RGB. Use VIDEO_YUV420 to do this conversion
+				 * in a shader program instead. */
+				uint8_t *outData[] = { (uint8_t*) state->data };
+				const int destStride[] = {3*state->width};
+				sws_scale(state->sws_ctx, (const uint8_t**) state->frame->data, state->frame->linesize, 0, state->height, outData, destStride);
+			}
 
 			/* The image we get from FFMPEG is flipped vertically (if
 			 * we look at the data and expect 0,0 to be in the lower
@@ -174,9 +245,10 @@ static int open_codec_context(enum AVMediaType type, video_state *state)
 
 
 
-static video_state* video_init(const char *filename)
+static video_state* video_init(const char *filename, video_format format)
 {
 	video_state *ret = calloc(sizeof(video_state), 1);
+	ret->format = format;
 	strncpy(ret->filename, filename, 1024);
 	ret->filename[1023] = '\0';
 
@@ -238,11 +310,37 @@ static video_state* video_init(const char *filename)
 	}
 	ret->frame = frame;
 
-	/* Create a swscontext to convert colorspace to RGB */
-	ret->sws_ctx = sws_getContext(ret->width, ret->height,
-	                              ret->pix_fmt, ret->width, ret->height,
-	                              AV_PIX_FMT_RGB24, 0, 0, 0, 0);
-    
+	if(format == VIDEO_YUV420)
+	{
+		ret->planeWidth[0]  = ret->width;
+		ret->planeHeight[0] = ret->height;
+		for(int i=1; i<3; i++)
+		{
+			ret->planeWidth[i]  = (ret->width+1)/2;
+			ret->planeHeight[i] = (ret->height+1)/2;
+		}
+		ret->bt709 = ret->video_dec_ctx->colorspace == AVCOL_SPC_BT709 ||
+			(ret->video_dec_ctx->colorspace == AVCOL_SPC_UNSPECIFIED && ret->height >= 720);
+		ret->fullRange = ret->video_dec_ctx->color_range == AVCOL_RANGE_JPEG ||
+			ret->pix_fmt == AV_PIX_FMT_YUVJ420P;
+
+		/* Most videos are already 4:2:0 planes and can be copied
+		 * directly. Otherwise, create a swscontext to convert them. */
+		if(ret->pix_fmt != AV_PIX_FMT_YUV420P && ret->pix_fmt != AV_PIX_FMT_YUVJ420P)
+		{
+			msg(MSG_DEBUG, "Converting %s video to yuv420p", av_get_pix_fmt_name(ret->pix_fmt));
+			ret->sws_ctx = sws_getContext(ret->width, ret->height,
+			                              ret->pix_fmt, ret->width, ret->height,
+			                              AV_PIX_FMT_YUV420P, 0, 0, 0, 0);
+		}
+	}
+	else
+	{
+		/* Create a swscontext to convert colorspace to RGB */
+		ret->sws_ctx = sws_getContext(ret->width, ret->height,
+		                              ret->pix_fmt, ret->width, ret->height,
+		                              AV_PIX_FMT_RGB24, 0, 0, 0, 0);
+	}
 
 	av_init_packet(&(ret->pkt));
 	ret->pkt.data = NULL;
@@ -255,21 +353,38 @@ void video_cleanup(video_state *state)
 	avcodec_close(state->video_dec_ctx);
 	avformat_close_input(&(state->fmt_ctx));
 	av_frame_free(&(state->frame));
+	if(state->sws_ctx)
+		sws_freeContext(state->sws_ctx);
+	free(state->data);
+	for(int i=0; i<3; i++)
+		free(state->planes[i]);
 	free(state);
 }
 
+/** Opens a video file. Call video_get_next_frame() to decode frames.
 
-video_state* video_get_next_frame(video_state *state, const char *filename)
+    @param filename The video file to open.
+
+    @param format The format that video_get_next_frame() should
+    convert frames into.
+
+    @return A new video_state or NULL on failure. Free it with
+    video_cleanup().
+*/
+video_state* video_open(const char *filename, video_format format)
+{
+	return video_init(filename, format);
+}
+
+
+/** Decodes the next frame of the video into state.
+
+    @return 1 if a frame was decoded, 0 if we reached the end of the
+    video.
+*/
+static int video_decode_next(video_state *state)
 {
 #define VIDEO_LOG_DECODE_TIME 0
-	
-	if(state == NULL)
-		state = video_init(filename);
-	if(state == NULL)
-	{
-		msg(MSG_ERROR, "Failed to get next frame of video from file %s\n", filename);
-		return NULL;
-	}
 
 	long startDecodeTime = kuhl_microseconds();
 	state->has_new_video_frame = 0;
@@ -298,14 +413,519 @@ video_state* video_get_next_frame(video_state *state, const char *filename)
 				long elapsedTime = kuhl_microseconds() - startDecodeTime;
 				msg(MSG_DEBUG, "Video frame decode time: %ld microseconds", elapsedTime);
 			}
-			return state;
+			return 1;
 		}
 	}
+	return 0;
+}
 
-	msg(MSG_FATAL, "Didn't find frame, exiting");
-	exit(EXIT_FAILURE);
-	
+video_state* video_get_next_frame(video_state *state, const char *filename)
+{
+	if(state == NULL)
+		state = video_init(filename, VIDEO_RGB);
+	if(state == NULL)
+	{
+		msg(MSG_ERROR, "Failed to get next frame of video from file %s\n", filename);
+		return NULL;
+	}
+
+	if(video_decode_next(state) == 0)
+	{
+		msg(MSG_FATAL, "Didn't find frame, exiting");
+		exit(EXIT_FAILURE);
+	}
 	return state;
 }
 
+
+/* ---- Decoding on a separate thread ----
+
+   The decoder thread and the thread which calls video_player_get()
+   share a fixed set of frames. Two lock-free queues pass the index of
+   a frame back and forth: "ready" holds frames which have been decoded
+   and "unused" holds frames which the decoder can reuse. The decoder
+   swaps the buffers of a frame with the buffers in video_state, so
+   decoded images are never copied.
+*/
+
+struct video_player {
+	video_state *state;    /**< Only used by the decoder thread after video_player_new() returns */
+	video_frame *frames;
+	int numFrames;
+	ringqueue_spsc *ready;  /**< Decoded frames (decoder to caller) */
+	ringqueue_spsc *unused; /**< Frames to decode into (caller to decoder) */
+	pthread_t thread;
+	int64_t frameDuration;  /**< Expected time between frames (microseconds) */
+
+	/* Shared between threads, accessed atomically. */
+	int quit;
+	int64_t seekUsec;
+	int seekGeneration;     /**< Incremented by video_player_seek() */
+	int eofGeneration;      /**< Set to seekGeneration when decoder reaches the end of the video */
+
+	/* Only used by the calling thread. */
+	int current;            /**< Frame being displayed, -1 if none */
+	int currentShown;       /**< Has current been returned to the caller? */
+	int next;               /**< Decoded frame that isn't due yet, -1 if none */
+
+	/* Statistics. The decoder's statistics are protected by statsLock. */
+	pthread_mutex_t statsLock;
+	video_player_stats stats;
+	double decodeSum, decodeSumSq;
+};
+
+/** Seeks to the keyframe at or before usec. */
+static void video_seek(video_state *state, int64_t usec)
+{
+	int64_t ts = av_rescale_q(usec, AV_TIME_BASE_Q, state->video_stream->time_base);
+	if(av_seek_frame(state->fmt_ctx, state->video_stream_idx, ts, AVSEEK_FLAG_BACKWARD) < 0)
+		msg(MSG_ERROR, "Failed to seek to %0.3f seconds in '%s'", usec/1000000.0, state->filename);
+	avcodec_flush_buffers(state->video_dec_ctx);
+}
+
+static void* video_player_thread(void *arg)
+{
+	video_player *p = (video_player*) arg;
+	video_state *state = p->state;
+	int generation = 0;
+	int64_t skipUntil = INT64_MIN; /* After seeking, discard frames before this time */
+	int slot = -1;                 /* Frame we are going to decode into */
+
+	while(!__atomic_load_n(&p->quit, __ATOMIC_ACQUIRE))
+	{
+		int seekGeneration = __atomic_load_n(&p->seekGeneration, __ATOMIC_ACQUIRE);
+		if(seekGeneration != generation)
+		{
+			skipUntil = __atomic_load_n(&p->seekUsec, __ATOMIC_ACQUIRE);
+			video_seek(state, skipUntil);
+			generation = seekGeneration;
+		}
+
+		if(__atomic_load_n(&p->eofGeneration, __ATOMIC_ACQUIRE) == generation)
+		{
+			usleep(1000);
+			continue;
+		}
+
+		if(slot < 0 && !ringqueue_spsc_remove(p->unused, &slot))
+		{
+			/* All frames are decoded and waiting to be displayed. */
+			usleep(1000);
+			continue;
+		}
+
+		long start = kuhl_microseconds();
+		int gotFrame;
+		do
+			gotFrame = video_decode_next(state);
+		while(gotFrame && state->usec < skipUntil);
+		long elapsed = kuhl_microseconds() - start;
+
+		if(!gotFrame)
+		{
+			__atomic_store_n(&p->eofGeneration, generation, __ATOMIC_RELEASE);
+			continue;
+		}
+		skipUntil = INT64_MIN;
+
+		pthread_mutex_lock(&p->statsLock);
+		p->stats.decoded++;
+		p->decodeSum += elapsed;
+		p->decodeSumSq += (double) elapsed * elapsed;
+		if(elapsed > p->stats.decodeMax)
+			p->stats.decodeMax = elapsed;
+		pthread_mutex_unlock(&p->statsLock);
+
+		/* Swap buffers between the frame and the video_state. */
+		video_frame *f = &p->frames[slot];
+		unsigned char *tmp = f->data;
+		f->data = state->data;
+		state->data = tmp;
+		for(int i=0; i<3; i++)
+		{
+			tmp = f->planes[i];
+			f->planes[i] = state->planes[i];
+			state->planes[i] = tmp;
+		}
+		f->usec = state->usec;
+		f->generation = generation;
+
+		ringqueue_spsc_add(p->ready, &slot);
+		slot = -1;
+	}
+	return NULL;
+}
+
+/** Opens a video and starts decoding it on a separate thread. The
+    decoder stays up to numFrames-2 frames ahead of the frame being
+    displayed, so a frame which is slow to decode doesn't delay
+    rendering as long as the average decode time is fast enough.
+
+    All other video_player functions must be called from the thread
+    which called video_player_new().
+
+    @param filename The video file to open.
+
+    @param format The format to decode frames into.
+
+    @param numFrames Number of frames to allocate (at least 3).
+
+    @return A new player or NULL if the video couldn't be opened. Free
+    with video_player_free().
+*/
+video_player* video_player_new(const char *filename, video_format format, int numFrames)
+{
+	if(numFrames < 3)
+		numFrames = 3;
+
+	video_state *state = video_init(filename, format);
+	if(state == NULL)
+		return NULL;
+
+	video_player *p = (video_player*) calloc(1, sizeof(video_player));
+	p->state = state;
+	p->numFrames = numFrames;
+	p->frames = (video_frame*) calloc((size_t) numFrames, sizeof(video_frame));
+	p->ready  = ringqueue_spsc_new(numFrames, sizeof(int));
+	p->unused = ringqueue_spsc_new(numFrames, sizeof(int));
+	for(int i=0; i<numFrames; i++)
+		ringqueue_spsc_add(p->unused, &i);
+	p->current = -1;
+	p->next = -1;
+	p->eofGeneration = -1;
+	pthread_mutex_init(&p->statsLock, NULL);
+
+	AVRational rate = state->video_stream->avg_frame_rate;
+	if(rate.num > 0 && rate.den > 0)
+		p->frameDuration = (int64_t) (1000000 / av_q2d(rate));
+	else
+		p->frameDuration = 1000000/30;
+
+	if(pthread_create(&p->thread, NULL, video_player_thread, p) != 0)
+	{
+		msg(MSG_ERROR, "Failed to create video decoding thread.");
+		video_cleanup(state);
+		ringqueue_spsc_free(p->ready);
+		ringqueue_spsc_free(p->unused);
+		free(p->frames);
+		free(p);
+		return NULL;
+	}
+	return p;
+}
+
+/** Returns a video_state which contains information about the video
+ * (width, height, format, etc). Don't use the frame data in it; it is
+ * owned by the decoder thread. */
+const video_state* video_player_info(const video_player *p)
+{
+	return p->state;
+}
+
+/** Gives a frame back to the decoder thread. */
+static void video_player_release(video_player *p, int slot)
+{
+	ringqueue_spsc_add(p->unused, &slot);
+}
+
+/** Removes the next decoded frame from the ready queue into p->next,
+ * discarding frames decoded before the most recent seek.
+ *
+ * @return 1 if p->next contains a frame.
+ */
+static int video_player_fetch(video_player *p)
+{
+	int generation = __atomic_load_n(&p->seekGeneration, __ATOMIC_ACQUIRE);
+	while(p->next < 0)
+	{
+		if(!ringqueue_spsc_remove(p->ready, &p->next))
+			return 0;
+		if(p->frames[p->next].generation != generation)
+		{
+			video_player_release(p, p->next);
+			p->next = -1;
+		}
+	}
+	return 1;
+}
+
+/** Gets the frame that should be displayed at a specific time.
+
+    If several frames are due, the newest one is returned and the
+    others are dropped. If the next frame isn't due yet (or hasn't
+    been decoded yet), the same frame is returned again.
+
+    @param usec The current time in microseconds, using the same
+    timestamps as video_frame.usec (the first frame of most videos
+    is at 0).
+
+    @return The frame to display or NULL if no frame is available
+    yet. The frame remains valid until the next call to
+    video_player_get(), video_player_next() or video_player_free().
+*/
+const video_frame* video_player_get(video_player *p, int64_t usec)
+{
+	int advanced = 0;
+	while(video_player_fetch(p) && p->frames[p->next].usec <= usec)
+	{
+		if(p->current >= 0)
+		{
+			if(!p->currentShown)
+				p->stats.dropped++;
+			video_player_release(p, p->current);
+		}
+		p->current = p->next;
+		p->currentShown = 0;
+		p->next = -1;
+		advanced = 1;
+	}
+
+	if(p->current < 0)
+		return NULL;
+
+	/* If the next frame should already be on the screen but the
+	 * decoder hasn't produced it, we have to show the old frame
+	 * again. */
+	if(!advanced && p->next < 0 && !video_player_eof(p) &&
+	   usec > p->frames[p->current].usec + p->frameDuration)
+		p->stats.repeated++;
+
+	if(!p->currentShown)
+	{
+		p->stats.displayed++;
+		p->currentShown = 1;
+	}
+	return &p->frames[p->current];
+}
+
+/** Gets the next decoded frame regardless of its timestamp. Useful
+    for processing every frame of a video as fast as possible.
+
+    @return The next frame or NULL if the decoder hasn't decoded it
+    yet (or the video has ended).
+*/
+const video_frame* video_player_next(video_player *p)
+{
+	if(!video_player_fetch(p))
+		return NULL;
+	if(p->current >= 0)
+		video_player_release(p, p->current);
+	p->current = p->next;
+	p->currentShown = 1;
+	p->next = -1;
+	p->stats.displayed++;
+	return &p->frames[p->current];
+}
+
+/** Jumps to a different time in the video. The decoder starts at the
+ * keyframe before usec and discards frames until it reaches usec. The
+ * previous frame continues to be returned by video_player_get() until
+ * a frame after the seek is available. */
+void video_player_seek(video_player *p, int64_t usec)
+{
+	__atomic_store_n(&p->seekUsec, usec, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&p->seekGeneration, 1, __ATOMIC_ACQ_REL);
+	if(p->next >= 0)
+	{
+		video_player_release(p, p->next);
+		p->next = -1;
+	}
+}
+
+/** Returns 1 if the decoder reached the end of the video and every
+ * decoded frame has been handed to the caller. */
+int video_player_eof(video_player *p)
+{
+	int generation = __atomic_load_n(&p->seekGeneration, __ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&p->eofGeneration, __ATOMIC_ACQUIRE) != generation)
+		return 0;
+	return !video_player_fetch(p);
+}
+
+/** Copies the statistics collected by the player into stats. */
+void video_player_get_stats(video_player *p, video_player_stats *stats)
+{
+	pthread_mutex_lock(&p->statsLock);
+	*stats = p->stats;
+	int n = p->stats.decoded;
+	if(n > 0)
+	{
+		stats->decodeAvg = p->decodeSum / n;
+		double var = p->decodeSumSq / n - stats->decodeAvg*stats->decodeAvg;
+		stats->decodeStdev = var > 0 ? sqrt(var) : 0;
+	}
+	pthread_mutex_unlock(&p->statsLock);
+}
+
+/** Stops the decoder thread and frees the player. */
+void video_player_free(video_player *p)
+{
+	if(p == NULL)
+		return;
+	__atomic_store_n(&p->quit, 1, __ATOMIC_RELEASE);
+	pthread_join(p->thread, NULL);
+	for(int i=0; i<p->numFrames; i++)
+	{
+		free(p->frames[i].data);
+		for(int j=0; j<3; j++)
+			free(p->frames[i].planes[j]);
+	}
+	free(p->frames);
+	ringqueue_spsc_free(p->ready);
+	ringqueue_spsc_free(p->unused);
+	pthread_mutex_destroy(&p->statsLock);
+	video_cleanup(p->state);
+	free(p);
+}
+
 #endif // HAVE_FFMPEG
+
+
+/** Creates the textures and pixel buffer objects used by
+ * video_yuv_textures_update(). */
+static void video_yuv_textures_init(video_yuv_textures *t, const video_state *state)
+{
+	t->width = state->width;
+	t->height = state->height;
+	t->nextPbo = 0;
+
+	glGenTextures(3, t->tex);
+	for(int i=0; i<3; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, t->tex[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, state->planeWidth[i], state->planeHeight[i],
+		             0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	GLsizeiptr size = 0;
+	for(int i=0; i<3; i++)
+		size += state->planeWidth[i]*state->planeHeight[i];
+	glGenBuffers(2, t->pbo);
+	for(int i=0; i<2; i++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	kuhl_errorcheck();
+}
+
+/** Uploads planes (which must have the sizes described by state) to
+ * the textures. */
+static int video_yuv_textures_upload(video_yuv_textures *t, const video_state *state, const unsigned char **planes)
+{
+	if(state->format != VIDEO_YUV420 || planes[0] == NULL)
+	{
+		msg(MSG_ERROR, "Video frame is not available in the VIDEO_YUV420 format.");
+		return 0;
+	}
+	if(t->tex[0] == 0)
+		video_yuv_textures_init(t, state);
+	if(t->width != state->width || t->height != state->height)
+	{
+		msg(MSG_ERROR, "Video size changed from %dx%d to %dx%d", t->width, t->height, state->width, state->height);
+		return 0;
+	}
+
+	GLsizeiptr size = 0;
+	for(int i=0; i<3; i++)
+		size += state->planeWidth[i]*state->planeHeight[i];
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo[t->nextPbo]);
+	/* Invalidating the buffer lets the driver give us fresh storage
+	 * instead of waiting for a pending transfer out of it. */
+	unsigned char *ptr = (unsigned char*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+	                                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(ptr == NULL)
+	{
+		msg(MSG_ERROR, "Failed to map pixel buffer object.");
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return 0;
+	}
+	size_t offset[3];
+	size_t total = 0;
+	for(int i=0; i<3; i++)
+	{
+		size_t planeSize = (size_t) (state->planeWidth[i]*state->planeHeight[i]);
+		offset[i] = total;
+		memcpy(ptr+total, planes[i], planeSize);
+		total += planeSize;
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	/* Rows in the planes are not padded. */
+	GLint prevAlignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &prevAlignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(int i=0; i<3; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, t->tex[i]);
+		/* The last parameter is an offset into the PBO. */
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, state->planeWidth[i], state->planeHeight[i],
+		                GL_RED, GL_UNSIGNED_BYTE, (const GLvoid*) offset[i]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, prevAlignment);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	kuhl_errorcheck();
+
+	t->nextPbo = (t->nextPbo+1) % 2;
+	return 1;
+}
+
+/** Uploads the Y, U and V planes of the current frame into three
+ * textures. The textures are created the first time this function is
+ * called. The data is copied into a pixel buffer object and
+ * glTexSubImage2D() transfers it from there, so the copy to the GPU
+ * does not block the CPU. The two PBOs are used alternately so that
+ * we never write into a buffer that the GPU may still be reading.
+
+    @param t A video_yuv_textures struct which was initialized with
+    zeros.
+
+    @param state A video opened with the VIDEO_YUV420 format.
+
+    @return 1 on success, 0 on failure.
+ */
+int video_yuv_textures_update(video_yuv_textures *t, const video_state *state)
+{
+	if(state == NULL)
+		return 0;
+	return video_yuv_textures_upload(t, state, (const unsigned char**) state->planes);
+}
+
+/** Like video_yuv_textures_update(), but uploads a frame returned by
+ * a video_player.
+
+    @param t A video_yuv_textures struct which was initialized with
+    zeros.
+
+    @param info Information about the video from video_player_info().
+
+    @param frame The frame to upload.
+
+    @return 1 on success, 0 on failure.
+*/
+int video_yuv_textures_update_frame(video_yuv_textures *t, const video_state *info, const video_frame *frame)
+{
+	if(info == NULL || frame == NULL)
+		return 0;
+	return video_yuv_textures_upload(t, info, (const unsigned char**) frame->planes);
+}
+
+/** Deletes the textures and buffers created by
+ * video_yuv_textures_update(). */
+void video_yuv_textures_delete(video_yuv_textures *t)
+{
+	if(t->tex[0] != 0)
+	{
+		glDeleteTextures(3, t->tex);
+		glDeleteBuffers(2, t->pbo);
+	}
+	memset(t, 0, sizeof(video_yuv_textures));
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <GL/glew.h>
+
 #ifdef HAVE_FFMPEG
 #include <libavutil/imgutils.h>
 #include <libavutil/samplefmt.h>
@@ -8,14 +11,30 @@
 #include <libswscale/swscale.h>
 #endif
 
+/** Formats that decoded video frames can be converted into. */
+typedef enum {
+	VIDEO_RGB,    /**< Packed 8-bit RGB stored in video_state.data */
+	VIDEO_YUV420  /**< 8-bit Y, U and V planes stored in
+	               * video_state.planes. The U and V planes are half
+	               * the width and height of the Y plane. Convert to
+	               * RGB in a shader (see videoplay-yuv.frag). */
+} video_format;
+
 typedef struct {
 	int width;           /**< Width of the video in pixels */
 	int height;          /**< Height of the video in pixels */
 	float aspectRatio;   /**< Aspect ratio of the video */
 	int64_t usec;        /**< Time of frame in microseconds */
-	unsigned char* data; /**< Contains the decoded image */
+	unsigned char* data; /**< Contains the decoded image (VIDEO_RGB only) */
 	char filename[1024]; /**< Filename of the video we loaded */
 
+	video_format format;       /**< Format of the decoded frames */
+	unsigned char* planes[3];  /**< Y, U and V planes (VIDEO_YUV420 only) */
+	int planeWidth[3];         /**< Width of each plane in pixels */
+	int planeHeight[3];        /**< Height of each plane in pixels */
+	int bt709;                 /**< 1 if the video uses BT.709 colors, 0 for BT.601 */
+	int fullRange;             /**< 1 if Y, U and V use the full 0-255 range */
+
 	/* The following variables are used internally by video.c */
 	int has_new_video_frame;
 
@@ -35,5 +54,53 @@ typedef struct {
 	
 } video_state;
 
+/** OpenGL textures which hold the planes of a VIDEO_YUV420 frame. Data
+ * is uploaded through two pixel buffer objects which are used
+ * alternately so that filling one buffer doesn't wait for the GPU to
+ * finish reading the other. Initialize the struct with zeros. */
+typedef struct {
+	GLuint tex[3];   /**< Y, U and V textures (GL_R8) */
+	GLuint pbo[2];   /**< Pixel buffer objects */
+	int nextPbo;     /**< Index of the PBO to fill next */
+	int width;       /**< Width of the Y texture */
+	int height;      /**< Height of the Y texture */
+} video_yuv_textures;
+
+/** A decoded frame held by a video_player. */
+typedef struct {
+	int64_t usec;              /**< Time of frame in microseconds */
+	unsigned char* data;       /**< Decoded image (VIDEO_RGB only) */
+	unsigned char* planes[3];  /**< Y, U and V planes (VIDEO_YUV420 only) */
+	int generation;            /**< Incremented by each seek; used internally */
+} video_frame;
+
+/** Statistics collected by a video_player. */
+typedef struct {
+	int decoded;        /**< Frames decoded by the decoder thread */
+	int displayed;      /**< Frames returned by video_player_get() */
+	int dropped;        /**< Frames skipped because a newer frame was due */
+	int repeated;       /**< Calls to video_player_get() which returned an old frame because the next one wasn't decoded in time */
+	double decodeAvg;   /**< Average time to decode a frame (microseconds) */
+	double decodeStdev; /**< Standard deviation of the decode time (microseconds) */
+	long decodeMax;     /**< Longest time to decode a frame (microseconds) */
+} video_player_stats;
+
+/** Decodes a video on a separate thread. See video_player_new(). */
+typedef struct video_player video_player;
+
+video_state* video_open(const char *filename, video_format format);
 video_state* video_get_next_frame(video_state *state, const char *filename);
 void video_cleanup(video_state *state);
+
+video_player* video_player_new(const char *filename, video_format format, int numFrames);
+const video_state* video_player_info(const video_player *p);
+const video_frame* video_player_get(video_player *p, int64_t usec);
+const video_frame* video_player_next(video_player *p);
+void video_player_seek(video_player *p, int64_t usec);
+int video_player_eof(video_player *p);
+void video_player_get_stats(video_player *p, video_player_stats *stats);
+void video_player_free(video_player *p);
+
+int video_yuv_textures_update(video_yuv_textures *t, const video_state *state);
+int video_yuv_textures_update_frame(video_yuv_textures *t, const video_state *info, const video_frame *frame);
+void video_yuv_textures_delete(video_yuv_textures *t);
@@ -22,6 +22,7 @@
 #include "camcontrol-mouse.h"
 #include "camcontrol-vrpn.h"
 #include "camcontrol-orientsensor.h"
+#include "camcontrol-replay.h"
 #include "camcontrol-oculus-linux.h"
 #include "camcontrol-oculus-windows.h"
 
@@ -33,6 +34,10 @@
 #include "orient-sensor.h"
 #include "dgr.h"
 #include "bufferswap.h"
+#include "trace.h"
+#include "gputimer.h"
+#include "dynres.h"
+#include "pick.h"
 
 #include "viewmat.h"
 
@@ -58,7 +63,8 @@ typedef enum
 	VIEWMAT_CONTROL_MOUSE,
 	VIEWMAT_CONTROL_VRPN,
 	VIEWMAT_CONTROL_ORIENT,
-	VIEWMAT_CONTROL_OCULUS
+	VIEWMAT_CONTROL_OCULUS,
+	VIEWMAT_CONTROL_REPLAY
 } ViewmatControlMode;
 static ViewmatControlMode viewmat_control_mode = VIEWMAT_CONTROL_MOUSE; /**< Currently active control mode */
 
@@ -128,6 +134,7 @@ float viewmat_window_aspect_ratio(void)
 void viewmat_begin_frame(void)
 {
 	desktop->begin_frame();
+	dynres_begin_frame();
 }
 
 
@@ -136,10 +143,22 @@ void viewmat_begin_frame(void)
  * been rendered. */
 void viewmat_end_frame(void)
 {
+	dynres_end_frame();
+	pick_end_frame();
 	desktop->end_frame();
 }
 
 
+/** Returns the name used to time a viewport with gputimer_begin(). */
+static const char* viewmat_gputimer_name(int viewportID)
+{
+	static const char *names[] = { "viewport 0", "viewport 1", "viewport 2", "viewport 3",
+	                               "viewport 4", "viewport 5", "viewport 6", "viewport 7" };
+	if(viewportID >= 0 && viewportID < 8)
+		return names[viewportID];
+	return "viewport other";
+}
+
 /** Changes the framebuffer (as needed) that OpenGL is rendering
  * to. Some HMDs (such as the Oculus Rift) require us to prerender the
  * left and right eye scenes to a texture. Those textures are then
@@ -155,10 +174,24 @@ void viewmat_end_frame(void)
 void viewmat_begin_eye(int viewportID)
 {
 	desktop->begin_eye(viewportID);
+	if(dynres_enabled())
+	{
+		int viewport[4];
+		desktop->get_viewport(viewport, viewportID);
+		dynres_begin_eye(viewport);
+	}
+	gputimer_begin(viewmat_gputimer_name(viewportID));
 }
 
 void viewmat_end_eye(int viewportID)
 {
+	gputimer_end(viewmat_gputimer_name(viewportID));
+	if(dynres_enabled())
+	{
+		int viewport[4];
+		desktop->get_viewport(viewport, viewportID);
+		dynres_end_eye(viewport);
+	}
 	desktop->end_eye(viewportID);
 }
 
@@ -208,9 +241,9 @@ void viewmat_init(const float pos[3], const float look[3], const float up[3])
 	}
 
 	/* Set viewmat_control_mode variable appropriately. */
-	static const char *controlStrings[] = { "none", "mouse", "vrpn", "orient", "oculus" };
-	static const ViewmatControlMode controlTypes[]    = { VIEWMAT_CONTROL_NONE, VIEWMAT_CONTROL_MOUSE, VIEWMAT_CONTROL_VRPN, VIEWMAT_CONTROL_ORIENT, VIEWMAT_CONTROL_OCULUS };
-	for(int i=0; i<5; i++)
+	static const char *controlStrings[] = { "none", "mouse", "vrpn", "orient", "oculus", "replay" };
+	static const ViewmatControlMode controlTypes[]    = { VIEWMAT_CONTROL_NONE, VIEWMAT_CONTROL_MOUSE, VIEWMAT_CONTROL_VRPN, VIEWMAT_CONTROL_ORIENT, VIEWMAT_CONTROL_OCULUS, VIEWMAT_CONTROL_REPLAY };
+	for(int i=0; i<6; i++)
 		if(strcasecmp(controlModeString, controlStrings[i]) == 0)
 			viewmat_control_mode = controlTypes[i];
 
@@ -287,6 +320,10 @@ void viewmat_init(const float pos[3], const float look[3], const float up[3])
 			msg(MSG_INFO, "viewmat control mode: Orientation sensor");
 			controller = new camcontrolOrientSensor(desktop, pos);
 			break;
+		case VIEWMAT_CONTROL_REPLAY:
+			msg(MSG_INFO, "viewmat control mode: Replay recorded tracker data");
+			controller = new camcontrolReplay(desktop, kuhl_config_get("viewmat.replay.file"));
+			break;
 		case VIEWMAT_CONTROL_OCULUS:
 #if defined(__linux__) && !defined(MISSING_OVR)
 			msg(MSG_INFO, "viewmat control mode: Oculus (Linux)");
@@ -379,32 +416,11 @@ static void viewmat_validate_ipd(const float viewmatrix[16], int viewportID)
 }
 
 
-/** Get a 4x4 view matrix. Some types of systems also need to update
- * the frustum based on where the virtual camera is. For example, on
- * the IVS display wall, the frustum is adjusted dynamically based on
- * where a person is relative to the screens.
- *
- * @param viewmatrix A 4x4 view matrix for viewmat to fill in.
- *
- * @param projmatrix A 4x4 projection matrix for viewmat to fill in.
- *
- * @param viewportID If there is only one viewport, set this to
- * 0. This value must be smaller than the value reported by
- * viewmat_num_viewports(). In an HMD, typically viewportID=0 is the
- * left eye and viewportID=1 is the right eye. However, some Oculus
- * HMDs will result in this being swapped. To definitively know which
- * eye this view matrix corresponds to, examine the return value of
- * this function. If viewportID == -1, then this function will return
- * a value appropriate for a "middle" eye regardless of rendering
- * mode. This is useful if you are rendering for an HMD but you
- * actually want to know the position of the point between the center
- * of the eyes.
- *
- * @return A viewmat_eye enum which indicates if this view matrix is
- * for the left, right, middle, or unknown eye.
- *
- */
-viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewportID)
+/** Implements viewmat_get() and viewmat_get_relative(). If camPos is
+ * NULL, viewmatrix includes the camera translation. Otherwise, the
+ * camera position is stored in camPos and viewmatrix is relative to
+ * the camera. */
+static viewmat_eye viewmat_private_get(float viewmatrix[16], float projmatrix[16], double camPos[3], int viewportID)
 {
 	viewmat_eye eye;
 	if(viewportID == -1)
@@ -424,7 +440,10 @@ viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewport
 	 * NOTE: There is no reason to get the view matrix if DGR is
 	 * enabled and we are a slave because the master process will
 	 * control the viewmatrix. */
-	controller->get(viewmatrix, desktop->eye_type(viewportID));
+	if(camPos)
+		controller->get_relative(viewmatrix, camPos, desktop->eye_type(viewportID));
+	else
+		controller->get(viewmatrix, desktop->eye_type(viewportID));
 	
 	/* If we are running in IVS mode and using the tracking systems,
 	 * all computers need to update their frustum differently. The
@@ -452,6 +471,11 @@ viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewport
 			float viewInverted[16];
 			mat4f_invert_new(viewInverted, viewmatrix);
 			mat4f_getColumn(pos, viewInverted, 3);
+			if(camPos) // relative view matrix doesn't contain the position
+			{
+				for(int i=0; i<3; i++)
+					pos[i] += (float) camPos[i];
+			}
 
 			/* Make sure all DGR hosts can get the position so that they
 			 * can update the frustum appropriately */
@@ -477,6 +501,14 @@ viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewport
 				lookat[i] = pos[i]+forwardVec[i];
 			float up[3] = {0, 1, 0};
 			mat4f_lookatVec_new(viewmatrix, pos, lookat, up);
+			if(camPos)
+			{
+				/* The tracked position becomes the camera position,
+				 * leaving only the rotation in the view matrix. */
+				float zero[4] = { 0,0,0,1 };
+				mat4f_setColumn(viewmatrix, zero, 3);
+				vec3d_from_vec3f(camPos, pos);
+			}
 		}
 	}
 
@@ -487,12 +519,148 @@ viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewport
 	char dgrkey[128];
 	snprintf(dgrkey, 128, "!!viewmat%d", viewportID);
 	dgr_setget(dgrkey, viewmatrix, sizeof(float)*16);
+	if(camPos)
+	{
+		snprintf(dgrkey, 128, "!!viewmatpos%d", viewportID);
+		dgr_setget(dgrkey, camPos, sizeof(double)*3);
+	}
 
 	/* Sanity checks */
 	viewmat_validate_ipd(viewmatrix, viewportID);
 	return eye;
 }
 
+/** Get a 4x4 view matrix. Some types of systems also need to update
+ * the frustum based on where the virtual camera is. For example, on
+ * the IVS display wall, the frustum is adjusted dynamically based on
+ * where a person is relative to the screens.
+ *
+ * @param viewmatrix A 4x4 view matrix for viewmat to fill in.
+ *
+ * @param projmatrix A 4x4 projection matrix for viewmat to fill in.
+ *
+ * @param viewportID If there is only one viewport, set this to
+ * 0. This value must be smaller than the value reported by
+ * viewmat_num_viewports(). In an HMD, typically viewportID=0 is the
+ * left eye and viewportID=1 is the right eye. However, some Oculus
+ * HMDs will result in this being swapped. To definitively know which
+ * eye this view matrix corresponds to, examine the return value of
+ * this function. If viewportID == -1, then this function will return
+ * a value appropriate for a "middle" eye regardless of rendering
+ * mode. This is useful if you are rendering for an HMD but you
+ * actually want to know the position of the point between the center
+ * of the eyes.
+ *
+ * @return A viewmat_eye enum which indicates if this view matrix is
+ * for the left, right, middle, or unknown eye.
+ *
+ */
+viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewportID)
+{
+	trace_scope trace("viewmat_get");
+	return viewmat_private_get(viewmatrix, projmatrix, NULL, viewportID);
+}
+
+/** Gets a view matrix and projection matrix for camera-relative
+ * rendering. This function behaves like viewmat_get() except that
+ * the view matrix doesn't translate the world by the camera
+ * position. Instead, the camera position is stored in camPos in
+ * double precision.
+ *
+ * Programs that draw large worlds should store the model matrices
+ * of objects in double precision and compute the modelview matrix
+ * with:
+ *
+ * mat4f_from_mat4d_relative(model, modelDouble, camPos);<br>
+ * mat4f_mult_mat4f_new(modelview, viewmatrix, model);
+ *
+ * Since the large camera position is subtracted from the model
+ * matrix in double precision, the resulting float matrices only
+ * contain values that are relative to the camera. Objects near the
+ * camera will be drawn without jitter even if they are very far
+ * from the origin.
+ *
+ * @param viewmatrix A 4x4 view matrix (without the camera translation) for viewmat to fill in.
+ *
+ * @param projmatrix A 4x4 projection matrix for viewmat to fill in.
+ *
+ * @param camPos To be filled in with the camera position in world coordinates.
+ *
+ * @param viewportID See viewmat_get().
+ *
+ * @return A viewmat_eye enum which indicates if this view matrix is
+ * for the left, right, middle, or unknown eye.
+ */
+viewmat_eye viewmat_get_relative(float viewmatrix[16], float projmatrix[16], double camPos[3], int viewportID)
+{
+	trace_scope trace("viewmat_get_relative");
+	return viewmat_private_get(viewmatrix, projmatrix, camPos, viewportID);
+}
+
+/** Checks if both eyes can be drawn in a single pass. This is
+ * possible with the side-by-side HMD and the anaglyph display
+ * modes. It can be turned off by setting viewmat.singlepass=false in
+ * the config file.
+ *
+ * @return 1 if the program should use viewmat_begin_single_pass()
+ * instead of drawing each viewport separately.
+ */
+int viewmat_single_pass(void)
+{
+	static kuhl_config_handle singlePass = KUHL_CONFIG_HANDLE("viewmat.singlepass");
+	return desktop->supports_single_pass() && kuhl_config_handle_boolean(&singlePass, 1, 1) &&
+		!dynres_enabled(); // dynamic resolution draws each viewport separately
+}
+
+/** Prepares to draw both eyes in a single pass. Call this instead of
+ * viewmat_begin_eye() and glViewport(). It sets the viewport to cover
+ * both eyes and enables GL_CLIP_DISTANCE0.
+ *
+ * The vertex program draws eye "gl_InstanceID % 2" (eye 0 is
+ * viewport 0) with the matrices from viewmat_get_stereo(). After it
+ * computes gl_Position, it must squeeze the eye into its half of the
+ * viewport and clip it at the center:
+
+ float side = eye == 0 ? -1.0 : 1.0;<br>
+ gl_Position.x = (gl_Position.x + side*gl_Position.w) * 0.5;<br>
+ gl_ClipDistance[0] = side * gl_Position.x;
+ */
+void viewmat_begin_single_pass(void)
+{
+	desktop->begin_single_pass();
+}
+
+/** To be called when done drawing both eyes in a single pass. */
+void viewmat_end_single_pass(void)
+{
+	desktop->end_single_pass();
+}
+
+/** Gets the view and projection matrices for both eyes at once. This
+ * is the same as calling viewmat_get() for viewport 0 and 1.
+ *
+ * @param viewmatrix To be filled in with the view matrix for viewport 0 and 1.
+ *
+ * @param projmatrix To be filled in with the projection matrix for viewport 0 and 1.
+ *
+ * @return The number of eyes. If the display mode only has one
+ * viewport, both matrices will be the same and this function returns
+ * 1.
+ */
+int viewmat_get_stereo(float viewmatrix[2][16], float projmatrix[2][16])
+{
+	trace_scope trace("viewmat_get_stereo");
+	int eyes = desktop->num_viewports() > 1 ? 2 : 1;
+	for(int i=0; i<eyes; i++)
+		viewmat_private_get(viewmatrix[i], projmatrix[i], NULL, i);
+	if(eyes == 1)
+	{
+		mat4f_copy(viewmatrix[1], viewmatrix[0]);
+		mat4f_copy(projmatrix[1], projmatrix[0]);
+	}
+	return eyes;
+}
+
 /** Gets the viewpgort information for a particular viewport.
 
  @param viewportValue A location to be filled in with the viewport x
@@ -504,6 +672,7 @@ viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewport
 void viewmat_get_viewport(int viewportValue[4], int viewportNum)
 {
 	desktop->get_viewport(viewportValue, viewportNum);
+	dynres_scale_viewport(viewportValue); // with dynamic resolution, draw into part of the viewport
 }
 
 
@@ -17,9 +17,19 @@
     viewmat_get_viewport() to get the viewport position and dimensions
     viewmat_begin_eye() prior to drawing each eye
     viewmat_get() to get projection and view matrices for the eye.
+      (or viewmat_get_relative() for camera-relative rendering of large worlds)
     viewmat_end_eye() when finished drawing graphics for an eye.
     viewmat_end_frame() when finished drawing a frame.
 
+    Stereo display modes can also draw both eyes at once, which halves
+    the number of draw calls: If viewmat_single_pass() returns 1, call
+    viewmat_begin_single_pass(), get the matrices for both eyes with
+    viewmat_get_stereo(), draw every object with two instances (see
+    kuhl_geometry_draw_instanced()) and call viewmat_end_single_pass()
+    instead of looping over the viewports. The vertex program uses
+    gl_InstanceID to pick the eye and must move each eye into its half
+    of the viewport. See triangle-shade.c and triangle-shade.vert.
+
     If you are running in a DGR environment, it also ensures that the
     information is sent (dgr_update()) and that the view matrices are
     synchronized across all DGR processes.
@@ -49,6 +59,12 @@ int viewmat_get_framebuffer(int viewportID);
 
 void viewmat_init(const float pos[3], const float look[3], const float up[3]);
 viewmat_eye viewmat_get(float viewmatrix[16], float projmatrix[16], int viewportNum);
+viewmat_eye viewmat_get_relative(float viewmatrix[16], float projmatrix[16], double camPos[3], int viewportNum);
+
+int viewmat_single_pass(void);
+void viewmat_begin_single_pass(void);
+void viewmat_end_single_pass(void);
+int viewmat_get_stereo(float viewmatrix[2][16], float projmatrix[2][16]);
 
 int viewmat_num_viewports(void);
 void viewmat_get_viewport(int viewportValue[4], int viewportNum);
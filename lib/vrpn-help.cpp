@@ -8,73 +8,120 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
+#ifndef _MSC_VER
+#include <pthread.h> // windows-compat.h provides pthreads on Visual Studio
+#endif
 #include <map>
 #include <string>
 
 #ifndef MISSING_VRPN
 #include <vrpn_Tracker.h>
-#include <quat.h>
 #endif
 
 #include "windows-compat.h"
 #include "kuhl-util.h"
 #include "vecmat.h"
-#include "kalman.h"
+#include "kalman-batch.h"
+#include "posering.h"
+#include "tdl-util.h"
 #include "vrpn-help.h"
 
-#ifndef MISSING_VRPN
+/* Tracker data is received by a background I/O thread so that slow
+ * or bursty VRPN servers do not stall the render thread. For each
+ * tracked object, the I/O thread adds timestamped poses to a
+ * pose_ring. The render thread only reads from the pose_ring.
+ *
+ * Objects are never removed once they are added. The render thread
+ * fills in a TrackedObject before it increments trackedCount, so the
+ * I/O thread never sees a partially initialized object.
+ */
 
+#define VRPN_MAX_OBJECTS 64
+#define VRPN_RING_SIZE 256       /**< Number of poses to keep for each object */
+#define VRPN_IO_SLEEP_USEC 1000  /**< Time I/O thread sleeps between polls */
+#define VRPN_RETRY_USEC 5000000  /**< Time to wait before reconnecting after a failure */
+#define VRPN_REPLAY_PREFIX "replay:"
 
-/** A struct which we will create for every single tracked
- * object. These will be in a map so that we can easily find the
- * struct that corresponds with an object using the "object\@tracker"
- * notation. */
+/** A struct which we will create for every single tracked object. */
 typedef struct {
-	vrpn_Tracker_Remote *tracker; /**< The VRPN tracker for this object */
-	vrpn_TRACKERCB data; /**< Data we receive from VRPN (we receive it in the callback */
-	int hasData; /**< Has data been written to? */
-	int failCount; /**< Number of times vrpn_get() has been called with hasData == 0 */
+	char fullname[256];   /**< object\@hostname */
+	int handle;           /**< Index of this object in trackedObjects */
+	int isReplay;         /**< Read poses from a TDL file instead of a VRPN server */
+	int isVicon;          /**< Poses need to be converted from Vicon coordinates */
+	pose_ring *ring;      /**< Poses received by the I/O thread */
+	int smooth;           /**< If 0, don't apply the Kalman filter (read by I/O thread) */
+
+	/* Only used by the render thread. */
+	int failCount; /**< Number of times vrpn_get() has been called with no data */
+	pose_predict_stats predictStats; /**< Accuracy of vrpn_get_handle_predicted() */
+	long predictStatsPrinted;        /**< predictStats.count when stats were last printed */
+
+	/* Only used by the I/O thread. */
 	kuhl_fps_state fps_state; /**< Track how many records per second this object has sent us */
-	kalman_state kalman[7]; /**< Kalman filter state for this object */
+	int filterPending;        /**< A record is waiting in the Kalman filter */
+	long lastMsgTime;         /**< Time of previous record from the tracker, -1 if none */
+	long retryTime;           /**< Don't try connecting again before this time */
+#ifndef MISSING_VRPN
+	vrpn_Tracker_Remote *tracker; /**< The VRPN tracker for this object, NULL if not connected */
+#endif
+	tdl_log *replayLog; /**< TDL file being replayed, NULL if not open */
+	size_t replayIndex; /**< Next record to add from replayLog */
+	long replayStart;   /**< Time that the first record in replayLog is played */
+	long replayPeriod;  /**< Microseconds between records in version 1 TDL files */
 } TrackedObject;
 
-/** A mapping of object\@tracker strings to vrpn_Tracker_Remote objects
- * so we can quickly find the appropriate object given an
- * object\@tracker string. */
-std::map<std::string, TrackedObject*> nameToTracker;
+static TrackedObject *trackedObjects[VRPN_MAX_OBJECTS];
+static int trackedCount = 0;
 
+/** A mapping of object\@tracker strings to indices in trackedObjects
+ * so that vrpn_get() can find an object by name. Only used by the
+ * render thread. Use vrpn_open() and vrpn_get_handle() to avoid the
+ * lookup. */
+static std::map<std::string, int> nameToHandle;
+
+/** Kalman filter for all objects. Only used by the I/O thread (after
+ * it is created). Starts with one object and is grown by the I/O
+ * thread as objects are added. */
+static kalman_batch *filter = NULL;
+
+static pthread_t ioThread;
+static int ioThreadStarted = 0;
+static int ioThreadQuit = 0;
 
-static void smooth(TrackedObject *to)
-{
-	long microseconds = (to->data.msg_time.tv_sec* 1000000L) + to->data.msg_time.tv_usec;
-	/* Smooth position */
-	for(int i=0; i<3; i++)
-	{
-		to->data.pos[i] = kalman_estimate(&(to->kalman[i]),
-		                                  to->data.pos[i],
-		                                  microseconds);
-	}
 
-	/* Smooth orientation */
-	for(int i=0; i<4; i++)
+/** Filters the records that are waiting in the Kalman filter for all
+ * objects at once and adds the results to the objects' pose_rings. */
+static void vrpn_filter_run(void)
+{
+	kalman_batch_run(filter);
+	/* Timestamp with our own clock so that the render thread can
+	 * compare sample times with kuhl_microseconds() even if the
+	 * tracking system is on a different computer. */
+	long now = kuhl_microseconds();
+	int count = __atomic_load_n(&trackedCount, __ATOMIC_ACQUIRE);
+	for(int i=0; i<count; i++)
 	{
-		to->data.quat[i] = kalman_estimate(&(to->kalman[3+i]),
-		                                   to->data.quat[i],
-		                                   microseconds);
+		TrackedObject *to = trackedObjects[i];
+		if(!to->filterPending)
+			continue;
+		to->filterPending = 0;
+
+		/* The filter also estimates velocity which we can use to
+		 * predict future poses. */
+		pose_sample s;
+		s.usec = now;
+		s.hasVelocity = 1;
+		kalman_batch_get(filter, i, s.pos, s.quat, s.vel, s.quatVel);
+		pose_ring_add(to->ring, &s);
 	}
-	
-	// printf("%ld, %lf, %lf\n", kuhl_milliseconds(), t.pos[0], smoothed);
 }
 
-static void vrpn_sanity_check(const struct timeval lastTime,
-                              const struct timeval thisTime,
-                              const char *name)
+static void vrpn_sanity_check(long lastTime_usec, long thisTime_usec, const char *name)
 {
-	long lastTime_usec = (lastTime.tv_sec * 1000000L) + lastTime.tv_usec;
-	long thisTime_usec = (thisTime.tv_sec * 1000000L) + thisTime.tv_usec;
 	long elapsed       = thisTime_usec - lastTime_usec;
 	long budget        = 1000000/55; // 55 records per second
 	if(elapsed > 1000000/55)
@@ -83,58 +130,92 @@ static void vrpn_sanity_check(const struct timeval lastTime,
 	}
 }
 
+/** Called by the I/O thread whenever a new record arrives for an
+ * object. Filters the record and adds it to the object's pose_ring.
 
-/** A callback function that will get called whenever the tracker
- * provides us with new data. This may be called repeatedly for each
- * record that we have missed if many records have been delivered
- * since the last call to the VRPN mainloop() function. */
-static void VRPN_CALLBACK handle_tracker(void *name, vrpn_TRACKERCB t)
+    @param microseconds The time the record was measured according to
+    the tracking system.
+*/
+static void vrpn_add_record(TrackedObject *to, float pos[3], float quat[4], long microseconds)
 {
-	std::string s = (char*)name;
-	TrackedObject *tracked = nameToTracker[s];
-		
-	float fps = kuhl_getfps(&(tracked->fps_state));
-	if(tracked->fps_state.frame == 0)
-		msg(MSG_INFO, "VRPN records per second: %.1f (%s)\n", fps, s.c_str());
+	float fps = kuhl_getfps(&(to->fps_state));
+	if(to->fps_state.frame == 0)
+		msg(MSG_INFO, "VRPN records per second: %.1f (%s)\n", fps, to->fullname);
 
-	/* Some tracking systems return large values when a point gets
-	 * lost. If the tracked point seems to be lost, ignore this
-	 * update. */
-	float pos[3], quat[4];
-	vec3f_set(pos, t.pos[0], t.pos[1], t.pos[2]);
-	vec4f_set(quat, t.quat[0], t.quat[1], t.quat[2], t.quat[3]);
-
-	if(tracked->hasData)
-		vrpn_sanity_check(tracked->data.msg_time, t.msg_time, (char*)name);
+	if(to->lastMsgTime >= 0)
+		vrpn_sanity_check(to->lastMsgTime, microseconds, to->fullname);
+	to->lastMsgTime = microseconds;
 
 	if(0)
 	{
-		long microseconds = (t.msg_time.tv_sec* 1000000L) + t.msg_time.tv_usec;
 		printf("Current time %ld; VRPN record time: %ld\n", kuhl_microseconds(), microseconds);
 		printf("Received position from vrpn: ");
 		vec3f_print(pos);
 		printf("Received quat from vrpn: ");
 		vec4f_print(quat);
 	}
-	
+
+	/* Some tracking systems return large values when a point gets
+	 * lost. If the tracked point seems to be lost, ignore this
+	 * update. */
 	if(vec3f_norm(pos) > 100)
 		return;
-	
-	// Store the data so we can use it later.
-	tracked->data = t;
-	smooth(tracked);
-	tracked->hasData = 1;
+
+	if(__atomic_load_n(&to->smooth, __ATOMIC_RELAXED))
+	{
+		/* The filter only has room for the objects that existed
+		 * when it was last grown. */
+		if(to->handle >= filter->numObjects &&
+		   !kalman_batch_resize(filter, __atomic_load_n(&trackedCount, __ATOMIC_ACQUIRE)))
+		{
+			msg(MSG_FATAL, "Unable to allocate memory to filter '%s'", to->fullname);
+			exit(EXIT_FAILURE);
+		}
+
+		/* Records are filtered in batches by vrpn_filter_run(). If
+		 * a record from this object is already waiting, filter it
+		 * first. */
+		if(!kalman_batch_set(filter, to->handle, pos, quat, microseconds))
+		{
+			vrpn_filter_run();
+			kalman_batch_set(filter, to->handle, pos, quat, microseconds);
+		}
+		to->filterPending = 1;
+		return;
+	}
+
+	pose_sample s;
+	s.usec = kuhl_microseconds();
+	vec3f_copy(s.pos, pos);
+	vec4f_copy(s.quat, quat);
+	s.hasVelocity = 0;
+	pose_ring_add(to->ring, &s);
 }
 
-/** Establish a VRPN connection to a specified host.
+#ifndef MISSING_VRPN
+
+/** A callback function that will get called whenever the tracker
+ * provides us with new data. This may be called repeatedly for each
+ * record that we have missed if many records have been delivered
+ * since the last call to the VRPN mainloop() function. */
+static void VRPN_CALLBACK handle_tracker(void *data, vrpn_TRACKERCB t)
+{
+	TrackedObject *to = (TrackedObject*) data;
+	float pos[3], quat[4];
+	vec3f_set(pos, t.pos[0], t.pos[1], t.pos[2]);
+	vec4f_set(quat, t.quat[0], t.quat[1], t.quat[2], t.quat[3]);
+	long microseconds = (t.msg_time.tv_sec* 1000000L) + t.msg_time.tv_usec;
+	vrpn_add_record(to, pos, quat, microseconds);
+}
 
-    @param fullname A string containing either the hostname or
-    something in the format of object\@hostname.
+/** Establish a VRPN connection for an object. Called by the I/O
+    thread.
 
     @return Returns 0 if connection failed, 1 otherwise.
  */
-static int vrpn_connect(const char *fullname)
+static int vrpn_connect(TrackedObject *to)
 {
+	const char *fullname = to->fullname;
 	msg(MSG_INFO, "Connecting to VRPN server to track '%s'\n", fullname);
 
 	/* If we are making a TCP connection and the server isn't up, the
@@ -160,88 +241,145 @@ static int vrpn_connect(const char *fullname)
 
 	/* Create a vrpn_Tracker_Remove object, register the callback function. */
 	vrpn_Tracker_Remote *tkr = new vrpn_Tracker_Remote(fullname, connection);
-	tkr->register_change_handler((void*) strdup(fullname), handle_tracker);
-
-	/* Store all of the information we will need later about this tracked object */
-	TrackedObject *to = (TrackedObject*) malloc(sizeof(TrackedObject));
+	tkr->register_change_handler((void*) to, handle_tracker);
 	to->tracker = tkr;
-	to->hasData = 0;
-	to->failCount = 0;
-	kuhl_getfps_init(&(to->fps_state));
-
-	/* Initialize kalman filter */
-	for(int i=0; i<3; i++) /* position */
-		kalman_initialize(&(to->kalman[i]), 0.00004f, 0.01f);
-	for(int i=3; i<7; i++) /* orientation */
-		kalman_initialize(&(to->kalman[i]), 0.0001f, 0.01f);
-		
-	nameToTracker[std::string(fullname)] = to;
 	return 1;
 }
+#endif // ifndef MISSING_VRPN
 
-/** Retrieves the latest information from a VRPN connection and stores
-    it in an appropriate TrackerObject.
-
- @param fullname A string in the format object\@hostname.
-
- @param pos An array to store the resulting position data.
-
- @param orient A matrix to store the resulting orientation data.
+/** Returns the time (relative to the beginning of the recording) that
+ * a record from a TDL file should be replayed at. */
+static long vrpn_replay_offset(const TrackedObject *to, size_t index)
+{
+	const tdl_log *log = to->replayLog;
+	if(!log->hasTimestamps) // version 1 files
+		return (long) index * to->replayPeriod;
+	return (long) (log->records[index].usec - log->records[0].usec);
+}
 
- @return Returns 1 on success; 0 on failure.
-*/
-static int vrpn_update(const char *fullname, float pos[3], float orient[16])
+/** Adds records from a TDL file to the object's pose_ring at the times
+ * they were recorded. Starts over at the beginning of the file when
+ * the end is reached. Called by the I/O thread. */
+static void vrpn_replay(TrackedObject *to, long now)
 {
-	TrackedObject *to = nameToTracker[fullname];
-	if(to == NULL)
+	if(to->replayLog == NULL)
 	{
-		msg(MSG_FATAL, "vrpn_update() was called before vrpn_connect() was called for object '%s'", fullname);
-		return 0;
+		if(now < to->retryTime)
+			return;
+		const char *filename = strstr(to->fullname, VRPN_REPLAY_PREFIX) + strlen(VRPN_REPLAY_PREFIX);
+		to->replayLog = tdl_open(filename);
+		if(to->replayLog == NULL || to->replayLog->count == 0)
+		{
+			msg(MSG_ERROR, "Unable to replay tracker data from TDL file '%s'", filename);
+			tdl_close(to->replayLog);
+			to->replayLog = NULL;
+			to->retryTime = now + VRPN_RETRY_USEC;
+			return;
+		}
+		if(to->replayLog->hasTimestamps)
+			msg(MSG_INFO, "Replaying object '%s' from '%s' (%lu records, %.1f seconds)", to->replayLog->name, filename,
+			    (unsigned long) to->replayLog->count, vrpn_replay_offset(to, to->replayLog->count-1) / 1000000.0);
+		else
+			msg(MSG_INFO, "Replaying object '%s' from '%s' at %ld records per second", to->replayLog->name, filename, 1000000/to->replayPeriod);
+		to->replayIndex = 0;
+		to->replayStart = now;
 	}
-		
-	/* If we already have a tracker object, ask it to run the main
-	 * loop (and therefore call our handle_tracker() function if
-	 * there is new data). */
-	to->tracker->mainloop();
 
-	if(to->hasData == 0) /* If mainloop() called our callback, hasData should be 1 */
+	const tdl_log *log = to->replayLog;
+	long when = to->replayStart + vrpn_replay_offset(to, to->replayIndex);
+
+	/* If we were stalled for a long time, don't try to catch up. */
+	if(now - when > 1000000)
 	{
-		const static int maxmessages = 4;  /** How many times should error messages be displayed */
-		const static int messagemod = 500; /** How many times does vrpn_get() get called before message is printed */
+		to->replayStart += now - when;
+		when = now;
+	}
 
-		/* Don't repeatedly print messages about this */
-		if(to->failCount >= maxmessages*messagemod)
-			return 0;
+	while(when <= now)
+	{
+		const tdl_record *r = &log->records[to->replayIndex];
+		float pos[3], quat[4];
+		vec3f_copy(pos, r->pos);
+		vec4f_copy(quat, r->quat);
+		vrpn_add_record(to, pos, quat, when);
+
+		to->replayIndex++;
+		if(to->replayIndex == log->count) // end of file, start over.
+		{
+			/* Wait an average record period before starting over. */
+			long period = to->replayPeriod;
+			if(log->hasTimestamps && log->count > 1)
+				period = vrpn_replay_offset(to, log->count-1) / (long) (log->count-1);
+			to->replayStart = when + (period > 0 ? period : to->replayPeriod);
+			to->replayIndex = 0;
+		}
+		when = to->replayStart + vrpn_replay_offset(to, to->replayIndex);
+	}
+}
 
-		/* If our callback never seems to get called for this
-		 * object, print a warning message about it */
-		to->failCount++;
-		if(to->failCount % messagemod == 0)
+/** Services all of the tracked objects until vrpn_io_stop() is
+ * called. */
+static void* vrpn_io_thread(void *arg)
+{
+	(void) arg;
+	while(!__atomic_load_n(&ioThreadQuit, __ATOMIC_ACQUIRE))
+	{
+		int count = __atomic_load_n(&trackedCount, __ATOMIC_ACQUIRE);
+		long now = kuhl_microseconds();
+		for(int i=0; i<count; i++)
 		{
-			msg(MSG_WARNING, "VRPN has not received any data for %s", fullname);
-			msg(MSG_WARNING, "As a result, you may see VRPN messages about receiving no response from server.");
-			if(to->failCount == messagemod*maxmessages)
-				msg(MSG_WARNING, "This is your last message about %s", fullname);
+			TrackedObject *to = trackedObjects[i];
+			if(to->isReplay)
+			{
+				vrpn_replay(to, now);
+				continue;
+			}
+#ifndef MISSING_VRPN
+			if(to->tracker == NULL)
+			{
+				if(now < to->retryTime)
+					continue;
+				if(!vrpn_connect(to))
+				{
+					to->retryTime = kuhl_microseconds() + VRPN_RETRY_USEC;
+					continue;
+				}
+			}
+			/* Calls handle_tracker() for each record that has
+			 * arrived since the last call. */
+			to->tracker->mainloop();
+#endif
 		}
 
-		return 0;
+		/* Filter all of the records we just received at once. */
+		for(int i=0; i<count; i++)
+		{
+			if(trackedObjects[i]->filterPending)
+			{
+				vrpn_filter_run();
+				break;
+			}
+		}
+		usleep(VRPN_IO_SLEEP_USEC);
 	}
+	return NULL;
+}
 
-	/* If we get to here, to->hasData indicates that the VRPN callback
-	 * has been called at least once and we have therefore received some data. */
-	to->failCount = 0;
-		
-	vrpn_TRACKERCB t = to->data;
-	float pos4[4];
-	for(int i=0; i<3; i++)
-		pos4[i] = t.pos[i];
-	pos4[3]=1;
-
-	double orientd[16];
+static void vrpn_io_stop(void)
+{
+	if(!ioThreadStarted)
+		return;
+	__atomic_store_n(&ioThreadQuit, 1, __ATOMIC_RELEASE);
+	pthread_join(ioThread, NULL);
+	ioThreadStarted = 0;
+}
+
+/** Converts a pose from the tracking system into the OpenGL
+ * convention. */
+static void vrpn_sample_to_matrix(const TrackedObject *to, const pose_sample *s, float pos[3], float orient[16])
+{
 	// Convert quaternion into orientation matrix.
-	q_to_ogl_matrix(orientd, t.quat);
-	for(int i=0; i<16; i++)
-		orient[i] = (float) orientd[i];
+	mat4f_rotateQuatVec_new(orient, s->quat);
 
 	/* VICON in the MTU IVS lab is typically calibrated so that:
 	 * X = points to the right (while facing screen)
@@ -264,29 +402,43 @@ static int vrpn_update(const char *fullname, float pos[3], float orient[16])
 	 * Below, we convert the position and orientation
 	 * information into the OpenGL convention.
 	 */
-	if(vrpn_is_vicon(fullname)) // MTU vicon tracker
+	if(to->isVicon) // MTU vicon tracker
 	{
 		float viconTransform[16] = { 1,0,0,0,  // column major order!
 		                             0,0,-1,0,
 		                             0,1,0,0,
 		                             0,0,0,1 };
+		float pos4[4] = { s->pos[0], s->pos[1], s->pos[2], 1 };
 		mat4f_mult_mat4f_new(orient, viconTransform, orient);
 		mat4f_mult_vec4f_new(pos4, viconTransform, pos4);
-		vec3f_copy(pos,pos4);
-		return 1; // we successfully collected some data
+		vec3f_copy(pos, pos4);
 	}
 	else // Non-Vicon tracker
 	{
 		/* Don't transform other tracking systems */
-		// orient is already filled in
-		vec3f_copy(pos, pos4);
-		return 1; // we successfully collected some data
+		vec3f_copy(pos, s->pos);
 	}
 }
 
+/** Prints warnings if an object has never received any data. */
+static void vrpn_no_data(TrackedObject *to)
+{
+	const static int maxmessages = 4;  /** How many times should error messages be displayed */
+	const static int messagemod = 500; /** How many times does vrpn_get() get called before message is printed */
 
+	/* Don't repeatedly print messages about this */
+	if(to->failCount >= maxmessages*messagemod)
+		return;
 
-#endif // ifndef MISSING_VRPN
+	to->failCount++;
+	if(to->failCount % messagemod == 0)
+	{
+		msg(MSG_WARNING, "VRPN has not received any data for %s", to->fullname);
+		msg(MSG_WARNING, "As a result, you may see VRPN messages about receiving no response from server.");
+		if(to->failCount == messagemod*maxmessages)
+			msg(MSG_WARNING, "This is your last message about %s", to->fullname);
+	}
+}
 
 extern "C" {
 
@@ -359,8 +511,212 @@ void vrpn_fullname(const char* object, const char* hostname, char result[256])
 
 	
 
+/** Starts tracking an object. The first time this is called for an
+    object, a background thread starts connecting to the tracking
+    system. Calling this function again for the same object returns
+    the same handle. This function and the other vrpn_get functions
+    should only be called by one thread.
+
+    If the hostname starts with "replay:", the rest of the hostname is
+    the name of a TDL file (see vrpn/recorder.c) which will be played
+    back in a loop instead of connecting to a VRPN server. Records are
+    played back at the times they were recorded. Version 1 TDL files
+    don't contain timestamps; their rate can be set with the
+    vrpn.replay.hz configuration variable (default 100).
+
+    @param object The name of the object being tracked.
+
+    @param hostname The IP address or hostname of the VRPN server. If
+    NULL, the vrpn.server configuration variable is used.
+
+    @return A handle which can be passed to vrpn_get_handle() or -1
+    on failure.
+ */
+int vrpn_open(const char *object, const char *hostname)
+{
+	/* Combine object and hostname into 'object@hostname'. Also, find
+	 * default hostname if it is NULL. */
+	char fullname[256];
+	vrpn_fullname(object, hostname, fullname);
+
+	std::map<std::string, int>::iterator it = nameToHandle.find(fullname);
+	if(it != nameToHandle.end())
+		return it->second;
+
+	int handle = __atomic_load_n(&trackedCount, __ATOMIC_RELAXED);
+	if(handle >= VRPN_MAX_OBJECTS)
+	{
+		msg(MSG_ERROR, "Unable to track more than %d objects; ignoring '%s'", VRPN_MAX_OBJECTS, fullname);
+		return -1;
+	}
+
+	TrackedObject *to = (TrackedObject*) calloc(1, sizeof(TrackedObject));
+	snprintf(to->fullname, 256, "%s", fullname);
+	to->handle = handle;
+	to->isReplay = strstr(fullname, "@" VRPN_REPLAY_PREFIX) != NULL;
+	to->isVicon = vrpn_is_vicon(fullname);
+	to->ring = pose_ring_new(VRPN_RING_SIZE);
+	to->smooth = 1;
+	to->lastMsgTime = -1;
+	pose_predict_stats_init(&(to->predictStats));
+	kuhl_getfps_init(&(to->fps_state));
+	int hz = kuhl_config_int("vrpn.replay.hz", 100, 100);
+	to->replayPeriod = 1000000 / (hz > 0 ? hz : 100);
+
+	/* Initialize kalman filter. The orientation settings correspond
+	 * to the settings which were previously used to filter each
+	 * quaternion component (a rotation angle is approximately twice
+	 * the change in the quaternion components). */
+	if(filter == NULL)
+		filter = kalman_batch_new(1, 0.00004f, 0.01f, 0.0002f, 0.04f);
+
+#ifdef MISSING_VRPN
+	if(!to->isReplay)
+		msg(MSG_ERROR, "You are missing VRPN support; unable to track '%s'.\n", fullname);
+#endif
+
+	/* Make the object visible to the I/O thread. */
+	trackedObjects[handle] = to;
+	__atomic_store_n(&trackedCount, handle+1, __ATOMIC_RELEASE);
+	nameToHandle[std::string(fullname)] = handle;
+
+	if(!ioThreadStarted)
+	{
+		if(pthread_create(&ioThread, NULL, vrpn_io_thread, NULL) != 0)
+		{
+			msg(MSG_FATAL, "Unable to create tracker I/O thread");
+			exit(EXIT_FAILURE);
+		}
+		ioThreadStarted = 1;
+		atexit(vrpn_io_stop);
+	}
+	return handle;
+}
+
+/** Gets the newest position and orientation of an object. See
+    vrpn_get() for more information.
+
+    @param handle A handle from vrpn_open().
+
+    @return 1 if we returned data from the tracker. 0 if no data has
+    been received yet.
+*/
+int vrpn_get_handle(int handle, float pos[3], float orient[16])
+{
+	/* Set to default values */
+	vec3f_set(pos, 10000,10000,10000);
+	mat4f_identity(orient);
+	if(handle < 0 || handle >= trackedCount)
+		return 0;
+
+	TrackedObject *to = trackedObjects[handle];
+	pose_sample s;
+	if(!pose_ring_newest(to->ring, &s))
+	{
+		vrpn_no_data(to);
+		return 0;
+	}
+	to->failCount = 0;
+	vrpn_sample_to_matrix(to, &s, pos, orient);
+	return 1;
+}
+
+/** Estimates the position and orientation of an object at a specific
+    time by interpolating between the records received from the
+    tracking system. If the time is newer than the newest record, the
+    newest record is returned. See vrpn_get() for more information.
+
+    @param handle A handle from vrpn_open().
+
+    @param usec The time in microseconds (see kuhl_microseconds()).
+
+    @return 1 if we returned data from the tracker. 0 if no data has
+    been received yet.
+*/
+int vrpn_get_handle_at(int handle, long usec, float pos[3], float orient[16])
+{
+	vec3f_set(pos, 10000,10000,10000);
+	mat4f_identity(orient);
+	if(handle < 0 || handle >= trackedCount)
+		return 0;
+
+	TrackedObject *to = trackedObjects[handle];
+	pose_sample s;
+	if(!pose_ring_at(to->ring, usec, &s))
+	{
+		vrpn_no_data(to);
+		return 0;
+	}
+	to->failCount = 0;
+	vrpn_sample_to_matrix(to, &s, pos, orient);
+	return 1;
+}
+
+/** Predicts the position and orientation of an object at a time in
+    the future, typically the time returned by
+    bufferswap_predict_display_time(). The prediction uses the
+    velocity estimated by the Kalman filter. The accuracy of the
+    predictions is tracked and can be retrieved with
+    vrpn_get_prediction_stats().
+
+    @param handle A handle from vrpn_open().
+
+    @param usec The time in microseconds (see kuhl_microseconds()).
+
+    @return 1 if we returned data from the tracker. 0 if no data has
+    been received yet.
+*/
+int vrpn_get_handle_predicted(int handle, long usec, float pos[3], float orient[16])
+{
+	vec3f_set(pos, 10000,10000,10000);
+	mat4f_identity(orient);
+	if(handle < 0 || handle >= trackedCount)
+		return 0;
+
+	TrackedObject *to = trackedObjects[handle];
+	pose_sample newest, predicted;
+	if(!pose_ring_newest(to->ring, &newest) ||
+	   !pose_ring_predict(to->ring, usec, &predicted))
+	{
+		vrpn_no_data(to);
+		return 0;
+	}
+	to->failCount = 0;
+
+	pose_predict_stats *stats = &(to->predictStats);
+	pose_predict_stats_update(stats, to->ring);
+	if(predicted.usec > newest.usec)
+		pose_predict_stats_add(stats, &predicted, &newest);
+	if(stats->count - to->predictStatsPrinted >= 1000)
+	{
+		pose_predict_stats_print(stats, to->fullname);
+		to->predictStatsPrinted = stats->count;
+	}
+
+	vrpn_sample_to_matrix(to, &predicted, pos, orient);
+	return 1;
+}
+
+/** Retrieves information about how accurate the predictions made by
+    vrpn_get_handle_predicted() were. Errors are measured in the
+    tracking system's coordinate system.
+
+    @return 1 on success, 0 if the handle is invalid.
+*/
+int vrpn_get_prediction_stats(int handle, pose_predict_stats *stats)
+{
+	if(handle < 0 || handle >= trackedCount)
+		return 0;
+	TrackedObject *to = trackedObjects[handle];
+	pose_predict_stats_update(&(to->predictStats), to->ring);
+	*stats = to->predictStats;
+	return 1;
+}
+
 /** Uses the VRPN library to get the position and orientation of a
- * tracked object.
+ * tracked object. Programs that call this function every frame can
+ * avoid looking up the object by name each time by calling
+ * vrpn_open() once and vrpn_get_handle() every frame instead.
  *
  * @param object The name of the object being tracked.
  *
@@ -386,26 +742,7 @@ void vrpn_fullname(const char* object, const char* hostname, char result[256])
  */
 int vrpn_get(const char *object, const char *hostname, float pos[3], float orient[16])
 {
-	/* Set to default values */
-	vec3f_set(pos, 10000,10000,10000);
-	mat4f_identity(orient);
-#ifdef MISSING_VRPN
-	msg(MSG_ERROR, "You are missing VRPN support.\n");
-	return 0;
-#else
-
-	/* Combine object and hostname into 'object@hostname'. Also, find
-	 * default hostname if it is NULL. */
-	char fullname[256];
-	vrpn_fullname(object, hostname, fullname);
-
-	/* Check if we have a tracker object for that string in our map. */
-	if(nameToTracker.count(fullname))
-		return vrpn_update(fullname, pos, orient);
-	else
-		return vrpn_connect(fullname);
-
-#endif
+	return vrpn_get_handle(vrpn_open(object, hostname), pos, orient);
 }
 
 /** Gets a set of records from VRPN before they are processed. This is
@@ -426,42 +763,44 @@ int vrpn_get(const char *object, const char *hostname, float pos[3], float orien
  */
 float* vrpn_get_raw(const char *object, const char *hostname, int count)
 {
-#ifdef MISSING_VRPN
-	msg(MSG_ERROR, "You are missing VRPN support.\n");
-	return 0;
-#else
-
-	/* Make sure we are connected */
-	float pos[4], orient[16];
-	vrpn_get(object, hostname, pos, orient);
-
-	char fullname[256];
-	vrpn_fullname(object, hostname, fullname);
-
-	TrackedObject *to = nameToTracker[std::string(fullname)];
+	int handle = vrpn_open(object, hostname);
+	if(handle < 0)
+		return NULL;
+	TrackedObject *to = trackedObjects[handle];
 
 	/* Disable kalman filtering */
-	for(int i = 0; i<7; i++)
-		to->kalman[i].isEnabled = 0;
+	__atomic_store_n(&to->smooth, 0, __ATOMIC_RELAXED);
 	
 	float *data = (float*) malloc(sizeof(float)*7*count);
 
-	for(int i=0; i<count; i++)
+	/* Skip records that may have been filtered. */
+	size_t next = pose_ring_count(to->ring)+1;
+	for(int i=0; i<count; )
 	{
-		while(to->hasData == 0)
-			to->tracker->mainloop();
-		to->hasData = 0;
-
-		data[i*7+0] = to->data.pos[0];
-		data[i*7+1] = to->data.pos[1];
-		data[i*7+2] = to->data.pos[2];
-		data[i*7+3] = to->data.quat[0];
-		data[i*7+4] = to->data.quat[1];
-		data[i*7+5] = to->data.quat[2];
-		data[i*7+6] = to->data.quat[3];
+		pose_sample s;
+		if(next >= pose_ring_count(to->ring))
+		{
+			usleep(VRPN_IO_SLEEP_USEC);
+			continue;
+		}
+		if(!pose_ring_get(to->ring, next, &s))
+		{
+			msg(MSG_WARNING, "Record %lu from %s was overwritten before we could read it", (unsigned long) next, to->fullname);
+			next = pose_ring_count(to->ring)-1;
+			continue;
+		}
+		next++;
+
+		data[i*7+0] = s.pos[0];
+		data[i*7+1] = s.pos[1];
+		data[i*7+2] = s.pos[2];
+		data[i*7+3] = s.quat[0];
+		data[i*7+4] = s.quat[1];
+		data[i*7+5] = s.quat[2];
+		data[i*7+6] = s.quat[3];
+		i++;
 	}
 	return data;
-#endif
 }
 	
 
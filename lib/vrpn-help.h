@@ -10,6 +10,10 @@
  * the position and orientation of a tracked point from a VRPN
  * server. The VRPN library itself uses C++.
  *
+ * Tracker data is received on a background thread. Recorded TDL
+ * files can be replayed in place of a VRPN server by using a hostname
+ * of the form "replay:filename.tdl".
+ *
  * For more information about VRPN, see:
  * http://www.cs.unc.edu/Research/vrpn/
  *
@@ -18,11 +22,18 @@
  */
 
 #pragma once
+#include "posering.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int vrpn_get(const char *object, const char *hostname, float pos[3], float orient[16]);
+int vrpn_open(const char *object, const char *hostname);
+int vrpn_get_handle(int handle, float pos[3], float orient[16]);
+int vrpn_get_handle_at(int handle, long usec, float pos[3], float orient[16]);
+int vrpn_get_handle_predicted(int handle, long usec, float pos[3], float orient[16]);
+int vrpn_get_prediction_stats(int handle, pose_predict_stats *stats);
 const char* vrpn_default_host(void);
 int vrpn_is_vicon(const char *hostname);
 float* vrpn_get_raw(const char *name, const char *host, int count);
@@ -77,6 +77,97 @@ void usleep(DWORD waitTime) {
 	} while ((now.QuadPart - start.QuadPart) / (float)(perfCnt.QuadPart) * 1000 * 1000 < waitTime);
 }
 
+#ifdef _MSC_VER
+#include <stdlib.h>
+#include <errno.h>
+#include <process.h>
+#include "windows-compat.h"
+
+struct pthread_start
+{
+	void *(*func)(void*);
+	void *arg;
+};
+
+static unsigned __stdcall pthread_start_routine(void *data)
+{
+	struct pthread_start start = *(struct pthread_start*) data;
+	free(data);
+	start.func(start.arg);
+	return 0;
+}
+
+int pthread_create(pthread_t *thread, const void *attr, void *(*func)(void*), void *arg)
+{
+	struct pthread_start *start = (struct pthread_start*) malloc(sizeof(struct pthread_start));
+	if(start == NULL)
+		return ENOMEM;
+	start->func = func;
+	start->arg = arg;
+	uintptr_t handle = _beginthreadex(NULL, 0, pthread_start_routine, start, 0, NULL);
+	if(handle == 0)
+	{
+		free(start);
+		return EAGAIN;
+	}
+	*thread = (HANDLE) handle;
+	return 0;
+}
+
+/* The value returned by the thread function is not kept. */
+int pthread_join(pthread_t thread, void **retval)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	if(retval)
+		*retval = NULL;
+	return 0;
+}
+
+long long kuhl_atomic_load(const volatile void *ptr, size_t size)
+{
+	/* Aligned 4 byte loads are atomic, and Visual Studio gives
+	 * volatile loads acquire semantics. */
+	if(size == 4)
+		return *(const volatile LONG*) ptr;
+	return InterlockedCompareExchange64((volatile LONG64*) ptr, 0, 0);
+}
+
+void kuhl_atomic_store(volatile void *ptr, long long val, size_t size)
+{
+	if(size == 4)
+		InterlockedExchange((volatile LONG*) ptr, (LONG) val);
+	else
+		InterlockedExchange64((volatile LONG64*) ptr, val);
+}
+
+long long kuhl_atomic_add_fetch(volatile void *ptr, long long val, size_t size)
+{
+	if(size == 4)
+		return InterlockedExchangeAdd((volatile LONG*) ptr, (LONG) val) + (LONG) val;
+	return InterlockedExchangeAdd64((volatile LONG64*) ptr, val) + val;
+}
+
+int kuhl_atomic_compare_exchange(volatile void *ptr, void *expected, long long desired, size_t size)
+{
+	if(size == 4)
+	{
+		LONG e = *(LONG*) expected;
+		LONG old = InterlockedCompareExchange((volatile LONG*) ptr, (LONG) desired, e);
+		if(old == e)
+			return 1;
+		*(LONG*) expected = old;
+		return 0;
+	}
+	LONG64 e = *(LONG64*) expected;
+	LONG64 old = InterlockedCompareExchange64((volatile LONG64*) ptr, desired, e);
+	if(old == e)
+		return 1;
+	*(LONG64*) expected = old;
+	return 0;
+}
+#endif // end if _MSC_VER
+
 #else
 
 #error You do not seem to be using Windows. If you are not using windows, do not compile windows-compat.c into the library.
@@ -29,4 +29,66 @@ extern "C" {
 /* strtok_r() on Unix is named strtok_s() on Windows */
 #define strtok_r strtok_s
 
+/* Visual Studio doesn't provide pthreads or the GCC/Clang __atomic
+ * builtins (MinGW provides both). The threads used by libkuhl only
+ * need the small subset of them below. */
+#ifdef _MSC_VER
+#include <stddef.h>
+
+typedef HANDLE pthread_t;
+typedef SRWLOCK pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
+#define PTHREAD_MUTEX_INITIALIZER SRWLOCK_INIT
+#define PTHREAD_COND_INITIALIZER CONDITION_VARIABLE_INIT
+
+static __inline int pthread_mutex_init(pthread_mutex_t *m, const void *attr) { InitializeSRWLock(m); return 0; }
+static __inline int pthread_mutex_destroy(pthread_mutex_t *m) { return 0; }
+static __inline int pthread_mutex_lock(pthread_mutex_t *m)    { AcquireSRWLockExclusive(m); return 0; }
+static __inline int pthread_mutex_unlock(pthread_mutex_t *m)  { ReleaseSRWLockExclusive(m); return 0; }
+static __inline int pthread_cond_init(pthread_cond_t *c, const void *attr) { InitializeConditionVariable(c); return 0; }
+static __inline int pthread_cond_destroy(pthread_cond_t *c)   { return 0; }
+static __inline int pthread_cond_signal(pthread_cond_t *c)    { WakeConditionVariable(c); return 0; }
+static __inline int pthread_cond_broadcast(pthread_cond_t *c) { WakeAllConditionVariable(c); return 0; }
+static __inline int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+	return SleepConditionVariableSRW(c, m, INFINITE, 0) ? 0 : -1;
+}
+
+/* Only 4 and 8 byte values are supported. The memory order is
+ * ignored; every operation is at least as strong as requested. */
+#define __ATOMIC_RELAXED 0
+#define __ATOMIC_CONSUME 1
+#define __ATOMIC_ACQUIRE 2
+#define __ATOMIC_RELEASE 3
+#define __ATOMIC_ACQ_REL 4
+#define __ATOMIC_SEQ_CST 5
+
+#define __atomic_load_n(ptr, order) \
+	kuhl_atomic_load((ptr), sizeof(*(ptr)))
+#define __atomic_store_n(ptr, val, order) \
+	kuhl_atomic_store((ptr), (long long) (val), sizeof(*(ptr)))
+#define __atomic_add_fetch(ptr, val, order) \
+	kuhl_atomic_add_fetch((ptr), (long long) (val), sizeof(*(ptr)))
+#define __atomic_compare_exchange_n(ptr, expected, desired, weak, success, failure) \
+	kuhl_atomic_compare_exchange((ptr), (expected), (long long) (desired), sizeof(*(ptr)))
+#define __atomic_thread_fence(order) MemoryBarrier()
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	int pthread_create(pthread_t *thread, const void *attr, void *(*func)(void*), void *arg);
+	int pthread_join(pthread_t thread, void **retval);
+
+	long long kuhl_atomic_load(const volatile void *ptr, size_t size);
+	void kuhl_atomic_store(volatile void *ptr, long long val, size_t size);
+	long long kuhl_atomic_add_fetch(volatile void *ptr, long long val, size_t size);
+	int kuhl_atomic_compare_exchange(volatile void *ptr, void *expected, long long desired, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // end if _MSC_VER
+
 #endif  // end if windows
@@ -0,0 +1,413 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/**
+   @file
+
+   Streams the cells of an endless grid around a viewer. Programs
+   such as infinicity which generate an endless world use this to
+   keep the cells within a radius of the viewer generated without
+   ever generating content on the render thread.
+
+   The grid lies in the XZ plane. Cell (x,z) is centered at
+   (x*cellSize, 0, z*cellSize). Each cell holds a fixed-size block of
+   data which a callback fills in on a background worker thread. The
+   data is deterministic: The callback receives a seed computed from
+   the cell coordinates, so a cell contains the same data every time
+   it is generated, no matter which order cells are generated in or
+   how many times the viewer leaves and returns.
+
+   The data for all cells is stored in a fixed number of "slots"
+   which are allocated once by world_grid_new() and are recycled as
+   the viewer moves---nothing is allocated while the program runs. A
+   program that keeps per-cell OpenGL resources should keep one set
+   per slot and refill it when world_grid_get() reports that the slot
+   has changed.
+
+   Each frame, the render thread calls world_grid_update() with the
+   viewer position and then uses world_grid_get() to find the cells
+   that are ready. Cells are generated nearest-first, so cells that
+   are still being generated are at the edge of the grid.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _MSC_VER
+#include "windows-compat.h" // pthreads on Visual Studio
+#else
+#include <pthread.h>
+#endif
+
+#include "world-grid.h"
+#include "msg.h"
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_GENERATING, SLOT_READY };
+
+typedef struct {
+	int64_t x, z;        /**< Cell stored in this slot */
+	int state;           /**< SLOT_* (protected by lock) */
+	int discard;         /**< Release the slot when generation finishes (protected by lock) */
+	int changed;         /**< Set when generated, cleared by world_grid_get() */
+	int visible;         /**< Ready at the last world_grid_update() (render thread only) */
+	unsigned char *data;
+} world_grid_slot;
+
+struct world_grid {
+	double cellSize;
+	int radius;
+	uint64_t seed;
+	world_grid_func generate;
+	void *userdata;
+
+	world_grid_slot *slots;
+	int numSlots;
+	unsigned char *data; /**< Data for all slots */
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /**< Signaled when cells are queued or the thread should quit */
+	pthread_cond_t done; /**< Signaled when a cell has been generated */
+
+	/* Protected by lock. */
+	int64_t centerX, centerZ;
+	int hasCenter;
+	int quit;
+};
+
+/** Returns the distance between a slot's cell and the center of the
+ * grid (in cells). */
+static int64_t world_grid_distance(const world_grid *g, const world_grid_slot *s)
+{
+	int64_t dx = llabs(s->x - g->centerX);
+	int64_t dz = llabs(s->z - g->centerZ);
+	return dx > dz ? dx : dz;
+}
+
+static void* world_grid_thread(void *arg)
+{
+	world_grid *g = (world_grid*) arg;
+	pthread_mutex_lock(&g->lock);
+	while(!g->quit)
+	{
+		/* Find the queued cell closest to the viewer. */
+		world_grid_slot *s = NULL;
+		int64_t bestDist = INT64_MAX;
+		for(int i=0; i<g->numSlots; i++)
+		{
+			if(g->slots[i].state != SLOT_QUEUED)
+				continue;
+			int64_t dist = world_grid_distance(g, &g->slots[i]);
+			if(dist < bestDist)
+			{
+				bestDist = dist;
+				s = &g->slots[i];
+			}
+		}
+		if(s == NULL)
+		{
+			pthread_cond_wait(&g->wake, &g->lock);
+			continue;
+		}
+
+		/* The render thread doesn't touch slots that are being
+		 * generated, so we don't need the lock while generating. */
+		s->state = SLOT_GENERATING;
+		int64_t x = s->x, z = s->z;
+		pthread_mutex_unlock(&g->lock);
+		g->generate(s->data, x, z, world_grid_seed(g->seed, x, z), g->userdata);
+		pthread_mutex_lock(&g->lock);
+
+		if(s->discard)
+		{
+			s->state = SLOT_FREE;
+			s->discard = 0;
+		}
+		else
+		{
+			s->state = SLOT_READY;
+			s->changed = 1;
+		}
+		pthread_cond_broadcast(&g->done);
+	}
+	pthread_mutex_unlock(&g->lock);
+	return NULL;
+}
+
+/** Creates a new grid and starts its worker thread. No cells are
+ * generated until world_grid_update() is called.
+
+    @param cellSize The width of each (square) cell in world units.
+
+    @param radius The number of cells to keep around the cell the
+    viewer is in. The grid contains (2*radius+1)^2 cells.
+
+    @param dataSize The number of bytes of data stored for each cell.
+
+    @param seed Seed for the world. Cells are identical every time
+    they are generated with the same seed.
+
+    @param generate Function called on the worker thread to fill in
+    the data for a cell.
+
+    @param userdata Passed to generate.
+
+    @return A new grid. Free it with world_grid_free().
+*/
+world_grid* world_grid_new(double cellSize, int radius, size_t dataSize, uint64_t seed,
+                           world_grid_func generate, void *userdata)
+{
+	if(cellSize <= 0 || radius < 0 || generate == NULL)
+	{
+		msg(MSG_FATAL, "Invalid world grid: cell size %f, radius %d", cellSize, radius);
+		exit(EXIT_FAILURE);
+	}
+
+	world_grid *g = (world_grid*) calloc(1, sizeof(world_grid));
+	g->cellSize = cellSize;
+	g->radius = radius;
+	g->seed = seed;
+	g->generate = generate;
+	g->userdata = userdata;
+
+	/* One slot for each cell in the grid plus one for a cell that
+	 * the worker may still be generating after the viewer has moved
+	 * away from it. */
+	g->numSlots = (2*radius+1)*(2*radius+1) + 1;
+	if(dataSize == 0)
+		dataSize = 1;
+	g->slots = (world_grid_slot*) calloc((size_t) g->numSlots, sizeof(world_grid_slot));
+	g->data = (unsigned char*) calloc((size_t) g->numSlots, dataSize);
+	if(g->slots == NULL || g->data == NULL)
+	{
+		msg(MSG_FATAL, "Unable to allocate %d world grid cells of %lu bytes each.",
+		    g->numSlots, (unsigned long) dataSize);
+		exit(EXIT_FAILURE);
+	}
+	for(int i=0; i<g->numSlots; i++)
+		g->slots[i].data = g->data + (size_t) i*dataSize;
+
+	pthread_mutex_init(&g->lock, NULL);
+	pthread_cond_init(&g->wake, NULL);
+	pthread_cond_init(&g->done, NULL);
+	if(pthread_create(&g->thread, NULL, world_grid_thread, g) != 0)
+	{
+		msg(MSG_FATAL, "Unable to create world grid thread.");
+		exit(EXIT_FAILURE);
+	}
+	return g;
+}
+
+/** Stops the worker thread (after it finishes the cell it is
+ * generating) and frees the grid. */
+void world_grid_free(world_grid *g)
+{
+	if(g == NULL)
+		return;
+	pthread_mutex_lock(&g->lock);
+	g->quit = 1;
+	pthread_cond_signal(&g->wake);
+	pthread_mutex_unlock(&g->lock);
+	pthread_join(g->thread, NULL);
+
+	pthread_cond_destroy(&g->done);
+	pthread_cond_destroy(&g->wake);
+	pthread_mutex_destroy(&g->lock);
+	free(g->data);
+	free(g->slots);
+	free(g);
+}
+
+/** Updates which slots world_grid_get() will return. Must be called
+ * with the lock held. */
+static int world_grid_snapshot(world_grid *g)
+{
+	int ready = 0;
+	for(int i=0; i<g->numSlots; i++)
+	{
+		world_grid_slot *s = &g->slots[i];
+		s->visible = (s->state == SLOT_READY);
+		ready += s->visible;
+	}
+	return ready;
+}
+
+/** Moves the grid so that it is centered on the cell that the viewer
+ * is in. Cells that are no longer in the grid are released and cells
+ * that are new to the grid are queued to be generated. This function
+ * never waits for cells to be generated and should be called once
+ * per frame before world_grid_get().
+
+    @param g The grid.
+
+    @param viewerPos The position of the viewer in world coordinates
+    (the Y coordinate is ignored).
+
+    @return The number of cells that are ready to be drawn.
+*/
+int world_grid_update(world_grid *g, const double viewerPos[3])
+{
+	int64_t cx = (int64_t) floor(viewerPos[0]/g->cellSize + 0.5);
+	int64_t cz = (int64_t) floor(viewerPos[2]/g->cellSize + 0.5);
+	int r = g->radius;
+
+	pthread_mutex_lock(&g->lock);
+	if(!g->hasCenter || cx != g->centerX || cz != g->centerZ)
+	{
+		g->centerX = cx;
+		g->centerZ = cz;
+		g->hasCenter = 1;
+
+		/* Release cells which are outside of the grid. */
+		for(int i=0; i<g->numSlots; i++)
+		{
+			world_grid_slot *s = &g->slots[i];
+			if(s->state == SLOT_FREE || world_grid_distance(g, s) <= r)
+				continue;
+			if(s->state == SLOT_GENERATING)
+				s->discard = 1;
+			else
+				s->state = SLOT_FREE;
+		}
+
+		/* Queue cells which are new to the grid. */
+		int freeSlot = 0;
+		for(int64_t z=cz-r; z<=cz+r; z++)
+		{
+			for(int64_t x=cx-r; x<=cx+r; x++)
+			{
+				int found = 0;
+				for(int i=0; i<g->numSlots && !found; i++)
+				{
+					const world_grid_slot *s = &g->slots[i];
+					found = s->state != SLOT_FREE && !s->discard && s->x == x && s->z == z;
+				}
+				if(found)
+					continue;
+
+				while(g->slots[freeSlot].state != SLOT_FREE)
+					freeSlot++;
+				world_grid_slot *s = &g->slots[freeSlot];
+				s->x = x;
+				s->z = z;
+				s->state = SLOT_QUEUED;
+				s->discard = 0;
+			}
+		}
+		pthread_cond_signal(&g->wake);
+	}
+	int ready = world_grid_snapshot(g);
+	pthread_mutex_unlock(&g->lock);
+	return ready;
+}
+
+/** Waits until every cell in the grid has been generated. This is
+ * useful when a program starts so that the first frame isn't
+ * empty. Cells are then returned by world_grid_get() without calling
+ * world_grid_update() again. */
+void world_grid_wait(world_grid *g)
+{
+	pthread_mutex_lock(&g->lock);
+	for(;;)
+	{
+		int pending = 0;
+		for(int i=0; i<g->numSlots; i++)
+		{
+			const world_grid_slot *s = &g->slots[i];
+			if(s->state == SLOT_QUEUED || (s->state == SLOT_GENERATING && !s->discard))
+				pending = 1;
+		}
+		if(!pending)
+			break;
+		pthread_cond_wait(&g->done, &g->lock);
+	}
+	world_grid_snapshot(g);
+	pthread_mutex_unlock(&g->lock);
+}
+
+/** Returns the number of slots in the grid. Loop over the slots with
+ * world_grid_get() to find all of the cells which are ready. */
+int world_grid_slots(const world_grid *g)
+{
+	return g->numSlots;
+}
+
+/** Gets the data for a slot if the slot contained a generated cell
+ * at the last call to world_grid_update().
+
+    @param g The grid.
+
+    @param slot The slot number (0 to world_grid_slots()-1).
+
+    @param cell Filled in with the X and Z coordinates of the cell in
+    the slot. May be NULL.
+
+    @param changed If not NULL, set to 1 if the slot contains a
+    different cell than the last time world_grid_get() returned it
+    with a non-NULL changed parameter (or if the slot has never been
+    returned before) and 0 otherwise.
+
+    @return The data for the cell or NULL if the slot isn't ready. The
+    data remains valid until the next call to world_grid_update().
+*/
+const void* world_grid_get(world_grid *g, int slot, int64_t cell[2], int *changed)
+{
+	if(slot < 0 || slot >= g->numSlots || !g->slots[slot].visible)
+		return NULL;
+
+	/* The worker thread doesn't modify slots that are ready, so no
+	 * lock is needed. */
+	world_grid_slot *s = &g->slots[slot];
+	if(cell)
+	{
+		cell[0] = s->x;
+		cell[1] = s->z;
+	}
+	if(changed)
+	{
+		*changed = s->changed;
+		s->changed = 0;
+	}
+	return s->data;
+}
+
+/** Gets the world coordinates of the center of a cell. The Y
+ * coordinate is always 0. */
+void world_grid_cell_center(const world_grid *g, int64_t x, int64_t z, double center[3])
+{
+	center[0] = (double) x * g->cellSize;
+	center[1] = 0;
+	center[2] = (double) z * g->cellSize;
+}
+
+/** Mixes the bits of a 64-bit value (the finalizer from SplitMix64). */
+static uint64_t world_grid_mix(uint64_t v)
+{
+	v += 0x9E3779B97F4A7C15ULL;
+	v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	v = (v ^ (v >> 27)) * 0x94D049BB133111EBULL;
+	return v ^ (v >> 31);
+}
+
+/** Computes the seed for a cell from the seed of the world and the
+ * cell coordinates. */
+uint64_t world_grid_seed(uint64_t seed, int64_t x, int64_t z)
+{
+	return world_grid_mix(world_grid_mix(seed ^ world_grid_mix((uint64_t) x)) ^ (uint64_t) z);
+}
+
+/** A small random number generator which, unlike rand(), can be used
+ * by several threads and is the same on every platform.
+
+    @param state The seed passed to the world_grid_func. It is
+    updated each time a number is generated.
+
+    @return A random number.
+*/
+uint32_t world_grid_random(uint64_t *state)
+{
+	*state += 0x9E3779B97F4A7C15ULL;
+	return (uint32_t) (world_grid_mix(*state) >> 32);
+}
@@ -0,0 +1,54 @@
+/* License: This code is licensed under a 3-clause BSD license. See
+ * the file named "LICENSE" for a full copy of the license.
+ */
+
+/** @file
+ * Streams the cells of an endless 2D grid (in the XZ plane) around a
+ * viewer, generating them on a background thread. See world-grid.c
+ * for details.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Called by the world_grid worker thread to fill in the data for a
+    cell. This function must not call OpenGL and must not use rand()
+    (use world_grid_random() instead) so that cells are identical
+    regardless of the order in which they are generated.
+
+    @param data The cell data to fill in (dataSize bytes, see
+    world_grid_new()). The memory is reused, so it contains the data
+    of some other cell when this function is called.
+
+    @param x The X coordinate of the cell (in cells, not world units).
+
+    @param z The Z coordinate of the cell.
+
+    @param seed A seed for world_grid_random() which depends only on
+    the cell coordinates and the seed passed to world_grid_new().
+
+    @param userdata The pointer passed to world_grid_new().
+*/
+typedef void (*world_grid_func)(void *data, int64_t x, int64_t z, uint64_t seed, void *userdata);
+
+typedef struct world_grid world_grid;
+
+world_grid* world_grid_new(double cellSize, int radius, size_t dataSize, uint64_t seed,
+                           world_grid_func generate, void *userdata);
+void world_grid_free(world_grid *g);
+int world_grid_update(world_grid *g, const double viewerPos[3]);
+void world_grid_wait(world_grid *g);
+int world_grid_slots(const world_grid *g);
+const void* world_grid_get(world_grid *g, int slot, int64_t cell[2], int *changed);
+void world_grid_cell_center(const world_grid *g, int64_t x, int64_t z, double center[3]);
+
+uint64_t world_grid_seed(uint64_t seed, int64_t x, int64_t z);
+uint32_t world_grid_random(uint64_t *state);
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -326,7 +326,7 @@ void display()
 			}
 			saved = 1;
 			// Go back to rendering on the screen:
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glBindFramebuffer(GL_FRAMEBUFFER, kuhl_default_framebuffer());
 			// Restore viewport
 			glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
 		}
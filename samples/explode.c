@@ -25,11 +25,13 @@ static kuhl_geometry *modelgeom = NULL;
 static float bbox[6];
 
 
-typedef struct {
-	GLfloat velocity[3];
-} particle;
-
-static particle **particles;
+/* Each vertex of the model is a particle. The particles are
+ * simulated on the GPU (see particles.c), so the model never needs to
+ * be copied back to the CPU. */
+static particles *modelParticles = NULL;
+static GLuint *firstParticle = NULL; /**< Index of the first particle for each kuhl_geometry in the model */
+static GLuint *restPositions = NULL; /**< Original in_Position buffer for each kuhl_geometry in the model */
+static int exploded = 0;
 
 #define GLSL_VERT_FILE "assimp.vert"
 #define GLSL_FRAG_FILE "assimp.frag"
@@ -37,85 +39,49 @@ static particle **particles;
 /** Give each vertex a velocity when the explosion occurs. */
 void explode()
 {
-	kuhl_geometry *g = modelgeom;
-	for(unsigned int i=0; i<kuhl_geometry_count(modelgeom); i++)
+	int i = 0;
+	for(kuhl_geometry *g = modelgeom; g != NULL; g = g->next, i++)
 	{
-		/* Get the normal information from each of the vertices. */
-		GLint numFloats = 0;
-		GLfloat *norm = kuhl_geometry_attrib_get(g, "in_Normal",
-		                                         &numFloats);
-		
-		/* Calculate the velocity of each vertex when the explosion occurs */
-		for(unsigned int j=0; j<g->vertex_count; j++)
-		{
-			// Start by setting the velocity equal to the normal to
-			// make the particles move out.
-			vec3f_copy(particles[i][j].velocity, &norm[j*3]);
-
-			// Scale the initial velocity
-			vec3f_scalarMult(particles[i][j].velocity, 10);
-
-			// Instead of moving the particles only in the direction
-			// of the normal, make them move 'up' (in object
-			// coordinates) too.
-			particles[i][j].velocity[1] += .5;
-
-			// Add a bit of randomness
-			for(int k=0; k<3; k++)
-				particles[i][j].velocity[k] += (drand48()-.5);
-		}
-		g = g->next;
+		/* Start by setting the velocity equal to the normal (scaled)
+		 * to make the particles move out. Instead of moving the
+		 * particles only in the direction of the normal, make them
+		 * move 'up' (in object coordinates) too. Add a bit of
+		 * randomness. */
+		float up[3] = { 0, .5f, 0 };
+		particles_set_velocities(modelParticles, firstParticle[i], g->vertex_count,
+		                         kuhl_geometry_attrib_buffer(g, "in_Normal"), 0,
+		                         10, up, 1);
 	}
+	exploded = 1;
 }
 
-/** Update the vertex positions and the velocity stored in the
- * particles array. */
-void update()
+/** Puts all of the particles back where they started. */
+void reset()
 {
-	kuhl_geometry *g = modelgeom;
-	for(unsigned int i=0; i<kuhl_geometry_count(modelgeom); i++)
+	int i = 0;
+	for(kuhl_geometry *g = modelgeom; g != NULL; g = g->next, i++)
 	{
-		int numFloats = 0;
-		GLfloat *pos = kuhl_geometry_attrib_get(g, "in_Position",
-		                                        &numFloats);
-
-		for(unsigned int j=0; j<g->vertex_count; j++)
-		{
-			/* If the first point isn't moving, don't update anything */
-			if(vec3f_norm(particles[i][j].velocity) == 0)
-				return;
-
-			/* Gravity is pushing particles down -Y, but we are
-			 * operating in object coordinates. If GeomTransform
-			 * (i.e., g->matrix) is used to rotate the model, then
-			 * gravity might not push the particles down in world
-			 * coordinates. */
-			float accel[3] = { 0, -1, 0};
-			float timestep = 0.1f; // change this to change speed of explosion
-			for(int k=0; k<3; k++)
-			{
-				pos[j*3+k] += timestep * (particles[i][j].velocity[k] + timestep * accel[k]/2);
-				particles[i][j].velocity[k] += timestep * accel[k];
-			}
-#if 1   /* Bounce the particles off the xz-plane. */
-			if(pos[j*3+1] < 0)
-			{
-				/* How much velocity is lost when a bounce occurs? */
-				float velocityLossFactor = .4;
-				/* If particle fell through floor, negate its position */
-				pos[j*3+1] *= -velocityLossFactor;
-				/* Negative the Y velocity */
-				particles[i][j].velocity[1] *= -1;
-				/* Scale velocity in all directions */
-				vec3f_scalarMult(particles[i][j].velocity, velocityLossFactor); // lose energy on bounce
-			}
-#endif
-		}
-		g = g->next;
+		particles_copy_positions(modelParticles, firstParticle[i], g->vertex_count,
+		                         restPositions[i], 0);
+		particles_set_velocities(modelParticles, firstParticle[i], g->vertex_count,
+		                         0, 0, 0, NULL, 0);
 	}
+	exploded = 0;
+}
 
+/** Update the vertex positions and velocities on the GPU. */
+void update()
+{
+	/* If the model hasn't exploded, don't update anything */
+	if(!exploded)
+		return;
 
-	
+	/* Gravity is pushing particles down -Y, but we are operating in
+	 * object coordinates. If GeomTransform (i.e., g->matrix) is used
+	 * to rotate the model, then gravity might not push the particles
+	 * down in world coordinates. */
+	float timestep = 0.1f; // change this to change speed of explosion
+	particles_update(modelParticles, timestep);
 }
 
 
@@ -188,6 +154,9 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 		case GLFW_KEY_Z:
 			update();
 			break;
+		case GLFW_KEY_R:
+			reset();
+			break;
 		case GLFW_KEY_SPACE: // Toggle different sections of the GLSL fragment shader
 			renderStyle++;
 			if(renderStyle > 9)
@@ -241,6 +210,16 @@ void display()
 {
 	dgr_setget("style", &renderStyle, sizeof(int));
 
+	/* Move the particles once per frame and draw the model's
+	 * vertices at the new positions. */
+	update();
+	int i = 0;
+	for(kuhl_geometry *g = modelgeom; g != NULL; g = g->next, i++)
+	{
+		kuhl_geometry_buffer_attrib(g, particles_position_buffer(modelParticles),
+		                            (GLintptr) firstParticle[i] * 3 * sizeof(float),
+		                            3, "in_Position", KG_NONE);
+	}
 	
 	/* Render the scene once for each viewport. Frequently one
 	 * viewport will fill the entire screen. However, this loop will
@@ -305,7 +284,6 @@ void display()
 		kuhl_errorcheck();
 
 		kuhl_limitfps(60);
-		update();
 		kuhl_geometry_draw(modelgeom); /* Draw the model */
 		kuhl_errorcheck();
 
@@ -374,24 +352,34 @@ int main(int argc, char** argv)
 	// Load the model from the file
 	modelgeom = kuhl_load_model(modelFilename, modelTexturePath, program, bbox);
 
-	/* Count the number of kuhl_geometry objects for this model */
+	/* Make a particle for each vertex in the model. Every
+	 * kuhl_geometry object in the model gets its own range of
+	 * particles. */
 	unsigned int geomCount = kuhl_geometry_count(modelgeom);
-	
-	/* Allocate an array of particle arrays */
-	particles = malloc(sizeof(particle*)*geomCount);
+	firstParticle = malloc(sizeof(GLuint)*geomCount);
+	restPositions = malloc(sizeof(GLuint)*geomCount);
+	GLuint particleCount = 0;
 	int i = 0;
 	for(kuhl_geometry *g = modelgeom; g != NULL; g=g->next)
 	{
-		/* allocate space to store velocity information for all of the
-		 * vertices in this kuhl_geometry */
-		particles[i] = malloc(sizeof(particle)*g->vertex_count);
-		for(unsigned int j=0; j<g->vertex_count; j++)
-			vec3f_set(particles[i][j].velocity, 0,0,0);
+		firstParticle[i] = particleCount;
+		particleCount += g->vertex_count;
+		/* Remember where the original vertex positions are. Once
+		 * display() points in_Position at the particles, the model
+		 * no longer refers to this buffer. */
+		restPositions[i] = kuhl_geometry_attrib_buffer(g, "in_Position");
 
 		/* Change the geometry to be drawn as points */
 		g->primitive_type = GL_POINTS; // Comment out this line to default to triangle rendering.
 		i++;
 	}
+	msg(MSG_INFO, "Model has %u particles (vertices).", particleCount);
+	modelParticles = particles_new(particleCount);
+
+	/* Bounce the particles off the xz-plane, losing energy on each
+	 * bounce. */
+	particles_set_floor(modelParticles, 1, 0, .4f);
+	reset();
 
 	while(!glfwWindowShouldClose(kuhl_get_window()))
 	{
@@ -3,8 +3,13 @@
  * the file named "LICENSE" for a full copy of the license.
  */
 
-/** @file Draws a single model repeatedly. Useful for doing very
- * simple performance measurements.
+/** @file Draws a flock of ducks which is simulated by boids.c. All of
+ * the ducks are drawn with one instanced draw call. The label shows
+ * how long each update of the simulation takes.
+ *
+ * The number of ducks can be changed with the flock.agents
+ * configuration setting and the number of threads used to update the
+ * flock can be changed with flock.threads (0 uses one per CPU).
  *
  * @author Scott Kuhl
  */
@@ -18,10 +23,12 @@
 #include <GLFW/glfw3.h>
 
 static GLuint program = 0; /**< id value for the GLSL program */
+static GLuint flockProgram = 0; /**< id value for the GLSL program which draws the flock */
 
 static kuhl_geometry *fpsgeom = NULL;
 static kuhl_geometry *modelgeom = NULL;
 static float bbox[6];
+static float fitMat[16]; /**< Scales and centers the model */
 
 /** Initial position of the camera. 1.55 is a good approximate
  * eyeheight in meters.*/
@@ -37,11 +44,14 @@ static const float initCamUp[3]   = {0,1,0};
 
 
 
-#define NUM_MODELS 5000
-static float positions[NUM_MODELS][3];
+static boids *flock = NULL;
+static float *instances = NULL; /**< Positions followed by directions of the agents */
+static GLuint instanceBuffer = 0;
+static long updateMicroseconds = 0; /**< Time that the last flock update took */
 
 #define GLSL_VERT_FILE "assimp.vert"
 #define GLSL_FRAG_FILE "assimp.frag"
+#define GLSL_FLOCK_VERT_FILE "flock.vert"
 
 /* Called by GLFW whenever a key is pressed. */
 void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -59,29 +69,31 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 }
 
 
-/** Given a bounding box (bbox) calculate a matrix that places the
- * bounding box on top of the specified location. "On top" means that
- * if you specify 0,0,0, then the model will be scaled to fit into a
- * 1x1x1 box whose center is at (0,0.5,0). The bbox variable is
- * usually generated by kuhl_load_model(). */
-void get_fit_matrix(float result[16], float xPos, float yPos, float zPos, float bbox[6])
+/** Moves the flock forward in time and copies the new positions and
+ * directions into the instance buffer. */
+void update()
 {
-	/* Get a matrix to scale+translate the model based on the bounding
-	 * box. If the last parameter is 1, the fit matrix will cause the
-	 * bounding box to sit at the origin on top of the XZ plane. If it
-	 * is set to 0, the fit matrix will cause the bounding box to be
-	 * centered at 0,0,0. */
-	float fitMat[16];
-	kuhl_bbox_fit(fitMat, bbox, 1);
-
-	/* Translate the model from the origin to the requested location. */
-	float transMat[16];
-	mat4f_translate_new(transMat, xPos, yPos, zPos);
-
-	/* The final matrix will be one which first fits the box on top of
-	   the origin, then moves the model to the requested location. */
-	mat4f_mult_mat4f_new(result, transMat, fitMat);
-	return;
+	/* Use the time between frames as the time step. Slaves use the
+	 * same time steps as the master so that their flocks stay the
+	 * same. */
+	static double prevTime = -1;
+	double time = glfwGetTime();
+	float dt = prevTime < 0 ? 0 : (float) (time - prevTime);
+	prevTime = time;
+	if(dt > .05f) // Don't let a slow frame make the flock unstable.
+		dt = .05f;
+	dgr_setget("dt", &dt, sizeof(float));
+
+	long start = kuhl_microseconds();
+	boids_update(flock, dt);
+	updateMicroseconds = kuhl_microseconds() - start;
+
+	int count = boids_count(flock);
+	boids_instances(flock, instances, instances + count*3);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*count, instances, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	kuhl_errorcheck();
 }
 
 
@@ -98,7 +110,9 @@ void display()
 		{
 			float fps = bufferswap_fps(); // get current fps
 			char message[1024];
-			snprintf(message, 1024, "FPS: %0.2f", fps); // make a string with fps on it
+			int count = boids_count(flock);
+			snprintf(message, 1024, "FPS: %0.2f  %d agents: %0.2f ms (%0.2f million/sec)", fps, count,
+			         updateMicroseconds/1000.0, updateMicroseconds > 0 ? count/(double)updateMicroseconds : 0.0);
 			float labelColor[3] = { 1,1,1 };
 			float labelBg[4] = { 0,0,0,.3 };
 
@@ -113,6 +127,8 @@ void display()
 	int renderStyle = 2;
 	dgr_setget("style", &renderStyle, sizeof(int));
 
+	update();
+
 	
 	/* Render the scene once for each viewport. Frequently one
 	 * viewport will fill the entire screen. However, this loop will
@@ -153,34 +169,34 @@ void display()
 		float viewMat[16], perspective[16];
 		viewmat_get(viewMat, perspective, viewportID);
 
-		glUseProgram(program);
+		/* Draw all of the ducks at once. The flock provides the
+		 * model matrix of each duck, so we only need to send the view
+		 * matrix. */
+		glUseProgram(flockProgram);
 		kuhl_errorcheck();
 		/* Send the perspective projection matrix to the vertex program. */
 		glUniformMatrix4fv(kuhl_get_uniform("Projection"),
 		                   1, // number of 4x4 float matrices
 		                   0, // transpose
 		                   perspective); // value
-
+		glUniformMatrix4fv(kuhl_get_uniform("ModelView"), 1, 0, viewMat);
+		glUniformMatrix4fv(kuhl_get_uniform("Fit"), 1, 0, fitMat);
+		/* Generate the normal matrix for the view matrix once instead
+		 * of for every vertex: normalMat = transpose(inverse(view)) */
+		float normalMat[9];
+		mat3f_from_mat4f(normalMat, viewMat);
+		mat3f_invert(normalMat);
+		mat3f_transpose(normalMat);
+		glUniformMatrix3fv(kuhl_get_uniform("NormalMat"), 1, 0, normalMat);
 		glUniform1i(kuhl_get_uniform("renderStyle"), renderStyle);
+		kuhl_errorcheck();
 
-		float modelview[16];
-		for(int i=0; i<NUM_MODELS; i++)
-		{
-			float fitMat[16];
-			get_fit_matrix(fitMat, positions[i][0], positions[i][1], positions[i][2], bbox);
-
-			mat4f_mult_mat4f_new(modelview, viewMat, fitMat); // modelview = view * model
-
-			/* Send the modelview matrix to the vertex program. */
-			glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
-			                   1, // number of 4x4 float matrices
-			                   0, // transpose
-			                   modelview); // value
+		kuhl_geometry_draw_instanced(modelgeom, boids_count(flock)); /* Draw the flock */
+		kuhl_errorcheck();
 
-			kuhl_errorcheck();
-			kuhl_geometry_draw(modelgeom); /* Draw the model */
-			kuhl_errorcheck();
-		}
+		float modelview[16];
+		glUseProgram(program);
+		kuhl_errorcheck();
 
 		// aspect ratio will be zero when the program starts (and FPS hasn't been computed yet)
 		if(dgr_is_master())
@@ -249,19 +265,40 @@ int main(int argc, char** argv)
 	glClearColor(.2f,.2f,.2f,1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	/* The flock is drawn with its own vertex program which places
+	 * each instance of the model at the position of an agent. */
+	flockProgram = kuhl_create_program(GLSL_FLOCK_VERT_FILE, GLSL_FRAG_FILE);
+
 	// Load the model from the file
 	const char *modelFile = "../models/duck/duck.dae";
-	modelgeom = kuhl_load_model(modelFile, NULL, program, bbox);
-
-
-
-	for(int i=0; i<NUM_MODELS; i++)
+	modelgeom = kuhl_load_model(modelFile, NULL, flockProgram, bbox);
+
+	/* Fit the model into a 1x1x1 box centered at the origin. */
+	kuhl_bbox_fit(fitMat, bbox, 0);
+
+	/* Create the flock. Every process uses the same seed so that
+	 * DGR slaves have the same flock as the master. */
+	int count = kuhl_config_int("flock.agents", 20000, 20000);
+	boids_params params;
+	boids_params_default(&params);
+	params.threads = kuhl_config_int("flock.threads", 0, 0);
+	flock = boids_new(count, &params, 1);
+	count = boids_count(flock);
+	msg(MSG_INFO, "Simulating %d agents with %d threads.", count, boids_threads(flock));
+
+	/* The instance buffer holds the positions of all of the agents
+	 * followed by their directions. */
+	instances = (float*) malloc(sizeof(float)*6*(count > 0 ? count : 1));
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*count, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	for(kuhl_geometry *g = modelgeom; g != NULL; g = g->next)
 	{
-		positions[i][0] = drand48()*50-25;
-		positions[i][1] = drand48()*50-25;
-		positions[i][2] = drand48()*50-25;
+		kuhl_geometry_instance_attrib(g, instanceBuffer, 0, 3, "in_Instance", KG_WARN);
+		kuhl_geometry_instance_attrib(g, instanceBuffer, sizeof(float)*3*count, 3, "in_Direction", KG_WARN);
 	}
-	
+
 	while(!glfwWindowShouldClose(kuhl_get_window()))
 	{
 		display();
@@ -270,5 +307,9 @@ int main(int argc, char** argv)
 		/* process events (keyboard, mouse, etc) */
 		glfwPollEvents();
 	}
+
+	boids_free(flock);
+	glDeleteBuffers(1, &instanceBuffer);
+	free(instances);
 	exit(EXIT_SUCCESS);
 }
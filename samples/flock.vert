@@ -0,0 +1,55 @@
+#version 150 // GLSL 150 = OpenGL 3.2
+
+in vec3 in_Position;
+in vec2 in_TexCoord;
+in vec3 in_Normal;
+in vec3 in_Color;
+
+/* One per agent (instance): The position of the agent and the
+ * direction it is moving. */
+in vec3 in_Instance;
+in vec3 in_Direction;
+
+uniform mat4 ModelView;     // view matrix (the agents provide the model matrix)
+uniform mat4 Projection;
+uniform mat4 GeomTransform;
+uniform mat4 Fit;           // scales+centers the model
+uniform mat3 NormalMat;     // transpose(inverse(mat3(ModelView)))
+
+out vec2 out_TexCoord;
+out vec3 out_Color;
+out vec3 out_Normal;   // normal vector (camera coordinates)
+out vec3 out_CamCoord; // vertex position (camera coordinates)
+
+void main()
+{
+	// Copy texture coordinates and color to fragment program
+	out_TexCoord = in_TexCoord;
+	out_Color = in_Color;
+
+	/* Rotate the model so that +Z points in the direction that the
+	 * agent is moving and then move it to the agent's position. */
+	vec3 forward = normalize(in_Direction);
+	vec3 right = cross(vec3(0,1,0), forward);
+	if(dot(right, right) < 1e-6)
+		right = vec3(1,0,0);
+	right = normalize(right);
+	vec3 up = cross(forward, right);
+	mat4 agent = mat4(vec4(right, 0), vec4(up, 0), vec4(forward, 0), vec4(in_Instance, 1));
+
+	mat4 actualModelView = ModelView * agent * Fit * GeomTransform;
+
+	/* Transform normal from object coordinates to camera
+	 * coordinates. The agent matrix is a rotation and Fit scales
+	 * uniformly, so neither changes the direction of a normal except
+	 * by rotating it. GeomTransform is assumed to scale uniformly too;
+	 * the fragment program normalizes the result. */
+	out_Normal = NormalMat * (mat3(agent) * (mat3(GeomTransform) * in_Normal.xyz));
+
+	// Transform vertex from object to unhomogenized Normalized Device
+	// Coordinates (NDC).
+	gl_Position = Projection * actualModelView * vec4(in_Position.xyz, 1);
+
+	// Calculate the position of the vertex in camera coordinates:
+	out_CamCoord = vec3(actualModelView * vec4(in_Position.xyz, 1));
+}
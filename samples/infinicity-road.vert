@@ -3,6 +3,7 @@
 in vec3 in_Position;
 in vec2 in_TexCoord;
 in vec3 in_Normal;
+in vec4 in_Instance; // position of the block relative to the camera
 
 uniform mat4 ModelView;
 uniform mat4 Projection;
@@ -11,7 +12,7 @@ out vec2 out_TexCoord;
 
 void main() 
 {
-	vec4 pos = vec4(in_Position.x, in_Position.y, in_Position.z, 1.0);
+	vec4 pos = vec4(in_Position + in_Instance.xyz, 1.0);
 	out_TexCoord = in_TexCoord;
 	gl_Position = Projection * ModelView * pos;
 }
@@ -10,6 +10,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <GL/glew.h>
@@ -29,69 +30,77 @@ static GLuint duck_prog = 0;
 //stucts I will need for the program
 /*
  *
- * A collection of quads that form a building
+ * A collection of quads that form a building. All buildings with the
+ * same type and height share one Building (only which windows are
+ * lit differs), and each Building is drawn once per frame with
+ * instancing---see drawCity().
  * 
  */
 typedef struct building{
-	float* modelMat;
 	kuhl_geometry* quads;
 	float width;
 	float height;
 }Building;
 
 /*
- *	A set of 4 buildings
+ *	A set of 4 buildings. Blocks are generated on a background thread
+ *	by world_grid (see generateBlock()), so a block only describes
+ *	which buildings it contains. It doesn't hold any OpenGL objects.
  */
 
 typedef struct block{
-	Building** buildings;
-	float* modelMat;
-	kuhl_geometry road;
-	float road_color;
+	int type[4];          // 0 = small building, 1 = complex building
+	int height[4];
+	float window_seed[4]; // picks which windows are lit (0 to 1)
 }Block;
 
 typedef struct viewer{
 	float start_pos[3];
 	float start_look[3];
 	float start_char[3];
-	float curr_pos[3];
-	float curr_look[3];
-	float curr_char[3];
-	float translate[3];
+	/* The positions are in double precision so that the city can
+	 * extend forever without the buildings starting to jitter as the
+	 * viewer moves away from the origin. */
+	double curr_pos[3];
+	double curr_look[3];
+	double curr_char[3];
+	double translate[3];
 	float yangle;
 	float xangle;
 }Viewer;
 
 
 //function prototypes
-Building* generateSmallBuilding(GLuint prog, float x, float y, float z);
-Block* generateBlock(float x, float y, float z);
-void drawBuilding(Building* build);
-void drawBlock(Block* object, float* viewMat, float* perspective);
-void destroyBlock(Block* object);
+Building* generateSmallBuilding(GLuint prog, float height);
+Building* generateComplexBuilding(GLuint prog, float height);
+void generateRoad();
+void generateBlock(void *data, int64_t x, int64_t z, uint64_t seed, void *userdata);
+void drawBuilding(Building* build, int first, int count);
+void drawCity(float* viewMat, const double camPos[3], float* perspective);
 void updateViewer();
-int viewer_in(Block* test);
-void expandRow(int dir);
-void expandColumn(int dir);
-Block** generateRow(float x, float y, float z);
-Block** generateColumn(float x, float y, float z);
-float randColor();
 
 
 
 
 //global variables
+#define MAX_HEIGHT 20
 static float min_height = 4.0;
-static float max_height = 20.0;
+static float max_height = MAX_HEIGHT;
 static float building_width = 5.0;
-static Block* map[9];
-static int max_blocks = 9;//should be a square number (i.e 1,4,9,16,25...)
+static float block_y = -2;
+static int grid_radius = 4; // blocks drawn in each direction from the viewer's block
+static world_grid *grid;    // the blocks around the viewer
+static Building* buildings[2][MAX_HEIGHT]; // [type][height], shared by every block
+static kuhl_geometry road;                 // shared by every block
+/* Per-instance data for drawCity(): the position of each building
+ * or road relative to the camera and a window seed. */
+static GLuint instance_buffer;
+static float* instances;
+static int max_instances;
 static Viewer you;
 static int dirs[4];
-static float last_frame;
-static float curr_frame;
-static int row = -1;
-static int col = 0;
+static double last_frame;
+static double curr_frame;
 static int debug = 0;
 static kuhl_geometry* duck;
 
@@ -281,14 +290,23 @@ void display()
 		glEnable(GL_DEPTH_TEST); // turn on depth testing
 		kuhl_errorcheck();
 
-		/* Get the view matrix and the projection matrix */
+		/* Get the view matrix and the projection matrix. The view
+		 * matrix only contains the camera rotation. Everything is
+		 * drawn relative to the camera position (camPos) by
+		 * subtracting it from the model matrices in double
+		 * precision---see drawBlock(). */
 		float viewMat[16], perspective[16];
-		mat4f_lookat_new(
-			viewMat, 
+		double viewMatD[16], camPos[3];
+		vec3d_copy(camPos, you.curr_pos);
+		mat4d_lookat_new(
+			viewMatD, 
 			you.curr_pos[0], you.curr_pos[1], you.curr_pos[2],
 			you.curr_look[0], you.curr_look[1], you.curr_look[2], 
 			 
 			0, 1, 0);
+		double zero[4] = { 0, 0, 0, 1 };
+		mat4d_setColumn(viewMatD, zero, 3);
+		mat4f_from_mat4d(viewMat, viewMatD);
 		mat4f_perspective_new(perspective, 70, 1, .1, 100);
 
 		/* Tell OpenGL which GLSL program the subsequent
@@ -298,17 +316,19 @@ void display()
 		 * vertex programs immediately above */
 		//draw da ducky
 		glUseProgram(duck_prog);
-		float duck_modelview[16], temp[16];
-		mat4f_rotateAxis_new(duck_modelview, you.xangle - 90, 0, 1, 0);
+		double duck_model[16], temp[16];
+		mat4d_rotateAxis_new(duck_model, you.xangle - 90, 0, 1, 0);
 		
-		mat4f_scale_new(temp, .5, .5, .5);
-		mat4f_mult_mat4f_new(duck_modelview, temp, duck_modelview);
-		mat4f_translate_new(
+		mat4d_scale_new(temp, .5, .5, .5);
+		mat4d_mult_mat4d_new(duck_model, temp, duck_model);
+		mat4d_translate_new(
 			temp, 
 			you.translate[0] + you.start_char[0], 
 			you.translate[1] - 1  + you.start_char[1], 
 			you.translate[2]  + you.start_char[2]);
-		mat4f_mult_mat4f_new(duck_modelview, temp, duck_modelview);
+		mat4d_mult_mat4d_new(duck_model, temp, duck_model);
+		float duck_modelview[16];
+		mat4f_from_mat4d_relative(duck_modelview, duck_model, camPos);
 		mat4f_mult_mat4f_new(duck_modelview, viewMat, duck_modelview);
 		glUniformMatrix4fv(kuhl_get_uniform("Projection"),
 			1,
@@ -322,18 +342,7 @@ void display()
 		kuhl_errorcheck();
 		kuhl_geometry_draw(duck);
 
-		if(debug == 1){
-			//printf("row = %d\n", row);
-		}
-		for(int i = 0; i < max_blocks; i++){
-			if(debug == 1){
-				//printf("drawing block %d\n", i);
-			}
-			drawBlock(map[i], viewMat, perspective);
-			if(debug == 1){
-				//printf("done drawing block %d\n",i); 
-			}
-		}
+		drawCity(viewMat, camPos, perspective);
 		if(debug == 1){
 			debug = 0;
 		}
@@ -408,298 +417,31 @@ void updateViewer(){
 		you.translate[1] = 50;
 	}
 
-	float translation[16];//translation matrix for the camera and the look point
-	mat4f_translate_new(translation, you.translate[0],you.translate[1],you.translate[2]);
-	//move the look camera point
-	mat4f_mult_vec4f_new(temp, translation, temp);
-	//copy the transformed camera look point to the viewer struct
+	//translate the look point, the camera and the duck. This is done
+	//in double precision because you.translate can get very large.
 	for(int i = 0; i < 3; i++){
-		you.curr_look[i] = temp[i];
+		you.curr_look[i] = you.translate[i] + temp[i];
+		you.curr_pos[i] = you.translate[i] + temp2[i];
+		you.curr_char[i] = you.translate[i] + you.start_char[i];
 	}
 
-	/****move the camera*****/
 
-	
-	mat4f_mult_mat4f_new(temp2, translation, temp2);
-	//copy the transformed point back to the viewer
-	for(int i = 0; i < 3; i++){
-		you.curr_pos[i] = temp2[i];
-	}
-
-	/***** move the duck ******/
-	//copy the start pos to temp
-	for(int i = 0; i < 3; i++){
-		temp[i] = you.start_char[i];
-	}
-	mat4f_mult_mat4f_new(temp, translation, temp);
-	//copy the transformed point back to the viewer
-	for(int i = 0; i < 3; i++){
-		you.curr_char[i] = temp[i];
-	}
-
-
-	//map[max_blocks/2] should always be the middle of the map
-	//returns 0 if the viewer has moved out of the center of the map
-	int expand = viewer_in(map[max_blocks/2]);
-	
-	if(expand == 1){
-		//expand with a new row in the negative z
-		//printf("expanding map\n");
-		expandRow(-1);
-		//printf("map expanded\n");
-	}else if(expand == 2){
-		//expand with a new row in the positive z
-		//printf("expanding map\n");
-		expandRow(1);
-		//printf("map expanded\n");
-	}else if(expand == 3){
-		//expand with a new column in the negative x
-		//printf("expanding map\n");
-		expandColumn(-1);
-		//printf("map expanded\n");
-	}else if(expand == 4){
-		//expand with a new column in the positive x
-		//printf("expanding map\n");
-		expandColumn(1);
-		//printf("map expanded\n");
-	}else{
-		//don't expand
-	}
-	
+	//queue blocks that the viewer is moving towards to be generated on
+	//the world_grid thread. Never waits for blocks to be generated.
+	world_grid_update(grid, you.curr_char);
 
 	last_frame = curr_frame;
 }
 
-int viewer_in(Block* test){
-	float* model = test->modelMat;
-	//extract the x,y,z coordinates of the test block
-	float x = model[12];
-	float z = model[14];
-
-	
-	if(you.translate[0] < x - building_width*1.5){
-		col--;
-		//printf("(%f, %f, %f)\n", model[3], model[7], model[11]);
-		//printf("%f\n", you.translate[2]);
-		return 3;
-	}else if(you.translate[0] > x + building_width*1.5){
-		//not within the xcoords of the middle block
-		//add a column
-		col++;
-		//printf("(%f, %f, %f)\n", model[3], model[7], model[11]);
-		//printf("%f\n", you.translate[2]);
-		return 4;
-	}else if(you.translate[2] < z - building_width*1.5){
-		row --;
-		//printf("(%f, %f, %f)\n", model[3], model[7], model[11]);
-		//printf("%f\n", you.translate[2]);
-		return 1;
-	}else if(you.translate[2] > z + building_width*1.5){
-		//not within the zcoords of the middle block
-		//add a row
-		row ++;
-		//printf("(%f, %f, %f)\n", model[3], model[7], model[11]);
-		//printf("%f\n", you.translate[2]);
-		return 2;
-	}else{
-		return 0;
-	}
-}
-
-void expandRow(int dir){
-	if(dir != -1 && dir != 1){
-		printf("ERROR: INCORRECT ROW DIRRECTION\n");
-		return;
-	}
-	float offset[3] = {0,0,0};
-	//get the coords from the current middle
-	float *coords = map[max_blocks/2]->modelMat;//get the middle block
-
-	offset[0] = coords[12];//x offset
-	offset[1] = -2;
-	offset[2] = coords[14] + dir * 6 * building_width;
-	
-	Block** new_row = generateRow(offset[0], offset[1], offset[2]);
-	//printf("new row generated\n");
-	
-	switch(dir){
-		case 1:
-			//printf("putting the row on the positive direction\n");
-			//since we are moving in the positive direction, 
-			//shift the last 6 blocks up by 3
-			for(int i = 0; i < 6; i++){
-				if(i < 3){
-					destroyBlock(map[i]);
-				}
-				map[i] = map[i+3];
-			}
-			//printf("saved blocks shifted\n");
-			//put the new blocks on the map
-			for(int i = 6; i < 9; i++){
-				map[i] = new_row[i-6];
-			}
-			//printf("new pieces added, old pieces freed\n");
-			break;
-		case -1:
-			//printf("putting the row on the negative direction\n");
-			//since we are moving in the negative direction, 
-			//shift the first 6 blocks up by 3
-			for(int i = 8; i > 2; i--){
-				if(i >= 6){
-					destroyBlock(map[i]);
-				}
-				map[i] = map[i-3];
-			}
-			//printf("saved blocks shifted\n");
-			//put the new blocks on the map
-			for(int i = 0; i < 3; i++){
-				map[i] = new_row[i];
-			}
-			//printf("new pieces added, old ones freed\n");
-			break;
-		default:
-			//printf("ERROR: WHY WASN'T THIS CAUGHT EARLIER\n");
-			break;
-	}
-	//printf("freeing temp datastruct\n");
-	free(new_row);
-	//debug = 1;
-}
-
-void expandColumn(int dir){
-	if(dir != -1 && dir != 1){
-		printf("ERROR: INCORRECT ROW DIRRECTION\n");
-		return;
-	}
-	float offset[3] = {0,0,0};
-	//get the coords from the current middle
-	float *coords = map[max_blocks/2]->modelMat;//get the middle block
-
-	offset[0] = coords[12] + dir * 6 * building_width;//x offset
-	offset[1] = -2;//y offset
-	offset[2] = coords[14];//z offset
-	
-	Block** new_row = generateColumn(offset[0], offset[1], offset[2]);
-	//printf("new row generated\n");
-	
-	switch(dir){
-		case 1:
-			//printf("putting the row on the positive direction\n");
-			//since we are moving in the positive direction, 
-			//shift the last 6 blocks up by 3
-			for(int i = 0; i < 9; i++){
-				if(i%3 == 0){
-					destroyBlock(map[i]);
-				}
-				if(i %3 != 2){
-					map[i] = map[i+1];
-				}
-			}
-			//printf("saved blocks shifted\n");
-			//put the new blocks on the map
-			for(int i = 0; i < 9; i+=3){
-				map[i+2] = new_row[i/3];
-			}
-			//printf("new pieces added, old pieces freed\n");
-			break;
-		case -1:
-			//printf("putting the row on the negative direction\n");
-			//since we are moving in the negative direction, 
-			//shift the first 6 blocks up by 3
-			for(int i = 8; i >= 0; i--){
-				if(i %3==2){
-					destroyBlock(map[i]);
-				}
-				if( i %3 != 0){
-					map[i] = map[i-1];
-				}
-			}
-			//printf("saved blocks shifted\n");
-			//put the new blocks on the map
-			for(int i = 0; i < 9; i+=3){
-				map[i] = new_row[i/3];
-			}
-			//printf("new pieces added, old ones freed\n");
-			break;
-		default:
-			//printf("ERROR: WHY WASN'T THIS CAUGHT EARLIER\n");
-			break;
-	}
-	//printf("freeing temp datastruct\n");
-	free(new_row);
-	//debug = 1;
-}
-
-void drawBuilding(Building* build){
-	int i = 0;
-	int iter = 2;
-	if(debug == 1){
-		//printf("drawing the quads\n");
-	}
-	
-	for(i = 0; i < iter; i++){
-		kuhl_geometry_draw(&(build->quads[i]));
-	}
-}
-
-void drawBlock(Block* object, float* viewMat, float* perspective){
-	//draw buildings
-	glUseProgram(program);
-	glUniformMatrix4fv(kuhl_get_uniform("Projection"),
-			1,
-			0,
-			perspective);
-		kuhl_errorcheck();
-	for(int i = 0; i < 4; i++){
-		float modelview[16];
-		if(debug == 1){
-			//printf("drawing building %d\n", i);
-		}
-		mat4f_mult_mat4f_new(modelview,viewMat,object->buildings[i]->modelMat);
-		// Send the modelview matrix to the vertex program.
-		glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
-		    1, 			// number of 4x4 float matrices
-		    0, 			// transpose
-			modelview); // value
-		if(debug == 1){
-			//printf("modelview sent\n");
-		}
-		drawBuilding(object->buildings[i]);
-	}
-
-	glUseProgram(0);
-	//draw road
-	glUseProgram(road_prog);
-	float modelview[16];
-	mat4f_mult_mat4f_new(modelview,viewMat,object->modelMat);
-	/* Send the modelview matrix to the vertex program. */
-	glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
-	    1, // number of 4x4 float matrices
-	    0, // transpose
-		modelview); // value
-	glUniformMatrix4fv(kuhl_get_uniform("Projection"),
-			1,
-			0,
-			perspective);
-	kuhl_errorcheck();
-	kuhl_geometry_draw(&(object->road));
-	glUseProgram(0);
-}
-
 /*	
  *	@param prog the program that puts the points on the screen
- *	@param x	the world x coord
- * 	@param y	the world y coord
- * 	@param z 	the world z coord
- * 	@return a build building (with one wall having windows)
+ *	@param height	the height of the building
+ * 	@return a build building (with windows on every wall), centered on the origin
  */
-Building* generateSmallBuilding(GLuint prog, float x, float y, float z){
+Building* generateSmallBuilding(GLuint prog, float height){
 	Building* output = (Building*)malloc(sizeof(Building));
 	output->width = building_width;
-	output->height = (float)(rand() % (int)max_height);
-	if(output->height < min_height){
-		output->height = min_height;
-	}
+	output->height = height;
 	
 	//the 1 is the base building, the width and height detirmine the number
 	//of windows on the building and there are 4 sides of the building that
@@ -917,7 +659,7 @@ Building* generateSmallBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -967,7 +709,7 @@ Building* generateSmallBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1017,7 +759,7 @@ Building* generateSmallBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1067,7 +809,7 @@ Building* generateSmallBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1080,26 +822,18 @@ Building* generateSmallBuilding(GLuint prog, float x, float y, float z){
 		kuhl_geometry_attrib(&(output->quads[1]), wind_colors,1 ,"color", KG_WARN);
 	}
 
-	output->modelMat = (float*)malloc(sizeof(float) * 16);
-	float y_offset = output->height/2;
-	mat4f_translate_new(output->modelMat,x,y_offset + 1,z);
 	return output;
 }
 
 /*	
  *	@param prog the program that puts the points on the screen
- *	@param x	the world x coord
- * 	@param y	the world y coord
- * 	@param z 	the world z coord
- * 	@return a build building (with one wall having windows)
+ *	@param height	the height of the building
+ * 	@return a build building (with windows on every wall), centered on the origin
  */
-Building* generateComplexBuilding(GLuint prog, float x, float y, float z){
+Building* generateComplexBuilding(GLuint prog, float height){
 	Building* output = (Building*)malloc(sizeof(Building));
 	output->width = building_width;
-	output->height = (float)(rand() % (int)max_height);
-	if(output->height < min_height){
-		output->height = min_height;
-	}
+	output->height = height;
 	float bottom_height = (int)output->height/2 + (int)(output->height)%2;
 	float top_height = output->height/2;
 	float top_width = (int)(building_width)/2 + 1;
@@ -1395,7 +1129,7 @@ Building* generateComplexBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1460,7 +1194,7 @@ Building* generateComplexBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1525,7 +1259,7 @@ Building* generateComplexBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1590,7 +1324,7 @@ Building* generateComplexBuilding(GLuint prog, float x, float y, float z){
 			indexdata[i*6+ 4] = 2 + i*4;
 			indexdata[i*6+ 5] = 3 + i*4;
 
-			float color = randColor();
+			float color = -1; // lit or unlit, picked per instance in infinicity.vert
 			wind_colors[i*4] = color;
 			wind_colors[i*4+1] = color;
 			wind_colors[i*4+2] = color;
@@ -1603,25 +1337,20 @@ Building* generateComplexBuilding(GLuint prog, float x, float y, float z){
 		kuhl_geometry_attrib(&(output->quads[1]), wind_colors,1 ,"color", KG_WARN);
 	}
 
-	output->modelMat = (float*)malloc(sizeof(float) * 16);
-	float y_offset = output->height/2;
-	mat4f_translate_new(output->modelMat,x,y_offset + 1,z);
 	return output;
 }
 
-Block* generateBlock(float x, float y, float z){
-	int type = 0;//will detirmine the contents of the block (range 0-15)
-	srand(x*y + y);
-	
-	Block* output = malloc(sizeof(Block));
-	output->buildings = (Building**)malloc(sizeof(Building*)*4);
-	glUseProgram(0);
+/*
+ *	Creates the road that is drawn under every block. The texture is
+ *	only loaded once.
+ */
+void generateRoad(){
 	glUseProgram(road_prog);
 	//code to make the road
 
 	{
 		//modified code from the racecar assignment
-		kuhl_geometry_new(&(output->road),road_prog,4,GL_TRIANGLES);
+		kuhl_geometry_new(&road,road_prog,4,GL_TRIANGLES);
 		float height = 1;
 		//sets the verticies for a rectangular prism with a square base and
 		//a variable height
@@ -1645,14 +1374,14 @@ Block* generateBlock(float x, float y, float z){
 		};
 
 		//sets the normals for the cube
-		kuhl_geometry_attrib(&(output->road),vertexPositions,3,"in_Position",KG_WARN);
+		kuhl_geometry_attrib(&road,vertexPositions,3,"in_Position",KG_WARN);
 
 		GLfloat texcoordData[] = {
 				0, 0,
 	            1, 0,
 				0, 1,
 	        	1, 1 };
-		kuhl_geometry_attrib(&(output->road), texcoordData, 2, "in_TexCoord", KG_WARN);
+		kuhl_geometry_attrib(&road, texcoordData, 2, "in_TexCoord", KG_WARN);
 		/*
 		GLfloat normalData[] = {
 			//front
@@ -1661,116 +1390,166 @@ Block* generateBlock(float x, float y, float z){
 			0, 1, 0,
 			0, 1, 0
 		};
-		kuhl_geometry_attrib(&(output->road), normalData,3,"in_Normal",KG_WARN);*/
+		kuhl_geometry_attrib(&road, normalData,3,"in_Normal",KG_WARN);*/
 
 		GLuint indexData[] = { 
 			//front
 			0, 1, 3,  
 			0, 2, 3,
 			};
-		kuhl_geometry_indices(&(output->road), indexData, 6);
+		kuhl_geometry_indices(&road, indexData, 6);
 		
 		/* Load the texture. It will be bound to texId */	
 		GLuint texId = 0;
 		kuhl_read_texture_file("../images/road.png", &texId);
 		/* Tell this piece of geometry to use the texture we just loaded. */
-		kuhl_geometry_texture(&(output->road), texId, "tex", KG_WARN);
+		kuhl_geometry_texture(&road, texId, "tex", KG_WARN);
 
 		kuhl_errorcheck();
 	}
-	glUseProgram(program);
-
-	//code to make the buildings
-	float x_shift = building_width * .75;
-	float z_shift = building_width * .75;
-	float y_shift = y;
-	//building on the far left
-	type = rand() % 2;
-	if(type == 0){
-		//generate simple building
-		output->buildings[0] = generateSmallBuilding(program, -x_shift, y_shift, -z_shift);
-	}else{
-		//generate complex building
-		output->buildings[0] = generateComplexBuilding(program, -x_shift, y_shift, -z_shift);
-	}
-	
-	//far right
-	type = rand() % 2;
-	if(type == 0){
-		//generate simple building
-		output->buildings[1] = generateSmallBuilding(program, x_shift, y_shift, -z_shift);
-	}else{
-		//generate complex building
-		output->buildings[1] = generateComplexBuilding(program, x_shift, y_shift, -z_shift);
-	}
-
-	//close left
-	type = rand() % 2;
-	if(type == 0){
-		//generate simple building
-		output->buildings[2] = generateSmallBuilding(program, -x_shift, y_shift, z_shift);
-	}else{
-		//generate complex building
-		output->buildings[2] = generateComplexBuilding(program, -x_shift, y_shift, z_shift);
-	}
-	
-	//close right
-	type = rand() % 2;
-	if(type == 0){
-		//generate simple building
-		output->buildings[3] = generateSmallBuilding(program, x_shift, y_shift, z_shift);
-	}else{
-		//generate complex building
-		output->buildings[3] = generateComplexBuilding(program, x_shift, y_shift, z_shift);
-	}
-
-	output->modelMat = (float*)malloc(sizeof(float) * 16);
+	glUseProgram(0);
+}
 
-	//x,y,z are the world coordinates for the center of the city block
-	mat4f_translate_new(output->modelMat,x,y,z);
+/*
+ *	Called by world_grid on a background thread to decide what the
+ *	block at grid cell (x,z) contains. This must not call OpenGL or
+ *	rand(): The block is created from the seed world_grid computes from
+ *	the block's coordinates, so a block looks the same every time the
+ *	viewer returns to it.
+ */
+void generateBlock(void *data, int64_t x, int64_t z, uint64_t seed, void *userdata){
+	(void) x; (void) z; (void) userdata;
+	Block* output = (Block*)data;
 	for(int i = 0; i < 4; i++){
-		//make the modelMat for each building their position in world coordinates
-		mat4f_mult_mat4f_new(output->buildings[i]->modelMat, output->modelMat, output->buildings[i]->modelMat);
+		output->type[i] = world_grid_random(&seed) % 2;
+		int height = world_grid_random(&seed) % (int)max_height;
+		if(height < min_height){
+			height = min_height;
+		}
+		output->height[i] = height;
+		output->window_seed[i] = (world_grid_random(&seed) % 10000) / 10000.0f;
 	}
-
-	return output;
 }
 
-
-Block** generateRow(float x, float y, float z){
-	Block** output = (Block**)malloc(sizeof(Block*) * 3);
-	for(int i = -1; i < 2;i++){
-		Block* temp = generateBlock(x + 3 * building_width * i,y,z);
-		output[i+1] = temp;
+/*
+ *	Draws count copies of a building. The instance data starts at
+ *	instance number first in instance_buffer.
+ */
+void drawBuilding(Building* build, int first, int count){
+	for(int i = 0; i < 2; i++){
+		kuhl_geometry_instance_attrib(&(build->quads[i]), instance_buffer,
+		                              sizeof(float)*4*first, 4, "in_Instance", KG_WARN);
+		kuhl_geometry_draw_instanced(&(build->quads[i]), count);
 	}
-	return output;
 }
 
-Block** generateColumn(float x, float y, float z){
-	Block** output = (Block**)malloc(sizeof(Block*) * 3);
-	for(int i = -1; i < 2;i++){
-		Block* temp = generateBlock(x,y,z + 3 * building_width * i);
-		output[i+1] = temp;
+/*
+ *	Draws every block that world_grid has finished generating. Each
+ *	type and height of building (and the road) is drawn with a single
+ *	instanced draw call, so the time it takes doesn't depend on how
+ *	many times the map has moved.
+ *
+ *	Block positions are in double precision. The position of each
+ *	instance relative to the camera is calculated in double precision
+ *	before it is converted to float, so viewMat only contains the
+ *	camera rotation.
+ */
+void drawCity(float* viewMat, const double camPos[3], float* perspective){
+	/* The buildings in each block (relative to the center of the block) */
+	float shift = building_width * .75;
+	float x_shift[4] = { -shift, shift, -shift, shift };
+	float z_shift[4] = { -shift, -shift, shift, shift };
+
+	/* Count the blocks and the instances of each building. */
+	int count[2][MAX_HEIGHT], first[2][MAX_HEIGHT];
+	int roads = 0;
+	memset(count, 0, sizeof(count));
+	int slots = world_grid_slots(grid);
+	for(int slot = 0; slot < slots; slot++){
+		const Block* block = (const Block*) world_grid_get(grid, slot, NULL, NULL);
+		if(block == NULL)
+			continue;
+		roads++;
+		for(int i = 0; i < 4; i++)
+			count[block->type[i]][block->height[i]]++;
+	}
+
+	/* The roads go at the start of instance_buffer, followed by the
+	 * instances of each building. */
+	int next = roads;
+	for(int t = 0; t < 2; t++){
+		for(int h = 0; h < MAX_HEIGHT; h++){
+			first[t][h] = next;
+			next += count[t][h];
+			count[t][h] = 0;
+		}
 	}
-	return output;
-}
 
-float randColor(){
-	float color = (float)((rand()%4) + 1);
-	if(color != 2.0){
-		color = 1.0;
+	int road_count = 0;
+	for(int slot = 0; slot < slots; slot++){
+		int64_t cell[2];
+		const Block* block = (const Block*) world_grid_get(grid, slot, cell, NULL);
+		if(block == NULL)
+			continue;
+		double center[3];
+		world_grid_cell_center(grid, cell[0], cell[1], center);
+		center[1] = block_y;
+
+		float* road_inst = instances + 4*road_count++;
+		for(int j = 0; j < 3; j++)
+			road_inst[j] = (float)(center[j] - camPos[j]);
+		road_inst[3] = 0;
+
+		for(int i = 0; i < 4; i++){
+			int t = block->type[i], h = block->height[i];
+			float* inst = instances + 4*(first[t][h] + count[t][h]++);
+			inst[0] = (float)(center[0] + x_shift[i] - camPos[0]);
+			inst[1] = (float)(center[1] + h/2.0 + 1 - camPos[1]);
+			inst[2] = (float)(center[2] + z_shift[i] - camPos[2]);
+			inst[3] = block->window_seed[i];
+		}
 	}
-	return color;
-}
 
-void destroyBlock(Block* object){
-	free(object->modelMat);
-	for(int i = 0 ; i < 4; i++){
-		free(object->buildings[i]->modelMat);
-		free(object->buildings[i]->quads);
-		free(object->buildings[i]);
+	/* Orphan the old buffer so that we don't wait for the GPU to
+	 * finish drawing the last frame before we can update it. */
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*max_instances, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float)*4*next, instances);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	kuhl_errorcheck();
+
+	//draw buildings
+	glUseProgram(program);
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"),
+			1,
+			0,
+			perspective);
+	glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
+	    1, 			// number of 4x4 float matrices
+	    0, 			// transpose
+		viewMat); // value
+	kuhl_errorcheck();
+	for(int t = 0; t < 2; t++){
+		for(int h = 0; h < MAX_HEIGHT; h++){
+			if(count[t][h] > 0)
+				drawBuilding(buildings[t][h], first[t][h], count[t][h]);
+		}
 	}
-	free(object);
+
+	//draw roads
+	glUseProgram(road_prog);
+	glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
+	    1, // number of 4x4 float matrices
+	    0, // transpose
+		viewMat); // value
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"),
+			1,
+			0,
+			perspective);
+	kuhl_errorcheck();
+	kuhl_geometry_instance_attrib(&road, instance_buffer, 0, 4, "in_Instance", KG_WARN);
+	kuhl_geometry_draw_instanced(&road, roads);
+	glUseProgram(0);
 }
 
 int main(int argc, char** argv)
@@ -1800,16 +1579,23 @@ int main(int argc, char** argv)
 	kuhl_errorcheck();
 	glUseProgram(0);
 
-	for(int i = 0; i < 3; i++){
-		//fix this
-		Block** temp = generateRow(0, -2, (i-1) * building_width*3);
-		for(int j = 0; j < 3; j++){
-			map[i*3 + j] = temp[j];
-		}
-		free(temp);
-		row++;
+	/* Create one building of each type and height. The blocks draw
+	 * these with instancing instead of creating their own. */
+	glUseProgram(program);
+	for(int h = min_height; h < MAX_HEIGHT; h++){
+		buildings[0][h] = generateSmallBuilding(program, h);
+		buildings[1][h] = generateComplexBuilding(program, h);
 	}
-	row = 0; col = 0;
+	glUseProgram(0);
+	generateRoad();
+
+	/* Blocks are generated by a background thread as the viewer
+	 * moves. Each block has a road and 4 buildings. */
+	grid = world_grid_new(building_width*3, grid_radius, sizeof(Block),
+	                      (uint64_t) time(NULL), generateBlock, NULL);
+	max_instances = world_grid_slots(grid) * 5;
+	instances = (float*)malloc(sizeof(float) * 4 * max_instances);
+	glGenBuffers(1, &instance_buffer);
 
 	/* Good practice: Unbind objects until we really need them. */
 	glUseProgram(0);
@@ -1861,6 +1647,12 @@ int main(int argc, char** argv)
 	#endif
 	last_frame = glfwGetTime();
 	viewmat_init(initCamPos, initCamLook, initCamUp);
+
+	/* Generate the blocks around the starting position before the
+	 * first frame. */
+	double start[3] = { you.start_char[0], you.start_char[1], you.start_char[2] };
+	world_grid_update(grid, start);
+	world_grid_wait(grid);
 	
 	while(!glfwWindowShouldClose(kuhl_get_window()))
 	{
@@ -1870,7 +1662,8 @@ int main(int argc, char** argv)
 		/* process events (keyboard, mouse, etc) */
 		glfwPollEvents();
 	}
-	for(int i = 0; i < max_blocks; i++)
-		destroyBlock(map[i]);
+	world_grid_free(grid);
+	glDeleteBuffers(1, &instance_buffer);
+	free(instances);
 	exit(EXIT_SUCCESS);
 }
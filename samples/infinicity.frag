@@ -3,7 +3,7 @@
 out vec4 fragColor;
 in vec3 lightDir;
 in vec3 out_Normal;
-in float out_Color;
+flat in float out_Color;
 uniform float color;
 /** Calculate diffuse shading. Normal and light direction do not need
  * to be normalized. */
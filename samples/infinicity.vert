@@ -4,20 +4,35 @@ in vec3 in_Position;
 in vec3 in_Normal;
 out vec3 lightDir;
 out vec3 out_Normal;
-out float out_Color;
+flat out float out_Color;
 in float color;
+/* One per building (instance): Position of the building relative to
+ * the camera and a random number which picks which windows are lit. */
+in vec4 in_Instance;
 
 uniform mat4 ModelView;
 uniform mat4 Projection;
 
+/* Returns the color of a window: 1 (unlit) or 2 (lit). */
+float windowColor(float seed, int window)
+{
+	float r = fract(sin(seed*12.9898 + float(window)*78.233) * 43758.5453);
+	if(r < 0.25)
+		return 2.0;
+	return 1.0;
+}
+
 void main() 
 {
 	vec3 lightPos = vec3(0,50,0);
 	mat3 NormalMatrix = transpose(inverse(mat3(ModelView)));
 	out_Normal = NormalMatrix * normalize(in_Normal).xyz;
 	out_Color = color;
+	/* Windows have a color of -1. Each window has 4 vertices. */
+	if(color < 0.0)
+		out_Color = windowColor(in_Instance.w, gl_VertexID/4);
 
-	vec4 pos = vec4(in_Position.x, in_Position.y, in_Position.z, 1.0);
+	vec4 pos = vec4(in_Position + in_Instance.xyz, 1.0);
 	pos = Projection * ModelView * pos;
 	lightDir = lightPos - vec3(pos.xyz);
 	gl_Position = pos;
@@ -4,9 +4,9 @@
  */
 
 /** @file This example demonstrates how to draw a HUD cursor and how
- * to use the stencil buffer to determine what piece of geometry the
- * cursor is on. For more information and details, see:
- * http://en.wikibooks.org/wiki/OpenGL_Programming/Object_selection
+ * to use pick.c to determine what piece of geometry the cursor is
+ * on. Picking never waits for the GPU: the result arrives in a
+ * callback during a later frame. Press 'p' to turn picking on or off.
  *
  * @author Scott Kuhl
  */
@@ -24,6 +24,8 @@ static kuhl_geometry cursor;
 static kuhl_geometry triangle;
 static kuhl_geometry quad;
 
+static int picking = 1; /**< Should we find what the cursor is on? */
+
 
 /* Called by GLFW whenever a key is pressed. */
 void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -37,9 +39,32 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 		case GLFW_KEY_ESCAPE:
 			glfwSetWindowShouldClose(window, GL_TRUE);
 			break;
+		case GLFW_KEY_P:
+			picking = !picking;
+			printf("Picking is %s.\n", picking ? "on" : "off");
+			break;
 	}
 }
 
+/** Called by pick.c when it has found what the cursor is on. */
+void picked(const pick_result *result, void *userdata)
+{
+	(void) userdata;
+
+	/* Only print a message when the object under the cursor changes. */
+	static GLuint prevObject = (GLuint) -1;
+	if(result->object == prevObject)
+		return;
+	prevObject = result->object;
+
+	if(result->object == 1)
+		printf("Cursor is on triangle.\n");
+	else if(result->object == 2)
+		printf("Cursor is on quad (triangle %u).\n", result->primitive);
+	else
+		printf("Cursor isn't on anything.\n");
+}
+
 /** Draws the 3D scene. */
 void display()
 {
@@ -66,7 +91,7 @@ void display()
 		glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
 		glEnable(GL_SCISSOR_TEST);
 		glClearColor(.2,.2,.2,0); // set clear color to grey
-		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
+		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 		glDisable(GL_SCISSOR_TEST);
 		glEnable(GL_DEPTH_TEST); // turn on depth testing
 		kuhl_errorcheck();
@@ -112,17 +137,19 @@ void display()
 		kuhl_errorcheck();
 
 		/* Draw the geometry using the matrices that we sent to the
-		 * vertex programs immediately above. Use the stencil buffer
-		 * to keep track of which object appears on top. */
-		if(viewportID == 0)
-			glEnable(GL_STENCIL_TEST);
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-		glStencilFunc(GL_ALWAYS, 1, -1);
+		 * vertex programs immediately above. */
 		kuhl_geometry_draw(&triangle);
-		
-		glStencilFunc(GL_ALWAYS, 2, -1);
 		kuhl_geometry_draw(&quad);
-		glDisable(GL_STENCIL_TEST);
+
+		/* If a pick was requested, draw the ID of each object that
+		 * can be picked. This does nothing if there is no pick to
+		 * do. */
+		if(pick_begin(viewport))
+		{
+			pick_draw(&triangle, 1, modelview, perspective);
+			pick_draw(&quad, 2, modelview, perspective);
+			pick_end();
+		}
 		
 		/* If we have multiple viewports, only draw cursor in the
 		 * first viewport. */
@@ -143,28 +170,12 @@ void display()
 			kuhl_geometry_draw(&cursor);
 			glEnable(GL_DEPTH_TEST);
 
-			/* When we render images on the Oculus, we are rendering
-			 * into a multisampled framebuffer object, and we can't
-			 * read from the multisample FBO until we have blitted it
-			 * into a normal FBO. Here, we get the blitted FBO for the
-			 * *previous* frame. */
-			GLint fb = viewmat_get_framebuffer(viewportID);
-			glBindFramebuffer(GL_FRAMEBUFFER, fb);
-			
-			GLuint stencilVal = 0;
-			kuhl_errorcheck();
-			glReadPixels(viewport[0]+viewport[2]/2, viewport[1]+viewport[3]/2,
-			             1,1, // get data for 1x1 area (i.e., a pixel)
-			             GL_STENCIL_INDEX, // query the stencil buffer
-			             GL_UNSIGNED_INT,
-			             &stencilVal);
-			kuhl_errorcheck();
-			if(stencilVal == 1)
-				printf("Cursor is on triangle.\n");
-			else if(stencilVal == 2)
-				printf("Cursor is on quad.\n");
-			else
-				printf("Cursor isn't on anything.\n");
+			/* Find out what is under the cursor (in the center of
+			 * the viewport). The objects will be drawn during the
+			 * next frame. */
+			if(picking && !pick_pending())
+				pick_request(viewport[0]+viewport[2]/2, viewport[1]+viewport[3]/2,
+				             2, picked, NULL);
 		}
 
 		glUseProgram(0); // stop using a GLSL program.
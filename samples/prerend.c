@@ -174,7 +174,7 @@ void display()
 		kuhl_geometry_draw(&quad);
 
 		/* Stop rendering to texture */
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, kuhl_default_framebuffer());
 		glUseProgram(0);
 		kuhl_errorcheck();
 		
@@ -185,8 +185,8 @@ void display()
 		glBlitFramebuffer(0,0,prerenderWidth,prerenderHeight,
 		                  0,0,prerenderWidth,prerenderHeight,
 		                  GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER,0);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER,0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, kuhl_default_framebuffer());
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, kuhl_default_framebuffer());
 		kuhl_errorcheck();
 #endif
 
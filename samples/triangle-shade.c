@@ -35,14 +35,106 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 	}
 }
 
+/** Draws the triangle and the quad. If viewportID is -1, draws both
+ * eyes in a single pass (see viewmat_begin_single_pass()). */
+static void draw_scene(int viewportID)
+{
+	/* Get the view matrix and the projection matrix. When drawing
+	 * both eyes at once, we get the matrices for both eyes. */
+	float viewMat[2][16], perspective[2][16];
+	int eyes = 1;
+	if(viewportID < 0)
+		eyes = viewmat_get_stereo(viewMat, perspective);
+	else
+		viewmat_get(viewMat[0], perspective[0], viewportID);
+
+	/* Calculate an angle to rotate the object. glfwGetTime() gets
+	 * the time in seconds since GLFW was initialized. Rotates 45 degrees every second. */
+	float angle = fmod(glfwGetTime()*45, 360);
+
+	/* Make sure all computers/processes use the same angle */
+	dgr_setget("angle", &angle, sizeof(GLfloat));
+
+	/* Create a 4x4 rotation matrix based on the angle we computed. */
+	float rotateMat[16];
+	mat4f_rotateAxis_new(rotateMat, angle, 0,1,0);
+
+	/* Create a scale matrix. */
+	float scaleMat[16];
+	mat4f_scale_new(scaleMat, 3, 3, 3);
+
+	/* Combine the scale and rotation matrices into a single model matrix.
+	   modelMat = scaleMat * rotateMat
+	*/
+	float modelMat[16];
+	mat4f_mult_mat4f_new(modelMat, scaleMat, rotateMat);
+
+	/* Tell OpenGL which GLSL program the subsequent
+	 * glUniformMatrix4fv() calls are for. */
+	kuhl_errorcheck();
+	glUseProgram(program);
+	kuhl_errorcheck();
+
+	/* Send the perspective projection matrices to the vertex program. */
+	glUniformMatrix4fv(kuhl_get_uniform("Projection"),
+	                   eyes, // number of 4x4 float matrices
+	                   0, // transpose
+	                   perspective[0]); // value
+	/* Send the view matrices and the model matrix to the vertex
+	 * program. The vertex program multiplies them together to get
+	 * the modelview matrix for each eye. */
+	glUniformMatrix4fv(kuhl_get_uniform("View"), eyes, 0, viewMat[0]);
+	glUniformMatrix4fv(kuhl_get_uniform("Model"), 1, 0, modelMat);
+	glUniform1i(kuhl_get_uniform("Eyes"), eyes);
+
+	/* Generate an appropriate normal matrix based on the model view matrix:
+	  normalMat = transpose(inverse(modelview))
+	  Both eyes look in the same direction, so we can use the same normal matrix for both.
+	*/
+	float modelview[16];
+	mat4f_mult_mat4f_new(modelview, viewMat[0], modelMat);
+	float normalMat[9];
+	mat3f_from_mat4f(normalMat, modelview);
+	mat3f_invert(normalMat);
+	mat3f_transpose(normalMat);
+	glUniformMatrix3fv(kuhl_get_uniform("NormalMat"),
+	                   1, // number of 3x3 float matrices
+	                   0, // transpose
+	                   normalMat); // value
+
+	kuhl_errorcheck();
+	/* Draw the geometry using the matrices that we sent to the
+	 * vertex programs immediately above. Each object is drawn once
+	 * per eye with a single draw call. */
+	kuhl_geometry_draw_instanced(&triangle, eyes);
+	kuhl_geometry_draw_instanced(&quad, eyes);
+
+	glUseProgram(0); // stop using a GLSL program.
+}
+
 /** Draws the 3D scene. */
 void display()
 {
+	viewmat_begin_frame();
+
+	/* HMD and anaglyph display modes can draw both eyes at once. */
+	if(viewmat_single_pass())
+	{
+		viewmat_begin_single_pass();
+		glClearColor(.2,.2,.2,0); // set clear color to grey
+		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+		glEnable(GL_DEPTH_TEST); // turn on depth testing
+		draw_scene(-1);
+		viewmat_end_single_pass();
+		viewmat_end_frame();
+		kuhl_errorcheck();
+		return;
+	}
+
 	/* Render the scene once for each viewport. Frequently one
 	 * viewport will fill the entire screen. However, this loop will
 	 * run twice for HMDs (once for the left eye and once for the
-	 * right). */
-	viewmat_begin_frame();
+	 * right) if single pass rendering is turned off. */
 	for(int viewportID=0; viewportID<viewmat_num_viewports(); viewportID++)
 	{
 		viewmat_begin_eye(viewportID);
@@ -66,71 +158,8 @@ void display()
 		glEnable(GL_DEPTH_TEST); // turn on depth testing
 		kuhl_errorcheck();
 
-		/* Get the view matrix and the projection matrix */
-		float viewMat[16], perspective[16];
-		viewmat_get(viewMat, perspective, viewportID);
-
-		/* Calculate an angle to rotate the object. glfwGetTime() gets
-		 * the time in seconds since GLFW was initialized. Rotates 45 degrees every second. */
-		float angle = fmod(glfwGetTime()*45, 360);
-
-		/* Make sure all computers/processes use the same angle */
-		dgr_setget("angle", &angle, sizeof(GLfloat));
-
-		/* Create a 4x4 rotation matrix based on the angle we computed. */
-		float rotateMat[16];
-		mat4f_rotateAxis_new(rotateMat, angle, 0,1,0);
-
-		/* Create a scale matrix. */
-		float scaleMat[16];
-		mat4f_scale_new(scaleMat, 3, 3, 3);
-
-		/* Combine the scale and rotation matrices into a single model matrix.
-		   modelMat = scaleMat * rotateMat
-		*/
-		float modelMat[16];
-		mat4f_mult_mat4f_new(modelMat, scaleMat, rotateMat);
-
-		/* Construct a modelview matrix: modelview = viewMat * modelMat */
-		float modelview[16];
-		mat4f_mult_mat4f_new(modelview, viewMat, modelMat);
-
-		/* Tell OpenGL which GLSL program the subsequent
-		 * glUniformMatrix4fv() calls are for. */
-		kuhl_errorcheck();
-		glUseProgram(program);
-		kuhl_errorcheck();
-		
-		/* Send the perspective projection matrix to the vertex program. */
-		glUniformMatrix4fv(kuhl_get_uniform("Projection"),
-		                   1, // number of 4x4 float matrices
-		                   0, // transpose
-		                   perspective); // value
-		/* Send the modelview matrix to the vertex program. */
-		glUniformMatrix4fv(kuhl_get_uniform("ModelView"),
-		                   1, // number of 4x4 float matrices
-		                   0, // transpose
-		                   modelview); // value
-		
-		/* Generate an appropriate normal matrix based on the model view matrix:
-		  normalMat = transpose(inverse(modelview))
-		*/
-		float normalMat[9];
-		mat3f_from_mat4f(normalMat, modelview);
-		mat3f_invert(normalMat);
-		mat3f_transpose(normalMat);
-		glUniformMatrix3fv(kuhl_get_uniform("NormalMat"),
-		                   1, // number of 3x3 float matrices
-		                   0, // transpose
-		                   normalMat); // value
-
-		kuhl_errorcheck();
-		/* Draw the geometry using the matrices that we sent to the
-		 * vertex programs immediately above */
-		kuhl_geometry_draw(&triangle);
-		kuhl_geometry_draw(&quad);
+		draw_scene(viewportID);
 
-		glUseProgram(0); // stop using a GLSL program.
 		viewmat_end_eye(viewportID);
 	} // finish viewport loop
 	viewmat_end_frame();
@@ -6,8 +6,10 @@ in vec3 in_Normal;   // normal vector   (object coordinates)
 out vec4 out_VertexPos; // vertex position (camera coordinates)
 out vec4 out_Normal;    // normal vector   (camera coordinates)
 
-uniform mat4 ModelView;
-uniform mat4 Projection;
+uniform mat4 Model;
+uniform mat4 View[2];       // one view matrix per eye
+uniform mat4 Projection[2]; // one projection matrix per eye
+uniform int Eyes;           // 2 if both eyes are drawn in a single pass
 uniform mat3 NormalMat;
 
 uniform int red;
@@ -19,11 +21,25 @@ void main()
 	vec3 transformedNormal = normalize(NormalMat * in_Normal);
 	out_Normal = vec4(transformedNormal.xyz, 0);
 
+	// When drawing both eyes in a single pass, each object is
+	// drawn twice (two instances). Instance 0 is the left eye.
+	int eye = gl_InstanceID % Eyes;
+
 	// Transform the vertex position from object coordinates into
 	// camera coordinates.
-	out_VertexPos = ModelView * vec4(in_Position, 1);
+	out_VertexPos = View[eye] * Model * vec4(in_Position, 1);
 
 	// Transform the vertex position from object coordinates into
 	// Normalized Device Coordinates (NDC).
-	gl_Position = Projection * ModelView * vec4(in_Position.xyz, 1);
+	gl_Position = Projection[eye] * out_VertexPos;
+
+	// The viewport covers both eyes. Squeeze each eye into its half
+	// of the viewport and clip away anything that would spill into
+	// the other half.
+	if(Eyes == 2)
+	{
+		float side = eye == 0 ? -1.0 : 1.0;
+		gl_Position.x = (gl_Position.x + side*gl_Position.w) * 0.5;
+		gl_ClipDistance[0] = side * gl_Position.x;
+	}
 }
@@ -0,0 +1,38 @@
+#version 150 // GLSL 150 = OpenGL 3.2
+
+out vec4 fragColor;
+in vec2 out_TexCoord;
+
+/* Y, U and V planes of a video frame (see video_yuv_textures_update()) */
+uniform sampler2D texY;
+uniform sampler2D texU;
+uniform sampler2D texV;
+
+uniform int Bt709;     // 1 for BT.709 (HD video), 0 for BT.601 (SD video)
+uniform int FullRange; // 1 if Y,U,V use 0-255, 0 if Y uses 16-235 and U,V use 16-240
+
+void main() 
+{
+	float y = texture(texY, out_TexCoord).r;
+	float u = texture(texU, out_TexCoord).r - 0.5;
+	float v = texture(texV, out_TexCoord).r - 0.5;
+
+	if(FullRange == 0)
+	{
+		y = (y - 16.0/255.0) * (255.0/219.0);
+		u = u * (255.0/224.0);
+		v = v * (255.0/224.0);
+	}
+
+	vec3 rgb;
+	if(Bt709 == 1)
+		rgb = vec3(y + 1.5748*v,
+		           y - 0.1873*u - 0.4681*v,
+		           y + 1.8556*u);
+	else
+		rgb = vec3(y + 1.4020*v,
+		           y - 0.3441*u - 0.7141*v,
+		           y + 1.7720*u);
+
+	fragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);
+}
@@ -4,6 +4,11 @@
  */
 
 /** @file Demonstrates using a video file as a texture.
+ *
+ * By default, the Y, U and V planes of each frame are uploaded as
+ * separate textures and converted to RGB in the fragment
+ * program. Set videoplay.yuv=0 in the config file to convert frames
+ * to RGB on the CPU instead.
  *
  * @author Scott Kuhl
  */
@@ -18,59 +23,86 @@
 static GLuint program = 0; /**< id value for the GLSL program */
 
 static kuhl_geometry quad;
-static video_state* video = NULL;
+static video_player* player = NULL;
+static const video_state* video = NULL; /**< Information about the video (size, etc) */
 static char *videofilename = NULL;
+static int useYuv = 1; /**< Convert YUV to RGB in a shader? */
+static video_yuv_textures yuvTextures; /**< Textures used if useYuv is set */
+static long startTime = 0; /**< kuhl_microseconds() when the first frame should be displayed */
 
-
-/* Call to update the video_state struct with the latest information */
-static void update_video()
+/* Sends a frame to OpenGL. */
+static void show_frame(const video_frame *frame)
 {
 	static GLuint texId = 0;
-	static long startTime = 0;
 
-	if(video == NULL) // if it is our first time
+	if(useYuv)
 	{
-		/* Get the next frame */
-		video = video_get_next_frame(video, videofilename);
-		if(video == NULL)
+		/* The texture ids don't change after the first frame. */
+		int firstFrame = (yuvTextures.tex[0] == 0);
+		video_yuv_textures_update_frame(&yuvTextures, video, frame);
+		if(firstFrame)
 		{
-			msg(MSG_FATAL, "Failed to load video file %s\n", videofilename);
-			exit(EXIT_FAILURE);
+			kuhl_geometry_texture(&quad, yuvTextures.tex[0], "texY", KG_WARN);
+			kuhl_geometry_texture(&quad, yuvTextures.tex[1], "texU", KG_WARN);
+			kuhl_geometry_texture(&quad, yuvTextures.tex[2], "texV", KG_WARN);
 		}
-		
-		/* Send the new frame to OpenGL */
-		texId = kuhl_read_texture_array(video->data, 1920, 1080, 3, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
-
-		startTime = kuhl_microseconds();
-		
-		/* Tell this piece of geometry to use the texture we just loaded. */
-		kuhl_geometry_texture(&quad, texId, "tex", KG_WARN);
-
-		/* Get the frame that should be displayed next */
-		video = video_get_next_frame(video, videofilename);
+		return;
 	}
-	else
-	{
-		/* If previously loaded frame is to be displayed in the future, do nothing. */
-		if(video->usec > kuhl_microseconds()-startTime)
-			return;
 
-		/* Display the frame we previously loaded */
+	if(texId != 0)
 		glDeleteTextures(1, &texId);
-		texId = kuhl_read_texture_array(video->data, 1920, 1080, 3, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+	texId = kuhl_read_texture_array(frame->data, video->width, video->height, 3, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+	/* Tell this piece of geometry to use the texture we just
+	 * loaded. Frequently, texId won't change because we just
+	 * deleted the texture and then reloaded a texture (causing
+	 * the same id to be used again). */
+	kuhl_geometry_texture(&quad, texId, "tex", KG_WARN);
+}
 
-		/* Tell this piece of geometry to use the texture we just
-		 * loaded. Frequently, texId won't change because we just
-		 * deleted the texture and then reloaded a texture (causing
-		 * the same id to be used again). */
-		kuhl_geometry_texture(&quad, texId, "tex", KG_WARN);
+/* Jump to a time (in microseconds) in the video. */
+static void seek_video(int64_t usec)
+{
+	if(usec < 0)
+		usec = 0;
+	video_player_seek(player, usec);
+	startTime = kuhl_microseconds() - usec;
+}
+
+/* Call to display the frame which should currently be on the screen. */
+static void update_video()
+{
+	static const video_frame *shown = NULL;
+	static int64_t shownUsec = -1;
 
-		/* Get the next frame that should be displayed next */
-		video = video_get_next_frame(video, videofilename);
+	if(player == NULL) // if it is our first time
+	{
+		/* Start decoding frames on another thread. */
+		int numFrames = kuhl_config_int("videoplay.frames", 8, 8);
+		player = video_player_new(videofilename, useYuv ? VIDEO_YUV420 : VIDEO_RGB, numFrames);
+		if(player == NULL)
+		{
+			msg(MSG_FATAL, "Failed to load video file %s\n", videofilename);
+			exit(EXIT_FAILURE);
+		}
+		video = video_player_info(player);
+		startTime = kuhl_microseconds();
 	}
 
-}
+	/* Start over at the end of the video. */
+	if(video_player_eof(player))
+		seek_video(0);
 
+	/* Get the frame that should be on the screen now. The player
+	 * drops frames if we are behind and repeats frames if the next
+	 * one isn't due yet. Only upload it if it changed. */
+	const video_frame *frame = video_player_get(player, kuhl_microseconds()-startTime);
+	if(frame == NULL || (frame == shown && frame->usec == shownUsec))
+		return;
+	show_frame(frame);
+	shown = frame;
+	shownUsec = frame->usec;
+}
 
 /* Called by GLFW whenever a key is pressed. */
 void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -84,6 +116,14 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 		case GLFW_KEY_ESCAPE:
 			glfwSetWindowShouldClose(window, GL_TRUE);
 			break;
+		case GLFW_KEY_LEFT:  // jump back 5 seconds
+			if(player)
+				seek_video(kuhl_microseconds()-startTime - 5000000);
+			break;
+		case GLFW_KEY_RIGHT: // jump forward 5 seconds
+			if(player)
+				seek_video(kuhl_microseconds()-startTime + 5000000);
+			break;
 	}
 }
 
@@ -93,7 +133,17 @@ void display()
 	static int counter = 0;
 	counter++;
 	if(counter % 60 == 0)
+	{
 		msg(MSG_INFO, "FPS: %0.2f\n", bufferswap_fps());
+		if(player)
+		{
+			video_player_stats stats;
+			video_player_get_stats(player, &stats);
+			msg(MSG_DEBUG, "Video frames: decoded=%d displayed=%d dropped=%d repeated=%d; decode time avg=%.0f stdev=%.0f max=%ld usec",
+			    stats.decoded, stats.displayed, stats.dropped, stats.repeated,
+			    stats.decodeAvg, stats.decodeStdev, stats.decodeMax);
+		}
+	}
 	
 	/* Render the scene once for each viewport. Frequently one
 	 * viewport will fill the entire screen. However, this loop will
@@ -164,6 +214,11 @@ void display()
 		                   1, // number of 4x4 float matrices
 		                   0, // transpose
 		                   modelview); // value
+		if(useYuv && video != NULL)
+		{
+			glUniform1i(kuhl_get_uniform("Bt709"), video->bt709);
+			glUniform1i(kuhl_get_uniform("FullRange"), video->fullRange);
+		}
 		kuhl_errorcheck();
 		/* Draw the geometry using the matrices that we sent to the
 		 * vertex programs immediately above */
@@ -238,7 +293,11 @@ int main(int argc, char** argv)
 
 	/* Compile and link a GLSL program composed of a vertex shader and
 	 * a fragment shader. */
-	program = kuhl_create_program("texture.vert", "texture.frag");
+	useYuv = kuhl_config_boolean("videoplay.yuv", 1, 1);
+	if(useYuv)
+		program = kuhl_create_program("texture.vert", "videoplay-yuv.frag");
+	else
+		program = kuhl_create_program("texture.vert", "texture.frag");
 	glUseProgram(program);
 	kuhl_errorcheck();
 
@@ -263,5 +322,6 @@ int main(int argc, char** argv)
 		glfwPollEvents();
 	}
 
+	video_player_free(player);
 	exit(EXIT_SUCCESS);
 }
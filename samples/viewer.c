@@ -268,7 +268,13 @@ void display()
 			
 			float fps = bufferswap_fps(); // get current fps
 			char message[1024];
-			snprintf(message, 1024, "FPS: %0.2f", fps); // make a string with fps in it
+			int len = snprintf(message, 1024, "FPS: %0.2f", fps); // make a string with fps in it
+
+			/* If gputimer.enabled is set, add where the GPU time
+			 * goes (see gputimer.c). */
+			char gpuTimes[768];
+			if(gputimer_summary(gpuTimes, sizeof(gpuTimes)) > 0)
+				snprintf(message+len, 1024-len, " | %s", gpuTimes);
 			float labelColor[3] = { 1.0f,1.0f,1.0f };
 			float labelBg[4] = { 0.0f,0.0f,0.0f,.3f };
 
@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "boids.h"
+#include "kuhl-nodep.h"
+
+/* Measures how many agents the flocking simulation updates per
+ * second with different numbers of threads. Doesn't need a window or
+ * OpenGL. Usage: bench-boids [agents] [steps] */
+
+#define DEFAULT_AGENTS 50000
+#define DEFAULT_STEPS 100
+
+static void run(int agents, int steps, int threads)
+{
+	boids_params params;
+	boids_params_default(&params);
+	params.threads = threads;
+	boids *b = boids_new(agents, &params, 1);
+
+	/* Let the flock form before timing it; the first updates are
+	 * faster because the agents are spread out evenly. */
+	for(int i=0; i<10; i++)
+		boids_update(b, 1/60.0f);
+
+	long start = kuhl_microseconds();
+	for(int i=0; i<steps; i++)
+		boids_update(b, 1/60.0f);
+	long elapsed = kuhl_microseconds() - start;
+
+	printf("%7d agents %2d threads: %8.3f ms/update  %7.2f million agents/sec\n",
+	       agents, boids_threads(b), elapsed/1000.0/steps,
+	       (double)agents*steps/elapsed);
+	boids_free(b);
+}
+
+int main(int argc, char *argv[])
+{
+	int agents = DEFAULT_AGENTS;
+	int steps = DEFAULT_STEPS;
+	if(argc > 1)
+		agents = atoi(argv[1]);
+	if(argc > 2)
+		steps = atoi(argv[2]);
+	if(agents < 1 || steps < 1)
+	{
+		printf("Usage: %s [agents] [steps]\n", argv[0]);
+		return 1;
+	}
+
+	int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	for(int threads=1; threads<cpus; threads*=2)
+		run(agents, steps, threads);
+	run(agents, steps, cpus);
+	return 0;
+}
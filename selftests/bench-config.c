@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "kuhl-config.h"
+#include "kuhl-nodep.h"
+
+/* Compares the cost of reading settings every frame: The linked list
+ * lookup that cfg_get() used to do, kuhl_config_float() (which uses
+ * the hash index in cfg_parse.c) and kuhl_config_handle_float(). Also
+ * checks that all three return the same values. */
+
+#define NUM_KEYS 80
+#define NUM_READS 2000000
+
+/* The keys of a typical settings file plus the includes it pulls in. */
+static char keys[NUM_KEYS][32];
+
+typedef struct node
+{
+	char *key;
+	char *value;
+	struct node *next;
+} node;
+
+/** The lookup that cfg_get() did before it had a hash index: trim and
+ * lowercase a malloc()'d copy of the key and walk a list. */
+static const char* list_get(const node *head, const char *key)
+{
+	while(isspace(*key))
+		key++;
+	int len = (int) strlen(key);
+	while(len > 0 && isspace(key[len-1]))
+		len--;
+	char *tkey = malloc(len+1);
+	for(int i=0; i<len; i++)
+		tkey[i] = (char) tolower(key[i]);
+	tkey[len] = '\0';
+
+	for(const node *n = head; n != NULL; n = n->next)
+	{
+		if(strcmp(n->key, tkey) == 0)
+		{
+			free(tkey);
+			return n->value;
+		}
+	}
+	free(tkey);
+	return NULL;
+}
+
+static void report(const char *test, long usec)
+{
+	printf("%-24s %8.2f ms  %6.1f ns/read\n", test, usec/1000.0, usec*1000.0/NUM_READS);
+}
+
+int main(void)
+{
+	char filename[] = "/tmp/bench-config-XXXXXX";
+	int fd = mkstemp(filename);
+	if(fd < 0)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	FILE *f = fdopen(fd, "w");
+
+	/* Write the keys we read last at the start of the file. Since
+	 * cfg_set() prepends to the list, they end up at the end of the
+	 * list like they would in a settings file with includes. */
+	node *head = NULL;
+	for(int i=0; i<NUM_KEYS; i++)
+	{
+		if(i == 0)
+			strcpy(keys[i], "nearplane");
+		else if(i == 1)
+			strcpy(keys[i], "farplane");
+		else if(i == 2)
+			strcpy(keys[i], "vfov");
+		else
+			snprintf(keys[i], sizeof(keys[i]), "section%d.setting%d", i%7, i);
+		char value[32];
+		snprintf(value, sizeof(value), "%d.5", i);
+		fprintf(f, "%s = %s\n", keys[i], value);
+
+		node *n = malloc(sizeof(node));
+		n->key = strdup(keys[i]);
+		n->value = strdup(value);
+		n->next = head;
+		head = n;
+	}
+	fclose(f);
+	kuhl_config_filename(filename);
+
+	static kuhl_config_handle nearHandle = KUHL_CONFIG_HANDLE("nearplane");
+	static kuhl_config_handle farHandle = KUHL_CONFIG_HANDLE("farplane");
+	static kuhl_config_handle vfovHandle = KUHL_CONFIG_HANDLE("vfov");
+
+	/* Check that everything agrees. */
+	int errors = 0;
+	for(int i=0; i<NUM_KEYS; i++)
+	{
+		float a = (float) atof(list_get(head, keys[i]));
+		float b = kuhl_config_float(keys[i], -1, -1);
+		if(a != b)
+		{
+			printf("ERROR: %s is %f in the list but %f in the config\n", keys[i], a, b);
+			errors++;
+		}
+	}
+	if(kuhl_config_handle_float(&nearHandle, -1, -1) != kuhl_config_float("nearplane", -1, -1) ||
+	   kuhl_config_handle_float(&vfovHandle, -1, -1) != kuhl_config_float(" VFOV ", -1, -1) ||
+	   kuhl_config_handle_int(&farHandle, -1, -1) != 1)
+	{
+		printf("ERROR: a handle doesn't match kuhl_config_float()\n");
+		errors++;
+	}
+
+	/* Read the three settings that get_frustum() reads every frame. */
+	volatile float sink = 0;
+	long start = kuhl_microseconds();
+	for(int i=0; i<NUM_READS; i+=3)
+	{
+		sink += (float) atof(list_get(head, "nearplane"));
+		sink += (float) atof(list_get(head, "farplane"));
+		sink += (float) atof(list_get(head, "vfov"));
+	}
+	report("linked list + atof", kuhl_microseconds()-start);
+
+	start = kuhl_microseconds();
+	for(int i=0; i<NUM_READS; i+=3)
+	{
+		sink += kuhl_config_float("nearplane", 0.1f, 0.1f);
+		sink += kuhl_config_float("farplane", 200.0f, 200.0f);
+		sink += kuhl_config_float("vfov", 65.0f, 65.0f);
+	}
+	report("kuhl_config_float", kuhl_microseconds()-start);
+
+	start = kuhl_microseconds();
+	for(int i=0; i<NUM_READS; i+=3)
+	{
+		sink += kuhl_config_handle_float(&nearHandle, 0.1f, 0.1f);
+		sink += kuhl_config_handle_float(&farHandle, 200.0f, 200.0f);
+		sink += kuhl_config_handle_float(&vfovHandle, 65.0f, 65.0f);
+	}
+	report("kuhl_config_handle_float", kuhl_microseconds()-start);
+
+	/* Handles must notice when a different file is loaded. */
+	f = fopen(filename, "w");
+	fprintf(f, "nearplane=0.25\n");
+	fclose(f);
+	kuhl_config_filename(NULL);
+	kuhl_config_filename(filename);
+	if(kuhl_config_handle_float(&nearHandle, -1, -1) != 0.25f ||
+	   kuhl_config_handle_float(&vfovHandle, -1, -1) != -1)
+	{
+		printf("ERROR: handles weren't updated when the config file changed\n");
+		errors++;
+	}
+	unlink(filename);
+
+	while(head != NULL)
+	{
+		node *next = head->next;
+		free(head->key);
+		free(head->value);
+		free(head);
+		head = next;
+	}
+
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
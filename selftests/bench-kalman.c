@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "kalman.h"
+#include "kalman-batch.h"
+#include "kuhl-nodep.h"
+
+/* Compares the time needed to filter tracker records with the scalar
+ * Kalman filter (seven kalman_estimate() calls per record) and the
+ * batched filter (all objects filtered in one kalman_batch_run()
+ * call). */
+
+#define RECORDS 20000 // records per object
+
+static volatile float sink; // keep the compiler from removing work
+
+static long bench_scalar(int numObjects)
+{
+	kalman_state *k = (kalman_state*) malloc(sizeof(kalman_state)*7*numObjects);
+	for(int i=0; i<7*numObjects; i++)
+		kalman_initialize(&k[i], 0.00004f, 0.01f);
+
+	long start = kuhl_microseconds();
+	for(int r=0; r<RECORDS; r++)
+	{
+		long usec = r*10000L;
+		for(int o=0; o<numObjects; o++)
+		{
+			float pos[3] = { sinf(r*.01f), o, 1 };
+			float quat[4] = { 0, sinf(r*.005f), 0, cosf(r*.005f) };
+			for(int j=0; j<3; j++)
+				pos[j] = kalman_estimate(&k[o*7+j], pos[j], usec);
+			for(int j=0; j<4; j++)
+				quat[j] = kalman_estimate(&k[o*7+3+j], quat[j], usec);
+			sink = pos[0] + quat[0];
+		}
+	}
+	long elapsed = kuhl_microseconds() - start;
+	free(k);
+	return elapsed;
+}
+
+static long bench_batch(int numObjects)
+{
+	kalman_batch *kb = kalman_batch_new(numObjects, 0.00004f, 0.01f, 0.0002f, 0.04f);
+
+	long start = kuhl_microseconds();
+	for(int r=0; r<RECORDS; r++)
+	{
+		long usec = r*10000L;
+		for(int o=0; o<numObjects; o++)
+		{
+			float pos[3] = { sinf(r*.01f), o, 1 };
+			float quat[4] = { 0, sinf(r*.005f), 0, cosf(r*.005f) };
+			kalman_batch_set(kb, o, pos, quat, usec);
+		}
+		kalman_batch_run(kb);
+		for(int o=0; o<numObjects; o++)
+		{
+			float pos[3], quat[4];
+			kalman_batch_get(kb, o, pos, quat, NULL, NULL);
+			sink = pos[0] + quat[0];
+		}
+	}
+	long elapsed = kuhl_microseconds() - start;
+	kalman_batch_free(kb);
+	return elapsed;
+}
+
+int main(void)
+{
+	int objects[] = { 1, 4, 16, 64 };
+	printf("objects   scalar (ns/record)   batch (ns/record)   speedup\n");
+	for(int i=0; i<4; i++)
+	{
+		int n = objects[i];
+		double scalar = bench_scalar(n) * 1000.0 / (RECORDS*n);
+		double batch  = bench_batch(n)  * 1000.0 / (RECORDS*n);
+		printf("%7d   %18.1f   %17.1f   %7.2fx\n", n, scalar, batch, scalar/batch);
+	}
+	return 0;
+}
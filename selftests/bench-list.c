@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "list.h"
+#include "tlist.h"
+#include "kuhl-nodep.h"
+
+/* Compares the speed of list and tlist when appending, reading random
+ * items and sorting. */
+
+TLIST_DECLARE(intlist, int, 16)
+#define INT_LESS(a,b) ((a)<(b))
+TLIST_DECLARE_SORT(intlist, int, INT_LESS)
+
+#define NUM_ITEMS 1000000
+#define NUM_READS 10000000
+
+static int compare_int(const void *a, const void *b)
+{
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char *test, long listUsec, long tlistUsec)
+{
+	printf("%-14s list: %8.2f ms  tlist: %8.2f ms  speedup: %5.1fx\n", test,
+	       listUsec/1000.0, tlistUsec/1000.0, tlistUsec > 0 ? listUsec/(double)tlistUsec : 0);
+}
+
+int main(void)
+{
+	int *values = malloc(sizeof(int)*NUM_ITEMS);
+	int *indices = malloc(sizeof(int)*NUM_READS);
+	srand(1);
+	for(int i=0; i<NUM_ITEMS; i++)
+		values[i] = rand();
+	for(int i=0; i<NUM_READS; i++)
+		indices[i] = rand() % NUM_ITEMS;
+
+	list *l = list_new(0, sizeof(int), compare_int);
+	intlist tl;
+	intlist_init(&tl);
+
+	/* Append */
+	long start = kuhl_microseconds();
+	for(int i=0; i<NUM_ITEMS; i++)
+		list_append(l, &values[i]);
+	long listTime = kuhl_microseconds()-start;
+
+	start = kuhl_microseconds();
+	for(int i=0; i<NUM_ITEMS; i++)
+		intlist_append(&tl, values[i]);
+	long tlistTime = kuhl_microseconds()-start;
+	report("append", listTime, tlistTime);
+
+	/* Bulk append */
+	intlist bulk;
+	intlist_init(&bulk);
+	start = kuhl_microseconds();
+	intlist_append_many(&bulk, values, NUM_ITEMS);
+	report("append_many", listTime, kuhl_microseconds()-start);
+	intlist_free(&bulk);
+
+	/* Random access */
+	long listSum = 0, tlistSum = 0;
+	start = kuhl_microseconds();
+	for(int i=0; i<NUM_READS; i++)
+	{
+		int x;
+		list_get(l, indices[i], &x);
+		listSum += x;
+	}
+	listTime = kuhl_microseconds()-start;
+
+	start = kuhl_microseconds();
+	for(int i=0; i<NUM_READS; i++)
+		tlistSum += intlist_get(&tl, indices[i]);
+	tlistTime = kuhl_microseconds()-start;
+	report("random get", listTime, tlistTime);
+	if(listSum != tlistSum)
+		printf("ERROR: list and tlist contain different values\n");
+
+	/* Sort */
+	start = kuhl_microseconds();
+	list_sort(l);
+	listTime = kuhl_microseconds()-start;
+
+	intlist copy;
+	intlist_copy(&copy, &tl);
+	start = kuhl_microseconds();
+	intlist_sort(&tl, compare_int);
+	tlistTime = kuhl_microseconds()-start;
+	report("sort", listTime, tlistTime);
+
+	start = kuhl_microseconds();
+	intlist_sort_fast(&copy);
+	tlistTime = kuhl_microseconds()-start;
+	report("sort_fast", listTime, tlistTime);
+
+	for(int i=0; i<NUM_ITEMS; i++)
+	{
+		int x;
+		list_get(l, i, &x);
+		if(x != intlist_get(&tl, i) || x != intlist_get(&copy, i))
+		{
+			printf("ERROR: Sorted lists differ at index %d\n", i);
+			break;
+		}
+	}
+
+	list_free(l);
+	intlist_free(&tl);
+	intlist_free(&copy);
+	free(values);
+	free(indices);
+	return 0;
+}
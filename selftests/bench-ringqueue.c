@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ringqueue.h"
+#include "queue.h"
+#include "kuhl-nodep.h"
+
+/* Measures the throughput of the lock-free queues. For comparison,
+ * the single-threaded queue is protected by a mutex. Items are 32 bytes,
+ * which is roughly the size of a tracker sample. */
+
+#define NUM_ITEMS 4000000
+#define MAX_THREADS 8
+
+typedef struct {
+	double value[4];
+} item;
+
+static ringqueue_spsc *spsc;
+static ringqueue_mpmc *mpmc;
+static queue *locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int itemsPerProducer;
+static long consumedTotal;
+
+static void* spsc_producer(void *arg)
+{
+	(void) arg;
+	item it = { { 0, 0, 0, 0 } };
+	for(int i=0; i<NUM_ITEMS; i++)
+	{
+		it.value[0] = i;
+		while(!ringqueue_spsc_add(spsc, &it))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void* spsc_consumer(void *arg)
+{
+	(void) arg;
+	item it;
+	for(int i=0; i<NUM_ITEMS; i++)
+		while(!ringqueue_spsc_remove(spsc, &it))
+			sched_yield();
+	return NULL;
+}
+
+static void* mpmc_producer(void *arg)
+{
+	(void) arg;
+	item it = { { 0, 0, 0, 0 } };
+	for(int i=0; i<itemsPerProducer; i++)
+		while(!ringqueue_mpmc_add(mpmc, &it))
+			sched_yield();
+	return NULL;
+}
+
+static void* mpmc_consumer(void *arg)
+{
+	(void) arg;
+	item it;
+	while(__atomic_load_n(&consumedTotal, __ATOMIC_RELAXED) < NUM_ITEMS)
+	{
+		if(ringqueue_mpmc_remove(mpmc, &it))
+			__atomic_add_fetch(&consumedTotal, 1, __ATOMIC_RELAXED);
+		else
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void* locked_producer(void *arg)
+{
+	(void) arg;
+	item it = { { 0, 0, 0, 0 } };
+	for(int i=0; i<itemsPerProducer; i++)
+	{
+		for(;;)
+		{
+			pthread_mutex_lock(&lock);
+			int full = queue_length(locked) >= 1024;
+			if(!full)
+				queue_add(locked, &it);
+			pthread_mutex_unlock(&lock);
+			if(!full)
+				break;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void* locked_consumer(void *arg)
+{
+	(void) arg;
+	item it;
+	while(__atomic_load_n(&consumedTotal, __ATOMIC_RELAXED) < NUM_ITEMS)
+	{
+		pthread_mutex_lock(&lock);
+		int ok = queue_length(locked) > 0 && queue_remove(locked, &it);
+		pthread_mutex_unlock(&lock);
+		if(ok)
+			__atomic_add_fetch(&consumedTotal, 1, __ATOMIC_RELAXED);
+		else
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void run(const char *name, int producers, int consumers,
+                void* (*producer)(void*), void* (*consumer)(void*))
+{
+	pthread_t p[MAX_THREADS], c[MAX_THREADS];
+	itemsPerProducer = NUM_ITEMS / producers;
+	consumedTotal = 0;
+
+	long start = kuhl_microseconds();
+	for(int i=0; i<consumers; i++)
+		pthread_create(&c[i], NULL, consumer, NULL);
+	for(int i=0; i<producers; i++)
+		pthread_create(&p[i], NULL, producer, NULL);
+	for(int i=0; i<producers; i++)
+		pthread_join(p[i], NULL);
+	for(int i=0; i<consumers; i++)
+		pthread_join(c[i], NULL);
+	long elapsed = kuhl_microseconds() - start;
+
+	printf("%-6s %dP/%dC: %8.2f ms  %7.2f million items/sec\n", name, producers, consumers,
+	       elapsed/1000.0, NUM_ITEMS/(double)elapsed);
+}
+
+int main(void)
+{
+	spsc = ringqueue_spsc_new(1024, sizeof(item));
+	mpmc = ringqueue_mpmc_new(1024, sizeof(item));
+	locked = queue_new(1024, sizeof(item));
+
+	run("spsc", 1, 1, spsc_producer, spsc_consumer);
+	run("mpmc", 1, 1, mpmc_producer, mpmc_consumer);
+	run("mpmc", 2, 2, mpmc_producer, mpmc_consumer);
+	run("mpmc", 4, 4, mpmc_producer, mpmc_consumer);
+	run("mutex", 1, 1, locked_producer, locked_consumer);
+	run("mutex", 4, 4, locked_producer, locked_consumer);
+
+	ringqueue_spsc_free(spsc);
+	ringqueue_mpmc_free(mpmc);
+	queue_free(locked);
+	return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "vecmat.h"
+#include "kuhl-nodep.h"
+
+/* Compares the batch operations in vecmat-batch.c with calling the
+ * scalar vecmat.h functions once per vector or matrix. Each
+ * instruction set that this computer supports is timed separately,
+ * and the results of each are checked against the scalar
+ * functions. */
+
+#define COUNT 4096    // vectors or matrices per batch
+#define REPEAT 500    // batches per measurement
+
+static volatile float sink; // keep the compiler from removing work
+static int errors = 0;
+
+static float randf(void)
+{
+	return (float) (rand() / (double) RAND_MAX * 2 - 1);
+}
+
+static void check(const char *what, int level, const float *expected, const float *actual, size_t n)
+{
+	for(size_t i=0; i<n; i++)
+	{
+		if(fabsf(expected[i]-actual[i]) > 1e-5f * (1+fabsf(expected[i])))
+		{
+			printf("ERROR: %s (%s) element %lu: expected %f, found %f\n",
+			       what, vecmat_simd_name(level), (unsigned long) i, expected[i], actual[i]);
+			errors++;
+			return;
+		}
+	}
+}
+
+int main(void)
+{
+	float *vecs   = (float*) malloc(sizeof(float)*4*COUNT);
+	float *mats   = (float*) malloc(sizeof(float)*16*COUNT);
+	float *mats2  = (float*) malloc(sizeof(float)*16*COUNT);
+	float *out    = (float*) malloc(sizeof(float)*16*COUNT);
+	float *refVec = (float*) malloc(sizeof(float)*4*COUNT);
+	float *refPt  = (float*) malloc(sizeof(float)*3*COUNT);
+	float *refMat = (float*) malloc(sizeof(float)*16*COUNT);
+	float m[16];
+	for(int i=0; i<16; i++)
+		m[i] = randf();
+	for(int i=0; i<4*COUNT; i++)
+		vecs[i] = randf();
+	for(int i=0; i<16*COUNT; i++)
+	{
+		mats[i] = randf();
+		mats2[i] = randf();
+	}
+
+	/* Scalar, one call per vector/matrix. */
+	long start = kuhl_microseconds();
+	for(int r=0; r<REPEAT; r++)
+	{
+		for(int i=0; i<COUNT; i++)
+			mat4f_mult_vec4f_new(refVec+i*4, m, vecs+i*4);
+		sink = refVec[r];
+	}
+	double scalarVec = (kuhl_microseconds() - start) * 1000.0 / (REPEAT*COUNT);
+
+	start = kuhl_microseconds();
+	for(int r=0; r<REPEAT; r++)
+	{
+		for(int i=0; i<COUNT; i++)
+		{
+			float v[4] = { vecs[i*3], vecs[i*3+1], vecs[i*3+2], 1 };
+			mat4f_mult_vec4f_new(v, m, v);
+			vec3f_copy(refPt+i*3, v);
+		}
+		sink = refPt[r];
+	}
+	double scalarPt = (kuhl_microseconds() - start) * 1000.0 / (REPEAT*COUNT);
+
+	start = kuhl_microseconds();
+	for(int r=0; r<REPEAT; r++)
+	{
+		for(int i=0; i<COUNT; i++)
+			mat4f_mult_mat4f_new(refMat+i*16, mats+i*16, mats2+i*16);
+		sink = refMat[r];
+	}
+	double scalarMat = (kuhl_microseconds() - start) * 1000.0 / (REPEAT*COUNT);
+
+	printf("Time per vector or matrix in nanoseconds (speedup compared to calling vecmat.h functions in a loop):\n");
+	printf("%-20s %16s %16s %16s\n", "", "mat4*vec4", "mat4*point3", "mat4*mat4");
+	printf("%-20s %16.2f %16.2f %16.2f\n", "vecmat.h loop", scalarVec, scalarPt, scalarMat);
+
+	for(int level=0; level<VECMAT_SIMD_COUNT; level++)
+	{
+		if(!vecmat_simd_supported(level))
+			continue;
+		vecmat_simd_set(level);
+
+		start = kuhl_microseconds();
+		for(int r=0; r<REPEAT; r++)
+		{
+			mat4f_mult_vec4f_array(out, m, vecs, COUNT);
+			sink = out[r];
+		}
+		double vec = (kuhl_microseconds() - start) * 1000.0 / (REPEAT*COUNT);
+		check("mat4f_mult_vec4f_array", level, refVec, out, 4*COUNT);
+
+		start = kuhl_microseconds();
+		for(int r=0; r<REPEAT; r++)
+		{
+			mat4f_mult_point3f_array(out, m, vecs, COUNT);
+			sink = out[r];
+		}
+		double pt = (kuhl_microseconds() - start) * 1000.0 / (REPEAT*COUNT);
+		check("mat4f_mult_point3f_array", level, refPt, out, 3*COUNT);
+
+		start = kuhl_microseconds();
+		for(int r=0; r<REPEAT; r++)
+		{
+			mat4f_mult_mat4f_array(out, mats, mats2, COUNT);
+			sink = out[r];
+		}
+		double mat = (kuhl_microseconds() - start) * 1000.0 / (REPEAT*COUNT);
+		check("mat4f_mult_mat4f_array", level, refMat, out, 16*COUNT);
+
+		/* Check the other functions, and that they work in place. */
+		for(int i=0; i<COUNT; i++)
+			mat4f_mult_mat4f_new(refMat+i*16, m, mats2+i*16);
+		for(int i=0; i<16*COUNT; i++)
+			out[i] = mats2[i];
+		mat4f_mult_mat4f_each(out, m, out, COUNT);
+		check("mat4f_mult_mat4f_each", level, refMat, out, 16*COUNT);
+		for(int i=0; i<COUNT; i++)
+			mat4f_mult_mat4f_new(refMat+i*16, mats+i*16, mats2+i*16);
+
+		for(int i=0; i<4*COUNT; i++)
+			out[i] = vecs[i];
+		mat4f_mult_vec4f_array(out, m, out, COUNT);
+		check("mat4f_mult_vec4f_array in place", level, refVec, out, 4*COUNT);
+		for(int i=0; i<3*COUNT; i++)
+			out[i] = vecs[i];
+		mat4f_mult_point3f_array(out, m, out, COUNT);
+		check("mat4f_mult_point3f_array in place", level, refPt, out, 3*COUNT);
+
+		char label[64];
+		snprintf(label, 64, "batch (%s)", vecmat_simd_name(level));
+		printf("%-20s %8.2f (%4.1fx) %8.2f (%4.1fx) %8.2f (%4.1fx)\n", label,
+		       vec, scalarVec/vec, pt, scalarPt/pt, mat, scalarMat/mat);
+	}
+	vecmat_simd_set(vecmat_simd_best());
+	printf("Using %s by default.\n", vecmat_simd_name(vecmat_simd_get()));
+
+	free(vecs);
+	free(mats);
+	free(mats2);
+	free(out);
+	free(refVec);
+	free(refPt);
+	free(refMat);
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include "video.h"
+#include "kuhl-nodep.h"
+
+/* Decodes a video without opening a window and reports how quickly
+ * frames were decoded. Usage:
+
+   bench-video video.mp4 [rgb|yuv] [seconds]
+
+   The first test decodes every frame as fast as possible. The second
+   test simulates a 60Hz display for the specified number of seconds
+   (default 10) and reports how many frames were dropped or repeated.
+*/
+
+static void print_stats(video_player *p)
+{
+	video_player_stats s;
+	video_player_get_stats(p, &s);
+	printf("  decoded=%d displayed=%d dropped=%d repeated=%d\n",
+	       s.decoded, s.displayed, s.dropped, s.repeated);
+	printf("  decode time: avg=%.0f stdev=%.0f max=%ld usec\n",
+	       s.decodeAvg, s.decodeStdev, s.decodeMax);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 2)
+	{
+		printf("Usage: %s video.mp4 [rgb|yuv] [seconds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	video_format format = VIDEO_YUV420;
+	if(argc > 2 && strcmp(argv[2], "rgb") == 0)
+		format = VIDEO_RGB;
+	int seconds = 10;
+	if(argc > 3)
+		seconds = atoi(argv[3]);
+
+	/* Test 1: Decode every frame as fast as possible. */
+	video_player *p = video_player_new(argv[1], format, 8);
+	if(p == NULL)
+	{
+		printf("ERROR: Unable to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	long start = kuhl_microseconds();
+	long prev = start;
+	int frames = 0;
+	double sum = 0, sumSq = 0;
+	long maxGap = 0;
+	while(!video_player_eof(p))
+	{
+		if(video_player_next(p) == NULL)
+		{
+			usleep(100);
+			continue;
+		}
+		long now = kuhl_microseconds();
+		long gap = now - prev;
+		prev = now;
+		frames++;
+		if(frames == 1) // don't include the time to decode the first frame
+			continue;
+		sum += gap;
+		sumSq += (double) gap*gap;
+		if(gap > maxGap)
+			maxGap = gap;
+	}
+	long elapsed = kuhl_microseconds() - start;
+	double avg = frames > 1 ? sum/(frames-1) : 0;
+	double var = frames > 1 ? sumSq/(frames-1) - avg*avg : 0;
+	printf("Decoded %d frames (%dx%d %s) in %.2f seconds: %.1f FPS\n", frames,
+	       video_player_info(p)->width, video_player_info(p)->height,
+	       format == VIDEO_RGB ? "rgb" : "yuv", elapsed/1000000.0, frames/(elapsed/1000000.0));
+	printf("  time between frames: avg=%.0f jitter(stdev)=%.0f max=%ld usec\n",
+	       avg, var > 0 ? sqrt(var) : 0, maxGap);
+	print_stats(p);
+	video_player_free(p);
+
+	/* Test 2: Play the video in real time on a simulated 60Hz
+	 * display. */
+	p = video_player_new(argv[1], format, 8);
+	if(p == NULL)
+	{
+		printf("ERROR: Unable to open %s again\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	start = kuhl_microseconds();
+	long nextVsync = start;
+	while(kuhl_microseconds() - start < seconds*1000000L && !video_player_eof(p))
+	{
+		video_player_get(p, kuhl_microseconds()-start);
+		nextVsync += 16667;
+		long sleep = nextVsync - kuhl_microseconds();
+		if(sleep > 0)
+			usleep(sleep);
+	}
+	printf("Played %d seconds at 60Hz:\n", seconds);
+	print_stats(p);
+	video_player_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "kalman.h"
+#include "kalman-batch.h"
+#include "tdl-util.h"
+#include "vecmat.h"
+
+/* Compares the batched Kalman filter (kalman-batch.c) against the
+ * original scalar filter (kalman.c) which vrpn-help.cpp used to run on
+ * each position and quaternion component separately.
+
+   selftest-kalman [recording.tdl] [hz]
+
+   hz is only used for version 1 TDL files, which lack timestamps.
+
+   Without arguments, a synthetic head motion with measurement noise
+   is filtered and both filters are compared against the true
+   motion. With a TDL file (see vrpn/recorder.c), the recorded data is
+   filtered; since the true motion is unknown, we report how far the
+   filtered data is from the recorded data and how smooth it is.
+*/
+
+#define SKIP 200 // ignore the first records while the filters settle
+
+static int errors = 0;
+
+typedef struct {
+	double posErr, angErr;   /* Sum of squared errors */
+	double posJerk, angJerk; /* Sum of squared second differences */
+	double maxNormErr;       /* Largest |1-|quat|| */
+	float prevPos[2][3], prevQuat[2][4];
+	int n;
+} filter_stats;
+
+static double angle_between(const float a[4], const float b[4])
+{
+	double d = fabs(vec4f_dot(a,b)) / (vec4f_norm(a)*vec4f_norm(b));
+	if(d > 1)
+		d = 1;
+	return 2*acos(d) * 180/M_PI;
+}
+
+static void stats_add(filter_stats *s, int i, const float pos[3], const float quat[4],
+                      const float refPos[3], const float refQuat[4])
+{
+	if(i >= SKIP)
+	{
+		float diff[3];
+		vec3f_sub_new(diff, pos, refPos);
+		s->posErr += vec3f_normSq(diff);
+		double ang = angle_between(quat, refQuat);
+		s->angErr += ang*ang;
+		double normErr = fabs(1-vec4f_norm(quat));
+		if(normErr > s->maxNormErr)
+			s->maxNormErr = normErr;
+
+		/* Second difference: how much the filtered motion jitters. */
+		for(int j=0; j<3; j++)
+		{
+			double d2 = pos[j] - 2*s->prevPos[0][j] + s->prevPos[1][j];
+			s->posJerk += d2*d2;
+		}
+		double a1 = angle_between(quat, s->prevQuat[0]);
+		double a2 = angle_between(s->prevQuat[0], s->prevQuat[1]);
+		s->angJerk += (a1-a2)*(a1-a2);
+		s->n++;
+	}
+	vec3f_copy(s->prevPos[1], s->prevPos[0]);
+	vec3f_copy(s->prevPos[0], pos);
+	vec4f_copy(s->prevQuat[1], s->prevQuat[0]);
+	vec4f_copy(s->prevQuat[0], quat);
+}
+
+static void stats_print(const char *name, const filter_stats *s)
+{
+	printf("%-10s pos RMS=%7.3fmm  angle RMS=%6.4fdeg  pos jitter=%.4fmm  angle jitter=%.4fdeg  max |1-|q||=%.2g\n",
+	       name, sqrt(s->posErr/s->n)*1000, sqrt(s->angErr/s->n),
+	       sqrt(s->posJerk/s->n)*1000, sqrt(s->angJerk/s->n), s->maxNormErr);
+}
+
+/** Generates a head-like motion: slow swaying and turning. */
+static void synthetic_pose(double t, float pos[3], float quat[4])
+{
+	vec3f_set(pos, 0.1f*sinf(0.7f*t), 1.6f+0.02f*sinf(1.9f*t), 0.05f*cosf(1.3f*t));
+	float yaw[4], pitch[4];
+	quatf_rotateAxis_new(yaw,   60*sinf(0.9f*t), 0,1,0);
+	quatf_rotateAxis_new(pitch, 20*sinf(1.7f*t+1), 1,0,0);
+	/* q = yaw * pitch */
+	quat[0] = yaw[3]*pitch[0] + pitch[3]*yaw[0] + yaw[1]*pitch[2] - yaw[2]*pitch[1];
+	quat[1] = yaw[3]*pitch[1] + pitch[3]*yaw[1] + yaw[2]*pitch[0] - yaw[0]*pitch[2];
+	quat[2] = yaw[3]*pitch[2] + pitch[3]*yaw[2] + yaw[0]*pitch[1] - yaw[1]*pitch[0];
+	quat[3] = yaw[3]*pitch[3] - yaw[0]*pitch[0] - yaw[1]*pitch[1] - yaw[2]*pitch[2];
+}
+
+static float gaussian(float sigma)
+{
+	/* Box-Muller transform */
+	double u1 = (rand()+1.0) / (RAND_MAX+2.0);
+	double u2 = (rand()+1.0) / (RAND_MAX+2.0);
+	return (float) (sigma * sqrt(-2*log(u1)) * cos(2*M_PI*u2));
+}
+
+int main(int argc, char **argv)
+{
+	tdl_log *f = NULL;
+	int hz = 100;
+	if(argc > 1)
+	{
+		f = tdl_open(argv[1]);
+		if(f == NULL)
+		{
+			printf("ERROR: Unable to read TDL file %s\n", argv[1]);
+			return 1;
+		}
+		if(argc > 2)
+			hz = atoi(argv[2]);
+	}
+
+	/* Same settings that vrpn-help.cpp uses. */
+	kalman_state scalar[7];
+	for(int i=0; i<3; i++)
+		kalman_initialize(&scalar[i], 0.00004f, 0.01f);
+	for(int i=3; i<7; i++)
+		kalman_initialize(&scalar[i], 0.0001f, 0.01f);
+	kalman_batch *batch = kalman_batch_new(1, 0.00004f, 0.01f, 0.0002f, 0.04f);
+
+	filter_stats sScalar = { 0 }, sBatch = { 0 }, sRaw = { 0 };
+	srand(1);
+	int records = 0;
+	for(int i=0; ; i++)
+	{
+		long usec = i * (1000000L/hz);
+		float truePos[3], trueQuat[4], pos[3], quat[4];
+		if(f)
+		{
+			if((size_t) i == f->count)
+				break;
+			const tdl_record *r = &f->records[i];
+			if(f->hasTimestamps)
+				usec = (long) (r->usec - f->records[0].usec);
+			vec3f_copy(pos, r->pos);
+			vec4f_copy(quat, r->quat);
+			vec3f_copy(truePos, pos); // unknown, compare to measurement
+			vec4f_copy(trueQuat, quat);
+		}
+		else
+		{
+			if(i == 6000) // one minute at 100Hz
+				break;
+			synthetic_pose(usec/1000000.0, truePos, trueQuat);
+			float noise[4];
+			quatf_rotateAxis_new(noise, gaussian(0.2f), gaussian(1), gaussian(1), gaussian(1));
+			for(int j=0; j<3; j++)
+				pos[j] = truePos[j] + gaussian(0.0003f);
+			quat[0] = noise[3]*trueQuat[0] + trueQuat[3]*noise[0] + noise[1]*trueQuat[2] - noise[2]*trueQuat[1];
+			quat[1] = noise[3]*trueQuat[1] + trueQuat[3]*noise[1] + noise[2]*trueQuat[0] - noise[0]*trueQuat[2];
+			quat[2] = noise[3]*trueQuat[2] + trueQuat[3]*noise[2] + noise[0]*trueQuat[1] - noise[1]*trueQuat[0];
+			quat[3] = noise[3]*trueQuat[3] - noise[0]*trueQuat[0] - noise[1]*trueQuat[1] - noise[2]*trueQuat[2];
+		}
+		records++;
+
+		stats_add(&sRaw, i, pos, quat, truePos, trueQuat);
+
+		float fpos[3], fquat[4];
+		for(int j=0; j<3; j++)
+			fpos[j] = kalman_estimate(&scalar[j], pos[j], usec);
+		for(int j=0; j<4; j++)
+			fquat[j] = kalman_estimate(&scalar[3+j], quat[j], usec);
+		stats_add(&sScalar, i, fpos, fquat, truePos, trueQuat);
+
+		/* Growing the filter (as vrpn-help.cpp does when objects are
+		 * added) must not disturb the objects being filtered. */
+		if(i == 100)
+			kalman_batch_resize(batch, 4);
+		kalman_batch_set(batch, 0, pos, quat, usec);
+		kalman_batch_run(batch);
+		kalman_batch_get(batch, 0, fpos, fquat, NULL, NULL);
+		stats_add(&sBatch, i, fpos, fquat, truePos, trueQuat);
+	}
+	tdl_close(f);
+	if(records <= SKIP+10)
+	{
+		printf("ERROR: Only %d records were read.\n", records);
+		return 1;
+	}
+
+	printf("%d records; errors are relative to the %s.\n", records, f ? "recorded data" : "true motion");
+	stats_print("unfiltered", &sRaw);
+	stats_print("scalar", &sScalar);
+	stats_print("batch", &sBatch);
+
+	if(sBatch.maxNormErr > 1e-5)
+	{
+		printf("ERROR: batch filter produced a quaternion which isn't unit length.\n");
+		errors++;
+	}
+	/* The position filters use the same model, so the results should
+	 * be nearly the same. */
+	if(sBatch.posErr > sScalar.posErr*1.05 + 1e-12)
+	{
+		printf("ERROR: batch position error is larger than scalar position error.\n");
+		errors++;
+	}
+	if(!f)
+	{
+		if(sBatch.angErr > sScalar.angErr*1.10)
+		{
+			printf("ERROR: batch orientation error is larger than scalar orientation error.\n");
+			errors++;
+		}
+		if(sBatch.posErr > sRaw.posErr || sBatch.angErr > sRaw.angErr)
+		{
+			printf("ERROR: batch filter made the data worse.\n");
+			errors++;
+		}
+	}
+
+	kalman_batch_free(batch);
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ringqueue.h"
+
+/* Stress test for the lock-free queues. Producers add items tagged
+ * with the producer number and a sequence number. Consumers check
+ * that nothing is lost or duplicated and that the items from each
+ * producer arrive in order. Threads yield when the queue is full or
+ * empty so that the test also finishes on machines with few cores. */
+
+#define ITEMS_PER_PRODUCER 2000000
+#define MAX_THREADS 8
+
+typedef struct {
+	int producer;
+	int seq;
+} item;
+
+static ringqueue_spsc *spsc;
+static ringqueue_mpmc *mpmc;
+static int numProducers;
+static int numConsumers;
+static int errors = 0;
+static long consumedTotal = 0; /* items removed by all consumers */
+
+/* received[consumer][producer] = number of items received */
+static long received[MAX_THREADS][MAX_THREADS];
+
+static void* spsc_producer(void *arg)
+{
+	(void) arg;
+	for(int i=0; i<ITEMS_PER_PRODUCER; i++)
+	{
+		item it = { 0, i };
+		while(!ringqueue_spsc_add(spsc, &it))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void* spsc_consumer(void *arg)
+{
+	(void) arg;
+	int expected = 0;
+	while(expected < ITEMS_PER_PRODUCER)
+	{
+		item it;
+		if(!ringqueue_spsc_remove(spsc, &it))
+		{
+			sched_yield();
+			continue;
+		}
+		if(it.seq != expected)
+		{
+			printf("ERROR: spsc: expected item %d, received %d\n", expected, it.seq);
+			__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		expected++;
+	}
+	return NULL;
+}
+
+static void* mpmc_producer(void *arg)
+{
+	int producer = (int) (long) arg;
+	for(int i=0; i<ITEMS_PER_PRODUCER; i++)
+	{
+		item it = { producer, i };
+		while(!ringqueue_mpmc_add(mpmc, &it))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void* mpmc_consumer(void *arg)
+{
+	int consumer = (int) (long) arg;
+	int last[MAX_THREADS];
+	for(int i=0; i<MAX_THREADS; i++)
+		last[i] = -1;
+
+	long total = (long) ITEMS_PER_PRODUCER * numProducers;
+	while(__atomic_load_n(&consumedTotal, __ATOMIC_RELAXED) < total)
+	{
+		item it;
+		if(!ringqueue_mpmc_remove(mpmc, &it))
+		{
+			sched_yield();
+			continue;
+		}
+		__atomic_add_fetch(&consumedTotal, 1, __ATOMIC_RELAXED);
+		if(it.producer < 0 || it.producer >= numProducers)
+		{
+			printf("ERROR: mpmc: invalid producer %d\n", it.producer);
+			__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		/* A single consumer must see each producer's items in
+		 * increasing order. */
+		if(it.seq <= last[it.producer])
+		{
+			printf("ERROR: mpmc: consumer %d received item %d from producer %d after item %d\n",
+			       consumer, it.seq, it.producer, last[it.producer]);
+			__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+		}
+		last[it.producer] = it.seq;
+		received[consumer][it.producer]++;
+	}
+	return NULL;
+}
+
+static void test_spsc(void)
+{
+	spsc = ringqueue_spsc_new(1000, sizeof(item));
+	if(ringqueue_spsc_capacity(spsc) != 1024)
+		printf("ERROR: capacity was not rounded up to a power of two\n");
+
+	pthread_t p, c;
+	pthread_create(&p, NULL, spsc_producer, NULL);
+	pthread_create(&c, NULL, spsc_consumer, NULL);
+	pthread_join(p, NULL);
+	pthread_join(c, NULL);
+
+	if(ringqueue_spsc_length(spsc) != 0)
+		printf("ERROR: spsc queue not empty at end of test\n");
+	ringqueue_spsc_free(spsc);
+}
+
+static void test_mpmc(int producers, int consumers)
+{
+	numProducers = producers;
+	numConsumers = consumers;
+	mpmc = ringqueue_mpmc_new(256, sizeof(item));
+	consumedTotal = 0;
+	for(int i=0; i<MAX_THREADS; i++)
+		for(int j=0; j<MAX_THREADS; j++)
+			received[i][j] = 0;
+
+	pthread_t p[MAX_THREADS], c[MAX_THREADS];
+	for(long i=0; i<consumers; i++)
+		pthread_create(&c[i], NULL, mpmc_consumer, (void*) i);
+	for(long i=0; i<producers; i++)
+		pthread_create(&p[i], NULL, mpmc_producer, (void*) i);
+	for(int i=0; i<producers; i++)
+		pthread_join(p[i], NULL);
+	for(int i=0; i<consumers; i++)
+		pthread_join(c[i], NULL);
+
+	for(int j=0; j<producers; j++)
+	{
+		long sum = 0;
+		for(int i=0; i<consumers; i++)
+			sum += received[i][j];
+		if(sum != ITEMS_PER_PRODUCER)
+			printf("ERROR: mpmc: received %ld items from producer %d, expected %d\n", sum, j, ITEMS_PER_PRODUCER);
+	}
+	if(ringqueue_mpmc_length(mpmc) != 0)
+		printf("ERROR: mpmc queue not empty at end of test\n");
+	ringqueue_mpmc_free(mpmc);
+}
+
+static void test_single_thread(void)
+{
+	/* Fill, overflow, then drain */
+	ringqueue_mpmc *q = ringqueue_mpmc_new(4, sizeof(int));
+	for(int i=0; i<4; i++)
+		if(!ringqueue_mpmc_add(q, &i))
+			printf("ERROR: add failed on non-full queue\n");
+	int x = 99;
+	if(ringqueue_mpmc_add(q, &x))
+		printf("ERROR: add succeeded on full queue\n");
+	for(int i=0; i<4; i++)
+		if(!ringqueue_mpmc_remove(q, &x) || x != i)
+			printf("ERROR: removed wrong item\n");
+	if(ringqueue_mpmc_remove(q, &x))
+		printf("ERROR: remove succeeded on empty queue\n");
+	ringqueue_mpmc_free(q);
+}
+
+int main(void)
+{
+	test_single_thread();
+	test_spsc();
+	test_mpmc(1, 1);
+	test_mpmc(4, 1);
+	test_mpmc(4, 4);
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
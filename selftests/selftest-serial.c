@@ -0,0 +1,259 @@
+#define _GNU_SOURCE // posix_openpt(), ptsname()
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "serial-reader.h"
+#include "orient-sensor.h"
+#include "kuhl-nodep.h"
+
+/* Tests serial-reader.c and the threaded orientation sensor code
+ * using a pseudo-terminal in place of a real serial device. The test
+ * writes records to the master side of the pseudo-terminal with
+ * garbage between some of them, one byte at a time and in large
+ * bursts, and checks that every record arrives in order. */
+
+#define MAGIC0 0xAA
+#define MAGIC1 0x55
+#define RECORD_SIZE 12 // 2 magic bytes, 2 padding bytes, int32 seq, float value
+
+static int errors = 0;
+static int expectedSeq = 0;
+
+static void callback(const unsigned char *record, long usec, void *userdata)
+{
+	(void) userdata;
+	int32_t seq;
+	float value;
+	memcpy(&seq, record+4, 4);
+	memcpy(&value, record+8, 4);
+	if(record[0] != MAGIC0 || record[1] != MAGIC1)
+	{
+		printf("ERROR: record %d doesn't start with the magic bytes\n", expectedSeq);
+		errors++;
+	}
+	if(seq != expectedSeq)
+	{
+		printf("ERROR: expected record %d, received %d\n", expectedSeq, seq);
+		errors++;
+	}
+	if(value != seq * 0.5f)
+	{
+		printf("ERROR: record %d contains %f, expected %f\n", seq, value, seq*0.5f);
+		errors++;
+	}
+	if(usec <= 0)
+	{
+		printf("ERROR: record %d has invalid timestamp %ld\n", seq, usec);
+		errors++;
+	}
+	expectedSeq = seq+1;
+}
+
+/** Opens a pseudo-terminal and stores the name of the slave device
+ * in name. */
+static int open_pty(char *name, size_t len)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+	{
+		printf("ERROR: Unable to create pseudo-terminal: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	snprintf(name, len, "%s", ptsname(fd));
+	return fd;
+}
+
+static void write_all(int fd, const unsigned char *buf, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+		{
+			printf("ERROR: write: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+}
+
+static void make_record(unsigned char *buf, int32_t seq)
+{
+	float value = seq * 0.5f;
+	memset(buf, 0, RECORD_SIZE);
+	buf[0] = MAGIC0;
+	buf[1] = MAGIC1;
+	memcpy(buf+4, &seq, 4);
+	memcpy(buf+8, &value, 4);
+}
+
+/** Waits up to 2 seconds for the reader to receive the given number
+ * of records. */
+static void wait_for_records(serial_reader *r, long count)
+{
+	long start = kuhl_microseconds();
+	long records = 0;
+	while(kuhl_microseconds() - start < 2000000)
+	{
+		serial_reader_stats(r, &records, NULL, NULL, NULL);
+		if(records >= count)
+			return;
+		usleep(1000);
+	}
+	printf("ERROR: received %ld records, expected %ld\n", records, count);
+	errors++;
+}
+
+static void test_reader(void)
+{
+	char name[256];
+	int master = open_pty(name, sizeof(name));
+	const unsigned char magic[2] = { MAGIC0, MAGIC1 };
+	serial_reader *r = serial_reader_new(name, 115200, magic, 2, RECORD_SIZE, callback, NULL);
+
+	int connected = 0;
+	serial_reader_stats(r, NULL, NULL, NULL, &connected);
+	if(!connected)
+	{
+		printf("ERROR: reader didn't connect to %s\n", name);
+		errors++;
+	}
+
+	unsigned char record[RECORD_SIZE];
+	int32_t seq = 0;
+
+	/* Records split into single bytes. */
+	for(int i=0; i<20; i++)
+	{
+		make_record(record, seq++);
+		for(int j=0; j<RECORD_SIZE; j++)
+		{
+			write_all(master, record+j, 1);
+			if(j % 5 == 0)
+				usleep(100);
+		}
+	}
+	wait_for_records(r, seq);
+
+	/* Garbage between records. Garbage that starts with the first
+	 * magic byte must be discarded too. */
+	const unsigned char garbage[5][3] = { { 1, 2, 3 }, { MAGIC0, 0, 7 }, { 0, 0, 0 },
+	                                      { MAGIC0, MAGIC0, 9 }, { 42, MAGIC1, 42 } };
+	long garbageBytes = 0;
+	for(int i=0; i<5; i++)
+	{
+		make_record(record, seq++);
+		write_all(master, record, RECORD_SIZE);
+		write_all(master, garbage[i], 3);
+		garbageBytes += 3;
+	}
+	make_record(record, seq++);
+	write_all(master, record, RECORD_SIZE);
+	wait_for_records(r, seq);
+
+	long resyncs, dropped;
+	serial_reader_stats(r, NULL, &resyncs, &dropped, NULL);
+	if(resyncs != 5)
+	{
+		printf("ERROR: expected 5 resyncs, found %ld\n", resyncs);
+		errors++;
+	}
+	if(dropped != garbageBytes)
+	{
+		printf("ERROR: expected %ld dropped bytes, found %ld\n", garbageBytes, dropped);
+		errors++;
+	}
+
+	/* Large bursts, which also wrap around the receive buffer many
+	 * times. */
+	unsigned char burst[RECORD_SIZE*1000];
+	for(int b=0; b<10; b++)
+	{
+		for(int i=0; i<1000; i++)
+			make_record(burst+i*RECORD_SIZE, seq++);
+		write_all(master, burst, sizeof(burst));
+	}
+	wait_for_records(r, seq);
+	if(expectedSeq != seq)
+	{
+		printf("ERROR: last record was %d, expected %d\n", expectedSeq-1, seq-1);
+		errors++;
+	}
+
+	serial_reader_free(r);
+	close(master);
+}
+
+/* Sends records in the format used by the BNO055 sensor and checks
+ * that orient_sensor_get() returns them without blocking. */
+static void test_orient_sensor(void)
+{
+	char name[256];
+	int master = open_pty(name, sizeof(name));
+	OrientSensorState state = orient_sensor_init(name, ORIENT_SENSOR_BNO055);
+
+	/* No data has been sent: orient_sensor_get() must return right away. */
+	float quat[4];
+	long maxTime = 0;
+	for(int i=0; i<1000; i++)
+	{
+		long start = kuhl_microseconds();
+		orient_sensor_get(&state, quat);
+		long elapsed = kuhl_microseconds() - start;
+		if(elapsed > maxTime)
+			maxTime = elapsed;
+	}
+	if(maxTime >= 1000)
+	{
+		printf("ERROR: orient_sensor_get() took %ld microseconds without any data\n", maxTime);
+		errors++;
+	}
+	if(quat[0] != 0 || quat[1] != 0 || quat[2] != 0 || quat[3] != 1)
+	{
+		printf("ERROR: expected identity quaternion before receiving data\n");
+		errors++;
+	}
+
+	unsigned char record[4+4*4+4];
+	float sanity = 123.456f;
+	float sent[4] = { 0.1f, 0.2f, 0.3f, 0.927362f };
+	memcpy(record, &sanity, 4);
+	memcpy(record+4, sent, sizeof(sent));
+	memset(record+4*5, 3, 4); // fully calibrated
+	write_all(master, record, sizeof(record));
+
+	long start = kuhl_microseconds();
+	while(pose_ring_count(orient_sensor_history(&state)) == 0 &&
+	      kuhl_microseconds() - start < 2000000)
+		usleep(1000);
+
+	orient_sensor_get(&state, quat);
+	if(memcmp(quat, sent, sizeof(sent)) != 0)
+	{
+		printf("ERROR: orient_sensor_get() returned %f %f %f %f\n", quat[0], quat[1], quat[2], quat[3]);
+		errors++;
+	}
+	if(!state.isWorking)
+	{
+		printf("ERROR: sensor isn't working after receiving data\n");
+		errors++;
+	}
+	orient_sensor_close(&state);
+	close(master);
+}
+
+int main(void)
+{
+	test_reader();
+	test_orient_sensor();
+
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "tdl-util.h"
+#include "vecmat.h"
+#include "kuhl-nodep.h"
+
+/* Writes version 2 TDL files, reads them back with tdl_open() and
+ * checks that records can be found by time. Also checks that version
+ * 1 files can still be opened. */
+
+#define RECORDS 20000
+
+static int errors = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("ERROR: %s:%d: %s\n", __FILE__, __LINE__, #cond); errors++; } } while(0)
+
+/** Time of record i: roughly 100Hz with jitter and a one second gap
+ * in the middle, so that guessing from the average rate is sometimes
+ * wrong. */
+static int64_t record_time(int i)
+{
+	int64_t t = 1000000000LL + i*10000LL + (i*7919 % 2000);
+	if(i >= RECORDS/2)
+		t += 1000000;
+	return t;
+}
+
+/** Returns the newest record at or before usec by searching every
+ * record. */
+static size_t linear_find(const tdl_log *log, int64_t usec)
+{
+	size_t found = 0;
+	for(size_t i=0; i<log->count; i++)
+		if(log->records[i].usec <= usec)
+			found = i;
+	return found;
+}
+
+static void check_find(const tdl_log *log)
+{
+	srand(1);
+	for(int i=0; i<2000; i++)
+	{
+		int64_t first = log->records[0].usec;
+		int64_t last = log->records[log->count-1].usec;
+		int64_t usec = first - 5000 + (int64_t) ((double) rand() / RAND_MAX * (double) (last-first+10000));
+		size_t expected = linear_find(log, usec);
+		size_t actual = tdl_find(log, usec);
+		if(actual != expected)
+		{
+			printf("ERROR: tdl_find(%lld) returned %lu, expected %lu\n", (long long) usec, (unsigned long) actual, (unsigned long) expected);
+			errors++;
+			return;
+		}
+	}
+	/* Exact times */
+	for(size_t i=0; i<log->count; i += 97)
+		CHECK(tdl_find(log, log->records[i].usec) == i);
+}
+
+int main(void)
+{
+	const char *path = "selftest-tdl.tdl";
+	CHECK(sizeof(tdl_header) == 128);
+	CHECK(sizeof(tdl_record) == 48);
+
+	tdl_writer *w = tdl_writer_open(path, "Tracker0");
+	CHECK(w != NULL);
+	if(w == NULL)
+		return 1;
+	for(int i=0; i<RECORDS; i++)
+	{
+		float pos[3] = { (float) i, 1, 2 };
+		float quat[4];
+		quatf_rotateAxis_new(quat, (float) (i % 360), 0, 1, 0);
+		CHECK(tdl_writer_add(w, record_time(i), pos, quat) == 1);
+	}
+	/* Records which go back in time are rejected. */
+	float zero[4] = { 0, 0, 0, 1 };
+	CHECK(tdl_writer_add(w, record_time(0), zero, zero) == 0);
+
+	/* A file which isn't closed yet has no index, but can still be
+	 * read. */
+	fflush(w->f);
+	tdl_log *log = tdl_open(path);
+	CHECK(log != NULL);
+	if(log)
+	{
+		CHECK(log->count == RECORDS);
+		CHECK(log->index == NULL);
+		check_find(log);
+		tdl_close(log);
+	}
+
+	CHECK(tdl_writer_close(w) == 1);
+
+	log = tdl_open(path);
+	CHECK(log != NULL);
+	if(log == NULL)
+		return 1;
+	CHECK(log->count == RECORDS);
+	CHECK(log->index != NULL);
+	CHECK(log->hasTimestamps == 1);
+	CHECK(strcmp(log->name, "Tracker0") == 0);
+	CHECK(log->records[123].pos[0] == 123);
+	CHECK(log->records[RECORDS-1].usec == record_time(RECORDS-1));
+	check_find(log);
+
+	/* Interpolation halfway between two records. */
+	float pos[3], quat[4];
+	int64_t mid = (record_time(10) + record_time(11)) / 2;
+	CHECK(tdl_lookup(log, mid, pos, quat) == 1);
+	CHECK(fabsf(pos[0] - 10.5f) < 0.01f);
+	CHECK(fabsf(vec4f_norm(quat) - 1) < 0.0001f);
+	CHECK(tdl_lookup(log, 0, pos, quat) == 1 && pos[0] == 0);
+
+	/* How long does it take to find a record? */
+	long start = kuhl_microseconds();
+	size_t sum = 0;
+	int lookups = 1000000;
+	for(int i=0; i<lookups; i++)
+		sum += tdl_find(log, record_time(i % RECORDS) + 3000);
+	long elapsed = kuhl_microseconds() - start;
+	printf("tdl_find(): %.1f ns per lookup (%lu)\n", elapsed*1000.0/lookups, (unsigned long) (sum % 10));
+	tdl_close(log);
+
+	/* Corrupt files are rejected instead of reading past the end of
+	 * the file. */
+	CHECK(truncate(path, sizeof(tdl_header) + RECORDS/2*sizeof(tdl_record)) == 0);
+	log = tdl_open(path);
+	CHECK(log == NULL);
+	if(log)
+		tdl_close(log);
+	FILE *corrupt = fopen(path, "r+b");
+	CHECK(corrupt != NULL);
+	if(corrupt)
+	{
+		tdl_header header;
+		CHECK(fread(&header, sizeof(header), 1, corrupt) == 1);
+		header.headerSize = 1u << 30;
+		rewind(corrupt);
+		CHECK(fwrite(&header, sizeof(header), 1, corrupt) == 1);
+		fclose(corrupt);
+		log = tdl_open(path);
+		CHECK(log == NULL);
+		if(log)
+			tdl_close(log);
+	}
+
+	/* Version 1 files */
+	FILE *f = tdl_create(path, "Old");
+	CHECK(f != NULL);
+	if(f)
+	{
+		for(int i=0; i<10; i++)
+		{
+			float p[3] = { (float) i, 0, 0 };
+			float orient[9];
+			mat3f_identity(orient);
+			tdl_write(f, p, orient);
+		}
+		fclose(f);
+		log = tdl_open(path);
+		CHECK(log != NULL);
+		if(log)
+		{
+			CHECK(log->count == 10);
+			CHECK(log->hasTimestamps == 0);
+			CHECK(strcmp(log->name, "Old") == 0);
+			CHECK(log->records[3].pos[0] == 3);
+			CHECK(log->records[3].usec == 3*1000000/TDL_V1_HZ);
+			CHECK(fabsf(log->records[3].quat[3] - 1) < 0.0001f);
+			tdl_close(log);
+		}
+	}
+	unlink(path);
+
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "vecmat.h"
+
+/* Checks the TRS transforms (trsf) and quaternion functions in
+ * vecmat.c against the equivalent 4x4 matrix calculations. */
+
+static int errors = 0;
+
+static float randf(void)
+{
+	return (float) (drand48()*2-1);
+}
+
+static float dist(const float *a, const float *b, int n)
+{
+	float sum = 0;
+	for(int i=0; i<n; i++)
+		sum += (a[i]-b[i])*(a[i]-b[i]);
+	return sqrtf(sum);
+}
+
+static void random_trs(trsf *t, int uniform)
+{
+	vec3f_set(t->pos, randf()*10, randf()*10, randf()*10);
+	quatf_rotateAxis_new(t->quat, randf()*180, randf(), randf(), randf()+2);
+	float s = 0.5f + (float) drand48()*2;
+	if(uniform)
+		vec3f_set(t->scale, s, s, s);
+	else
+		vec3f_set(t->scale, s, 0.5f + (float) drand48()*2, 0.5f + (float) drand48()*2);
+}
+
+static void check_matrix(const char *what, const float expected[16], const float actual[16])
+{
+	float diff = 0;
+	for(int i=0; i<16; i++)
+		diff += fabsf(expected[i]-actual[i]);
+	if(diff > .001)
+	{
+		printf("ERROR: %s: matrices differ by %f\n", what, diff);
+		mat4f_print(expected);
+		mat4f_print(actual);
+		errors++;
+	}
+}
+
+/* Converting a TRS transform into a matrix should match building the
+ * matrix from translation, rotation and scale matrices. */
+static void test_matrix(void)
+{
+	trsf t;
+	random_trs(&t, 0);
+	float trans[16], rot[16], scale[16], expected[16], actual[16];
+	mat4f_translateVec_new(trans, t.pos);
+	mat4f_rotateQuatVec_new(rot, t.quat);
+	mat4f_scaleVec_new(scale, t.scale);
+	mat4f_mult_mat4f_many(expected, trans, rot, scale, NULL);
+	mat4f_from_trsf(actual, &t);
+	check_matrix("mat4f_from_trsf", expected, actual);
+
+	/* Convert back again. */
+	trsf back;
+	if(!trsf_from_mat4f(&back, actual))
+	{
+		printf("ERROR: trsf_from_mat4f failed on a TRS matrix\n");
+		errors++;
+		return;
+	}
+	mat4f_from_trsf(expected, &back);
+	check_matrix("trsf_from_mat4f", actual, expected);
+
+	/* Matrices with shear can't be converted. */
+	actual[4] += 0.5f;
+	if(trsf_from_mat4f(&back, actual))
+	{
+		printf("ERROR: trsf_from_mat4f accepted a sheared matrix\n");
+		errors++;
+	}
+}
+
+/* Composing TRS transforms should match multiplying their matrices
+ * (when the first transform has a uniform scale). */
+static void test_compose(void)
+{
+	trsf a, b, c;
+	random_trs(&a, 1);
+	random_trs(&b, 0);
+	trsf_mult_trsf_new(&c, &a, &b);
+
+	float ma[16], mb[16], expected[16], actual[16];
+	mat4f_from_trsf(ma, &a);
+	mat4f_from_trsf(mb, &b);
+	mat4f_mult_mat4f_new(expected, ma, mb);
+	mat4f_from_trsf(actual, &c);
+	check_matrix("trsf_mult_trsf_new", expected, actual);
+
+	/* Quaternion multiplication should match matrix multiplication. */
+	float q[4], mq[16], ra[16], rb[16];
+	quatf_mult_quatf_new(q, a.quat, b.quat);
+	mat4f_rotateQuatVec_new(mq, q);
+	mat4f_rotateQuatVec_new(ra, a.quat);
+	mat4f_rotateQuatVec_new(rb, b.quat);
+	mat4f_mult_mat4f_new(expected, ra, rb);
+	check_matrix("quatf_mult_quatf_new", expected, mq);
+
+	/* Rotating a vector with a quaternion should match the matrix. */
+	float v[4] = { randf(), randf(), randf(), 0 }, rv[3];
+	quatf_rotate_vec3f_new(rv, a.quat, v);
+	mat4f_mult_vec4f(v, ra);
+	if(dist(v, rv, 3) > .0001)
+	{
+		printf("ERROR: quatf_rotate_vec3f_new: off by %f\n", dist(v, rv, 3));
+		errors++;
+	}
+}
+
+/* nlerp should match the endpoints and be close to slerp for nearby
+ * quaternions. */
+static void test_nlerp(void)
+{
+	float a[4], b[4], n[4], s[4];
+	quatf_rotateAxis_new(a, randf()*180, randf(), randf(), 1);
+	quatf_rotateAxis_new(b, 5, randf(), randf(), 1);
+	quatf_mult_quatf_new(b, b, a); // b is within 5 degrees of a
+
+	quatf_nlerp_new(n, a, b, 0);
+	quatf_nlerp_new(s, a, b, 1);
+	if(dist(n, a, 4) > .0001 || dist(s, b, 4) > .0001)
+	{
+		printf("ERROR: quatf_nlerp_new doesn't match the endpoints\n");
+		errors++;
+	}
+
+	/* Interpolating towards -b should give the same rotations. */
+	float negB[4];
+	vec4f_scalarMult_new(negB, b, -1);
+	for(int i=0; i<=10; i++)
+	{
+		float t = i / 10.0f;
+		quatf_nlerp_new(n, a, negB, t);
+		quatf_slerp_new(s, a, b, t);
+		if(vec4f_dot(n, n) < .999 || vec4f_dot(n, n) > 1.001)
+		{
+			printf("ERROR: quatf_nlerp_new returned a quaternion that isn't normalized\n");
+			errors++;
+		}
+		if(fabsf(fabsf(vec4f_dot(n, s))-1) > .00001)
+		{
+			printf("ERROR: quatf_nlerp_new and quatf_slerp_new differ at t=%f\n", t);
+			errors++;
+		}
+	}
+}
+
+int main(void)
+{
+	srand48(0);
+	for(int i=0; i<1000; i++)
+	{
+		test_matrix();
+		test_compose();
+		test_nlerp();
+	}
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "world-grid.h"
+#include "kuhl-nodep.h"
+
+/* Tests world-grid.c: Checks that the grid covers the cells around
+ * the viewer, that cells contain the same data no matter which order
+ * they are generated in, and that world_grid_update() doesn't wait
+ * for cells to be generated. */
+
+#define CELL_SIZE 15.0
+#define RADIUS 2
+#define VALUES 8
+
+typedef struct {
+	int64_t x, z;
+	uint32_t values[VALUES];
+} cell_data;
+
+static int errors = 0;
+static volatile int slowGenerate = 0;
+
+static void generate(void *data, int64_t x, int64_t z, uint64_t seed, void *userdata)
+{
+	(void) userdata;
+	cell_data *c = (cell_data*) data;
+	c->x = x;
+	c->z = z;
+	for(int i=0; i<VALUES; i++)
+		c->values[i] = world_grid_random(&seed);
+	if(slowGenerate)
+		usleep(2000);
+}
+
+/** Checks that every cell within RADIUS of the viewer is ready, that
+ * each cell appears once, and that each contains the right data. */
+static void check_grid(world_grid *g, const double pos[3], const char *what)
+{
+	int64_t cx = (int64_t) floor(pos[0]/CELL_SIZE + 0.5);
+	int64_t cz = (int64_t) floor(pos[2]/CELL_SIZE + 0.5);
+	int seen[2*RADIUS+1][2*RADIUS+1];
+	memset(seen, 0, sizeof(seen));
+
+	for(int slot=0; slot<world_grid_slots(g); slot++)
+	{
+		int64_t cell[2];
+		const cell_data *c = (const cell_data*) world_grid_get(g, slot, cell, NULL);
+		if(c == NULL)
+			continue;
+		if(c->x != cell[0] || c->z != cell[1])
+		{
+			printf("ERROR: %s: slot %d is for cell %lld %lld but contains cell %lld %lld\n", what, slot,
+			       (long long) cell[0], (long long) cell[1], (long long) c->x, (long long) c->z);
+			errors++;
+			continue;
+		}
+		int64_t dx = cell[0]-cx, dz = cell[1]-cz;
+		if(llabs(dx) > RADIUS || llabs(dz) > RADIUS)
+		{
+			printf("ERROR: %s: cell %lld %lld is outside of the grid\n", what,
+			       (long long) cell[0], (long long) cell[1]);
+			errors++;
+			continue;
+		}
+		seen[dz+RADIUS][dx+RADIUS]++;
+
+		/* The data must only depend on the cell coordinates. */
+		cell_data expected;
+		generate(&expected, cell[0], cell[1], world_grid_seed(1234, cell[0], cell[1]), NULL);
+		if(memcmp(expected.values, c->values, sizeof(expected.values)) != 0)
+		{
+			printf("ERROR: %s: cell %lld %lld contains the wrong data\n", what,
+			       (long long) cell[0], (long long) cell[1]);
+			errors++;
+		}
+	}
+
+	for(int z=0; z<2*RADIUS+1; z++)
+	{
+		for(int x=0; x<2*RADIUS+1; x++)
+		{
+			if(seen[z][x] != 1)
+			{
+				printf("ERROR: %s: cell %lld %lld appears %d times\n", what,
+				       (long long) (cx+x-RADIUS), (long long) (cz+z-RADIUS), seen[z][x]);
+				errors++;
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	world_grid *g = world_grid_new(CELL_SIZE, RADIUS, sizeof(cell_data), 1234, generate, NULL);
+	if(world_grid_slots(g) < (2*RADIUS+1)*(2*RADIUS+1))
+	{
+		printf("ERROR: grid has %d slots\n", world_grid_slots(g));
+		errors++;
+	}
+
+	/* Start far from the origin. */
+	double pos[3] = { 1e9, 0, -1e9 };
+	world_grid_update(g, pos);
+	world_grid_wait(g);
+	check_grid(g, pos, "start");
+
+	/* Every slot should be reported as changed once. */
+	int changed, changedCount = 0;
+	for(int slot=0; slot<world_grid_slots(g); slot++)
+	{
+		if(world_grid_get(g, slot, NULL, &changed) && changed)
+			changedCount++;
+		if(world_grid_get(g, slot, NULL, &changed) && changed)
+		{
+			printf("ERROR: slot %d was reported as changed twice\n", slot);
+			errors++;
+		}
+	}
+	if(changedCount != (2*RADIUS+1)*(2*RADIUS+1))
+	{
+		printf("ERROR: %d slots changed, expected %d\n", changedCount, (2*RADIUS+1)*(2*RADIUS+1));
+		errors++;
+	}
+
+	/* Move one cell: only one row of cells should change. */
+	pos[0] += CELL_SIZE;
+	world_grid_update(g, pos);
+	world_grid_wait(g);
+	check_grid(g, pos, "one cell");
+	changedCount = 0;
+	for(int slot=0; slot<world_grid_slots(g); slot++)
+	{
+		if(world_grid_get(g, slot, NULL, &changed) && changed)
+			changedCount++;
+	}
+	if(changedCount != 2*RADIUS+1)
+	{
+		printf("ERROR: moving one cell changed %d slots, expected %d\n", changedCount, 2*RADIUS+1);
+		errors++;
+	}
+
+	/* Move quickly while generating slowly. world_grid_update() must
+	 * not wait for the cells, and cells which are still being
+	 * generated when the viewer leaves them must be discarded. */
+	slowGenerate = 1;
+	long maxUpdate = 0;
+	for(int i=0; i<200; i++)
+	{
+		pos[0] += CELL_SIZE * (i%3);
+		pos[2] -= CELL_SIZE * ((i+1)%2);
+		long start = kuhl_microseconds();
+		world_grid_update(g, pos);
+		long elapsed = kuhl_microseconds() - start;
+		if(elapsed > maxUpdate)
+			maxUpdate = elapsed;
+		usleep(500);
+	}
+	if(maxUpdate > 1500) // generating one cell takes at least 2000 us
+	{
+		printf("ERROR: world_grid_update() took %ld microseconds\n", maxUpdate);
+		errors++;
+	}
+	world_grid_wait(g);
+	slowGenerate = 0;
+	check_grid(g, pos, "moving");
+
+	/* Return to the start: the cells must be the same as before. */
+	pos[0] = 1e9; pos[2] = -1e9;
+	world_grid_update(g, pos);
+	world_grid_wait(g);
+	check_grid(g, pos, "returned");
+	world_grid_free(g);
+
+	/* Negative coordinates around the origin. */
+	g = world_grid_new(CELL_SIZE, RADIUS, sizeof(cell_data), 1234, generate, NULL);
+	double origin[3] = { -CELL_SIZE*0.49, 0, -CELL_SIZE*0.51 };
+	world_grid_update(g, origin);
+	world_grid_wait(g);
+	check_grid(g, origin, "origin");
+	world_grid_free(g);
+
+	printf("%d errors\n", errors);
+	return errors > 0;
+}
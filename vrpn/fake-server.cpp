@@ -41,7 +41,7 @@ using namespace std;
 class myTracker : public vrpn_Tracker
 {
   public:
-	myTracker( const char* name, bool* flags, vrpn_Connection *c = 0, FILE* fs = NULL );
+	myTracker( const char* name, bool* flags, vrpn_Connection *c = 0, tdl_log* recording = NULL );
 	virtual ~myTracker() {};
 	virtual void mainloop();
 
@@ -55,12 +55,13 @@ class myTracker : public vrpn_Tracker
   	bool noise;
   	bool type;
   	char* trackerName;
-  	FILE *fs;
+  	tdl_log *recording;
+  	long playbackStart; /**< kuhl_microseconds() when playback started */
   	int modifier;
   	long lastrecord;
 };
 
-myTracker::myTracker( const char* name, bool* flags, vrpn_Connection *c, FILE* fs ) :
+myTracker::myTracker( const char* name, bool* flags, vrpn_Connection *c, tdl_log* recording ) :
 	vrpn_Tracker( name, c )
 {
 	printf("Using tracker name: %s\n", name);
@@ -69,7 +70,8 @@ myTracker::myTracker( const char* name, bool* flags, vrpn_Connection *c, FILE* f
 	this->quiet = flags[1];
 	this->noise = flags[2];
 	this->type = flags[3];
-	this->fs = fs;
+	this->recording = recording;
+	this->playbackStart = kuhl_microseconds();
 	this->modifier = ((double) rand() / (RAND_MAX)) * (360);
 	this->lastrecord = kuhl_microseconds();
 	kuhl_getfps_init(&fps_state);
@@ -85,26 +87,22 @@ void myTracker::mainloop()
 	static int timeThroughData = 1;
 	if(type == FILE_TRACKER)
 	{
-		int readVal = tdl_read(fs, filePos, fileOrient);
-	
-		if(readVal == 1)  // end of file
+		/* Send the record for the current time, starting over at the
+		 * end of the file. */
+		const tdl_record *first = &recording->records[0];
+		const tdl_record *last = &recording->records[recording->count-1];
+		int64_t duration = last->usec - first->usec;
+		if(recording->count > 1)
+			duration += duration / (int64_t) (recording->count-1);
+		int64_t elapsed = kuhl_microseconds() - playbackStart;
+		if(duration > 0)
 		{
-			timeThroughData++;
-
-			// When we reach end of file, start over again from beginning of file.
-			if(tdl_prepare(fs, NULL) == -1)
-			{
-				printf("Error going back to beginning of file.\n");
-				exit(EXIT_FAILURE);
-			}
-
-			// read data so that server has info to serve
-			tdl_read(fs, filePos, fileOrient);
-		}
-		else if(readVal == -1)  // error
-		{
-			exit(EXIT_FAILURE);
+			timeThroughData = (int) (elapsed / duration) + 1;
+			elapsed %= duration;
 		}
+		const tdl_record *rec = &recording->records[tdl_find(recording, first->usec + elapsed)];
+		vec3f_copy(filePos, rec->pos);
+		mat3f_rotateQuatVec_new(fileOrient, rec->quat);
 	}
 	
 	if(!quiet)
@@ -347,18 +345,16 @@ int main(int argc, char* argv[])
 		}
 		else
 		{
-			FILE *fs = fopen(filesv[i], "r");
-			if(fs == NULL)
+			tdl_log *recording = tdl_open(filesv[i]);
+			if(recording == NULL || recording->count == 0)
 			{
-				fprintf(stderr, "Failed to open file \"%s\": %s\n", filesv[i], strerror(errno));
-    			exit(1);
-    		}
-    		
-    		char* name;
-			tdl_prepare(fs, &name);	
+				fprintf(stderr, "Failed to read records from file \"%s\"\n", filesv[i]);
+				exit(1);
+			}
+			const char *name = recording->name;
 			
 			if(verbose)printf("Creating tracker for %s from file %s\n", name, filesv[i]);
-			trackersv[i] = new myTracker(name, flags, m_Connection, fs);
+			trackersv[i] = new myTracker(name, flags, m_Connection, recording);
 			
 		}
 	}
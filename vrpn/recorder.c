@@ -8,6 +8,7 @@
  */
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/time.h> // gettimeofday
 #include <time.h> // localtime
 
@@ -16,6 +17,15 @@
 #include "vecmat.h"
 #include "tdl-util.h"
 
+/* Set when Ctrl+C is pressed so that the files can be closed
+ * properly. */
+static volatile sig_atomic_t stopRecording = 0;
+static void handle_sigint(int sig)
+{
+	(void) sig;
+	stopRecording = 1;
+}
+
 int main(int argc, char* argv[])
 {
 	//Check if we got the proper arguments.
@@ -40,7 +50,7 @@ int main(int argc, char* argv[])
 	strftime(timestamp, 1024, "%Y%m%d-%H%M%S", nowtm);
 
 	int objectsToRecord = argc - 2;
-	FILE **outputFiles = malloc(sizeof(FILE*)*objectsToRecord);
+	tdl_writer **outputFiles = malloc(sizeof(tdl_writer*)*objectsToRecord);
 	
 	for(int i=0; i<objectsToRecord; i++) // for each object to record
 	{
@@ -49,7 +59,7 @@ int main(int argc, char* argv[])
 
 		//Create a new TDL file.
 		printf("Output file: %s\n", filename);
-		outputFiles[i] = tdl_create(filename, argv[i+2]);
+		outputFiles[i] = tdl_writer_open(filename, argv[i+2]);
 		if(outputFiles[i] == NULL)
 		{
 			printf("Failed to create file: %s\n", filename);
@@ -61,32 +71,35 @@ int main(int argc, char* argv[])
 
 
 	//Loop until Ctrl+C.
-	while(1)
+	signal(SIGINT, handle_sigint);
+	printf("Press Ctrl+C to stop recording.\n");
+	while(!stopRecording)
 	{
 		//Buffers for the data.
 		float pos[3];
 		float rotMat4[16];  // 4x4 matrix, what we vrpn_get() gives us.
-		float rotMat3[9];   // a 3x3 rotation matrix, what we need to give to tdl_write()
+		float quat[4];
 
 		for(int i=0; i<objectsToRecord; i++)
 		{
 			//Get the next vrpn entry
 			vrpn_get(argv[i+2], argv[1], pos, rotMat4);
+			long usec = kuhl_microseconds();
 			
 			//Write that entry to the file
-			mat3f_from_mat4f(rotMat3, rotMat4);
-			tdl_write(outputFiles[i], pos, rotMat3);
+			quatf_from_mat4f(quat, rotMat4);
+			tdl_writer_add(outputFiles[i], usec, pos, quat);
 		}
 		
-		//IMPORTANT! Since there are no time stamps, this MUST be the same value as the fake
-		//server that is going to be reading the file, otherwise artificial speed ups or delays
-		//may occur in the final reading and output of the file.
+		/* Each record is timestamped, so playback happens at the
+		 * recorded rate regardless of this value. */
 		kuhl_limitfps(100);
 	}
 	
 
-	//Close the fd (Useless code until code to stop loop is added)
+	/* Write the index at the end of each file. */
 	for(int i=0; i<objectsToRecord; i++)
-		fclose(outputFiles[i]);
-	         
+		tdl_writer_close(outputFiles[i]);
+	free(outputFiles);
+	return 0;
 }
@@ -0,0 +1,50 @@
+/*
+ * Converts a TDL file (see tdl-util.c) into a version 2 TDL file.
+ * Version 1 files don't contain timestamps, so the rate that the
+ * records were recorded at must be provided.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "tdl-util.h"
+
+int main(int argc, char* argv[])
+{
+	if(argc < 3)
+	{
+		printf("Usage\n\ttdl-convert input.tdl output.tdl [hz]\n");
+		printf("\n");
+		printf("Converts a TDL file into the version 2 format which has timestamps and an index.\n");
+		printf("hz is the rate a version 1 file was recorded at (default: %d).\n", TDL_V1_HZ);
+		exit(EXIT_FAILURE);
+	}
+	int hz = TDL_V1_HZ;
+	if(argc > 3)
+		hz = atoi(argv[3]);
+	if(hz <= 0)
+	{
+		printf("Invalid rate: %s\n", argv[3]);
+		exit(EXIT_FAILURE);
+	}
+
+	tdl_log *in = tdl_open(argv[1]);
+	if(in == NULL)
+		exit(EXIT_FAILURE);
+	tdl_writer *out = tdl_writer_open(argv[2], in->name);
+	if(out == NULL)
+		exit(EXIT_FAILURE);
+
+	for(size_t i=0; i<in->count; i++)
+	{
+		const tdl_record *r = &in->records[i];
+		int64_t usec = r->usec;
+		if(!in->hasTimestamps)
+			usec = (int64_t) i * 1000000 / hz;
+		tdl_writer_add(out, usec, r->pos, r->quat);
+	}
+	printf("Wrote %lu records of object '%s' to %s\n", (unsigned long) in->count, in->name, argv[2]);
+	tdl_close(in);
+	if(!tdl_writer_close(out))
+		exit(EXIT_FAILURE);
+	return 0;
+}